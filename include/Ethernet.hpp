@@ -3,12 +3,29 @@
 
 #include <array>
 #include <cstdint>
+#include <functional>
 
 namespace Ethernet {
 
 /* General Constants/Types */
 constexpr std::size_t MAC_LEN = 6;
 using MacAddr = std::array<uint8_t, MAC_LEN>;
+constexpr MacAddr BROADCAST_MAC{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+// Set in the first byte of broadcast and multicast addresses
+constexpr uint8_t GROUP_BIT = 0x01;
+// Where MAC Control frames such as PAUSE are sent, never forwarded by bridges
+constexpr MacAddr PAUSE_MAC{0x01, 0x80, 0xC2, 0x00, 0x00, 0x01};
+
+// Hashes a MAC address for unordered containers
+struct MacAddrHash {
+  std::size_t operator()(const MacAddr &mac) const {
+    uint64_t value = 0;
+    for (const uint8_t byte : mac) {
+      value = (value << 8) | byte;
+    }
+    return std::hash<uint64_t>{}(value);
+  }
+};
 
 } // namespace Ethernet
 
@@ -0,0 +1,123 @@
+#ifndef ETHERNET_ALLOC_HPP
+#define ETHERNET_ALLOC_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Ethernet {
+
+/* Heap allocation accounting. The counting global operator new and delete
+ * live in the eth_alloc object library, and only binaries that link it have
+ * their allocations counted; everywhere else the counters stay at zero.
+ *
+ * Each thread counts its own allocations without touching shared state, and
+ * charges them to the tag it is inside, such as "frame.decode". Tracepoint
+ * spans open a tag of the same name, so with ETHERNET_TRACING on the send
+ * and receive path is tagged by phase. A Scope measures what one thread
+ * allocated across a stretch of code, which is what the steady state tests
+ * bound.
+ */
+class Alloc {
+public:
+  /* Constants */
+  // Sites kept per thread, the first for untagged allocations. Tags beyond
+  // the rest are counted as untagged.
+  static constexpr std::size_t MAX_SITES = 32;
+
+  /* Types */
+  struct Counts {
+    uint64_t allocations{0};
+    uint64_t deallocations{0};
+    uint64_t bytes{0};
+
+    friend Counts operator-(const Counts &a, const Counts &b) {
+      return Counts{a.allocations - b.allocations,
+                    a.deallocations - b.deallocations, a.bytes - b.bytes};
+    }
+  };
+
+  struct Site {
+    // The tag, or nullptr for allocations outside any tag
+    const char *tag{nullptr};
+    Counts counts{};
+  };
+
+  /* Charges the calling thread's allocations to a tag while in scope
+   */
+  class Tag {
+  public:
+    explicit Tag(const char *name) : previous(current) { current = name; }
+    ~Tag() { current = this->previous; }
+    Tag(const Tag &) = delete;
+    Tag &operator=(const Tag &) = delete;
+
+  private:
+    const char *previous;
+  };
+
+  /* Counts the calling thread's allocations since construction
+   */
+  class Scope {
+  public:
+    Scope() : start(Alloc::thread()) {}
+    [[nodiscard]] Counts counts() const { return Alloc::thread() - this->start; }
+
+  private:
+    Counts start;
+  };
+
+  Alloc() = delete;
+
+  /* Gets whether the counting operator new is linked into this binary
+   * @return True if allocations are being counted
+   */
+  static bool tracking() { return hooked.load(std::memory_order_relaxed); }
+
+  /* Gets the calling thread's totals
+   * @return The counts since the thread started
+   */
+  static Counts thread();
+
+  /* Gets the totals over every thread
+   * @return The counts since the process started
+   */
+  static Counts process();
+
+  /* Gets the calling thread's counts by tag
+   * @return One site per tag that has seen an allocation or deallocation
+   */
+  static std::vector<Site> sites();
+
+  /* Counts an allocation on the calling thread, called by operator new
+   * @param size The bytes requested
+   * @return none
+   */
+  static void noteAllocation(const std::size_t size);
+
+  /* Counts a deallocation on the calling thread, called by operator delete
+   * @return none
+   */
+  static void noteDeallocation();
+
+  /* Marks the counting hooks as linked, called once by eth_alloc
+   * @return True
+   */
+  static bool hook();
+
+private:
+  /* Data */
+  // The thread's counters are plain thread locals too, so counting never
+  // allocates or locks
+  static inline thread_local const char *current{nullptr};
+
+  static inline std::atomic<bool> hooked{false};
+  static inline std::atomic<uint64_t> all_allocations{0};
+  static inline std::atomic<uint64_t> all_deallocations{0};
+  static inline std::atomic<uint64_t> all_bytes{0};
+};
+
+} // namespace Ethernet
+
+#endif // ETHERNET_ALLOC_HPP
@@ -0,0 +1,82 @@
+#ifndef ETHERNET_BUFFER_HPP
+#define ETHERNET_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Ethernet {
+
+/* An encoded frame on its way through a receive queue. It starts out owning
+ * its bytes alone, as a frame sent to one station does. Sharing it moves the
+ * bytes into a block with an atomic reference count, after which they are
+ * immutable, so flooding a frame to N stations queues N references instead
+ * of N copies. A holder that needs to change the bytes takes them back with
+ * release, which copies them only while another reference remains.
+ */
+class FrameBuffer {
+public:
+  /* Default constructor, an empty buffer
+   */
+  FrameBuffer() = default;
+
+  /* Alternate constructor, implicit so a frame vector can be queued as is
+   * @param bytes The encoded frame, taken without copying
+   */
+  FrameBuffer(std::vector<uint8_t> &&bytes) : owned(std::move(bytes)) {}
+
+  FrameBuffer(FrameBuffer &&other) noexcept;
+  FrameBuffer &operator=(FrameBuffer &&other) noexcept;
+
+  /* Copying is explicit, through share
+   */
+  FrameBuffer(const FrameBuffer &) = delete;
+  FrameBuffer &operator=(const FrameBuffer &) = delete;
+
+  /* Drops this reference, freeing the bytes if it was the last
+   */
+  ~FrameBuffer();
+
+  /* Gets another reference to the same bytes. The first call moves them
+   * into a shared block, later ones only count the reference.
+   * @return The new reference
+   */
+  [[nodiscard]] FrameBuffer share();
+
+  /* Gets the bytes
+   * @return A view of the encoded frame
+   */
+  [[nodiscard]] std::span<const uint8_t> bytes() const;
+
+  /* Gets the number of references to the bytes
+   * @return 1 if this buffer holds them alone, 0 if it is empty
+   */
+  [[nodiscard]] std::size_t useCount() const;
+
+  /* Takes the bytes out to be changed, leaving this buffer empty
+   * @return The bytes, moved out if this was the only reference and copied
+   * otherwise
+   */
+  [[nodiscard]] std::vector<uint8_t> release();
+
+private:
+  struct Block {
+    std::atomic<std::size_t> refs;
+    std::vector<uint8_t> bytes;
+  };
+
+  explicit FrameBuffer(Block *block) : block(block) {}
+
+  /* Drops the reference to the shared block, if any
+   */
+  void drop();
+
+  /* Data */
+  std::vector<uint8_t> owned{};
+  Block *block{nullptr};
+};
+
+} // namespace Ethernet
+
+#endif // ETHERNET_BUFFER_HPP
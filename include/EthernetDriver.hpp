@@ -1,16 +1,163 @@
 #ifndef ETHERNET_DRIVER_HPP
 #define ETHERNET_DRIVER_HPP
 
+#include "EthernetBuffer.hpp"
 #include "EthernetFrame.hpp"
-#include <deque>
+#include "EthernetReliable.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <random>
+#include <utility>
 
 namespace Ethernet {
 
+class Driver;
+
+/* Carries frames between drivers in place of Driver::link, such as a shared
+ * segment or a simulated wire. Drivers connected to a medium hand it every
+ * frame they transmit, and the medium delivers them when and where it likes.
+ */
+class Medium {
+public:
+  virtual ~Medium() = default;
+
+  /* Takes a frame a connected driver transmitted
+   * @param src The sending driver's MAC address
+   * @param frame The encoded frame
+   * @return none
+   */
+  virtual void forward(const MacAddr &src, std::vector<uint8_t> &&frame) = 0;
+
+protected:
+  /* Connects a driver so its transmissions go to the medium
+   * @param driver The driver, not yet linked and without reliability
+   * @param medium The medium
+   * @return none
+   */
+  static void connect(Driver &driver, Medium &medium);
+
+  /* Queues a frame at a driver and wakes its receiver
+   * @param driver The receiving driver
+   * @param frame The encoded frame, a vector or a shared buffer
+   * @return none
+   */
+  static void deliver(Driver &driver, FrameBuffer &&frame);
+};
+
 class Driver {
 public:
+  /* Constants */
+  // 802.1p traffic classes a receive queue can be split into, 7 the highest
+  static constexpr std::size_t CLASSES = Frame::PRIORITIES;
+  // How long one pause quantum lasts, 512 bit times of a 1 Gb/s link
+  static constexpr std::chrono::nanoseconds PAUSE_QUANTUM{512};
+  // Hash buckets of the receive-side scaling indirection table
+  static constexpr std::size_t INDIRECTION_LEN = 128;
+  // Entries of the demux table
+  static constexpr std::size_t DEMUX_RULES = 16;
+
   /* Types */
-  using ByteQueue = std::deque<std::vector<uint8_t>>;
+  // Queue of encoded frames, a ring buffer that doubles when full. It does
+  // not allocate until the first frame, nor once it has reached its working
+  // depth.
+  class ByteQueue {
+  public:
+    [[nodiscard]] bool empty() const { return this->count == 0; }
+    [[nodiscard]] std::size_t size() const { return this->count; }
+    FrameBuffer &front() { return this->slots[this->head]; }
+    void push_back(FrameBuffer &&frame);
+    void pop_front();
+    void reserve(const std::size_t frames);
+
+  private:
+    std::vector<FrameBuffer> slots{};
+    std::size_t head{0};
+    std::size_t count{0};
+  };
+
+  // Called by the linked peer each time it queues a frame for this driver
+  struct RxNotify {
+    void (*fn)(void *){nullptr};
+    void *ctx{nullptr};
+  };
+
+  // Picks the traffic class of an untagged wire-format frame
+  using Classifier = uint8_t (*)(std::span<const uint8_t> frame);
+
+  struct QueueConfig {
+    // Classes at or above this are served before any other, highest first
+    uint8_t strict_from{6};
+    // Frames each class below strict_from takes per weighted round-robin turn
+    std::array<uint16_t, CLASSES> weights{1, 1, 1, 1, 1, 1, 1, 1};
+    // Frames each class may hold, 0 for no limit, more are dropped
+    std::array<std::size_t, CLASSES> limits{};
+    // Classifies untagged frames, which are class 0 without one
+    Classifier classify{nullptr};
+  };
+
+  struct QueueStats {
+    std::array<uint64_t, CLASSES> queued{};
+    std::array<uint64_t, CLASSES> dropped{};
+  };
+
+  // Reads flow key bits from a wire-format frame, such as its message ID
+  using FlowKey = uint32_t (*)(std::span<const uint8_t> frame);
+
+  struct RssConfig {
+    // Receive queues, each with its own lock so each can have a consumer
+    std::size_t queues{1};
+    // Hashed with the source MAC address and EtherType, nothing if null
+    FlowKey key{nullptr};
+    // The queue of each hash bucket, INDIRECTION_LEN of them. Empty spreads
+    // the buckets across the queues in turn.
+    std::vector<uint8_t> indirection{};
+  };
+
+  // Reads a byte of a wire-format frame demux rules can match, such as its
+  // message type
+  using DemuxKey = uint8_t (*)(std::span<const uint8_t> frame);
+
+  struct DemuxRule {
+    // Matched past any 802.1Q tag
+    Frame::EtherType type{Frame::EtherType::IPV4};
+    // The demux key must match too, any key if unset
+    std::optional<uint8_t> key{};
+    // The receive queue matching frames go to
+    std::size_t queue{0};
+  };
+
+  struct DemuxConfig {
+    // At most DEMUX_RULES, a rule with a key taking precedence over one
+    // without for the same EtherType
+    std::vector<DemuxRule> rules{};
+    // Reads the key of untagged frames, needed by rules with a key
+    DemuxKey key{nullptr};
+  };
+
+  struct FlowControl {
+    // Frames queued at which the peer is paused
+    std::size_t xoff{256};
+    // Frames queued at which the peer is resumed, below xoff
+    std::size_t xon{64};
+    // How long a pause lasts unless resumed first, in PAUSE_QUANTUM
+    uint16_t quanta{0xFFFF};
+    // Pause each traffic class on its own depth with PFC, instead of the
+    // whole link on the total
+    bool per_class{false};
+  };
+
+  struct FlowStats {
+    // Sent as a receiver
+    uint64_t pauses_sent{0};
+    uint64_t resumes_sent{0};
+    // Received as a sender, and the time its sends spent waiting them out
+    uint64_t pauses_received{0};
+    std::chrono::nanoseconds paused{0};
+  };
 
   /* Default constructor, deleted to require MAC address on creation
    */
@@ -70,6 +217,55 @@ public:
   void send(const std::vector<uint8_t> &data,
             const Frame::EtherType type = Frame::EtherType::IPV4);
 
+  /* Sends a byte-array of data to a station on the driver's segment
+   * @param dst The destination MAC address, BROADCAST_MAC for every station
+   * @param data The byte-array of data to send
+   * @param type The type of the frame, defaults to IPv4
+   * @return none
+   */
+  void sendTo(const MacAddr &dst, const std::vector<uint8_t> &data,
+              const Frame::EtherType type = Frame::EtherType::IPV4);
+
+  /* Gets the largest payload that send and reserve accept, which is smaller
+   * than Frame::PAYLOAD_LEN_MAX when reliability adds a link header
+   * @return The maximum payload length
+   */
+  [[nodiscard]] std::size_t mtu() const;
+
+  /* Allocates a wire-format frame buffer with headroom for the Ethernet header
+   * and any link header, and tailroom for the CRC32, so upper layers can write
+   * their payload directly into it (see payloadOf) and hand it to sendReserved
+   * @param payload_len The number of payload bytes to reserve
+   * @return The frame buffer
+   */
+  [[nodiscard]] std::vector<uint8_t> reserve(const std::size_t payload_len) const;
+
+  /* Gets the region of a frame buffer from reserve() that upper layers write
+   * their payload into
+   * @param frame The frame buffer
+   * @return Span over the payload, after the Ethernet and any link header
+   */
+  [[nodiscard]] std::span<uint8_t> payloadOf(std::span<uint8_t> frame) const;
+
+  /* Sends a frame buffer from reserve() to the linked peer without copying the
+   * payload. The header and CRC32 are filled in on the way out.
+   * @param frame The frame buffer, its payload already written in place
+   * @param type The type of the frame, defaults to IPv4
+   * @return none
+   */
+  void sendReserved(std::vector<uint8_t> &&frame,
+                    const Frame::EtherType type = Frame::EtherType::IPV4);
+
+  /* Sends a frame buffer from reserve() to a station on the driver's
+   * segment. Reliable delivery only supports the linked peer.
+   * @param frame The frame buffer, its payload already written in place
+   * @param dst The destination MAC address, BROADCAST_MAC for every station
+   * @param type The type of the frame, defaults to IPv4
+   * @return none
+   */
+  void sendReservedTo(std::vector<uint8_t> &&frame, const MacAddr &dst,
+                      const Frame::EtherType type = Frame::EtherType::IPV4);
+
   /* Receives a byte-array of data from the linked peer. Blocks by default.
    * @param output The received peer data. Unchanged if non-blocking and nothing
    * received.
@@ -79,11 +275,152 @@ public:
    */
   bool recv(std::vector<uint8_t> &output);
 
+  /* Receives a byte-array of data and the station that sent it
+   * @param output The received data. Unchanged if nothing was received.
+   * @param src The sender's MAC address. Unchanged if nothing was received.
+   * @return True if data was received, False otherwise
+   */
+  bool recv(std::vector<uint8_t> &output, MacAddr &src);
+
+  /* Receives from one receive queue only, so each queue can have its own
+   * consumer thread
+   * @param queue The receive queue, below receiveQueues()
+   * @param output The received data. Unchanged if nothing was received.
+   * @param src The sender's MAC address. Unchanged if nothing was received.
+   * @return True if data was received, False otherwise
+   */
+  bool recvQueue(std::size_t queue, std::vector<uint8_t> &output, MacAddr &src);
+
   /* Checks whether the Driver's peer has sent data
    * @return True if data has been received, False othewise
    */
   bool hasPending() const;
 
+  /* Checks whether one receive queue has data
+   * @param queue The receive queue
+   * @return True if data has been received, False othewise
+   */
+  bool hasPending(std::size_t queue) const;
+
+  /* Sets a callback the linked peer calls, outside of any queue lock, after
+   * it queues a frame for this driver, so a waiting receiver can be woken
+   * instead of polling. Must be set before the peer starts sending.
+   * @param fn The function to call, nullptr to disable
+   * @param ctx Passed to fn
+   * @return none
+   */
+  void setRxNotify(void (*fn)(void *), void *ctx);
+
+  /* Sets the callback for frames steered to one receive queue only
+   * @param queue The receive queue
+   * @param fn The function to call, nullptr to disable
+   * @param ctx Passed to fn
+   * @return none
+   */
+  void setRxNotify(std::size_t queue, void (*fn)(void *), void *ctx);
+
+  /* Calls the first queue's callback without queueing a frame, so a receiver
+   * waiting on it wakes to recheck something else, such as a new deadline
+   * @return none
+   */
+  void wakeReceiver();
+
+  /* Preallocates the receive queue, so it does not allocate until more
+   * frames than this are waiting
+   * @param frames The number of frames
+   * @return none
+   */
+  void reserveQueue(const std::size_t frames);
+
+  /* Splits the receive queue into traffic classes, so control frames need
+   * not wait behind bulk ones. A tagged frame's class is its 802.1Q PCP, an
+   * untagged frame's comes from the classifier. recv serves the classes at
+   * or above strict_from first, highest first, then the rest by weighted
+   * round-robin. Not available with reliable delivery, whose window needs
+   * frames in order.
+   * @param config The scheduling, limits and classifier
+   * @return none
+   */
+  void setQueueing(const QueueConfig &config);
+
+  /* Gets the frames queued and dropped in each traffic class
+   * @return The counters over every receive queue, every frame in class 0
+   * until queueing is set
+   */
+  [[nodiscard]] QueueStats getQueueStats() const;
+
+  /* Gets the frames queued and dropped in each traffic class of one
+   * receive queue
+   * @param queue The receive queue
+   * @return The counters
+   */
+  [[nodiscard]] QueueStats getQueueStats(std::size_t queue) const;
+
+  /* Spreads received frames over several receive queues, like receive-side
+   * scaling on a NIC. A Toeplitz hash of the source MAC address, EtherType
+   * and flow key picks a bucket of the indirection table, which names the
+   * queue. Frames of one flow always land in one queue, so they stay in
+   * order while the queues are consumed on different threads. Traffic
+   * classes apply within each queue. Not available with reliable delivery
+   * or flow control, which need a single queue. Must be set before the peer
+   * starts sending, and the queues it removes must be empty.
+   * @param config The queue count, flow key and indirection table
+   * @return none
+   */
+  void setReceiveQueues(const RssConfig &config);
+
+  /* Gets the number of receive queues
+   * @return The number of queues, 1 unless setReceiveQueues was called
+   */
+  [[nodiscard]] std::size_t receiveQueues() const;
+
+  /* Gets the receive queue a frame is steered to
+   * @param frame The wire-format frame
+   * @return The queue
+   */
+  [[nodiscard]] std::size_t queueOf(std::span<const uint8_t> frame) const;
+
+  /* Demultiplexes received frames by EtherType, and optionally a key such
+   * as the message type, into dedicated receive queues. A frame matching a
+   * rule goes to its queue, and any other is steered by receive-side
+   * scaling, so an indirection table that names none of the dedicated
+   * queues keeps them to their rules. Each protocol can then have its own
+   * consumer thread with recvQueue, or be woken with setRxNotify, rather
+   * than one consumer sorting every frame. A rule's queue must not also be
+   * drained with recv, which takes from every queue in turn and so can
+   * reorder its frames against the other queues. Must be set after
+   * setReceiveQueues and before the peer starts sending.
+   * @param config The rules and key, no rules to turn demultiplexing off
+   * @return none
+   */
+  void setDemux(const DemuxConfig &config);
+
+  /* Computes the Toeplitz hash of receive-side scaling, with the key NICs
+   * ship by default
+   * @param input The bytes to hash, at most 36
+   * @return The hash
+   */
+  static uint32_t rssHash(std::span<const uint8_t> input);
+
+  /* Enables 802.3x flow control on this driver's receive queue. When it
+   * holds xoff frames the linked peer is sent a PAUSE, and when recv drains
+   * it to xon a PAUSE of zero quanta resumes it. A paused peer's sends wait
+   * until it resumes or the pause runs out, so a fast sender is held to the
+   * pace of a slow receiver instead of growing its queue. With per_class,
+   * PFC frames pause only the traffic classes over their threshold, the
+   * sender classifying its frames with its own QueueConfig. The two ends
+   * must run on different threads, since the sender blocks. Not available
+   * with reliable delivery, whose window already bounds what is in flight.
+   * @param config The thresholds, pause length and whether to use PFC
+   * @return none
+   */
+  void setFlowControl(const FlowControl &config);
+
+  /* Gets the pauses sent and received and the time spent paused
+   * @return The counters
+   */
+  [[nodiscard]] FlowStats getFlowStats() const;
+
   /* Whether or not to flip a random bit in all sent frames. Purely for testing
    * purposes.
    * @param enable True will flip bits in send frames, False will not.
@@ -91,6 +428,33 @@ public:
    */
   void setErrorInjection(const bool enable);
 
+  /* Sets the probability that any single transmitted bit is flipped. Each
+   * frame is then damaged with probability 1 - (1 - ber)^bits. Purely for
+   * testing purposes.
+   * @param ber The bit error rate, 0 disables
+   * @return none
+   */
+  void setBitErrorRate(const double ber);
+
+  /* Enables sliding-window reliable delivery. Corrupted frames are then
+   * dropped and retransmitted instead of throwing from recv. The linked peer
+   * must enable it too.
+   * @param config The window and timeout settings
+   * @return none
+   */
+  void setReliability(const Reliability::Config &config);
+
+  /* Runs reliability timers, retransmitting any frame whose timeout has
+   * passed. send and recv do this too, so it is only needed when idle.
+   * @return none
+   */
+  void service();
+
+  /* Gets the reliable delivery counters
+   * @return The counters, all zero if reliability is disabled
+   */
+  [[nodiscard]] Reliability::Stats getReliabilityStats() const;
+
   /* This function links 2 drivers together. It is purely for simulating the
    * tx/rx queues that would normally be handled by physical hardware. That is,
    * it is only for testing
@@ -100,20 +464,160 @@ public:
   static void link(Driver &a, Driver &b);
 
 private:
+  friend class Reliability;
+  friend class Medium;
+
+  /* The receive queue, a ByteQueue per traffic class. Everything shares
+   * class 0 until queueing is set. It is also the receiving MAC, acting on
+   * PAUSE and PFC frames instead of queueing them, and tracking when the
+   * peer needs pausing or resuming under flow control.
+   */
+  class RxQueue {
+  public:
+    [[nodiscard]] bool empty() const { return this->count == 0; }
+    [[nodiscard]] bool isSplit() const { return this->split; }
+    [[nodiscard]] bool isFlowControlled() const { return this->flow_on; }
+    bool push(FrameBuffer &&frame);
+    bool pop(FrameBuffer &frame);
+    void reserve(const std::size_t frames);
+    void configure(const QueueConfig &config);
+    [[nodiscard]] const QueueConfig &getConfig() const { return this->config; }
+    void configureFlow(const FlowControl &config);
+    [[nodiscard]] std::size_t classOf(std::span<const uint8_t> frame) const;
+    [[nodiscard]] uint16_t pauseQuanta() const { return this->flow.quanta; }
+
+    // Takes the classes whose peer must now be paused, or resumed
+    uint8_t takePauses() { return std::exchange(this->to_pause, 0); }
+    uint8_t takeResumes() { return std::exchange(this->to_resume, 0); }
+
+    // When a class may send again, in steady clock nanoseconds, read by the
+    // sending side without the queue lock
+    [[nodiscard]] bool pauseSeen() const {
+      return this->pause_seen.load(std::memory_order_acquire);
+    }
+    [[nodiscard]] int64_t pausedUntil(const std::size_t c) const {
+      return this->paused_until[c].load(std::memory_order_acquire);
+    }
+
+    QueueStats stats{};
+    uint64_t pauses_received{0};
+
+  private:
+    std::array<ByteQueue, CLASSES> classes{};
+    QueueConfig config{};
+    bool split{false};
+    std::size_t count{0};
+    // The weighted round-robin position, and what the class has left
+    uint8_t turn{0};
+    uint16_t credit{0};
+    // Flow control of the peer, a bit per class it is paused for
+    FlowControl flow{};
+    bool flow_on{false};
+    uint8_t peer_paused{0};
+    uint8_t to_pause{0};
+    uint8_t to_resume{0};
+    // Pauses the peer asked of this driver
+    std::array<std::atomic<int64_t>, CLASSES> paused_until{};
+    std::atomic<bool> pause_seen{false};
+    // The last sequence number acted on per class, older ones are stale
+    std::array<uint32_t, CLASSES> pause_sequences{};
+  };
+
+  // A receive queue with its own lock and notification
+  struct RxLane {
+    RxQueue queue{};
+    mutable std::mutex mutex{};
+    RxNotify notify{};
+  };
+
+  /* Gets a receive queue, the first of which lives in the driver itself so
+   * a single-queue driver does not allocate
+   */
+  RxLane &lane(const std::size_t queue) {
+    return queue == 0 ? this->rx : this->rx_lanes[queue - 1];
+  }
+  const RxLane &lane(const std::size_t queue) const {
+    return queue == 0 ? this->rx : this->rx_lanes[queue - 1];
+  }
+
+  // A demux rule as the receive path looks it up, 6 bytes
+  struct DemuxEntry {
+    uint16_t type{0};
+    uint8_t key{0};
+    bool any_key{true};
+    uint8_t queue{0};
+  };
+
+  /* Finds the queue of the first demux rule a frame matches
+   */
+  [[nodiscard]] std::optional<std::size_t>
+  demuxOf(std::span<const uint8_t> frame) const;
+
+  /* Fills in the Ethernet header and CRC32 of a frame buffer, applies any
+   * error injection, and pushes it to the linked peer
+   * @param frame The frame buffer, its payload already written in place
+   * @param type The type of the frame
+   */
+  void transmit(std::vector<uint8_t> &&frame, const Frame::EtherType type);
+
+  /* Fills in the Ethernet header of a frame buffer for a destination, then
+   * pushes it to the medium, or to the linked peer
+   */
+  void transmitTo(std::vector<uint8_t> &&frame, const MacAddr &dst,
+                  const Frame::EtherType type);
+
+  /* Queues a frame received from the medium or linked peer in the queue it
+   * steers to, wakes any waiting receiver, and pauses the peer if that
+   * queue reached xoff
+   */
+  void deliver(FrameBuffer &&frame);
+
+  /* Sends the linked peer a PAUSE or PFC frame for some traffic classes
+   * @param classes A bit per class, all of them for a PAUSE
+   * @param quanta How long to pause, 0 to resume
+   * @param sequence Its place among this driver's pauses, from nextPauseSequence
+   */
+  void sendPause(uint8_t classes, uint16_t quanta, uint32_t sequence);
+
+  /* Numbers a pause or resume, called under the queue lock it was decided
+   * under, so the numbers follow the order of the decisions even though the
+   * frames are sent after the lock is released
+   * @return The next sequence number, never 0
+   */
+  uint32_t nextPauseSequence();
+
+  /* Waits out any pause the peer asked for the frame's traffic class
+   */
+  void waitWhilePaused(std::span<const uint8_t> frame);
+
   /* Function to flip a random byte in any sent packets, purely for testing
    * purposes
-   * @param frame The frame to flip a bit in
+   * @param payload The payload of the frame to flip a bit in
    */
-  static void corrupt(Frame &frame);
+  static void corrupt(std::span<uint8_t> payload);
 
   /* Data */
   MacAddr mac_self{};
   MacAddr mac_peer{};
-  ByteQueue rxQueue{};
-  ByteQueue* txQueue{nullptr};
-  std::mutex rxMutex{};
-  std::mutex* txMutex{nullptr};
+  RxLane rx{};
+  std::unique_ptr<RxLane[]> rx_lanes{};
+  std::size_t rx_queues{1};
+  std::array<uint8_t, INDIRECTION_LEN> indirection{};
+  FlowKey flow_key{nullptr};
+  std::array<DemuxEntry, DEMUX_RULES> demux{};
+  std::size_t demux_len{0};
+  DemuxKey demux_key{nullptr};
+  std::atomic<std::size_t> rx_turn{0};
+  Driver* txPeer{nullptr};
+  Medium* medium{nullptr};
   bool error_injection{false};
+  double bit_error_rate{0.0};
+  std::minstd_rand rng{};
+  std::unique_ptr<Reliability> reliability{};
+  std::atomic<uint64_t> pauses_sent{0};
+  std::atomic<uint64_t> resumes_sent{0};
+  std::atomic<uint32_t> pause_sequence{0};
+  std::atomic<int64_t> paused_ns{0};
 };
 
 } // namespace Ethernet
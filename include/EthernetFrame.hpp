@@ -2,6 +2,7 @@
 #define ETHERNET_FRAME_HPP
 
 #include "Ethernet.hpp"
+#include <optional>
 #include <span>
 #include <vector>
 
@@ -23,12 +24,37 @@ public:
   static constexpr std::size_t FRAME_LEN_MAX = 1518;
   static constexpr std::size_t PAYLOAD_LEN_MIN = 46;
   static constexpr std::size_t PAYLOAD_LEN_MAX = 1500;
+  static constexpr std::size_t HEADER_LEN = 2 * MAC_LEN + sizeof(uint16_t);
+  static constexpr std::size_t CRC_LEN = sizeof(uint32_t);
+  // An 802.1Q tag: the VLAN EtherType, then the PCP, DEI and VLAN id
+  static constexpr std::size_t TAG_LEN = 2 * sizeof(uint16_t);
+  // MAC Control opcodes, an 802.3x PAUSE and an 802.1Qbb priority PAUSE
+  static constexpr uint16_t PAUSE_OPCODE = 0x0001;
+  static constexpr uint16_t PFC_OPCODE = 0x0101;
+  // Where a PAUSE's sequence number sits, past a PFC frame's quanta
+  static constexpr std::size_t PAUSE_SEQUENCE_AT = 20;
+  // 802.1p priorities, which PFC pauses one by one
+  static constexpr std::size_t PRIORITIES = 8;
 
   /* Types */
   enum class EtherType : uint16_t {
     IPV4 = 0x0800,
     IPV6 = 0x86DD,
     ARP = 0x0806,
+    VLAN = 0x8100,
+    MAC_CONTROL = 0x8808,
+  };
+
+  // What a PAUSE or PFC frame asks of its receiver: stop sending the
+  // priorities it names for their quanta of 512 bit times, 0 to resume
+  struct Pause {
+    // A bit per priority, every one for a PAUSE
+    uint8_t priorities{0xFF};
+    std::array<uint16_t, PRIORITIES> quanta{};
+    // Orders one sender's pauses, so a receiver can drop one that a later
+    // resume overtook. It rides in padding 802.3 leaves zero, 0 if unnumbered.
+    uint32_t sequence{0};
+    friend bool operator==(const Pause &, const Pause &) = default;
   };
 
   /* Default constructor
@@ -78,6 +104,58 @@ public:
    */
   [[nodiscard]] std::vector<uint8_t> serialize() const;
 
+  /* Writes the header and CRC32 of a wire-format frame buffer whose payload
+   * has already been written in place. The buffer must be laid out as
+   * [HEADER_LEN headroom][payload][CRC_LEN tailroom], see payloadOf.
+   * @param frame The wire-format frame buffer to finalize
+   * @param dst The destination MAC Address
+   * @param src The source MAC Address
+   * @param type The EtherType of the frame
+   * @return none
+   */
+  static void encodeInPlace(std::span<uint8_t> frame, const MacAddr &dst,
+                            const MacAddr &src, const EtherType type);
+
+  /* Gets the payload region of a wire-format frame buffer
+   * @param frame The wire-format frame buffer
+   * @return Span over the bytes between the header and the CRC32
+   */
+  [[nodiscard]] static std::span<uint8_t> payloadOf(std::span<uint8_t> frame);
+
+  /* Reads the 802.1p priority of a wire-format frame without decoding it
+   * @param frame The wire-format frame
+   * @return The PCP of an 802.1Q tagged frame, nothing if it is untagged
+   */
+  [[nodiscard]] static std::optional<uint8_t>
+  priorityOf(std::span<const uint8_t> frame);
+
+  /* Reads the EtherType of a wire-format frame without decoding it, looking
+   * past any 802.1Q tag
+   * @param frame The wire-format frame
+   * @return The EtherType of what the frame carries, nothing if it is too
+   * short to have one
+   */
+  [[nodiscard]] static std::optional<EtherType>
+  typeOf(std::span<const uint8_t> frame);
+
+  /* Builds a MAC Control frame asking the link peer to pause. Every
+   * priority with the same quanta is sent as an 802.3x PAUSE, anything
+   * else as a PFC frame. A sequence number goes in the padding after them.
+   * @param src The sending MAC address
+   * @param pause The priorities to pause and their quanta
+   * @return The wire-format frame, addressed to PAUSE_MAC
+   */
+  [[nodiscard]] static std::vector<uint8_t> encodePause(const MacAddr &src,
+                                                        const Pause &pause);
+
+  /* Reads a PAUSE or PFC frame
+   * @param frame The wire-format frame
+   * @return What it asks, nothing if it is not a PAUSE or PFC frame. Throws
+   * if its CRC32 does not match.
+   */
+  [[nodiscard]] static std::optional<Pause>
+  pauseOf(std::span<const uint8_t> frame);
+
   /* Checks whether the CRC32 of the frame matches the expected
    * @return True if the CRC32 is valid, false otherwise
    */
@@ -147,6 +225,10 @@ private:
    */
   static uint32_t crc32(const Frame &frame);
 
+  /* Calculates the CRC32 across multiple contiguous byte spans
+   */
+  static uint32_t crc32(std::span<const std::span<const uint8_t>> spans);
+
   /* Data */
   MacAddr dst{};
   MacAddr src{};
@@ -0,0 +1,177 @@
+#ifndef ETHERNET_RELIABLE_HPP
+#define ETHERNET_RELIABLE_HPP
+
+#include "EthernetFrame.hpp"
+#include <chrono>
+#include <deque>
+
+namespace Ethernet {
+
+class Driver;
+
+/* Sliding-window reliable delivery between two linked drivers. Every data
+ * frame carries a sequence number in a small link header at the front of its
+ * payload. The receiver answers with cumulative and selective ACKs, and the
+ * sender retransmits from the frames it retains, either when a later frame is
+ * selectively acknowledged or when the retransmission timeout passes. Both
+ * linked drivers must have reliability enabled.
+ */
+class Reliability {
+public:
+  /* Constants */
+  static constexpr std::size_t HEADER_LEN = sizeof(uint8_t) + sizeof(uint32_t);
+  static constexpr std::size_t WINDOW_MAX = 256;
+
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+
+  enum class Kind : uint8_t {
+    DATA = 0x01,
+    ACK = 0x02,
+  };
+
+  struct Config {
+    // Number of unacknowledged frames the sender may have outstanding
+    std::size_t window{64};
+    // Retransmission timeout used until a round trip has been measured, it is
+    // doubled on every expiry until a fresh measurement arrives
+    Clock::duration rto{std::chrono::milliseconds(5)};
+    // Bounds on the retransmission timeout, including backoff
+    Clock::duration rto_min{std::chrono::milliseconds(1)};
+    Clock::duration rto_max{std::chrono::milliseconds(200)};
+  };
+
+  struct Stats {
+    uint64_t sent{0};
+    uint64_t retransmitted{0};
+    uint64_t delivered{0};
+    uint64_t duplicates{0};
+    uint64_t corrupted{0};
+    uint64_t acks_sent{0};
+    uint64_t acks_received{0};
+  };
+
+  Reliability() = delete;
+  ~Reliability() = default;
+  Reliability(const Reliability &) = delete;
+  Reliability &operator=(const Reliability &) = delete;
+
+  /* Alternate constructor
+   * @param driver The driver this layer sends through
+   * @param config The window and timeout settings
+   */
+  Reliability(Driver &driver, const Config &config);
+
+  /* Queues a frame for reliable delivery. The frame is transmitted at once if
+   * the window has room, otherwise when acknowledgements open it.
+   * @param frame A frame buffer from Driver::reserve with the payload written
+   * @param type The EtherType of the frame
+   * @param now The current time
+   * @return none
+   */
+  void send(std::vector<uint8_t> &&frame, const Frame::EtherType type,
+            const Clock::time_point now);
+
+  /* Processes the payload of a received frame
+   * @param payload The payload including the link header
+   * @param now The current time
+   * @return none
+   */
+  void receive(std::span<const uint8_t> payload, const Clock::time_point now);
+
+  /* Retransmits frames whose timeout has passed
+   * @param now The current time
+   * @return none
+   */
+  void service(const Clock::time_point now);
+
+  /* Takes the next in-order payload, if any
+   * @param output The payload without the link header
+   * @return True if a payload was delivered, False otherwise
+   */
+  bool deliver(std::vector<uint8_t> &output);
+
+  /* Checks whether any in-order payloads are ready
+   * @return True if deliver would succeed
+   */
+  [[nodiscard]] bool hasDeliverable() const;
+
+  /* Gets the number of frames sent but not yet acknowledged
+   * @return The number of frames in flight
+   */
+  [[nodiscard]] std::size_t inFlight() const;
+
+  /* Counts a frame dropped for failing its CRC32 check
+   * @return none
+   */
+  void countCorrupted();
+
+  /* Gets the delivery counters
+   * @return The delivery counters
+   */
+  [[nodiscard]] const Stats &getStats() const;
+
+private:
+  struct TxSlot {
+    bool in_use{false};
+    bool acked{false};
+    bool fast_retransmitted{false};
+    uint32_t retries{0};
+    Frame::EtherType type{Frame::EtherType::IPV4};
+    Clock::time_point sent_at{};
+    Clock::time_point deadline{};
+    std::vector<uint8_t> frame{};
+  };
+
+  struct RxSlot {
+    bool present{false};
+    std::vector<uint8_t> payload{};
+  };
+
+  struct Pending {
+    Frame::EtherType type;
+    std::vector<uint8_t> frame;
+  };
+
+  /* Moves backlogged frames into the window while there is room
+   */
+  void fill(const Clock::time_point now);
+
+  /* Transmits a copy of a retained frame and restarts its timer
+   */
+  void transmit(TxSlot &slot, const Clock::time_point now);
+
+  /* Marks a frame acknowledged, feeding the round-trip estimate from frames
+   * that were only sent once
+   */
+  void acknowledge(TxSlot &slot, const Clock::time_point now);
+
+  /* Slides the send window past acknowledged frames
+   */
+  void advance();
+
+  /* Sends a cumulative and selective acknowledgement of received frames
+   */
+  void sendAck();
+
+  /* Data */
+  Driver &driver;
+  Config config{};
+  Stats stats{};
+  // Sender
+  uint32_t base{0};
+  uint32_t next_seq{0};
+  Clock::duration srtt{};
+  Clock::duration rttvar{};
+  Clock::duration rto{};
+  std::vector<TxSlot> tx_window{};
+  std::deque<Pending> backlog{};
+  // Receiver
+  uint32_t expected{0};
+  std::vector<RxSlot> rx_window{};
+  std::deque<std::vector<uint8_t>> delivered{};
+};
+
+} // namespace Ethernet
+
+#endif // ETHERNET_RELIABLE_HPP
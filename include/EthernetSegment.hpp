@@ -0,0 +1,85 @@
+#ifndef ETHERNET_SEGMENT_HPP
+#define ETHERNET_SEGMENT_HPP
+
+#include "EthernetDriver.hpp"
+#include <atomic>
+#include <span>
+#include <unordered_map>
+
+namespace Ethernet {
+
+/* A shared segment connecting any number of drivers, like a switch with
+ * every station's port already known. Unicast frames go to the driver with
+ * the destination MAC, broadcast frames to every driver but the sender, and
+ * multicast frames to the group's members but the sender. A frame sent to
+ * several drivers is queued at each as a reference to one shared buffer.
+ * Like Driver::link, it only simulates the wire for testing.
+ */
+class Segment : public Medium {
+public:
+  /* Types */
+  struct Stats {
+    uint64_t forwarded{0};
+    uint64_t flooded{0};
+    uint64_t multicast{0};
+    uint64_t dropped{0};
+  };
+
+  Segment() = default;
+  ~Segment() override = default;
+  Segment(const Segment &) = delete;
+  Segment &operator=(const Segment &) = delete;
+
+  /* Connects a driver to the segment. Drivers must be attached before any
+   * of them send, and the segment must outlive them.
+   * @param driver The driver, whose MAC must be unique on the segment
+   * @return none
+   */
+  void attach(Driver &driver);
+
+  /* Adds an attached driver to a multicast group, so frames sent to the
+   * group reach it. Like attach, it must be done before any driver sends.
+   * @param group The group address, with GROUP_BIT set
+   * @param driver The driver
+   * @return none
+   */
+  void join(const MacAddr &group, Driver &driver);
+
+  /* Gets the number of attached drivers
+   * @return The number of drivers
+   */
+  [[nodiscard]] std::size_t size() const;
+
+  /* Gets the frame counters
+   * @return Unicast frames forwarded, broadcast frames flooded, multicast
+   * frames sent to their group, and frames dropped for an unknown
+   * destination
+   */
+  [[nodiscard]] Stats getStats() const;
+
+private:
+  /* Passes an encoded frame to its destination
+   * @param src The sending driver's MAC, which a broadcast skips
+   * @param frame The encoded frame
+   */
+  void forward(const MacAddr &src, std::vector<uint8_t> &&frame) override;
+
+  /* Queues a frame at each driver but the sender
+   */
+  static void fanOut(const MacAddr &src, FrameBuffer &&frame,
+                     std::span<Driver *const> drivers);
+
+  /* Data */
+  std::unordered_map<MacAddr, Driver *, MacAddrHash> ports{};
+  // The attached drivers in order, for flooding
+  std::vector<Driver *> stations{};
+  std::unordered_map<MacAddr, std::vector<Driver *>, MacAddrHash> groups{};
+  std::atomic<uint64_t> forwarded{0};
+  std::atomic<uint64_t> flooded{0};
+  std::atomic<uint64_t> multicast{0};
+  std::atomic<uint64_t> dropped{0};
+};
+
+} // namespace Ethernet
+
+#endif // ETHERNET_SEGMENT_HPP
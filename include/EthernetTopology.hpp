@@ -0,0 +1,180 @@
+#ifndef ETHERNET_TOPOLOGY_HPP
+#define ETHERNET_TOPOLOGY_HPP
+
+#include "EthernetSegment.hpp"
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Ethernet {
+
+/* A simulated network built in bulk from a description, instead of
+ * constructing drivers and linking them pair by pair. Every driver lives in
+ * one contiguous array, as does every segment, so building thousands of
+ * nodes costs a handful of allocations and walking the drivers stays in
+ * cache.
+ *
+ * The text form has one statement per line, and # starts a comment:
+ *
+ *   node <name> [mac]         A driver, its MAC 02:00 then its index if none
+ *   switch <name>             A shared Segment
+ *   link <node> <node>        A point-to-point Driver::link
+ *   attach <switch> <node>... Attaches nodes to a switch
+ *
+ * A name may end in a range such as dev[0..999], which stands for dev0 to
+ * dev999. Both sides of a link must then expand to the same count, and are
+ * linked in order.
+ */
+class Topology {
+public:
+  /* Types */
+  struct Node {
+    std::string name{};
+    MacAddr mac{};
+    friend bool operator==(const Node &, const Node &) = default;
+  };
+
+  struct Link {
+    uint32_t a{0};
+    uint32_t b{0};
+    friend bool operator==(const Link &, const Link &) = default;
+  };
+
+  struct Attachment {
+    uint32_t segment{0};
+    uint32_t node{0};
+    friend bool operator==(const Attachment &, const Attachment &) = default;
+  };
+
+  // What to build, with every name resolved to an index
+  struct Description {
+    std::vector<Node> nodes{};
+    std::vector<std::string> segments{};
+    std::vector<Link> links{};
+    std::vector<Attachment> attachments{};
+    friend bool operator==(const Description &, const Description &) = default;
+
+    /* Parses the text form
+     * @param text The description
+     * @return The description, throws naming the line of any error
+     */
+    static Description parse(std::string_view text);
+
+    /* Reads the binary form
+     * @param bytes The encoded description
+     * @return The description, throws if it is truncated or malformed
+     */
+    static Description fromBinary(std::span<const uint8_t> bytes);
+
+    /* Writes the binary form, which loads without any parsing
+     * @return The encoded description
+     */
+    [[nodiscard]] std::vector<uint8_t> toBinary() const;
+  };
+
+  struct Config {
+    // Frames each receive queue is preallocated for
+    std::size_t queue_depth{0};
+  };
+
+  Topology() = delete;
+  Topology(const Topology &) = delete;
+  Topology &operator=(const Topology &) = delete;
+
+  /* Alternate constructor, builds the network
+   * @param description The nodes, switches, links and attachments
+   * @param config The queue preallocation
+   */
+  Topology(const Description &description, const Config &config);
+
+  /* Alternate constructor, builds the network without preallocated queues
+   * @param description The nodes, switches, links and attachments
+   */
+  explicit Topology(const Description &description);
+
+  /* Destroys the drivers before the segments they are attached to
+   */
+  ~Topology();
+
+  /* Reads and parses a text description
+   * @param path The file
+   * @return The description
+   */
+  static Description load(const std::string &path);
+
+  /* Reads a text description through a binary cache. The cache holds a hash
+   * of the text, and is rewritten whenever the text no longer matches it.
+   * @param path The text file
+   * @param cache_path The cache file, created if missing
+   * @return The description
+   */
+  static Description loadCached(const std::string &path,
+                                const std::string &cache_path);
+
+  /* Gets every driver, in the order the description declares them
+   * @return The drivers
+   */
+  [[nodiscard]] std::span<Driver> drivers();
+
+  /* Gets a driver by name
+   * @param name The node's name
+   * @return The driver, throws if there is no such node
+   */
+  [[nodiscard]] Driver &driver(std::string_view name);
+
+  /* Gets a segment by name
+   * @param name The switch's name
+   * @return The segment, throws if there is no such switch
+   */
+  [[nodiscard]] Segment &segment(std::string_view name);
+
+private:
+  /* Objects built in place in one allocation, destroyed in reverse order
+   */
+  template <typename T> class Storage {
+  public:
+    explicit Storage(const std::size_t capacity)
+        : items(capacity == 0 ? nullptr
+                              : std::allocator<T>().allocate(capacity)),
+          capacity(capacity) {}
+    ~Storage() {
+      while (0 < this->count) {
+        std::destroy_at(&this->items[--this->count]);
+      }
+      if (this->items) {
+        std::allocator<T>().deallocate(this->items, this->capacity);
+      }
+    }
+    Storage(const Storage &) = delete;
+    Storage &operator=(const Storage &) = delete;
+
+    template <typename... Args> T &emplace(Args &&...args) {
+      T *item = std::construct_at(&this->items[this->count],
+                                  std::forward<Args>(args)...);
+      ++this->count;
+      return *item;
+    }
+    std::span<T> span() { return {this->items, this->count}; }
+
+  private:
+    T *items;
+    std::size_t capacity;
+    std::size_t count{0};
+  };
+
+  /* Data */
+  // Declared first so it is destroyed last
+  Storage<Segment> segments;
+  Storage<Driver> driver_storage;
+  std::unordered_map<std::string_view, uint32_t> node_index{};
+  std::unordered_map<std::string_view, uint32_t> segment_index{};
+  std::vector<std::string> names{};
+};
+
+} // namespace Ethernet
+
+#endif // ETHERNET_TOPOLOGY_HPP
@@ -0,0 +1,209 @@
+#ifndef ETHERNET_TRACE_HPP
+#define ETHERNET_TRACE_HPP
+
+#include "EthernetAlloc.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Builds the tracepoints in, set by the ETHERNET_TRACING CMake option. With
+// it off the tracepoint macros expand to nothing.
+#ifndef ETHERNET_TRACING
+#define ETHERNET_TRACING 0
+#endif
+
+namespace Ethernet {
+
+/* Frame lifecycle tracing. Tracepoints along the send and receive path time
+ * spans such as packing a message or validating a CRC, and mark when a frame
+ * enters and leaves a receive queue. Each thread writes its events into its
+ * own ring buffer, newest overwriting oldest, so recording never takes a
+ * lock or allocates once the ring exists.
+ *
+ * A ring outlives its thread until its events have been exported, or a new
+ * trace has started, so threads that come and go do not add up.
+ *
+ * Only one in sample_every spans is recorded on each thread, and a queued
+ * frame is recorded if its CRC falls in the same share, so both ends of the
+ * wait agree without sharing state.
+ */
+class Trace {
+public:
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+
+  enum class Phase : uint8_t {
+    // A complete span with a duration
+    SPAN,
+    // The start and end of an interval that crosses threads, matched by id
+    BEGIN,
+    END,
+  };
+
+  struct Event {
+    const char *name{nullptr};
+    Phase phase{Phase::SPAN};
+    // Index of the recording thread, in the order threads first traced
+    uint32_t thread{0};
+    // Nanoseconds since the clock's epoch
+    uint64_t start{0};
+    uint64_t duration{0};
+    uint64_t id{0};
+  };
+
+  struct Config {
+    // Events kept per thread, rounded up to a power of two. A thread's ring
+    // is sized when it first records.
+    std::size_t ring_len{1 << 14};
+    // Record one in this many spans, 1 records every one
+    uint32_t sample_every{64};
+  };
+
+  /* Times a scope if tracing is on and the thread's sample is due. Every
+   * span, sampled or not, tags the allocations made inside it.
+   */
+  class Span {
+  public:
+    explicit Span(const char *name)
+        : tag(name), name(Trace::sample() ? name : nullptr),
+          start(this->name ? Trace::now() : 0) {}
+    ~Span() {
+      if (this->name) {
+        Trace::span(this->name, this->start, Trace::now() - this->start);
+      }
+    }
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+  private:
+    Alloc::Tag tag;
+    const char *name;
+    uint64_t start;
+  };
+
+  Trace() = delete;
+
+  /* Starts recording. Events recorded before are no longer exported.
+   * @param config The ring size and sampling
+   * @return none
+   */
+  static void start(const Config &config);
+
+  /* Starts recording with the default ring size and sampling
+   * @return none
+   */
+  static void start();
+
+  /* Stops recording, the events recorded so far can still be exported
+   * @return none
+   */
+  static void stop();
+
+  /* Gets whether tracing is recording
+   * @return True if recording
+   */
+  static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+  /* Decides whether the calling thread records its next span
+   * @return True if it should
+   */
+  static bool sample() {
+    if (!enabled()) {
+      return false;
+    }
+    if (countdown != 0) {
+      --countdown;
+      return false;
+    }
+    countdown = sample_every.load(std::memory_order_relaxed) - 1;
+    return true;
+  }
+
+  /* Records a complete span
+   * @param name The span's name, which must outlive the trace
+   * @param start When it started, from now
+   * @param duration How long it took in nanoseconds
+   * @return none
+   */
+  static void span(const char *name, const uint64_t start,
+                   const uint64_t duration);
+
+  /* Records the start of an interval another thread may end
+   * @param name The interval's name
+   * @param id Matches the end to the start
+   * @return none
+   */
+  static void begin(const char *name, const uint64_t id);
+
+  /* Records the end of an interval
+   * @param name The interval's name
+   * @param id Matches the end to the start
+   * @return none
+   */
+  static void end(const char *name, const uint64_t id);
+
+  /* Gets the current time as tracing counts it
+   * @return Nanoseconds since the clock's epoch
+   */
+  static uint64_t now();
+
+  /* Copies the events every thread still holds since tracing last started.
+   * The rings of threads that have exited are freed once read, so their
+   * events are exported only once.
+   * @return The events, ordered by start time
+   */
+  static std::vector<Event> snapshot();
+
+  /* Gets the number of thread rings held
+   * @return Rings of running threads, and of exited threads not yet exported
+   */
+  static std::size_t rings();
+
+  /* Writes the events as Chrome trace JSON, which Perfetto and
+   * chrome://tracing both open
+   * @param out The stream to write to
+   * @return none
+   */
+  static void writeChrome(std::FILE *out);
+
+private:
+  struct Ring;
+
+  /* Decides whether an interval with an id is recorded
+   */
+  static bool sampleId(const uint64_t id);
+
+  /* Writes an event into the calling thread's ring
+   */
+  static void record(const Event &event);
+
+  /* Data */
+  static inline std::atomic<bool> active{false};
+  static inline std::atomic<uint32_t> sample_every{1};
+  static inline thread_local uint32_t countdown{0};
+};
+
+} // namespace Ethernet
+
+#if ETHERNET_TRACING
+#define ETHERNET_TRACE_CONCAT_(a, b) a##b
+#define ETHERNET_TRACE_CONCAT(a, b) ETHERNET_TRACE_CONCAT_(a, b)
+#define ETHERNET_TRACE_SPAN(name)                                              \
+  const ::Ethernet::Trace::Span ETHERNET_TRACE_CONCAT(trace_span_, __LINE__)(  \
+      name)
+// The id is only worked out while tracing is on
+#define ETHERNET_TRACE_BEGIN(name, id)                                         \
+  (::Ethernet::Trace::enabled() ? ::Ethernet::Trace::begin(name, id)           \
+                                : static_cast<void>(0))
+#define ETHERNET_TRACE_END(name, id)                                           \
+  (::Ethernet::Trace::enabled() ? ::Ethernet::Trace::end(name, id)             \
+                                : static_cast<void>(0))
+#else
+#define ETHERNET_TRACE_SPAN(name) static_cast<void>(0)
+#define ETHERNET_TRACE_BEGIN(name, id) static_cast<void>(0)
+#define ETHERNET_TRACE_END(name, id) static_cast<void>(0)
+#endif
+
+#endif // ETHERNET_TRACE_HPP
@@ -14,6 +14,10 @@ enum class CmdID : uint8_t {
   PING = 0x01,
   START_STREAM = 0x02,
   STOP_STREAM = 0x03,
+  // Data is the stream id and Encoding, the response echoes both
+  SET_ENCODING = 0x04,
+  // Usually broadcast, the response is an Announce from each device
+  DISCOVER = 0x05,
 };
 
 enum class StreamID : uint8_t {
@@ -24,6 +28,13 @@ enum class ErrorID : uint8_t {
   UNKNOWN_CMD = 0x01,
   BAD_PAYLOAD = 0x02,
 };
+
+// Matches a response or error to the command that caused it. NONE marks
+// messages that are not part of a request.
+enum class CorrID : uint16_t {
+  NONE = 0x0000,
+};
+
 union ID {
   CmdID cmd_id;
   StreamID stream_id;
@@ -35,6 +46,8 @@ enum class MsgType : uint8_t {
   RESPONSE = 0x02,
   STREAM = 0x03,
   ERROR = 0x04,
+  FRAGMENT = 0x05,
+  BATCH = 0x06,
 };
 
 struct Msg {
@@ -42,24 +55,136 @@ struct Msg {
     MsgType type;
     ID id;
     uint16_t len;
+    CorrID corr{CorrID::NONE};
   };
   Header header;
   std::vector<uint8_t> data;
 };
 
+// Non-owning view of a message whose data lives in a received buffer
+struct MsgView {
+  Msg::Header header;
+  std::span<const uint8_t> data;
+};
+
 /* Constants */
 // The bare minimum we need to verify size. I'm not using sizeof(Msg::Header)
 // since there is likely padding and packed messages will have that removed
-static constexpr std::size_t MSG_LEN_MIN = sizeof(Msg::Header::type) +
-                                           sizeof(Msg::Header::id) +
-                                           sizeof(Msg::Header::len);
+static constexpr std::size_t MSG_LEN_MIN =
+    sizeof(Msg::Header::type) + sizeof(Msg::Header::id) +
+    sizeof(Msg::Header::len) + sizeof(Msg::Header::corr);
+
+// Traffic classes trafficClass assigns
+static constexpr uint8_t CONTROL_CLASS = 6;
+static constexpr uint8_t BULK_CLASS = 0;
 
 /* Helper functions */
+
+/* Gets the wire byte of a message id
+ * @param t The message type, selects the active member of the id
+ * @param id The message id
+ * @return The wire byte
+ */
+uint8_t packId(const MsgType t, const ID id);
+
+/* Gets the message id from its wire byte
+ * @param t The message type, selects the active member of the id
+ * @param byte The wire byte
+ * @return The message id
+ */
+ID unpackId(const MsgType t, const uint8_t byte);
+
 std::vector<uint8_t> packMsg(const MsgType t, const ID id,
-                             const std::vector<uint8_t> &data);
+                             const std::vector<uint8_t> &data,
+                             const CorrID corr = CorrID::NONE);
+
+/* Gets the length of a packed message, including the leading padding needed to
+ * satisfy the Ethernet minimum payload length
+ * @param data_len The length of the message data
+ * @return The number of bytes packMsgInto will write
+ */
+std::size_t packedLen(const std::size_t data_len);
+
+/* Packs a message header and padding in place into a caller provided buffer,
+ * leaving the data region for the caller to fill
+ * @param out The buffer to pack into, must be exactly packedLen(data_len)
+ * @param t The message type
+ * @param id The message id
+ * @param data_len The length of the message data
+ * @param corr The correlation id, NONE outside of requests
+ * @return The data region at the end of the buffer
+ */
+std::span<uint8_t> packHeaderInto(std::span<uint8_t> out, const MsgType t,
+                                  const ID id, const std::size_t data_len,
+                                  const CorrID corr = CorrID::NONE);
+
+/* Packs a message in place into a caller provided buffer, such as the payload
+ * of a frame from Driver::reserve
+ * @param out The buffer to pack into, must be exactly packedLen(data.size())
+ * @param t The message type
+ * @param id The message id
+ * @param data The message data
+ * @param corr The correlation id, NONE outside of requests
+ * @return none
+ */
+void packMsgInto(std::span<uint8_t> out, const MsgType t, const ID id,
+                 std::span<const uint8_t> data,
+                 const CorrID corr = CorrID::NONE);
+
+/* Packs a message directly into a reserved driver frame and sends it, so the
+ * message data is written exactly once on the way to the wire
+ * @param driver The driver to send with
+ * @param t The message type
+ * @param id The message id
+ * @param data The message data
+ * @param corr The correlation id, NONE outside of requests
+ * @return none
+ */
+void sendMsg(Driver &driver, const MsgType t, const ID id,
+             std::span<const uint8_t> data, const CorrID corr = CorrID::NONE);
+
+/* Packs a message into a reserved driver frame and sends it to a station on
+ * the driver's segment
+ * @param driver The driver to send with
+ * @param dst The destination MAC address
+ * @param t The message type
+ * @param id The message id
+ * @param data The message data
+ * @param corr The correlation id, NONE outside of requests
+ * @return none
+ */
+void sendMsg(Driver &driver, const MacAddr &dst, const MsgType t, const ID id,
+             std::span<const uint8_t> data, const CorrID corr = CorrID::NONE);
 
 Msg unpackMsg(const std::vector<uint8_t> &data);
 
+/* Classifies a frame by its message type, for Driver::QueueConfig. Commands,
+ * responses and errors are control traffic. Streams, fragments and batches,
+ * which trade latency for throughput, are bulk. So is the SET_ENCODING
+ * response, which must not overtake the samples sent before it.
+ * @param frame The wire-format frame
+ * @return CONTROL_CLASS or BULK_CLASS
+ */
+uint8_t trafficClass(std::span<const uint8_t> frame);
+
+/* Reads a frame's flow key for Driver::RssConfig, its message type and ID,
+ * so each command, response and stream is a flow of its own. A SET_ENCODING
+ * response takes the key of the stream it switches, so it is received in
+ * order with the samples around it.
+ * @param frame The wire-format frame
+ * @return The message type above the ID, 0 if the frame has no message
+ */
+uint32_t flowKey(std::span<const uint8_t> frame);
+
+/* Reads a frame's message type for Driver::DemuxConfig, so streams, say,
+ * can be received apart from commands and responses. It is the outer type:
+ * streams inside a batch or fragment read as BATCH or FRAGMENT, and the
+ * SET_ENCODING response of a stream reads as RESPONSE.
+ * @param frame The wire-format frame
+ * @return The message type, 0 if the frame has no message
+ */
+uint8_t demuxKey(std::span<const uint8_t> frame);
+
 } // namespace Protocol
 
 #endif // PROTOCOL_HPP
@@ -0,0 +1,159 @@
+#ifndef PROTOCOL_AGGREGATE_HPP
+#define PROTOCOL_AGGREGATE_HPP
+
+#include "Protocol.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace Protocol {
+
+/* Keeps per-stream rate, min, max, mean and percentiles over recent time,
+ * updated as samples arrive instead of recomputed from raw samples.
+ *
+ * Time is cut into buckets of a fixed width, and each stream keeps a ring of
+ * the most recent buckets. A bucket holds a count, sum, min, max and a
+ * log-linear histogram of its samples, the histogram acting as a quantile
+ * sketch within about 3% of the true value. Each of those is a column
+ * across the ring, so a query merges buckets column by column. Sliding windows merge
+ * the buckets that cover the span up to now, tumbling windows merge the
+ * buckets of the last completed window.
+ *
+ * Samples are added with relaxed atomic updates, so several shards can feed
+ * one aggregator and queries never block them. The only wait is when a
+ * bucket is reused for a new time and two writers race to clear it. A query
+ * skips any bucket that is reused while it reads, and reads a bucket that
+ * is still filling as it stands.
+ */
+class Aggregator {
+public:
+  /* Constants */
+  // Histogram bins per power of two, values below 2 * SUB_BINS get a bin each
+  static constexpr std::size_t SUB_BINS = 16;
+  // The exact bins, then the powers of two from 2^5 up to 2^31
+  static constexpr std::size_t BINS = 2 * SUB_BINS + (32 - 5) * SUB_BINS;
+
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+
+  struct Config {
+    // Width of the smallest window
+    Clock::duration bucket_width{std::chrono::seconds(1)};
+    // Buckets of history kept per stream, bounding the longest window
+    std::size_t buckets{60};
+  };
+
+  struct Summary {
+    uint64_t count{0};
+    // Samples per second over the window
+    double rate{0.0};
+    uint32_t min{0};
+    uint32_t max{0};
+    double mean{0.0};
+    uint32_t p50{0};
+    uint32_t p90{0};
+    uint32_t p99{0};
+  };
+
+  struct Stats {
+    // Samples older than every bucket of their stream, which are dropped
+    uint64_t late{0};
+  };
+
+  Aggregator(const Aggregator &) = delete;
+  Aggregator &operator=(const Aggregator &) = delete;
+
+  /* Alternate constructor
+   * @param config The bucket width and history length
+   */
+  explicit Aggregator(const Config &config);
+
+  /* Default constructor, one minute of one second buckets
+   */
+  Aggregator();
+
+  ~Aggregator();
+
+  /* Adds a sample. Safe to call from several threads at once.
+   * @param stream_id The stream
+   * @param time When the sample was received
+   * @param value The sample
+   * @return none
+   */
+  void add(StreamID stream_id, Clock::time_point time, uint32_t value);
+
+  /* Adds a block of samples received together, such as a decoded block.
+   * Count, sum, min and max are reduced over the block before touching the
+   * shared bucket.
+   * @param stream_id The stream
+   * @param time When the block was received
+   * @param values The samples
+   * @return none
+   */
+  void add(StreamID stream_id, Clock::time_point time,
+           std::span<const uint32_t> values);
+
+  /* Aggregates a sliding window ending now
+   * @param stream_id The stream
+   * @param span How far back the window reaches, rounded up to whole
+   * buckets and capped at the history kept
+   * @param now The end of the window
+   * @return The aggregates, all zero if the stream has no samples
+   */
+  [[nodiscard]] Summary sliding(StreamID stream_id, Clock::duration span,
+                                Clock::time_point now = Clock::now()) const;
+
+  /* Aggregates the last completed tumbling window. Windows are aligned to
+   * multiples of their width.
+   * @param stream_id The stream
+   * @param width The window width, a whole number of buckets within half
+   * the history kept, throws otherwise
+   * @param now The time the window must have completed by
+   * @return The aggregates, all zero if the stream has no samples
+   */
+  [[nodiscard]] Summary tumbling(StreamID stream_id, Clock::duration width,
+                                 Clock::time_point now = Clock::now()) const;
+
+  /* Gets the late sample counter
+   * @return The counter
+   */
+  [[nodiscard]] Stats getStats() const;
+
+  /* Gets the histogram bin a value falls in
+   * @param value The value
+   * @return The bin index, below BINS
+   */
+  static std::size_t binOf(uint32_t value);
+
+  /* Gets the value a bin stands for, the middle of its range
+   * @param bin The bin index
+   * @return The value
+   */
+  static uint32_t binValue(std::size_t bin);
+
+private:
+  struct Series;
+
+  /* Gets a stream's buckets, creating them on its first sample
+   */
+  Series &series(StreamID stream_id);
+
+  /* Merges the buckets of a stream's ticks, first to last inclusive
+   */
+  Summary merge(StreamID stream_id, int64_t first, int64_t last,
+                Clock::duration elapsed) const;
+
+  [[nodiscard]] int64_t tickOf(Clock::time_point time) const;
+
+  /* Data */
+  Config config;
+  std::array<std::atomic<Series *>, 256> streams{};
+  std::atomic<uint64_t> late{0};
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_AGGREGATE_HPP
@@ -0,0 +1,129 @@
+#ifndef PROTOCOL_BATCH_HPP
+#define PROTOCOL_BATCH_HPP
+
+#include "Protocol.hpp"
+#include <chrono>
+#include <iterator>
+#include <optional>
+
+namespace Protocol {
+
+/* Packs several messages into the data of a single BATCH message. Each record
+ * is a message header followed directly by its data, with no padding, so small
+ * messages such as telemetry samples share one frame, CRC32, and queue entry.
+ * Records are written straight into a reserved driver frame.
+ */
+class Coalescer {
+public:
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+
+  struct Config {
+    // Largest BATCH frame payload to build before flushing
+    std::size_t max_len{Ethernet::Frame::PAYLOAD_LEN_MAX};
+    // Longest time the oldest record may wait before flushIfDue sends it
+    Clock::duration max_delay{std::chrono::milliseconds(1)};
+  };
+
+  Coalescer() = delete;
+  ~Coalescer() = default;
+  Coalescer(const Coalescer &) = delete;
+  Coalescer &operator=(const Coalescer &) = delete;
+
+  /* Alternate constructor
+   * @param driver The driver to send batches with
+   * @param config The size and deadline limits to flush at
+   */
+  Coalescer(Driver &driver, const Config &config);
+
+  /* Appends a message record, flushing first if it would not fit
+   * @param t The message type
+   * @param id The message id
+   * @param data The message data
+   * @param now The current time, starts the deadline of a new batch
+   * @return True if the record was batched, False if it can never share a
+   * frame. Pending records are flushed first so the caller can send it next.
+   */
+  bool append(const MsgType t, const ID id, std::span<const uint8_t> data,
+              const Clock::time_point now = Clock::now());
+
+  /* Flushes the pending records if the oldest has waited max_delay
+   * @param now The current time
+   * @return True if a batch was sent, False otherwise
+   */
+  bool flushIfDue(const Clock::time_point now = Clock::now());
+
+  /* Sends any pending records as a single BATCH message
+   * @return none
+   */
+  void flush();
+
+  /* Gets the number of records waiting to be sent
+   * @return The number of pending records
+   */
+  [[nodiscard]] std::size_t pending() const;
+
+  /* Gets the time flushIfDue will send the pending records
+   * @return The deadline, or nothing if no records are pending
+   */
+  [[nodiscard]] std::optional<Clock::time_point> nextDeadline() const;
+
+private:
+  /* Data */
+  Driver &driver;
+  Config config{};
+  std::vector<uint8_t> frame{};
+  std::size_t used{0};
+  std::size_t records{0};
+  Clock::time_point deadline{};
+};
+
+/* Iterates over the records of a BATCH message's data without copying. Each
+ * record is validated as it is reached.
+ */
+class BatchView {
+public:
+  class Iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = MsgView;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const MsgView *;
+    using reference = const MsgView &;
+
+    Iterator() = default;
+    explicit Iterator(std::span<const uint8_t> remaining);
+
+    reference operator*() const;
+    pointer operator->() const;
+    Iterator &operator++();
+    Iterator operator++(int);
+    friend bool operator==(const Iterator &lhs, const Iterator &rhs) {
+      return lhs.remaining.data() == rhs.remaining.data() &&
+             lhs.remaining.size() == rhs.remaining.size();
+    }
+
+  private:
+    /* Decodes the record at the front of the remaining data
+     */
+    void decode();
+
+    std::span<const uint8_t> remaining{};
+    MsgView current{};
+  };
+
+  /* Alternate constructor
+   * @param data The data of a BATCH message
+   */
+  explicit BatchView(std::span<const uint8_t> data);
+
+  [[nodiscard]] Iterator begin() const;
+  [[nodiscard]] Iterator end() const;
+
+private:
+  std::span<const uint8_t> data{};
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_BATCH_HPP
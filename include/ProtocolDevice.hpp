@@ -3,30 +3,176 @@
 #define PROTOCOL_DEVICE_HPP
 
 #include "Protocol.hpp"
+#include "ProtocolBatch.hpp"
+#include "ProtocolEncoding.hpp"
+#include "ProtocolFragment.hpp"
+#include "ProtocolHandlers.hpp"
+#include "ProtocolStream.hpp"
+#include "RuntimeScheduler.hpp"
+#include "RuntimeSimulation.hpp"
+#include <array>
+#include <optional>
 
 namespace Protocol {
 
 class Device {
 public:
+  /* Types */
+  // Command handlers receive the device so they can respond
+  using CommandTable = HandlerTable<CmdID, Device &, const MsgView &>;
+
   Device() = delete;
   ~Device() = default;
   Device(const Device &) = delete;
   Device &operator=(const Device &) = delete;
   explicit Device(Driver &driver);
 
-  bool poll();
+  /* Handles at most one received frame and sends any stream samples that are
+   * due
+   * @param now The current time
+   * @return True
+   */
+  bool poll(const StreamScheduler::Clock::time_point now =
+                StreamScheduler::Clock::now());
+
+  /* Adds or replaces a stream this device can send. START_STREAM and
+   * STOP_STREAM enable and disable it by id.
+   * @param config The rate, batching, priority, and sample producer
+   * @param now The current time, restarts a replaced stream that was running
+   * @return none
+   */
+  void addStream(const StreamScheduler::StreamConfig &config,
+                 const StreamScheduler::Clock::time_point now =
+                     StreamScheduler::Clock::now());
+
+  /* Enables or disables a stream directly
+   * @param stream_id The stream
+   * @param enable True to start sending, False to stop
+   * @param now The current time
+   * @return True if the stream exists, False otherwise
+   */
+  bool enableStream(const StreamID stream_id, const bool enable,
+                    const StreamScheduler::Clock::time_point now =
+                        StreamScheduler::Clock::now());
+
+  /* Sets how a stream's samples are sent. With a delta encoding, the samples
+   * a stream produces in one poll are sent together as encoded blocks, so
+   * its batch size sets the block size. The samples must be 4 bytes.
+   * @param stream_id The stream
+   * @param encoding The encoding
+   * @return True if the stream exists, False otherwise
+   */
+  bool setStreamEncoding(const StreamID stream_id, const Encoding encoding);
+
+  /* Gets the earliest time a stream sample or coalesced batch is due, so the
+   * caller can sleep until then rather than polling
+   * @return The deadline, or nothing if nothing is due
+   */
+  [[nodiscard]] std::optional<StreamScheduler::Clock::time_point>
+  nextDeadline() const;
+
+  /* Runs the device as a coroutine. It sleeps until a command arrives or
+   * the next stream sample is due, and returns once the scheduler stops.
+   * @param scheduler The scheduler running the task, with this device's
+   * driver attached
+   * @return The task to spawn
+   */
+  Runtime::Task run(Runtime::Scheduler &scheduler);
+
+  /* Gets the device as a simulation endpoint. Each step handles every
+   * command that has arrived and samples its streams at the virtual time.
+   * @return The endpoint to spawn
+   */
+  Runtime::Simulation::Endpoint simulate();
 
   void sendResponse(const CmdID cmd_id, const std::vector<uint8_t> &data);
   void sendStream(const StreamID stream_id, const std::vector<uint8_t> &data);
   void sendError(const ErrorID code);
 
+  /* Sends a response packed from a message schema
+   * @param cmd_id The command being answered
+   * @param msg The response data
+   * @return none
+   */
+  template <FrameSchema T> void sendResponse(const CmdID cmd_id, const T &msg) {
+    const auto data = pack(msg);
+    this->sendResponseData(cmd_id, data);
+  }
+
+  /* Sends a stream sample packed from a message schema
+   * @param stream_id The stream
+   * @param msg The sample
+   * @return none
+   */
+  template <FrameSchema T> void sendStream(const StreamID stream_id, const T &msg) {
+    const auto data = pack(msg);
+    this->sendStreamData(stream_id, data);
+  }
+
+  /* Enables packing stream messages into BATCH frames, flushed when a frame
+   * fills up or the oldest sample reaches the configured delay
+   * @param config The batch size and delay limits
+   * @return none
+   */
+  void setStreamCoalescing(const Coalescer::Config &config);
+
+  /* Registers a command handler known at compile time, replacing any
+   * existing handler for the command
+   * @tparam Handler Function taking (Device &, const MsgView &)
+   * @param cmd_id The command to handle
+   * @return none
+   */
+  template <auto Handler> void onCommand(const CmdID cmd_id) {
+    this->commands.template bind<Handler>(cmd_id);
+  }
+
+  /* Registers a command handler callable such as a lambda, replacing any
+   * existing handler for the command
+   * @param cmd_id The command to handle
+   * @param handler Callable taking (Device &, const MsgView &)
+   * @return none
+   */
+  template <typename F> void onCommand(const CmdID cmd_id, F &&handler) {
+    this->commands.bind(cmd_id, std::forward<F>(handler));
+  }
+
 private:
   /* Handlers */
-  void handleCommand(const Msg &msg);
+  void dispatch(const MsgView &msg);
+  void sendResponseData(const CmdID cmd_id, std::span<const uint8_t> data);
+  void sendStreamData(const StreamID stream_id, std::span<const uint8_t> data);
+
+  /* Sends a produced sample, or adds it to the stream's pending block
+   */
+  void emitSample(const StreamID stream_id, const std::vector<uint8_t> &sample);
+
+  /* Encodes and sends the pending block, if any
+   */
+  void flushBlock();
+  static void handlePing(Device &dev, const MsgView &msg);
+  static void handleStartStream(Device &dev, const MsgView &msg);
+  static void handleStopStream(Device &dev, const MsgView &msg);
+  static void handleSetEncoding(Device &dev, const MsgView &msg);
+  static void handleDiscover(Device &dev, const MsgView &msg);
+  static void produceTelemetry(uint32_t index, std::vector<uint8_t> &sample);
+  static void handleUnknown(Device &dev, const MsgView &msg);
 
   /* Data */
   Driver &driver;
-  bool send_stream{false};
+  CommandTable commands{};
+  Reassembler reassembler{};
+  std::optional<Coalescer> coalescer{};
+  StreamScheduler streams{};
+  std::array<Encoding, 256> encodings{};
+  // Samples of one encoded stream waiting to be sent as a block
+  StreamID block_id{StreamID::TELEMETRY};
+  std::vector<uint32_t> block{};
+  std::vector<uint8_t> encoded{};
+  // Time passed to the poll in progress, so commands act on the same clock
+  StreamScheduler::Clock::time_point polled_at{};
+  // Correlation id of the command being handled, NONE outside of handlers
+  CorrID replying_to{CorrID::NONE};
+  uint16_t frag_id{0};
 };
 
 } // namespace Protocol
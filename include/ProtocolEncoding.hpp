@@ -0,0 +1,68 @@
+#ifndef PROTOCOL_ENCODING_HPP
+#define PROTOCOL_ENCODING_HPP
+
+#include "Protocol.hpp"
+#include "ProtocolSchema.hpp"
+
+namespace Protocol {
+
+/* Types */
+// How the samples of a stream are carried in its STREAM messages. RAW sends
+// each sample as its own message, the others pack a block of 32-bit samples
+// into one message.
+enum class Encoding : uint8_t {
+  RAW = 0x00,
+  // First sample, then zig-zag varints of the differences between samples
+  DELTA_VARINT = 0x01,
+  // First sample, then zig-zag differences packed at a common bit width
+  DELTA_BITPACK = 0x02,
+};
+
+// Data of SET_ENCODING and of its response
+struct EncodingSelect {
+  StreamID stream_id;
+  Encoding encoding;
+  using FIELDS = Fields<&EncodingSelect::stream_id, &EncodingSelect::encoding>;
+};
+
+// A sample of an encoded stream
+struct BlockSample {
+  uint32_t value;
+  using FIELDS = Fields<&BlockSample::value>;
+};
+
+/* Constants */
+// Encoding byte, sample count, and first sample
+static constexpr std::size_t BLOCK_HEADER_LEN =
+    sizeof(Encoding) + sizeof(uint16_t) + sizeof(uint32_t);
+static constexpr std::size_t BLOCK_SAMPLES_MAX = UINT16_MAX;
+
+/* Helper functions */
+
+/* Checks whether a byte names a known encoding
+ * @param byte The wire byte
+ * @return True if it is an Encoding
+ */
+bool isEncoding(const uint8_t byte);
+
+/* Encodes a block of samples. The block records its encoding, so it can be
+ * decoded without knowing which was used.
+ * @param encoding The encoding, not RAW
+ * @param samples The samples, between 1 and BLOCK_SAMPLES_MAX of them
+ * @param out Replaced with the encoded block
+ * @return none
+ */
+void encodeBlock(const Encoding encoding, std::span<const uint32_t> samples,
+                 std::vector<uint8_t> &out);
+
+/* Decodes a block of samples. The delta and zig-zag stages run four samples
+ * at a time with SSE2 where it is available.
+ * @param block The encoded block
+ * @param samples Replaced with the decoded samples
+ * @return none, throws if the block is malformed
+ */
+void decodeBlock(std::span<const uint8_t> block, std::vector<uint32_t> &samples);
+
+} // namespace Protocol
+
+#endif // PROTOCOL_ENCODING_HPP
@@ -0,0 +1,155 @@
+#ifndef PROTOCOL_FRAGMENT_HPP
+#define PROTOCOL_FRAGMENT_HPP
+
+#include "Protocol.hpp"
+#include <bitset>
+#include <chrono>
+#include <limits>
+
+namespace Protocol {
+
+/* Types */
+struct FragmentHeader {
+  uint16_t frag_id;
+  uint16_t offset;
+  uint16_t total_len;
+  MsgType type;
+  ID id;
+};
+
+/* Constants */
+static constexpr std::size_t FRAGMENT_HEADER_LEN =
+    sizeof(FragmentHeader::frag_id) + sizeof(FragmentHeader::offset) +
+    sizeof(FragmentHeader::total_len) + sizeof(FragmentHeader::type) +
+    sizeof(uint8_t);
+// Every fragment but the last carries exactly this many data bytes, which lets
+// the receiver track arrival with a bitmap indexed by offset. Room is left for
+// the reliability link header so fragments fit with or without it.
+static constexpr std::size_t FRAGMENT_DATA_MAX =
+    Ethernet::Frame::PAYLOAD_LEN_MAX - Ethernet::Reliability::HEADER_LEN -
+    MSG_LEN_MIN - FRAGMENT_HEADER_LEN;
+static constexpr std::size_t FRAGMENT_COUNT_MAX =
+    (std::numeric_limits<uint16_t>::max() + FRAGMENT_DATA_MAX - 1) /
+    FRAGMENT_DATA_MAX;
+
+/* Helper functions */
+
+/* Sends a message, splitting it into FRAGMENT messages if it does not fit in a
+ * single Ethernet frame
+ * @param driver The driver to send with
+ * @param t The message type
+ * @param id The message id
+ * @param data The message data, up to 64 KiB
+ * @param frag_id The sender's fragment id counter, incremented when used
+ * @param corr The correlation id, carried in every fragment's message header
+ * @return none
+ */
+void sendMsg(Driver &driver, const MsgType t, const ID id,
+             std::span<const uint8_t> data, uint16_t &frag_id,
+             const CorrID corr = CorrID::NONE);
+
+/* Sends a message to a station on the driver's segment, splitting it into
+ * FRAGMENT messages if it does not fit in a single Ethernet frame
+ * @param driver The driver to send with
+ * @param dst The destination MAC address
+ * @param t The message type
+ * @param id The message id
+ * @param data The message data, up to 64 KiB
+ * @param frag_id The sender's fragment id counter
+ * @param corr The correlation id, carried in every fragment's message header
+ * @return none
+ */
+void sendMsg(Driver &driver, const MacAddr &dst, const MsgType t, const ID id,
+             std::span<const uint8_t> data, uint16_t &frag_id,
+             const CorrID corr = CorrID::NONE);
+
+/* Parses the fragment header at the front of a FRAGMENT message's data
+ * @param data The data of the FRAGMENT message
+ * @return The fragment header
+ */
+FragmentHeader unpackFragmentHeader(std::span<const uint8_t> data);
+
+/* Reassembles FRAGMENT messages back into the original message. Each pending
+ * message is a flow identified by its fragment id and owns a slot whose buffer
+ * is allocated once and reused for every later message in that slot.
+ */
+class Reassembler {
+public:
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+
+  struct Config {
+    // Maximum number of partially received messages at once
+    std::size_t max_pending{4};
+    // Largest message that will be accepted for reassembly
+    std::size_t max_msg_len{std::numeric_limits<uint16_t>::max()};
+    // How long a partial message may wait for its remaining fragments
+    Clock::duration timeout{std::chrono::milliseconds(500)};
+  };
+
+  struct Stats {
+    uint64_t completed{0};
+    uint64_t expired{0};
+    uint64_t dropped{0};
+  };
+
+  /* Alternate constructor
+   * @param config The slot count, size limit, and timeout to use
+   */
+  explicit Reassembler(const Config &config);
+
+  /* Default constructor
+   */
+  Reassembler();
+
+  /* Consumes a FRAGMENT message
+   * @param fragment The received FRAGMENT message
+   * @param output The reassembled message, only written when complete
+   * @param now The current time, used for fragment timeouts
+   * @return True if the fragment completed a message, False otherwise
+   */
+  bool push(const Msg &fragment, Msg &output,
+            const Clock::time_point now = Clock::now());
+
+  /* Discards any partial messages whose timeout has passed
+   * @param now The current time
+   * @return none
+   */
+  void expire(const Clock::time_point now = Clock::now());
+
+  /* Gets the number of partially received messages
+   * @return The number of slots in use
+   */
+  [[nodiscard]] std::size_t pending() const;
+
+  /* Gets the reassembly counters
+   * @return The reassembly counters
+   */
+  [[nodiscard]] const Stats &getStats() const;
+
+private:
+  struct Slot {
+    bool active{false};
+    FragmentHeader header{};
+    CorrID corr{CorrID::NONE};
+    std::size_t received{0};
+    Clock::time_point deadline{};
+    std::bitset<FRAGMENT_COUNT_MAX> chunks{};
+    std::vector<uint8_t> buffer{};
+  };
+
+  /* Finds the slot for a fragment, claiming a free one for a new message
+   * @return The slot, or nullptr if every slot is in use
+   */
+  Slot *claim(const FragmentHeader &header, const CorrID corr,
+              const Clock::time_point now);
+
+  /* Data */
+  Config config{};
+  std::vector<Slot> slots{};
+  Stats stats{};
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_FRAGMENT_HPP
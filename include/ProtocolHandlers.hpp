@@ -0,0 +1,137 @@
+#ifndef PROTOCOL_HANDLERS_HPP
+#define PROTOCOL_HANDLERS_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace Protocol {
+
+/* Table of message handlers indexed directly by a byte-wide id enum, so
+ * dispatch is a single array load and an indirect call with no lookup or
+ * virtual call. Handlers are either functions known at compile time, bound
+ * with bind<Handler>(id), or callables such as lambdas bound at startup with
+ * bind(id, callable). Ids without a handler go to the fallback.
+ *
+ * Each id owns the callable bound to it, so rebinding frees the one it
+ * replaces. A handler must therefore not rebind or unbind its own id while
+ * it runs.
+ */
+template <typename Id, typename... Args> class HandlerTable {
+  static_assert(sizeof(Id) == 1, "HandlerTable ids must be byte-wide");
+
+public:
+  /* Binds a function known at compile time to an id
+   * @tparam Handler The function to call, taking Args...
+   * @param id The id to handle
+   * @return none
+   */
+  template <auto Handler> void bind(const Id id) {
+    this->entries[index(id)] = Entry{&invokeStatic<Handler>, nullptr};
+    this->storage[index(id)].reset();
+  }
+
+  /* Binds a callable to an id. The callable is stored once here, so
+   * dispatching it never allocates, and replaces any the id had.
+   * @param id The id to handle
+   * @param callable The callable to call, taking Args...
+   * @return none
+   */
+  template <typename F> void bind(const Id id, F &&callable) {
+    this->entries[index(id)] =
+        store(std::forward<F>(callable), this->storage[index(id)]);
+  }
+
+  /* Binds a function known at compile time to every id without a handler
+   * @tparam Handler The function to call, taking Args...
+   * @return none
+   */
+  template <auto Handler> void fallback() {
+    this->fallback_entry = Entry{&invokeStatic<Handler>, nullptr};
+    this->fallback_storage.reset();
+  }
+
+  /* Binds a callable to every id without a handler
+   * @param callable The callable to call, taking Args...
+   * @return none
+   */
+  template <typename F> void fallback(F &&callable) {
+    this->fallback_entry = store(std::forward<F>(callable), this->fallback_storage);
+  }
+
+  /* Removes the handler for an id, so it goes to the fallback
+   * @param id The id to unbind
+   * @return none
+   */
+  void unbind(const Id id) {
+    this->entries[index(id)] = Entry{};
+    this->storage[index(id)].reset();
+  }
+
+  /* Checks whether an id has its own handler
+   * @param id The id to check
+   * @return True if a handler is bound, False otherwise
+   */
+  [[nodiscard]] bool contains(const Id id) const {
+    return this->entries[index(id)].fn != nullptr;
+  }
+
+  /* Calls the handler for an id, or the fallback if none is bound
+   * @param id The id to dispatch
+   * @param args The arguments to pass to the handler
+   * @return none
+   */
+  void operator()(const Id id, Args... args) const {
+    const Entry &entry = this->entries[index(id)];
+    const Entry &target = entry.fn ? entry : this->fallback_entry;
+    if (!target.fn) {
+      throw std::runtime_error("No handler bound for id");
+    }
+    target.fn(target.ctx, std::forward<Args>(args)...);
+  }
+
+private:
+  /* Types */
+  using Fn = void (*)(void *, Args...);
+  struct Entry {
+    Fn fn{nullptr};
+    void *ctx{nullptr};
+  };
+
+  static constexpr std::size_t index(const Id id) {
+    return static_cast<std::size_t>(static_cast<uint8_t>(id));
+  }
+
+  template <auto Handler> static void invokeStatic(void *, Args... args) {
+    Handler(std::forward<Args>(args)...);
+  }
+
+  template <typename F> static void invokeStored(void *ctx, Args... args) {
+    (*static_cast<F *>(ctx))(std::forward<Args>(args)...);
+  }
+
+  /* Moves a callable into a slot's storage, freeing what the slot held
+   */
+  template <typename F>
+  static Entry store(F &&callable, std::shared_ptr<void> &slot) {
+    using Stored = std::decay_t<F>;
+    auto owned = std::make_shared<Stored>(std::forward<F>(callable));
+    Entry entry{&invokeStored<Stored>, owned.get()};
+    slot = std::move(owned);
+    return entry;
+  }
+
+  /* Data */
+  std::array<Entry, 256> entries{};
+  Entry fallback_entry{};
+  // The callable each entry points into, if any
+  std::array<std::shared_ptr<void>, 256> storage{};
+  std::shared_ptr<void> fallback_storage{};
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_HANDLERS_HPP
@@ -3,28 +3,378 @@
 #define PROTOCOL_HOST_HPP
 
 #include "Protocol.hpp"
+#include "ProtocolAggregate.hpp"
+#include "ProtocolBatch.hpp"
+#include "ProtocolEncoding.hpp"
+#include "ProtocolFragment.hpp"
+#include "ProtocolHandlers.hpp"
+#include "ProtocolNeighbor.hpp"
+#include "ProtocolRequest.hpp"
+#include "ProtocolSink.hpp"
+#include "RuntimeScheduler.hpp"
+#include "RuntimeSimulation.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 
 namespace Protocol {
 
+/* Talks to one device over a linked driver, or to many devices over a
+ * shared segment. Each device the host hears from gets a neighbor cache entry
+ * and a session holding its reassembly and stream state. Commands without a
+ * destination go to the driver's peer.
+ *
+ * With more than one shard, each device is pinned to a shard thread. poll
+ * only receives frames and routes them, and the device's shard unpacks them
+ * and runs the handlers. Handlers then run concurrently for different
+ * devices, but never for the same device, so they must be thread-safe unless
+ * they only touch state of the device they are handling.
+ */
 class Host {
 public:
+  /* Types */
+  using ResponseTable = HandlerTable<CmdID, Host &, const MsgView &>;
+  using StreamTable = HandlerTable<StreamID, Host &, const MsgView &>;
+  using ErrorTable = HandlerTable<ErrorID, Host &, const MsgView &>;
+
+  struct Config {
+    RequestTable::Config requests{};
+    // Neighbor ageing, and the number of shard threads when above one
+    NeighborCache::Config neighbors{};
+  };
+
   Host() = delete;
-  ~Host() = default;
   Host(const Host&) = delete;
   Host& operator=(const Host&) = delete;
   explicit Host(Driver &driver);
 
-  bool poll();
+  /* Alternate constructor
+   * @param driver The driver to talk to the device with
+   * @param config The request timeout and timer wheel settings
+   */
+  Host(Driver &driver, const RequestTable::Config &config);
+
+  /* Alternate constructor, starts any shard threads
+   * @param driver The driver to talk to the devices with
+   * @param config The request, neighbor, and shard settings
+   */
+  Host(Driver &driver, const Config &config);
+
+  /* Stops the shard threads, dropping any frames they have not handled
+   */
+  ~Host();
+
+  /* Times out overdue requests, ages the neighbor cache, then handles at
+   * most one received frame. Replies to outstanding requests complete their
+   * futures, other messages go to the registered handlers. With shards, the
+   * frame is handed to its device's shard instead.
+   * @param now The current time
+   * @return True if a frame was received, False otherwise. Rethrows the
+   * first exception a shard's handler threw.
+   */
+  bool poll(const RequestTable::Clock::time_point now =
+                RequestTable::Clock::now());
+
+  /* Blocks until the shards have handled every frame poll gave them
+   * @return none, rethrows the first exception a shard's handler threw
+   */
+  void sync();
+
+  /* Broadcasts DISCOVER. Each device that answers is added to the neighbor
+   * cache when its Announce is polled.
+   * @return none
+   */
+  void discover();
+
+  /* Gets the devices the host has heard from. Only safe to call from the
+   * thread that polls.
+   * @return The neighbor cache
+   */
+  [[nodiscard]] const NeighborCache &getNeighbors() const;
+
+  /* Gets the device whose message the calling thread is handling
+   * @return The device's MAC address, only meaningful inside a handler
+   */
+  [[nodiscard]] MacAddr source() const;
+
+  /* Gets when the frame the calling thread is handling was received
+   * @return The receive time, only meaningful inside a handler
+   */
+  [[nodiscard]] RequestTable::Clock::time_point receivedAt() const;
+
+  /* Runs the host as a coroutine. It sleeps until a frame arrives or the
+   * next request timeout or neighbor sweep is due, and returns once the
+   * scheduler stops. A request that is due sooner than the task's wait wakes
+   * it, from any thread.
+   * @param scheduler The scheduler running the task, with this host's driver
+   * attached
+   * @return The task to spawn
+   */
+  Runtime::Task run(Runtime::Scheduler &scheduler);
+
+  /* Gets the host as a simulation endpoint. Each step handles every frame
+   * that has arrived and returns the next request timeout.
+   * @return The endpoint to spawn
+   */
+  Runtime::Simulation::Endpoint simulate();
+
+  /* Gets the earliest time an outstanding request can time out
+   * @return The deadline, or nothing if no request is outstanding
+   */
+  [[nodiscard]] std::optional<RequestTable::Clock::time_point>
+  nextDeadline() const;
+
   void sendCommand(const CmdID cmd_id, const std::vector<uint8_t>& data);
 
+  /* Sends a command to one device
+   * @param dst The device
+   * @param cmd_id The command to send
+   * @param data The command data
+   * @return none
+   */
+  void sendCommand(const MacAddr &dst, const CmdID cmd_id,
+                   const std::vector<uint8_t> &data);
+
+  /* Sends a command packed from a message schema
+   * @param cmd_id The command to send
+   * @param msg The command data
+   * @return none
+   */
+  template <FrameSchema T> void sendCommand(const CmdID cmd_id, const T &msg) {
+    this->sendCommand(this->driver.getPeerMacAddr(), cmd_id, msg);
+  }
+
+  /* Sends a command packed from a message schema to one device
+   * @param dst The device
+   * @param cmd_id The command to send
+   * @param msg The command data
+   * @return none
+   */
+  template <FrameSchema T>
+  void sendCommand(const MacAddr &dst, const CmdID cmd_id, const T &msg) {
+    const auto data = pack(msg);
+    this->sendCommandData(dst, cmd_id, data);
+  }
+
+  /* Sends a command carrying a correlation id and returns a future for its
+   * answer, so many commands can be outstanding at once. The future is
+   * completed by poll, so it must not be waited on without polling.
+   * @param cmd_id The command to send
+   * @param data The command data
+   * @param timeout How long to wait for an answer
+   * @return The RESPONSE, or CommandError or CommandTimeout through the future
+   */
+  std::future<Msg> request(const CmdID cmd_id, const std::vector<uint8_t> &data,
+                           const RequestTable::Clock::duration timeout);
+
+  /* Sends a command using the configured request timeout
+   * @param cmd_id The command to send
+   * @param data The command data
+   * @return The RESPONSE, or CommandError or CommandTimeout through the future
+   */
+  std::future<Msg> request(const CmdID cmd_id, const std::vector<uint8_t> &data);
+
+  /* Sends a command to one device and returns a future for its answer
+   * @param dst The device
+   * @param cmd_id The command to send
+   * @param data The command data
+   * @param timeout How long to wait for an answer
+   * @param now The current time, which the timeout counts from
+   * @return The RESPONSE, or CommandError or CommandTimeout through the future
+   */
+  std::future<Msg> request(const MacAddr &dst, const CmdID cmd_id,
+                           const std::vector<uint8_t> &data,
+                           const RequestTable::Clock::duration timeout,
+                           const RequestTable::Clock::time_point now =
+                               RequestTable::Clock::now());
+
+  /* Gets the request counters
+   * @return The request counters
+   */
+  [[nodiscard]] RequestTable::Stats getRequestStats() const;
+
+  /* Asks the device to send a stream with an encoding. Once the device
+   * accepts, the host decodes the stream's blocks and its handler still sees
+   * one 4-byte sample at a time. A refusal arrives as a BAD_PAYLOAD error.
+   * @param stream_id The stream
+   * @param encoding The encoding
+   * @return none
+   */
+  void setStreamEncoding(const StreamID stream_id, const Encoding encoding);
+
+  /* Asks one device to send a stream with an encoding
+   * @param dst The device
+   * @param stream_id The stream
+   * @param encoding The encoding
+   * @return none
+   */
+  void setStreamEncoding(const MacAddr &dst, const StreamID stream_id,
+                         const Encoding encoding);
+
+  /* Gets the encoding the device has accepted for a stream
+   * @param stream_id The stream
+   * @return The encoding, RAW until one is accepted
+   */
+  [[nodiscard]] Encoding getStreamEncoding(const StreamID stream_id) const;
+
+  /* Gets the encoding one device has accepted for a stream
+   * @param dst The device
+   * @param stream_id The stream
+   * @return The encoding, RAW until one is accepted
+   */
+  [[nodiscard]] Encoding getStreamEncoding(const MacAddr &dst,
+                                           const StreamID stream_id) const;
+
+  /* Sets where the default response, telemetry and error handlers deliver
+   * what they decode. The host does not own the sink, which must outlive it.
+   * @param sink The sink, stdoutSink() until set
+   * @return none
+   */
+  void setSink(Sink &sink);
+
+  /* Feeds an aggregator every sample of raw streams whose samples are a
+   * single uint32, such as telemetry, and of every encoded stream. The host
+   * does not own the aggregator, which must outlive it.
+   * @param aggregator The aggregator, none until set
+   * @return none
+   */
+  void setAggregator(Aggregator &aggregator);
+
+  /* Registers a response handler known at compile time for a command,
+   * replacing the default handler
+   * @tparam Handler Function taking (Host &, const MsgView &)
+   * @param cmd_id The command whose responses to handle
+   * @return none
+   */
+  template <auto Handler> void onResponse(const CmdID cmd_id) {
+    this->responses.template bind<Handler>(cmd_id);
+  }
+
+  /* Registers a response handler callable for a command
+   * @param cmd_id The command whose responses to handle
+   * @param handler Callable taking (Host &, const MsgView &)
+   * @return none
+   */
+  template <typename F> void onResponse(const CmdID cmd_id, F &&handler) {
+    this->responses.bind(cmd_id, std::forward<F>(handler));
+  }
+
+  /* Registers a stream handler known at compile time
+   * @tparam Handler Function taking (Host &, const MsgView &)
+   * @param stream_id The stream to handle
+   * @return none
+   */
+  template <auto Handler> void onStream(const StreamID stream_id) {
+    this->streams.template bind<Handler>(stream_id);
+  }
+
+  /* Registers a stream handler callable
+   * @param stream_id The stream to handle
+   * @param handler Callable taking (Host &, const MsgView &)
+   * @return none
+   */
+  template <typename F> void onStream(const StreamID stream_id, F &&handler) {
+    this->streams.bind(stream_id, std::forward<F>(handler));
+  }
+
+  /* Registers an error handler known at compile time
+   * @tparam Handler Function taking (Host &, const MsgView &)
+   * @param error_id The error to handle
+   * @return none
+   */
+  template <auto Handler> void onError(const ErrorID error_id) {
+    this->errors.template bind<Handler>(error_id);
+  }
+
+  /* Registers an error handler callable
+   * @param error_id The error to handle
+   * @param handler Callable taking (Host &, const MsgView &)
+   * @return none
+   */
+  template <typename F> void onError(const ErrorID error_id, F &&handler) {
+    this->errors.bind(error_id, std::forward<F>(handler));
+  }
+
 private:
+  // Per-device state, shared with in-flight shard work so an evicted device's
+  // last frames can still be handled
+  struct Session {
+    MacAddr mac{};
+    Reassembler reassembler{};
+    // Written by the shard handling the device, read by any thread
+    std::array<std::atomic<Encoding>, 256> encodings{};
+    std::vector<uint32_t> decoded{};
+    RequestTable::Clock::time_point received_at{};
+  };
+
+  struct Work {
+    std::shared_ptr<Session> session{};
+    std::vector<uint8_t> bytes{};
+    RequestTable::Clock::time_point received_at{};
+  };
+
+  struct Shard {
+    std::mutex mutex{};
+    std::condition_variable ready{};
+    std::condition_variable idle{};
+    std::deque<Work> inbox{};
+    bool busy{false};
+    bool stopping{false};
+    std::thread thread{};
+  };
+
+  /* Gets a device's session, creating it if needed
+   */
+  std::shared_ptr<Session> sessionFor(const MacAddr &mac);
+
+  /* Unpacks a received frame and dispatches the messages in it
+   */
+  void handle(Session &session, const std::vector<uint8_t> &bytes,
+              const RequestTable::Clock::time_point now);
+
+  void runShard(Shard &shard);
+  void rethrowShardError();
+  void sendCommandData(const MacAddr &dst, const CmdID cmd_id,
+                       std::span<const uint8_t> data);
+
   /* Handlers */
-  void handleResponse(const Msg& msg);
-  void handleStream(const Msg& msg);
-  void handleError(const Msg& msg);
+  void dispatch(Session &session, const MsgView &msg);
+  void dispatchBlock(Session &session, const MsgView &msg);
+  static void handleEncodingSet(Host &host, const MsgView &msg);
+  static void handleAnnounce(Host &host, const MsgView &msg);
+  static void handleResponse(Host& host, const MsgView& msg);
+  static void handleTelemetry(Host& host, const MsgView& msg);
+  static void handleUnknownStream(Host& host, const MsgView& msg);
+  static void handleError(Host& host, const MsgView& msg);
 
   /* Data */
   Driver& driver;
+  ResponseTable responses{};
+  StreamTable streams{};
+  ErrorTable errors{};
+  RequestTable requests;
+  mutable std::mutex requests_mutex{};
+  // When the run task wakes if nothing arrives, under requests_mutex, so a
+  // request due sooner knows to wake it
+  RequestTable::Clock::time_point waking_at{
+      RequestTable::Clock::time_point::max()};
+  Sink *sink{&stdoutSink()};
+  Aggregator *aggregator{nullptr};
+  // Handlers on different shards may send at once
+  std::mutex send_mutex{};
+  uint16_t frag_id{0};
+  NeighborCache neighbors;
+  std::vector<MacAddr> stale{};
+  std::vector<MacAddr> evicted{};
+  mutable std::mutex sessions_mutex{};
+  std::unordered_map<MacAddr, std::shared_ptr<Session>, Ethernet::MacAddrHash>
+      sessions{};
+  std::vector<std::unique_ptr<Shard>> shards{};
+  std::mutex error_mutex{};
+  std::exception_ptr shard_error{};
+  // Session being handled on this thread, for source() and built-in handlers
+  static thread_local Session *handling;
 };
 
 } // namespace Protocol
@@ -0,0 +1,104 @@
+#ifndef PROTOCOL_NEIGHBOR_HPP
+#define PROTOCOL_NEIGHBOR_HPP
+
+#include "Protocol.hpp"
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+
+namespace Protocol {
+
+/* Devices a Host has heard from, keyed by MAC address, in the manner of an
+ * ARP cache. Any frame from a device confirms its entry. An entry not
+ * confirmed for stale_after becomes STALE and is probed, and one not
+ * confirmed for evict_after is removed. Each device is also given the shard
+ * that handles its messages, the least loaded one when it is first seen.
+ */
+class NeighborCache {
+public:
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+
+  enum class State : uint8_t { REACHABLE, STALE };
+
+  struct Config {
+    Clock::duration stale_after{std::chrono::seconds(30)};
+    Clock::duration evict_after{std::chrono::seconds(60)};
+    // Shards devices are spread over
+    std::size_t shards{1};
+  };
+
+  struct Neighbor {
+    MacAddr mac{};
+    State state{State::REACHABLE};
+    Clock::time_point last_seen{};
+    std::size_t shard{0};
+  };
+
+  NeighborCache(const NeighborCache &) = delete;
+  NeighborCache &operator=(const NeighborCache &) = delete;
+
+  /* Alternate constructor
+   * @param config The ageing and sharding settings
+   */
+  explicit NeighborCache(const Config &config);
+
+  /* Default constructor
+   */
+  NeighborCache();
+
+  /* Records that a device was heard from, adding it if it is new
+   * @param mac The device
+   * @param now The current time
+   * @return The device's entry
+   */
+  const Neighbor &learn(const MacAddr &mac, const Clock::time_point now);
+
+  /* Looks up a device
+   * @param mac The device
+   * @return The entry, or nullptr if the device is unknown
+   */
+  [[nodiscard]] const Neighbor *find(const MacAddr &mac) const;
+
+  /* Ages the entries. Does nothing until a tenth of stale_after has passed
+   * since the last sweep, so it is cheap to call on every poll.
+   * @param now The current time
+   * @param stale Appended with the devices that just became STALE
+   * @param evicted Appended with the devices that were removed
+   * @return none
+   */
+  void expire(const Clock::time_point now, std::vector<MacAddr> &stale,
+              std::vector<MacAddr> &evicted);
+
+  /* Gets the time expire next sweeps the entries
+   * @return The time, or nothing if there are no entries to age
+   */
+  [[nodiscard]] std::optional<Clock::time_point> nextDeadline() const;
+
+  /* Gets the number of known devices
+   * @return The number of entries
+   */
+  [[nodiscard]] std::size_t size() const;
+
+  /* Gets the number of devices given to a shard
+   * @param shard The shard
+   * @return The number of entries
+   */
+  [[nodiscard]] std::size_t load(const std::size_t shard) const;
+
+  /* Gets every entry, ordered by MAC address
+   * @return The entries
+   */
+  [[nodiscard]] std::vector<Neighbor> entries() const;
+
+private:
+  /* Data */
+  Config config{};
+  std::unordered_map<MacAddr, Neighbor, Ethernet::MacAddrHash> neighbors{};
+  std::vector<std::size_t> loads{};
+  Clock::time_point next_sweep{};
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_NEIGHBOR_HPP
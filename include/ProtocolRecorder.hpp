@@ -0,0 +1,180 @@
+#ifndef PROTOCOL_RECORDER_HPP
+#define PROTOCOL_RECORDER_HPP
+
+#include "ProtocolSink.hpp"
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Protocol {
+
+/* Records decoded stream samples to disk for later analysis. Samples are
+ * copied into a bounded lock-free queue, the same way AsyncLogSink queues
+ * records, so recording never stalls Host::poll. A background flusher
+ * drains the queue into memory-mapped segment files.
+ *
+ * Each segment file is columnar: a header, then the timestamps, devices,
+ * values and stream ids each stored contiguously, so a reader scanning a
+ * time range only touches the pages of the time column until it finds a
+ * match. A segment is preallocated for a fixed number of samples and the
+ * flusher rotates to a new one when it fills. A small index file lists each
+ * segment's time span and sample count, so readers skip segments outside
+ * the range without opening them.
+ *
+ * Times are wall-clock, so recordings from different runs line up. Files
+ * are in host byte order.
+ */
+class Recorder : public Sink {
+public:
+  /* Types */
+  using Clock = std::chrono::system_clock;
+
+  struct Sample {
+    Clock::time_point time{};
+    MacAddr device{};
+    StreamID stream_id{StreamID::TELEMETRY};
+    uint32_t value{0};
+    friend bool operator==(const Sample &, const Sample &) = default;
+  };
+
+  struct Config {
+    // Directory for the segments and index, created if missing
+    std::string directory{};
+    // Samples per segment file before rotating
+    std::size_t segment_samples{std::size_t{1} << 20};
+    // Oldest segments are deleted beyond this many, 0 keeps every segment
+    std::size_t max_segments{0};
+    // Queue cells, rounded up to a power of two
+    std::size_t capacity{std::size_t{1} << 16};
+    // How long the flusher sleeps when the queue is empty
+    std::chrono::microseconds idle{200};
+  };
+
+  struct Stats {
+    uint64_t written{0};
+    uint64_t dropped{0};
+    uint64_t segments{0};
+  };
+
+  Recorder() = delete;
+  Recorder(const Recorder &) = delete;
+  Recorder &operator=(const Recorder &) = delete;
+
+  /* Alternate constructor, opens the recording and starts the flusher. An
+   * existing recording in the directory is appended to.
+   * @param config The directory, segment size and queue size
+   */
+  explicit Recorder(const Config &config);
+
+  /* Writes every queued sample, then stops the flusher
+   */
+  ~Recorder() override;
+
+  /* Queues a sample. Handlers of application streams call this directly.
+   * @param sample The sample
+   * @return False if the queue was full and the sample was dropped
+   */
+  bool append(const Sample &sample);
+
+  // Records telemetry samples, responses and errors are not recorded
+  void response(const ResponseRecord &record) override;
+  void telemetry(const TelemetryRecord &record) override;
+  void error(const ErrorRecord &record) override;
+
+  /* Blocks until every sample queued before the call is in its segment and
+   * the index covers it
+   * @return none, rethrows any error the flusher hit
+   */
+  void flush();
+
+  /* Gets the written, dropped and segment counters
+   * @return The counters
+   */
+  [[nodiscard]] Stats getStats() const;
+
+private:
+  class Writer;
+
+  struct Cell {
+    std::atomic<std::size_t> sequence{0};
+    Sample sample{};
+  };
+
+  /* Takes the oldest sample, only called by the flusher
+   * @return False if the queue was empty
+   */
+  bool pop(Sample &sample);
+
+  void run();
+
+  /* Data */
+  Config config;
+  // Maps the steady receive times the Host stamps onto the wall clock
+  std::chrono::nanoseconds steady_offset{};
+  std::vector<Cell> cells;
+  std::size_t mask{0};
+  alignas(64) std::atomic<std::size_t> enqueue_pos{0};
+  alignas(64) std::size_t dequeue_pos{0};
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> segments{0};
+  // Samples the flusher is done with, written or not
+  std::atomic<uint64_t> finished{0};
+  std::unique_ptr<Writer> writer;
+  std::mutex error_mutex{};
+  std::exception_ptr flush_error{};
+  std::atomic<bool> running{true};
+  std::thread thread{};
+};
+
+/* Reads a recording, including one a Recorder is still writing. Segments
+ * are memory-mapped, so only the pages a scan touches are read from disk.
+ */
+class Recording {
+public:
+  Recording() = delete;
+
+  /* Alternate constructor
+   * @param directory The Recorder's directory
+   */
+  explicit Recording(std::string directory);
+
+  /* Visits the samples in a time range, oldest segment first. Within a
+   * segment whose samples arrived in time order the range is found by
+   * binary search, otherwise the time column is scanned. A segment the
+   * recorder rotates out while the scan runs is skipped.
+   * @param from The first time included
+   * @param to The first time excluded
+   * @param visit Called with each sample in the range
+   * @return The number of samples visited, throws if a file is malformed
+   */
+  std::size_t scan(Recorder::Clock::time_point from,
+                   Recorder::Clock::time_point to,
+                   const std::function<void(const Recorder::Sample &)> &visit) const;
+
+  /* Collects the samples in a time range
+   * @param from The first time included
+   * @param to The first time excluded
+   * @return The samples
+   */
+  [[nodiscard]] std::vector<Recorder::Sample>
+  read(Recorder::Clock::time_point from, Recorder::Clock::time_point to) const;
+
+  /* Gets how many samples the recording holds
+   * @return The sample count over every segment
+   */
+  [[nodiscard]] std::size_t size() const;
+
+private:
+  std::string directory;
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_RECORDER_HPP
@@ -0,0 +1,162 @@
+#ifndef PROTOCOL_REQUEST_HPP
+#define PROTOCOL_REQUEST_HPP
+
+#include "Protocol.hpp"
+#include <chrono>
+#include <future>
+#include <optional>
+#include <stdexcept>
+
+namespace Protocol {
+
+/* Thrown through a request's future when the device answers with an error
+ */
+class CommandError : public std::runtime_error {
+public:
+  explicit CommandError(const ErrorID error_id);
+
+  ErrorID error_id;
+};
+
+/* Thrown through a request's future when no answer arrives in time
+ */
+class CommandTimeout : public std::runtime_error {
+public:
+  CommandTimeout();
+};
+
+/* Tracks outstanding commands by correlation id. The low byte of a
+ * correlation id is a slot index and the high byte the slot's generation, so
+ * a reply finds its request with one array access, and a late reply to a slot
+ * that has since been reused is recognised as stale. Timeouts are kept in a
+ * hashed timer wheel whose buckets are intrusive lists through the slots, so
+ * arming and cancelling a timeout never allocates or searches.
+ */
+class RequestTable {
+public:
+  /* Constants */
+  static constexpr std::size_t SLOT_COUNT = 256;
+
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+
+  struct Config {
+    // Timeout used when a request does not give its own
+    Clock::duration timeout{std::chrono::milliseconds(100)};
+    // Resolution of the timer wheel, timeouts fire up to one tick late
+    Clock::duration tick{std::chrono::milliseconds(1)};
+    // Number of buckets in the timer wheel
+    std::size_t wheel_len{256};
+  };
+
+  struct Stats {
+    uint64_t completed{0};
+    uint64_t failed{0};
+    uint64_t timed_out{0};
+    uint64_t stale{0};
+  };
+
+  RequestTable(const RequestTable &) = delete;
+  RequestTable &operator=(const RequestTable &) = delete;
+
+  /* Alternate constructor
+   * @param config The default timeout and timer wheel shape
+   */
+  explicit RequestTable(const Config &config);
+
+  /* Default constructor
+   */
+  RequestTable();
+
+  /* Claims a slot for a new request and arms its timeout
+   * @param promise Completed when the request is answered or times out
+   * @param now The current time
+   * @param timeout How long to wait for an answer
+   * @return The correlation id to send with the command
+   */
+  CorrID open(std::promise<Msg> &&promise, const Clock::time_point now,
+              const Clock::duration timeout);
+
+  /* Completes the request a reply belongs to. A RESPONSE fulfils the future
+   * and an ERROR fails it with CommandError.
+   * @param msg The received RESPONSE or ERROR
+   * @return True if the reply belonged to an outstanding request, False if it
+   * has no correlation id or its request already finished
+   */
+  bool complete(const MsgView &msg);
+
+  /* Abandons a request without completing its future, such as when the
+   * command could not be sent
+   * @param corr The correlation id returned by open
+   * @return none
+   */
+  void cancel(const CorrID corr);
+
+  /* Fails every request whose timeout has passed with CommandTimeout
+   * @param now The current time
+   * @return none
+   */
+  void expire(const Clock::time_point now);
+
+  /* Gets the number of requests waiting for an answer
+   * @return The number of slots in use
+   */
+  [[nodiscard]] std::size_t outstanding() const;
+
+  /* Gets the earliest time a request can time out, so the caller can sleep
+   * until then rather than polling every tick
+   * @return The deadline, or nothing if no request is outstanding
+   */
+  [[nodiscard]] std::optional<Clock::time_point> nextDeadline() const;
+
+  /* Gets the timeout and timer wheel settings
+   * @return The settings
+   */
+  [[nodiscard]] const Config &getConfig() const;
+
+  /* Gets the request counters
+   * @return The request counters
+   */
+  [[nodiscard]] const Stats &getStats() const;
+
+private:
+  /* Constants */
+  static constexpr uint16_t NIL = 0xffff;
+
+  struct Slot {
+    bool active{false};
+    uint8_t generation{1};
+    uint64_t deadline_tick{0};
+    uint16_t prev{NIL};
+    uint16_t next{NIL};
+    std::promise<Msg> promise{};
+  };
+
+  /* Finds the active slot a correlation id refers to
+   * @return The slot index, or NIL if the id is stale or invalid
+   */
+  uint16_t find(const CorrID corr) const;
+
+  /* Links a slot into the wheel bucket of its deadline
+   */
+  void arm(const uint16_t index);
+
+  /* Unlinks a slot from its wheel bucket and frees it
+   */
+  void release(const uint16_t index);
+
+  uint64_t tickOf(const Clock::time_point time) const;
+
+  /* Data */
+  Config config{};
+  Stats stats{};
+  Clock::time_point epoch{};
+  uint64_t current_tick{0};
+  std::vector<Slot> slots{};
+  std::vector<uint16_t> free_slots{};
+  std::vector<uint16_t> wheel{};
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_REQUEST_HPP
@@ -0,0 +1,247 @@
+#ifndef PROTOCOL_SCHEMA_HPP
+#define PROTOCOL_SCHEMA_HPP
+
+#include "EthernetReliable.hpp"
+#include "Protocol.hpp"
+#include <array>
+#include <bit>
+#include <concepts>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace Protocol {
+
+/* Lists the members of a message struct in wire order. A struct becomes a
+ * schema by naming its fields:
+ *
+ *   struct Voltage {
+ *     uint16_t millivolts;
+ *     int8_t trend;
+ *     using FIELDS = Fields<&Voltage::millivolts, &Voltage::trend>;
+ *   };
+ *
+ * Fields are written back to back, little-endian and without padding. They
+ * may be integers, enums, bool, float, double, std::array of those, or other
+ * schema structs.
+ */
+template <auto... Members> struct Fields {};
+
+/* Constants */
+// Largest schema that still fits one frame with the reliability header, so
+// typed messages are never fragmented
+static constexpr std::size_t SCHEMA_LEN_MAX = Ethernet::Frame::PAYLOAD_LEN_MAX -
+                                              Ethernet::Reliability::HEADER_LEN -
+                                              MSG_LEN_MIN;
+
+template <typename T> struct WireField;
+
+template <typename T>
+concept Schema = std::is_aggregate_v<T> && requires { typename T::FIELDS; };
+
+namespace Detail {
+
+template <typename T, typename List> struct SchemaLen;
+
+template <typename T, auto... Members>
+struct SchemaLen<T, Fields<Members...>> {
+  static constexpr std::size_t value =
+      (WireField<std::remove_cvref_t<decltype(std::declval<T &>().*Members)>>::LEN +
+       ... + 0);
+};
+
+} // namespace Detail
+
+/* Bytes a schema takes on the wire
+ */
+template <Schema T>
+inline constexpr std::size_t WIRE_LEN = Detail::SchemaLen<T, typename T::FIELDS>::value;
+
+/* Schemas small enough to send in a single frame. Packing a larger one does
+ * not compile.
+ */
+template <typename T>
+concept FrameSchema = Schema<T> && WIRE_LEN<T> <= SCHEMA_LEN_MAX;
+
+/* Per-type encoders. Every loop has a length fixed at compile time, so the
+ * compiler unrolls them into straight-line shifts and stores.
+ */
+template <std::integral T> struct WireField<T> {
+  static constexpr std::size_t LEN = sizeof(T);
+
+  static constexpr void put(const T value, uint8_t *out) {
+    using U = std::make_unsigned_t<T>;
+    const U bits = static_cast<U>(value);
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+      ((out[I] = static_cast<uint8_t>((bits >> (I * 8)) & 0xff)), ...);
+    }(std::make_index_sequence<LEN>{});
+  }
+
+  static constexpr T get(const uint8_t *in) {
+    using U = std::make_unsigned_t<T>;
+    return [&]<std::size_t... I>(std::index_sequence<I...>) {
+      return static_cast<T>(static_cast<U>(((static_cast<U>(in[I]) << (I * 8)) | ...)));
+    }(std::make_index_sequence<LEN>{});
+  }
+};
+
+template <> struct WireField<bool> {
+  static constexpr std::size_t LEN = 1;
+
+  static constexpr void put(const bool value, uint8_t *out) {
+    out[0] = static_cast<uint8_t>(value);
+  }
+
+  static constexpr bool get(const uint8_t *in) { return in[0] != 0; }
+};
+
+template <typename T>
+  requires std::is_enum_v<T>
+struct WireField<T> {
+  using Underlying = std::underlying_type_t<T>;
+  static constexpr std::size_t LEN = sizeof(Underlying);
+
+  static constexpr void put(const T value, uint8_t *out) {
+    WireField<Underlying>::put(static_cast<Underlying>(value), out);
+  }
+
+  static constexpr T get(const uint8_t *in) {
+    return static_cast<T>(WireField<Underlying>::get(in));
+  }
+};
+
+template <std::floating_point T> struct WireField<T> {
+  static_assert(sizeof(T) == 4 || sizeof(T) == 8, "Unsupported float width");
+  using Bits = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+  static constexpr std::size_t LEN = sizeof(T);
+
+  static constexpr void put(const T value, uint8_t *out) {
+    WireField<Bits>::put(std::bit_cast<Bits>(value), out);
+  }
+
+  static constexpr T get(const uint8_t *in) {
+    return std::bit_cast<T>(WireField<Bits>::get(in));
+  }
+};
+
+template <typename T, std::size_t N> struct WireField<std::array<T, N>> {
+  static constexpr std::size_t LEN = N * WireField<T>::LEN;
+
+  static constexpr void put(const std::array<T, N> &value, uint8_t *out) {
+    for (std::size_t i = 0; i < N; ++i) {
+      WireField<T>::put(value[i], out + i * WireField<T>::LEN);
+    }
+  }
+
+  static constexpr std::array<T, N> get(const uint8_t *in) {
+    std::array<T, N> value{};
+    for (std::size_t i = 0; i < N; ++i) {
+      value[i] = WireField<T>::get(in + i * WireField<T>::LEN);
+    }
+    return value;
+  }
+};
+
+template <Schema T> struct WireField<T> {
+  static constexpr std::size_t LEN = WIRE_LEN<T>;
+
+  static constexpr void put(const T &value, uint8_t *out) {
+    putAll(value, out, typename T::FIELDS{});
+  }
+
+  static constexpr T get(const uint8_t *in) {
+    T value{};
+    getAll(value, in, typename T::FIELDS{});
+    return value;
+  }
+
+private:
+  template <auto... Members>
+  static constexpr void putAll(const T &value, uint8_t *out, Fields<Members...>) {
+    std::size_t offset = 0;
+    (putField(value.*Members, out, offset), ...);
+  }
+
+  template <auto... Members>
+  static constexpr void getAll(T &value, const uint8_t *in, Fields<Members...>) {
+    std::size_t offset = 0;
+    (getField(value.*Members, in, offset), ...);
+  }
+
+  template <typename F>
+  static constexpr void putField(const F &field, uint8_t *out,
+                                  std::size_t &offset) {
+    WireField<F>::put(field, out + offset);
+    offset += WireField<F>::LEN;
+  }
+
+  template <typename F>
+  static constexpr void getField(F &field, const uint8_t *in,
+                                  std::size_t &offset) {
+    field = WireField<F>::get(in + offset);
+    offset += WireField<F>::LEN;
+  }
+};
+
+/* Helper functions */
+
+/* Packs a message into a caller provided buffer
+ * @param value The message
+ * @param out The buffer, exactly WIRE_LEN<T> bytes
+ * @return none
+ */
+template <FrameSchema T>
+constexpr void packInto(const T &value, std::span<uint8_t, WIRE_LEN<T>> out) {
+  WireField<T>::put(value, out.data());
+}
+
+/* Packs a message
+ * @param value The message
+ * @return The message data
+ */
+template <FrameSchema T>
+constexpr std::array<uint8_t, WIRE_LEN<T>> pack(const T &value) {
+  std::array<uint8_t, WIRE_LEN<T>> out{};
+  packInto(value, std::span<uint8_t, WIRE_LEN<T>>(out));
+  return out;
+}
+
+/* Unpacks a message. Enum fields are not range checked.
+ * @param data The message data
+ * @return The message, throws if data is not WIRE_LEN<T> bytes
+ */
+template <FrameSchema T> constexpr T unpack(std::span<const uint8_t> data) {
+  if (data.size() != WIRE_LEN<T>) {
+    throw std::runtime_error("Message data does not match its schema");
+  }
+  return WireField<T>::get(data.data());
+}
+
+/* Adapts a handler taking a typed message to the (endpoint, MsgView) handler
+ * signature, unpacking the message before the call
+ * @tparam T The schema of the message data
+ * @param handler Callable taking (Host & or Device &, const T &)
+ * @return The handler to register
+ */
+template <FrameSchema T, typename F> auto typed(F &&handler) {
+  return [handler = std::forward<F>(handler)](auto &endpoint, const MsgView &msg) {
+    handler(endpoint, unpack<T>(msg.data));
+  };
+}
+
+/* Built-in messages */
+// Data of the TELEMETRY stream
+struct TelemetrySample {
+  uint32_t count;
+  using FIELDS = Fields<&TelemetrySample::count>;
+};
+
+// Response to DISCOVER, carrying the device's MAC address as an ARP reply does
+struct Announce {
+  MacAddr mac;
+  using FIELDS = Fields<&Announce::mac>;
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_SCHEMA_HPP
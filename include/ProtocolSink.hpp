@@ -0,0 +1,167 @@
+#ifndef PROTOCOL_SINK_HPP
+#define PROTOCOL_SINK_HPP
+
+#include "Protocol.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace Protocol {
+
+/* Types */
+struct ResponseRecord {
+  CmdID cmd_id;
+  CorrID corr;
+  std::span<const uint8_t> data;
+};
+
+struct TelemetryRecord {
+  uint32_t count;
+  StreamID stream_id{StreamID::TELEMETRY};
+  MacAddr device{};
+  std::chrono::steady_clock::time_point received_at{};
+};
+
+struct ErrorRecord {
+  ErrorID error_id;
+  CorrID corr;
+};
+
+/* Receives the typed messages the Host's default handlers decode. The data
+ * of a ResponseRecord is only valid during the call.
+ */
+class Sink {
+public:
+  virtual ~Sink() = default;
+  virtual void response(const ResponseRecord &record) = 0;
+  virtual void telemetry(const TelemetryRecord &record) = 0;
+  virtual void error(const ErrorRecord &record) = 0;
+};
+
+/* Writes each record to a stdio stream as it arrives, on the caller's
+ * thread. This is the Host's default sink.
+ */
+class StdioSink : public Sink {
+public:
+  /* Alternate constructor
+   * @param out The stream to write to
+   */
+  explicit StdioSink(std::FILE *out = stdout);
+
+  void response(const ResponseRecord &record) override;
+  void telemetry(const TelemetryRecord &record) override;
+  void error(const ErrorRecord &record) override;
+
+private:
+  std::FILE *out{nullptr};
+};
+
+/* Gets the process-wide stdout sink Hosts use until given another
+ * @return The sink
+ */
+Sink &stdoutSink();
+
+/* Copies records into a bounded lock-free queue and formats them on a
+ * background thread, so the receive path never waits on stdio. Producers
+ * only claim a queue cell with a compare-and-swap, and a record that finds
+ * the queue full is dropped and counted rather than blocking.
+ */
+class AsyncLogSink : public Sink {
+public:
+  /* Constants */
+  // Response bytes kept per record, longer responses are truncated
+  static constexpr std::size_t DATA_MAX = 48;
+
+  /* Types */
+  struct Config {
+    // Queue cells, rounded up to a power of two
+    std::size_t capacity{4096};
+    // Stream the background thread writes to
+    std::FILE *out{stdout};
+    // How long the background thread sleeps when the queue is empty
+    std::chrono::microseconds idle{200};
+  };
+
+  struct Stats {
+    uint64_t written{0};
+    uint64_t dropped{0};
+  };
+
+  AsyncLogSink(const AsyncLogSink &) = delete;
+  AsyncLogSink &operator=(const AsyncLogSink &) = delete;
+
+  /* Alternate constructor, starts the background thread
+   * @param config The queue size and output stream
+   */
+  explicit AsyncLogSink(const Config &config);
+
+  /* Default constructor
+   */
+  AsyncLogSink();
+
+  /* Writes every queued record, then stops the background thread
+   */
+  ~AsyncLogSink() override;
+
+  void response(const ResponseRecord &record) override;
+  void telemetry(const TelemetryRecord &record) override;
+  void error(const ErrorRecord &record) override;
+
+  /* Blocks until every record queued before the call has been written
+   * @return none
+   */
+  void flush();
+
+  /* Gets the written and dropped counters
+   * @return The counters
+   */
+  [[nodiscard]] Stats getStats() const;
+
+private:
+  enum class Kind : uint8_t { RESPONSE, TELEMETRY, ERROR };
+
+  struct Record {
+    Kind kind{Kind::RESPONSE};
+    uint8_t id{0};
+    CorrID corr{CorrID::NONE};
+    uint16_t len{0};
+    uint32_t count{0};
+    std::array<uint8_t, DATA_MAX> data{};
+  };
+
+  struct Cell {
+    std::atomic<std::size_t> sequence{0};
+    Record record{};
+  };
+
+  /* Claims a cell and copies a record into it
+   * @return False if the queue was full
+   */
+  bool push(const Record &record);
+
+  /* Takes the oldest record, only called by the background thread
+   * @return False if the queue was empty
+   */
+  bool pop(Record &record);
+
+  void write(const Record &record);
+  void run();
+
+  /* Data */
+  Config config{};
+  std::vector<Cell> cells;
+  std::size_t mask{0};
+  alignas(64) std::atomic<std::size_t> enqueue_pos{0};
+  alignas(64) std::size_t dequeue_pos{0};
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> running{true};
+  std::thread thread{};
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_SINK_HPP
@@ -0,0 +1,110 @@
+#ifndef PROTOCOL_STREAM_HPP
+#define PROTOCOL_STREAM_HPP
+
+#include "Protocol.hpp"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+
+namespace Protocol {
+
+/* Schedules stream samples by deadline. Each stream has a token bucket that
+ * fills at its configured rate, so the sample rate is set by the clock rather
+ * than by how often the owner polls. A late poll sends at most a bucket's
+ * worth of samples to catch up.
+ */
+class StreamScheduler {
+public:
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+
+  // Writes sample number index of a stream into sample
+  using Producer = std::function<void(uint32_t index, std::vector<uint8_t> &sample)>;
+
+  // Sends one produced sample
+  using Emitter = std::function<void(StreamID id, const std::vector<uint8_t> &sample)>;
+
+  struct StreamConfig {
+    StreamID id{StreamID::TELEMETRY};
+    // Samples per second the bucket fills at
+    double rate_hz{1000.0};
+    // Bucket depth in samples, the most that can be sent after a stall
+    uint32_t burst{1};
+    // Samples sent together each time the stream is due
+    uint32_t batch{1};
+    // Streams due at the same poll are served highest priority first
+    uint8_t priority{0};
+    Producer producer{};
+  };
+
+  /* Adds or replaces a stream. Streams start disabled.
+   * @param config The rate, batching, priority, and sample producer
+   * @param now The current time, restarts a replaced stream that was running
+   * @return none
+   */
+  void add(const StreamConfig &config, const Clock::time_point now = Clock::now());
+
+  /* Enables or disables a stream. Enabling starts it with one batch of tokens
+   * so the first samples go out on the next poll.
+   * @param id The stream
+   * @param enable True to start sending, False to stop
+   * @param now The current time
+   * @return True if the stream exists, False otherwise
+   */
+  bool enable(const StreamID id, const bool enable,
+              const Clock::time_point now = Clock::now());
+
+  /* Checks whether a stream has been added
+   * @param id The stream
+   * @return True if the stream exists
+   */
+  [[nodiscard]] bool contains(const StreamID id) const;
+
+  /* Checks whether a stream is enabled
+   * @param id The stream
+   * @return True if the stream exists and is enabled
+   */
+  [[nodiscard]] bool isEnabled(const StreamID id) const;
+
+  /* Sends every sample that is due
+   * @param emit Called once per sample
+   * @param now The current time
+   * @return The number of samples sent
+   */
+  std::size_t poll(const Emitter &emit, const Clock::time_point now = Clock::now());
+
+  /* Gets the earliest time any enabled stream is due
+   * @return The deadline, or nothing if no stream is enabled
+   */
+  [[nodiscard]] std::optional<Clock::time_point> nextDeadline() const;
+
+private:
+  struct Stream {
+    StreamConfig config{};
+    bool enabled{false};
+    double tokens{0.0};
+    uint32_t index{0};
+    Clock::time_point refilled{};
+    Clock::time_point deadline{};
+  };
+
+  /* Adds the tokens earned since the last refill, capped at the bucket depth
+   */
+  static void refill(Stream &stream, const Clock::time_point now);
+
+  /* Sets the time the stream will next hold a full batch of tokens
+   */
+  static void schedule(Stream &stream, const Clock::time_point now);
+
+  /* Data */
+  // Indexed by StreamID, so a device may run any of the 256 stream ids
+  std::vector<std::unique_ptr<Stream>> streams{};
+  std::vector<Stream *> enabled{};
+  std::vector<uint8_t> scratch{};
+  std::vector<Stream *> due{};
+};
+
+} // namespace Protocol
+
+#endif // PROTOCOL_STREAM_HPP
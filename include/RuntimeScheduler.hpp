@@ -0,0 +1,218 @@
+#ifndef RUNTIME_SCHEDULER_HPP
+#define RUNTIME_SCHEDULER_HPP
+
+#include "EthernetDriver.hpp"
+#include "RuntimeTask.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+
+namespace Runtime {
+
+/* Runs endpoint coroutines on a small pool of threads. Each thread has its
+ * own run queue, and an idle thread takes work from the others before
+ * sleeping. Coroutines suspend on timers and on driver receive notifications
+ * instead of occupying a thread in a sleep loop, so one process can host far
+ * more endpoints than it has threads.
+ */
+class Scheduler {
+public:
+  /* Types */
+  using Clock = std::chrono::steady_clock;
+  using Driver = Ethernet::Driver;
+
+  /* Awaitable returned by sleepUntil and readable. It resumes the coroutine
+   * once the first of its conditions holds, or when the scheduler stops.
+   */
+  class Wait {
+  public:
+    Wait(const Wait &) = delete;
+    Wait &operator=(const Wait &) = delete;
+
+    bool await_ready() const;
+    bool await_suspend(std::coroutine_handle<> handle);
+    void await_resume();
+
+  private:
+    friend class Scheduler;
+
+    /* A driver's receive notification. A frame that arrives with no
+     * coroutine waiting is remembered, so a wait that starts just after does
+     * not sleep through it.
+     */
+    struct RxEvent {
+      static void notify(void *ctx);
+
+      std::mutex mutex{};
+      Driver *driver{nullptr};
+      Wait *waiter{nullptr};
+      bool signaled{false};
+    };
+
+    enum State : int { ARMING, WAITING, FIRED };
+    static constexpr std::size_t NOT_ARMED = static_cast<std::size_t>(-1);
+
+    Wait(Scheduler &scheduler, RxEvent *event, const Clock::time_point deadline);
+
+    /* Resumes the coroutine unless another condition already did. Called
+     * with the lock of the timer or event that fired held.
+     */
+    void fire();
+
+    /* Removes the wait from the timers and its driver event
+     */
+    void disarm();
+
+    Scheduler &scheduler;
+    RxEvent *event{nullptr};
+    Clock::time_point deadline{Clock::time_point::max()};
+    std::coroutine_handle<> handle{};
+    std::atomic<int> state{ARMING};
+    std::size_t heap_index{NOT_ARMED};
+  };
+
+  struct Config {
+    // Number of worker threads
+    std::size_t threads{1};
+    // Pins each worker to one of the CPUs the process may run on, in turn
+    bool pin{false};
+  };
+
+  Scheduler() = delete;
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  /* Alternate constructor, starts the worker threads
+   * @param threads The number of worker threads
+   */
+  explicit Scheduler(const std::size_t threads);
+
+  /* Alternate constructor, starts and optionally pins the worker threads
+   * @param config The worker count and pinning
+   */
+  explicit Scheduler(const Config &config);
+
+  /* Stops the scheduler, discarding any exception from a task
+   */
+  ~Scheduler();
+
+  /* Hooks a driver's receive notification so coroutines can wait on it with
+   * readable. Must be called before the driver's peer starts sending.
+   * @param driver The driver to watch
+   * @return none
+   */
+  void attach(Driver &driver);
+
+  /* Starts running a task
+   * @param task The coroutine to run, the scheduler takes ownership
+   * @return none
+   */
+  void spawn(Task &&task);
+
+  /* Asks every task to finish, wakes all waits, and blocks until every task
+   * has returned and the workers have exited
+   * @return none, rethrows the first exception that escaped a task
+   */
+  void stop();
+
+  /* Checks whether stop has been called. Task loops should exit once it has.
+   * @return True if the scheduler is stopping
+   */
+  [[nodiscard]] bool stopping() const;
+
+  /* Gets the number of worker threads
+   * @return The number of workers
+   */
+  [[nodiscard]] std::size_t size() const;
+
+  /* Suspends the calling coroutine until a time
+   * @param deadline The time to resume at
+   * @return The awaitable
+   */
+  [[nodiscard]] Wait sleepUntil(const Clock::time_point deadline);
+
+  /* Suspends the calling coroutine until an attached driver has a frame to
+   * receive, or a deadline passes. Wakes can be spurious, such as for a frame
+   * consumed by the reliability layer, so callers recheck the driver. Only
+   * one coroutine may wait on a driver at a time.
+   * @param driver The attached driver
+   * @param deadline The latest time to resume at
+   * @return The awaitable
+   */
+  [[nodiscard]] Wait readable(Driver &driver,
+                              const Clock::time_point deadline =
+                                  Clock::time_point::max());
+
+private:
+  friend struct Task::promise_type;
+
+  struct Worker {
+    std::mutex mutex{};
+    std::deque<std::coroutine_handle<>> queue{};
+    std::thread thread{};
+  };
+
+  /* Queues a coroutine to resume, on the calling worker's own queue when
+   * called from a worker
+   */
+  void schedule(std::coroutine_handle<> handle);
+
+  /* Takes a coroutine from a worker's own queue, or from another's
+   */
+  std::coroutine_handle<> take(const std::size_t index);
+
+  /* Fires every timer whose deadline has passed
+   * @return The earliest remaining deadline
+   */
+  Clock::time_point fireTimers(const Clock::time_point now);
+
+  /* Tells workers that work was queued or timers changed, waking one
+   * sleeping worker, or all of them
+   */
+  void wake(const bool all);
+
+  /* Records a finished task and its exception, if any
+   */
+  void finished(std::exception_ptr exception);
+
+  /* Stops and joins the workers
+   */
+  void shutdown();
+
+  /* Binds each worker thread to a CPU
+   */
+  void pin();
+
+  void run(const std::size_t index);
+
+  // Indexed min-heap of timed waits, so a wait that resumes for another
+  // reason can remove its timer directly
+  void heapPush(Wait *wait);
+  void heapRemove(Wait *wait);
+  void heapSwap(const std::size_t a, const std::size_t b);
+  void heapUp(std::size_t index);
+  void heapDown(std::size_t index);
+
+  /* Data */
+  std::vector<std::unique_ptr<Worker>> workers{};
+  std::atomic<std::size_t> next_worker{0};
+  std::atomic<bool> stop_requested{false};
+  std::atomic<std::size_t> live_tasks{0};
+  // Bumped whenever work is queued, so a worker about to sleep sees it
+  std::atomic<uint64_t> epoch{0};
+  std::atomic<std::size_t> sleepers{0};
+  std::mutex idle_mutex{};
+  std::condition_variable idle{};
+  std::mutex timer_mutex{};
+  std::vector<Wait *> timers{};
+  std::unordered_map<Driver *, std::unique_ptr<Wait::RxEvent>> events{};
+  std::mutex exception_mutex{};
+  std::exception_ptr exception{};
+};
+
+} // namespace Runtime
+
+#endif // RUNTIME_SCHEDULER_HPP
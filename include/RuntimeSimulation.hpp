@@ -0,0 +1,212 @@
+#ifndef RUNTIME_SIMULATION_HPP
+#define RUNTIME_SIMULATION_HPP
+
+#include "EthernetDriver.hpp"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+
+namespace Runtime {
+
+/* Discrete-event simulation on a virtual clock. Events run in time order
+ * from a binary heap, and time jumps straight to the next event, so a
+ * simulated second costs only the work done in it and every run with the
+ * same inputs gives the same result.
+ *
+ * Endpoints are spawned as processes that the simulation steps when a frame
+ * reaches their driver and at the deadline each step returns. Drivers are
+ * connected with simulated wires that deliver frames after a latency. Like a
+ * Segment, the simulation must outlive the drivers connected to it.
+ *
+ * With more than one partition, the topology is split across threads and run
+ * conservatively: every partition runs the events before the earliest
+ * pending event plus the lookahead, then they all synchronise. Wires between
+ * partitions must be at least the lookahead long, so no frame can arrive
+ * inside a window another partition is still running.
+ */
+class Simulation {
+public:
+  /* Types */
+  // Time points are virtual, counted from the clock's epoch
+  using Clock = std::chrono::steady_clock;
+  using Driver = Ethernet::Driver;
+  using Event = std::function<void()>;
+
+  // An endpoint as the simulation sees it. step handles everything that is
+  // due at the time it is given, and returns when it next needs to run
+  // without a frame arriving.
+  struct Endpoint {
+    Driver *driver{nullptr};
+    std::function<std::optional<Clock::time_point>(Clock::time_point)> step{};
+  };
+
+  struct Config {
+    // Threads the topology is split across
+    std::size_t partitions{1};
+    // Shortest wire between partitions, and so the length of each window
+    Clock::duration lookahead{Clock::duration::zero()};
+  };
+
+  struct Stats {
+    uint64_t events{0};
+    uint64_t windows{0};
+  };
+
+  Simulation(const Simulation &) = delete;
+  Simulation &operator=(const Simulation &) = delete;
+
+  /* Alternate constructor
+   * @param config The partitioning
+   */
+  explicit Simulation(const Config &config);
+
+  /* Default constructor, runs on the calling thread only
+   */
+  Simulation();
+
+  ~Simulation();
+
+  /* Gets the virtual time. Inside an event it is the event's time.
+   * @return The virtual time
+   */
+  [[nodiscard]] Clock::time_point now() const;
+
+  /* Schedules an event on the calling event's partition, or on partition 0
+   * outside of run
+   * @param time When to run it, not before now
+   * @param event The event
+   * @return none
+   */
+  void at(const Clock::time_point time, Event event);
+
+  /* Schedules an event on a partition
+   * @param partition The partition
+   * @param time When to run it, not before the partition's time
+   * @param event The event
+   * @return none, throws if an event for another partition is inside the
+   * current window
+   */
+  void at(const std::size_t partition, const Clock::time_point time,
+          Event event);
+
+  /* Schedules an event a delay from now
+   * @param delay How long from now
+   * @param event The event
+   * @return none
+   */
+  void after(const Clock::duration delay, Event event);
+
+  /* Connects two drivers with a simulated wire, in place of Driver::link.
+   * Each frame arrives after the latency, plus its serialisation time if a
+   * bit rate is given, queued behind earlier frames in the same direction.
+   * @param a The 1st driver
+   * @param b The 2nd driver
+   * @param latency The propagation delay
+   * @param bits_per_second The wire's bit rate, 0 for unlimited
+   * @return none
+   */
+  void link(Driver &a, Driver &b, const Clock::duration latency,
+            const double bits_per_second = 0.0);
+
+  /* Starts stepping an endpoint, first at the current time. Its driver's
+   * frames are delivered on the endpoint's partition.
+   * @param endpoint The endpoint, such as from Device::simulate
+   * @param partition The partition to run it on
+   * @return none
+   */
+  void spawn(Endpoint &&endpoint, const std::size_t partition = 0);
+
+  /* Runs events in time order until none are left at or before a time, then
+   * moves the clock to it
+   * @param until The time to stop at
+   * @return none, rethrows the first exception an event threw
+   */
+  void run(const Clock::time_point until);
+
+  /* Runs until no events are left
+   * @return none, rethrows the first exception an event threw
+   */
+  void run();
+
+  /* Gets the event counters
+   * @return The events run, and the windows the partitions synchronised at
+   */
+  [[nodiscard]] Stats getStats() const;
+
+private:
+  // Events are ordered by time, then by the partition and order they were
+  // scheduled in, which does not depend on how threads interleave
+  struct Scheduled {
+    Clock::time_point time{};
+    std::size_t origin{0};
+    uint64_t order{0};
+    Event event{};
+  };
+
+  struct Partition {
+    std::vector<Scheduled> events{};
+    Clock::time_point now{};
+    uint64_t next_order{0};
+    uint64_t processed{0};
+    std::mutex inbox_mutex{};
+    std::vector<Scheduled> inbox{};
+  };
+
+  struct Process {
+    Simulation *simulation{nullptr};
+    Endpoint endpoint{};
+    std::size_t partition{0};
+    bool wake_queued{false};
+    std::optional<Clock::time_point> armed{};
+    uint64_t generation{0};
+  };
+
+  class Wire;
+
+  static bool later(const Scheduled &a, const Scheduled &b);
+  static void notify(void *ctx);
+
+  /* Queues a step of a process at the partition's current time
+   */
+  void wake(Process &process);
+
+  /* Steps a process and arms its next deadline
+   */
+  void step(Process &process);
+
+  /* Gets the partition a driver's frames are delivered on
+   */
+  std::size_t partitionOf(const Driver &driver) const;
+
+  /* Runs a partition's events before a time
+   */
+  void drain(Partition &partition, const Clock::time_point end);
+
+  /* Moves every inbox into its partition's event list
+   * @return The earliest pending event, max if there is none
+   */
+  Clock::time_point merge();
+
+  void fail(std::exception_ptr exception);
+
+  /* Data */
+  Config config{};
+  std::vector<std::unique_ptr<Partition>> partitions{};
+  std::deque<std::unique_ptr<Process>> processes{};
+  std::deque<std::unique_ptr<Wire>> wires{};
+  std::unordered_map<const Driver *, std::size_t> driver_partitions{};
+  Clock::time_point clock{};
+  // End of the window the partitions are running, events for other
+  // partitions must be later
+  Clock::time_point window_end{Clock::time_point::max()};
+  bool parallel{false};
+  uint64_t windows{0};
+  std::mutex error_mutex{};
+  std::exception_ptr error{};
+};
+
+} // namespace Runtime
+
+#endif // RUNTIME_SIMULATION_HPP
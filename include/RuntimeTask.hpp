@@ -0,0 +1,110 @@
+#ifndef RUNTIME_TASK_HPP
+#define RUNTIME_TASK_HPP
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <utility>
+
+namespace Runtime {
+
+class Scheduler;
+
+/* Allocates coroutine frames from per-thread free lists of fixed size
+ * classes, so spawning and finishing endpoint tasks does not go to the
+ * global heap once a thread has warmed up. A frame freed on another thread
+ * joins that thread's lists.
+ */
+class FramePool {
+public:
+  /* Constants */
+  static constexpr std::size_t CLASS_SIZE = 64;
+  static constexpr std::size_t CLASS_COUNT = 32;
+  // Frames kept per size class and thread, the rest go back to the heap
+  static constexpr std::size_t CACHE_MAX = 4096;
+
+  /* Allocates a frame
+   * @param size The frame size requested by the compiler
+   * @return The frame memory
+   */
+  static void *allocate(const std::size_t size);
+
+  /* Returns a frame to the calling thread's free list
+   * @param frame The frame memory from allocate
+   * @param size The same size passed to allocate
+   * @return none
+   */
+  static void deallocate(void *frame, const std::size_t size) noexcept;
+
+  /* Gets the number of frames cached by the calling thread
+   * @return The number of cached frames
+   */
+  [[nodiscard]] static std::size_t cached();
+};
+
+/* A detached endpoint coroutine. It starts suspended and runs once it is
+ * handed to Scheduler::spawn, after which the scheduler owns it. The frame is
+ * freed when the coroutine finishes. An exception escaping the coroutine is
+ * rethrown from Scheduler::stop.
+ */
+class Task {
+public:
+  struct promise_type {
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept {
+      this->exception = std::current_exception();
+    }
+
+    static void *operator new(const std::size_t size) {
+      return FramePool::allocate(size);
+    }
+    static void operator delete(void *frame, const std::size_t size) noexcept {
+      FramePool::deallocate(frame, size);
+    }
+
+    // Tells the scheduler the task has finished, as the frame is destroyed
+    ~promise_type();
+
+    Scheduler *scheduler{nullptr};
+    std::exception_ptr exception{};
+  };
+
+  Task() = delete;
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  Task(Task &&other) noexcept
+      : handle(std::exchange(other.handle, nullptr)) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (this->handle) {
+        this->handle.destroy();
+      }
+      this->handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+
+  /* Destroys the coroutine if it was never spawned
+   */
+  ~Task() {
+    if (this->handle) {
+      this->handle.destroy();
+    }
+  }
+
+private:
+  friend class Scheduler;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle{};
+};
+
+} // namespace Runtime
+
+#endif // RUNTIME_TASK_HPP
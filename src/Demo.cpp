@@ -1,12 +1,43 @@
 #include "ProtocolDevice.hpp"
 #include "ProtocolHost.hpp"
-#include <atomic>
+#include "RuntimeScheduler.hpp"
 #include <chrono>
 #include <cstdio>
-#include <thread>
+#include <future>
 
 using namespace Ethernet;
 using namespace Protocol;
+using namespace std::chrono_literals;
+using Runtime::Scheduler;
+using Runtime::Task;
+
+/* Sends each command, then handles whatever arrives for a while. The host
+ * sleeps until a frame arrives instead of polling on a fixed step.
+ */
+static Task script(Scheduler &scheduler, Host &host, Driver &host_eth,
+                   std::promise<void> &done) {
+  struct Step {
+    CmdID cmd_id;
+    Scheduler::Clock::duration listen;
+  };
+  const Step steps[] = {
+      {CmdID::PING, 200ms},
+      {CmdID::START_STREAM, 1s},
+      {CmdID::STOP_STREAM, 200ms},
+      {static_cast<CmdID>(0x99), 200ms}, // UNKNOWN_COMMAND
+  };
+
+  for (const Step &step : steps) {
+    host.sendCommand(step.cmd_id, {});
+    const auto until = Scheduler::Clock::now() + step.listen;
+    while (!scheduler.stopping() && Scheduler::Clock::now() < until) {
+      co_await scheduler.readable(host_eth, until);
+      while (host.poll()) {
+      }
+    }
+  }
+  done.set_value();
+}
 
 int main() {
   // MAC addresses
@@ -22,49 +53,19 @@ int main() {
   Host host(host_eth);
   Device dev(dev_eth);
 
-  // Atomic bool to coordinate program halt
-  std::atomic<bool> run{true};
-
-  /* DEVICE */
-  // New thread for Device
-  std::thread devThread([&] {
-    while (run.load()) {
-      dev.poll();
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
-  });
-
-  /* HOST */
-  // The main thread is the host
-  auto hostStep = [&] {
-    host.poll(); // check for responses or streams
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-  };
-
-  // PING
-  host.sendCommand(CmdID::PING, {});
-  for (int i = 0; i < 20; ++i)
-    hostStep();
-
-  // START_STREAM
-  host.sendCommand(CmdID::START_STREAM, {});
-  for (int i = 0; i < 100; ++i)
-    hostStep(); // one second @10 ms steps
-
-  // STOP_STREAM
-  host.sendCommand(CmdID::STOP_STREAM, {});
-  for (int i = 0; i < 20; ++i)
-    hostStep();
-
-  // UNKNOWN_COMMAND
-  host.sendCommand(static_cast<CmdID>(0x99), {});
-  for (int i = 0; i < 20; ++i)
-    hostStep();
+  // Both endpoints run as coroutines on one worker thread
+  Scheduler scheduler(1);
+  scheduler.attach(host_eth);
+  scheduler.attach(dev_eth);
+  std::promise<void> done;
+  std::future<void> finished = done.get_future();
+  scheduler.spawn(dev.run(scheduler));
+  scheduler.spawn(script(scheduler, host, host_eth, done));
 
   /* Shutdown -------------------------------------------------------- */
-  run.store(false);
-  devThread.join();
+  finished.wait();
+  scheduler.stop();
 
-  std::puts("\nDemo complete (single-producer single-consumer)");
+  std::puts("\nDemo complete (coroutine runtime)");
   return 0;
 }
@@ -0,0 +1,77 @@
+#include "EthernetAlloc.hpp"
+#include <array>
+#include <cstring>
+
+namespace Ethernet {
+
+namespace {
+
+thread_local Alloc::Counts totals{};
+thread_local std::array<Alloc::Site, Alloc::MAX_SITES> thread_sites{};
+thread_local std::size_t site_count{1};
+
+/* Finds or claims the calling thread's site for a tag
+ */
+Alloc::Site &siteOf(const char *tag) {
+  if (!tag) {
+    return thread_sites[0];
+  }
+  // The same literal may have a different address in each translation unit
+  for (std::size_t i = 1; i < site_count; ++i) {
+    if (thread_sites[i].tag == tag || std::strcmp(thread_sites[i].tag, tag) == 0) {
+      return thread_sites[i];
+    }
+  }
+  if (site_count == Alloc::MAX_SITES) {
+    return thread_sites[0];
+  }
+  Alloc::Site &site = thread_sites[site_count++];
+  site.tag = tag;
+  return site;
+}
+
+} // namespace
+
+Alloc::Counts Alloc::thread() { return totals; }
+
+Alloc::Counts Alloc::process() {
+  return Counts{all_allocations.load(std::memory_order_relaxed),
+                all_deallocations.load(std::memory_order_relaxed),
+                all_bytes.load(std::memory_order_relaxed)};
+}
+
+std::vector<Alloc::Site> Alloc::sites() {
+  // Copied first, since building the result allocates and is counted
+  const std::array<Site, MAX_SITES> copy = thread_sites;
+  const std::size_t count = site_count;
+  std::vector<Site> out;
+  for (std::size_t i = 0; i < count; ++i) {
+    if (copy[i].counts.allocations != 0 || copy[i].counts.deallocations != 0) {
+      out.push_back(copy[i]);
+    }
+  }
+  return out;
+}
+
+void Alloc::noteAllocation(const std::size_t size) {
+  ++totals.allocations;
+  totals.bytes += size;
+  Site &site = siteOf(current);
+  ++site.counts.allocations;
+  site.counts.bytes += size;
+  all_allocations.fetch_add(1, std::memory_order_relaxed);
+  all_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void Alloc::noteDeallocation() {
+  ++totals.deallocations;
+  ++siteOf(current).counts.deallocations;
+  all_deallocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Alloc::hook() {
+  hooked.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+} // namespace Ethernet
@@ -0,0 +1,55 @@
+#include "EthernetAlloc.hpp"
+#include <cstdlib>
+#include <new>
+
+// Replaces the global allocation functions of any binary this is linked
+// into. The array, nothrow and sized forms all reach these through the
+// standard library's defaults.
+
+namespace {
+
+const bool registered = Ethernet::Alloc::hook();
+
+void *allocate(const std::size_t size) {
+  Ethernet::Alloc::noteAllocation(size);
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *allocateAligned(const std::size_t size, const std::align_val_t align) {
+  Ethernet::Alloc::noteAllocation(size);
+  const auto alignment = static_cast<std::size_t>(align);
+  // aligned_alloc wants a multiple of the alignment
+  const std::size_t rounded = (size + alignment - 1) / alignment * alignment;
+  if (void *ptr = std::aligned_alloc(alignment, rounded == 0 ? alignment : rounded)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void release(void *ptr) noexcept {
+  if (ptr) {
+    Ethernet::Alloc::noteDeallocation();
+    std::free(ptr);
+  }
+}
+
+} // namespace
+
+void *operator new(std::size_t size) { return allocate(size); }
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  return allocateAligned(size, align);
+}
+
+void operator delete(void *ptr) noexcept { release(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { release(ptr); }
+
+void operator delete(void *ptr, std::align_val_t) noexcept { release(ptr); }
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  release(ptr);
+}
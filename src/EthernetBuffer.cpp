@@ -0,0 +1,68 @@
+#include "EthernetBuffer.hpp"
+#include <utility>
+
+namespace Ethernet {
+
+FrameBuffer::FrameBuffer(FrameBuffer &&other) noexcept
+    : owned(std::move(other.owned)), block(std::exchange(other.block, nullptr)) {}
+
+FrameBuffer &FrameBuffer::operator=(FrameBuffer &&other) noexcept {
+  if (this != &other) {
+    this->drop();
+    this->owned = std::move(other.owned);
+    this->block = std::exchange(other.block, nullptr);
+  }
+  return *this;
+}
+
+FrameBuffer::~FrameBuffer() {
+  this->drop();
+}
+
+FrameBuffer FrameBuffer::share() {
+  if (!this->block) {
+    this->block = new Block{1, std::move(this->owned)};
+    this->owned = {};
+  }
+  // A new reference comes from an existing one, so no ordering is needed
+  this->block->refs.fetch_add(1, std::memory_order_relaxed);
+  return FrameBuffer(this->block);
+}
+
+std::span<const uint8_t> FrameBuffer::bytes() const {
+  return this->block ? std::span<const uint8_t>(this->block->bytes)
+                     : std::span<const uint8_t>(this->owned);
+}
+
+std::size_t FrameBuffer::useCount() const {
+  if (this->block) {
+    return this->block->refs.load(std::memory_order_relaxed);
+  }
+  return this->owned.empty() ? 0 : 1;
+}
+
+std::vector<uint8_t> FrameBuffer::release() {
+  if (!this->block) {
+    return std::exchange(this->owned, {});
+  }
+  // The acquire pairs with the other holders' releasing decrements, so
+  // their reads are done before the bytes are moved out
+  std::vector<uint8_t> bytes;
+  if (this->block->refs.load(std::memory_order_acquire) == 1) {
+    bytes = std::move(this->block->bytes);
+  } else {
+    bytes = this->block->bytes;
+  }
+  this->drop();
+  return bytes;
+}
+
+void FrameBuffer::drop() {
+  if (this->block &&
+      this->block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete this->block;
+  }
+  this->block = nullptr;
+}
+
+} // namespace Ethernet
@@ -1,9 +1,37 @@
 #include "EthernetDriver.hpp"
 #include "EthernetFrame.hpp"
+#include "EthernetTrace.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <optional>
 #include <stdexcept>
+#include <thread>
 
 namespace Ethernet {
 
+namespace {
+
+// Identifies a frame in the trace by its CRC, which both ends can read
+[[maybe_unused]] uint64_t traceId(std::span<const uint8_t> frame) {
+  uint32_t crc = 0;
+  if (frame.size() < Frame::CRC_LEN) {
+    return crc;
+  }
+  for (std::size_t i = frame.size() - Frame::CRC_LEN; i < frame.size(); ++i) {
+    crc = (crc << 8) | frame[i];
+  }
+  return crc;
+}
+
+int64_t steadyNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
 Driver::Driver(const MacAddr &mac_self) : mac_self(mac_self) {}
 
 void Driver::setMacAddr(const MacAddr& new_mac_self){
@@ -24,63 +52,763 @@ MacAddr Driver::getPeerMacAddr() const{
 
 void Driver::send(const std::vector<uint8_t> &data,
                   const Frame::EtherType type) {
-  if (!this->txQueue) {
+  this->sendTo(this->mac_peer, data, type);
+}
+
+void Driver::sendTo(const MacAddr &dst, const std::vector<uint8_t> &data,
+                    const Frame::EtherType type) {
+  std::vector<uint8_t> frame = this->reserve(data.size());
+  std::copy(data.begin(), data.end(), this->payloadOf(frame).begin());
+  this->sendReservedTo(std::move(frame), dst, type);
+}
+
+std::size_t Driver::mtu() const {
+  return Frame::PAYLOAD_LEN_MAX -
+         (this->reliability ? Reliability::HEADER_LEN : 0);
+}
+
+std::vector<uint8_t> Driver::reserve(const std::size_t payload_len) const {
+  if (this->mtu() < payload_len) {
+    throw std::runtime_error("Payload too large");
+  }
+  if (payload_len < Frame::PAYLOAD_LEN_MIN) {
+    throw std::runtime_error("Payload too small");
+  }
+  const std::size_t headroom = Frame::PAYLOAD_LEN_MAX - this->mtu();
+  return std::vector<uint8_t>(Frame::HEADER_LEN + headroom + payload_len +
+                              Frame::CRC_LEN);
+}
+
+std::span<uint8_t> Driver::payloadOf(std::span<uint8_t> frame) const {
+  const std::size_t headroom = Frame::PAYLOAD_LEN_MAX - this->mtu();
+  return Frame::payloadOf(frame).subspan(headroom);
+}
+
+void Driver::sendReserved(std::vector<uint8_t> &&frame,
+                          const Frame::EtherType type) {
+  this->sendReservedTo(std::move(frame), this->mac_peer, type);
+}
+
+void Driver::sendReservedTo(std::vector<uint8_t> &&frame, const MacAddr &dst,
+                            const Frame::EtherType type) {
+  if (!this->txPeer && !this->medium) {
     throw std::logic_error("Driver not linked");
   }
-  Frame frame(this->mac_peer, this->mac_self, type, data);
-  if(this->error_injection){
-    this->corrupt(frame);
+  if (this->reliability) {
+    if (dst != this->mac_peer) {
+      throw std::logic_error("Reliable delivery only reaches the linked peer");
+    }
+    this->reliability->send(std::move(frame), type, Reliability::Clock::now());
+    return;
+  }
+  this->transmitTo(std::move(frame), dst, type);
+}
+
+void Driver::transmit(std::vector<uint8_t> &&frame,
+                      const Frame::EtherType type) {
+  this->transmitTo(std::move(frame), this->mac_peer, type);
+}
+
+void Driver::transmitTo(std::vector<uint8_t> &&frame, const MacAddr &dst,
+                        const Frame::EtherType type) {
+  {
+    ETHERNET_TRACE_SPAN("frame.encode");
+    Frame::encodeInPlace(frame, dst, this->mac_self, type);
+  }
+  ETHERNET_TRACE_BEGIN("frame.queue", traceId(frame));
+  bool damaged = this->error_injection;
+  if (!damaged && 0.0 < this->bit_error_rate) {
+    const double bits = 8.0 * static_cast<double>(frame.size());
+    const double p = 1.0 - std::pow(1.0 - this->bit_error_rate, bits);
+    damaged = std::bernoulli_distribution(p)(this->rng);
+  }
+  if(damaged){
+    this->corrupt(Frame::payloadOf(frame));
   }
-  std::lock_guard<std::mutex> lock(*this->txMutex);
-  this->txQueue->push_back(std::move(frame.serialize()));
+  if (this->rx.queue.pauseSeen()) {
+    this->waitWhilePaused(frame);
+  }
+  if (this->medium) {
+    this->medium->forward(this->mac_self, std::move(frame));
+    return;
+  }
+  this->txPeer->deliver(std::move(frame));
+}
+
+void Driver::sendPause(const uint8_t classes, const uint16_t quanta,
+                       const uint32_t sequence) {
+  Frame::Pause pause;
+  pause.priorities = classes;
+  pause.quanta.fill(quanta);
+  pause.sequence = sequence;
+  this->txPeer->deliver(Frame::encodePause(this->mac_self, pause));
+  (quanta == 0 ? this->resumes_sent : this->pauses_sent)
+      .fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t Driver::nextPauseSequence() {
+  // 0 marks an unnumbered pause, so it is skipped when the count wraps
+  uint32_t sequence = this->pause_sequence.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (sequence == 0) {
+    sequence = this->pause_sequence.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+  return sequence;
+}
+
+void Driver::waitWhilePaused(const std::span<const uint8_t> frame) {
+  const std::size_t c = this->rx.queue.classOf(frame);
+  const int64_t start = steadyNanos();
+  int64_t now = start;
+  // Polled in short sleeps, so a resume is seen soon after it arrives
+  for (int64_t until = this->rx.queue.pausedUntil(c); now < until;
+       until = this->rx.queue.pausedUntil(c)) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(
+        std::min<int64_t>(until - now, 50'000)));
+    now = steadyNanos();
+  }
+  this->paused_ns.fetch_add(now - start, std::memory_order_relaxed);
 }
 
 bool Driver::recv(std::vector<uint8_t>& output){
-  std::lock_guard<std::mutex> lock(this->rxMutex);
-  if(this->rxQueue.empty()){
-    return false;
+  MacAddr src{};
+  return this->recv(output, src);
+}
+
+bool Driver::recv(std::vector<uint8_t> &output, MacAddr &src) {
+  if (this->reliability) {
+    const Reliability::Clock::time_point now = Reliability::Clock::now();
+    this->reliability->service(now);
+    while (!this->reliability->hasDeliverable()) {
+      // The queue lock is released before processing, since answering with
+      // an ACK takes the peer's queue lock
+      FrameBuffer bytes;
+      {
+        std::lock_guard<std::mutex> lock(this->rx.mutex);
+        if (!this->rx.queue.pop(bytes)) {
+          break;
+        }
+      }
+      ETHERNET_TRACE_END("frame.queue", traceId(bytes.bytes()));
+
+      // Damaged frames are dropped and left to the sender to retransmit
+      std::optional<Frame> frame;
+      try {
+        ETHERNET_TRACE_SPAN("frame.decode");
+        frame.emplace(bytes.bytes());
+      } catch (const std::runtime_error &) {
+        this->reliability->countCorrupted();
+        continue;
+      }
+      if (frame->getDst() != this->mac_self) {
+        throw std::runtime_error("Driver received frame for incorrect destination MAC");
+      }
+      this->reliability->receive(frame->getPayload(), now);
+    }
+    if (!this->reliability->deliver(output)) {
+      return false;
+    }
+    src = this->mac_peer;
+    return true;
+  }
+  if (this->rx_queues == 1) {
+    return this->recvQueue(0, output, src);
+  }
+  // Start from a different queue each time, so none is starved
+  const std::size_t first = this->rx_turn.fetch_add(1, std::memory_order_relaxed);
+  for (std::size_t i = 0; i < this->rx_queues; ++i) {
+    if (this->recvQueue((first + i) % this->rx_queues, output, src)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Driver::recvQueue(const std::size_t queue, std::vector<uint8_t> &output,
+                       MacAddr &src) {
+  if (this->rx_queues <= queue) {
+    throw std::runtime_error("No such receive queue");
+  }
+  if (this->reliability) {
+    throw std::logic_error("Reliable delivery receives through recv");
   }
+  RxLane &lane = this->lane(queue);
 
-  // Receive frame
-  Frame frame = Frame(this->rxQueue.front());
-  this->rxQueue.pop_front();
+  // Receive frame, a damaged one is dropped rather than left at the front
+  FrameBuffer bytes;
+  uint8_t resume = 0;
+  uint32_t sequence = 0;
+  {
+    std::lock_guard<std::mutex> lock(lane.mutex);
+    if (!lane.queue.pop(bytes)) {
+      return false;
+    }
+    resume = lane.queue.takeResumes();
+    if (resume != 0) {
+      sequence = this->nextPauseSequence();
+    }
+  }
+  if (resume != 0) {
+    this->sendPause(resume, 0, sequence);
+  }
+  ETHERNET_TRACE_END("frame.queue", traceId(bytes.bytes()));
+  ETHERNET_TRACE_SPAN("frame.decode");
+  Frame frame = Frame(bytes.bytes());
 
-  // Ensure the destination MAC is correct
-  if(frame.getDst() != this->mac_self){
+  // Ensure the destination MAC is correct, group addresses such as broadcast
+  // being filtered by the medium
+  if (frame.getDst() != this->mac_self && (frame.getDst()[0] & GROUP_BIT) == 0) {
     throw std::runtime_error("Driver received frame for incorrect destination MAC");
   }
 
-  // Return
+  // Return, without any 802.1Q tag
+  src = frame.getSrc();
   output = std::move(frame.getPayload());
+  if (frame.getType() == Frame::EtherType::VLAN) {
+    output.erase(output.begin(), output.begin() + Frame::TAG_LEN);
+  }
   return true;
 }
 
 bool Driver::hasPending() const {
-  return !this->rxQueue.empty();
+  if (this->reliability && this->reliability->hasDeliverable()) {
+    return true;
+  }
+  for (std::size_t queue = 0; queue < this->rx_queues; ++queue) {
+    if (this->hasPending(queue)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Driver::hasPending(const std::size_t queue) const {
+  if (this->rx_queues <= queue) {
+    throw std::runtime_error("No such receive queue");
+  }
+  const RxLane &lane = this->lane(queue);
+  std::lock_guard<std::mutex> lock(lane.mutex);
+  return !lane.queue.empty();
+}
+
+void Driver::deliver(FrameBuffer &&frame) {
+  RxLane &lane = this->lane(this->queueOf(frame.bytes()));
+  bool queued = false;
+  uint8_t pause = 0;
+  uint16_t quanta = 0;
+  uint32_t sequence = 0;
+  {
+    std::lock_guard<std::mutex> lock(lane.mutex);
+    queued = lane.queue.push(std::move(frame));
+    pause = lane.queue.takePauses();
+    quanta = lane.queue.pauseQuanta();
+    if (pause != 0) {
+      sequence = this->nextPauseSequence();
+    }
+  }
+  if (queued && lane.notify.fn) {
+    lane.notify.fn(lane.notify.ctx);
+  }
+  // The MAC answers a queue at xoff, outside of its queue lock. The sequence
+  // number lets the peer drop it if a resume decided later gets there first.
+  if (pause != 0) {
+    this->sendPause(pause, quanta, sequence);
+  }
+}
+
+void Driver::setRxNotify(void (*fn)(void *), void *ctx){
+  for (std::size_t queue = 0; queue < this->rx_queues; ++queue) {
+    this->lane(queue).notify = RxNotify{fn, ctx};
+  }
+}
+
+void Driver::setRxNotify(const std::size_t queue, void (*fn)(void *), void *ctx) {
+  if (this->rx_queues <= queue) {
+    throw std::runtime_error("No such receive queue");
+  }
+  this->lane(queue).notify = RxNotify{fn, ctx};
+}
+
+void Driver::wakeReceiver() {
+  const RxLane &lane = this->lane(0);
+  if (lane.notify.fn) {
+    lane.notify.fn(lane.notify.ctx);
+  }
+}
+
+void Driver::reserveQueue(const std::size_t frames) {
+  for (std::size_t queue = 0; queue < this->rx_queues; ++queue) {
+    RxLane &lane = this->lane(queue);
+    std::lock_guard<std::mutex> lock(lane.mutex);
+    lane.queue.reserve(frames);
+  }
+}
+
+void Driver::setQueueing(const QueueConfig &config) {
+  if (this->reliability) {
+    throw std::logic_error("Reliable delivery needs frames in order");
+  }
+  if (CLASSES < config.strict_from) {
+    throw std::runtime_error("Strict priority from a class that does not exist");
+  }
+  for (std::size_t c = 0; c < config.strict_from; ++c) {
+    if (config.weights[c] == 0) {
+      throw std::runtime_error("Round-robin weights must be at least one");
+    }
+  }
+  for (std::size_t queue = 0; queue < this->rx_queues; ++queue) {
+    RxLane &lane = this->lane(queue);
+    std::lock_guard<std::mutex> lock(lane.mutex);
+    lane.queue.configure(config);
+  }
+}
+
+Driver::QueueStats Driver::getQueueStats() const {
+  QueueStats total;
+  for (std::size_t queue = 0; queue < this->rx_queues; ++queue) {
+    const QueueStats stats = this->getQueueStats(queue);
+    for (std::size_t c = 0; c < CLASSES; ++c) {
+      total.queued[c] += stats.queued[c];
+      total.dropped[c] += stats.dropped[c];
+    }
+  }
+  return total;
+}
+
+Driver::QueueStats Driver::getQueueStats(const std::size_t queue) const {
+  if (this->rx_queues <= queue) {
+    throw std::runtime_error("No such receive queue");
+  }
+  const RxLane &lane = this->lane(queue);
+  std::lock_guard<std::mutex> lock(lane.mutex);
+  return lane.queue.stats;
+}
+
+void Driver::setReceiveQueues(const RssConfig &config) {
+  if (config.queues == 0 || INDIRECTION_LEN < config.queues) {
+    throw std::runtime_error("Receive queues must number 1 to INDIRECTION_LEN");
+  }
+  if (!config.indirection.empty() &&
+      (config.indirection.size() != INDIRECTION_LEN ||
+       std::any_of(config.indirection.begin(), config.indirection.end(),
+                   [&config](const uint8_t queue) { return config.queues <= queue; }))) {
+    throw std::runtime_error("Indirection table must name a queue per bucket");
+  }
+  if (1 < config.queues && this->reliability) {
+    throw std::logic_error("Reliable delivery needs frames in order");
+  }
+  if (1 < config.queues && this->rx.queue.isFlowControlled()) {
+    throw std::logic_error("Flow control needs a single receive queue");
+  }
+  for (std::size_t queue = 1; queue < this->rx_queues; ++queue) {
+    if (this->hasPending(queue)) {
+      throw std::logic_error("Receive queues still hold frames");
+    }
+  }
+  for (std::size_t i = 0; i < this->demux_len; ++i) {
+    if (config.queues <= this->demux[i].queue) {
+      throw std::logic_error("Demux rules name a queue being removed");
+    }
+  }
+
+  // New queues schedule traffic classes and notify like the first
+  std::unique_ptr<RxLane[]> lanes;
+  if (1 < config.queues) {
+    lanes = std::make_unique<RxLane[]>(config.queues - 1);
+    std::lock_guard<std::mutex> lock(this->rx.mutex);
+    for (std::size_t i = 0; i + 1 < config.queues; ++i) {
+      if (this->rx.queue.isSplit()) {
+        lanes[i].queue.configure(this->rx.queue.getConfig());
+      }
+      lanes[i].notify = this->rx.notify;
+    }
+  }
+  this->rx_lanes = std::move(lanes);
+  this->rx_queues = config.queues;
+  this->flow_key = config.key;
+  for (std::size_t bucket = 0; bucket < INDIRECTION_LEN; ++bucket) {
+    this->indirection[bucket] = config.indirection.empty()
+                                    ? static_cast<uint8_t>(bucket % config.queues)
+                                    : config.indirection[bucket];
+  }
+}
+
+void Driver::setDemux(const DemuxConfig &config) {
+  if (DEMUX_RULES < config.rules.size()) {
+    throw std::runtime_error("Too many demux rules");
+  }
+  std::array<DemuxEntry, DEMUX_RULES> table{};
+  std::size_t len = 0;
+  // Rules with a key go first, so the first match is the most specific
+  for (const bool keyed : {true, false}) {
+    for (const DemuxRule &rule : config.rules) {
+      if (rule.key.has_value() != keyed) {
+        continue;
+      }
+      if (this->rx_queues <= rule.queue) {
+        throw std::runtime_error("Demux rule names a queue that does not exist");
+      }
+      if (rule.type == Frame::EtherType::MAC_CONTROL ||
+          rule.type == Frame::EtherType::VLAN) {
+        throw std::runtime_error("Demux rule matches frames the MAC handles");
+      }
+      if (keyed && !config.key) {
+        throw std::runtime_error("Demux rule matches a key nothing reads");
+      }
+      const DemuxEntry entry{static_cast<uint16_t>(rule.type), rule.key.value_or(0),
+                             !keyed, static_cast<uint8_t>(rule.queue)};
+      for (std::size_t i = 0; i < len; ++i) {
+        if (table[i].type == entry.type && table[i].key == entry.key &&
+            table[i].any_key == entry.any_key) {
+          throw std::runtime_error("Demux rules overlap");
+        }
+      }
+      table[len++] = entry;
+    }
+  }
+  this->demux = table;
+  this->demux_len = len;
+  this->demux_key = config.key;
+}
+
+std::size_t Driver::receiveQueues() const {
+  return this->rx_queues;
+}
+
+std::size_t Driver::queueOf(const std::span<const uint8_t> frame) const {
+  if (this->rx_queues == 1 || frame.size() < Frame::HEADER_LEN) {
+    return 0;
+  }
+  // The MAC's own frames stay with the first queue, which acts on them
+  const std::size_t type_at = 2 * MAC_LEN;
+  if (frame[type_at] == static_cast<uint16_t>(Frame::EtherType::MAC_CONTROL) >> 8 &&
+      frame[type_at + 1] == (static_cast<uint16_t>(Frame::EtherType::MAC_CONTROL) & 0xff)) {
+    return 0;
+  }
+  if (this->demux_len != 0) {
+    if (const std::optional<std::size_t> queue = this->demuxOf(frame)) {
+      return *queue;
+    }
+  }
+  // Source MAC address and EtherType, then the flow key big-endian
+  std::array<uint8_t, MAC_LEN + sizeof(uint16_t) + sizeof(uint32_t)> input{};
+  std::copy_n(frame.begin() + MAC_LEN, MAC_LEN + sizeof(uint16_t), input.begin());
+  if (this->flow_key) {
+    const uint32_t key = this->flow_key(frame);
+    for (std::size_t i = 0; i < sizeof(key); ++i) {
+      input[MAC_LEN + sizeof(uint16_t) + i] =
+          static_cast<uint8_t>(key >> (8 * (sizeof(key) - 1 - i)));
+    }
+  }
+  return this->indirection[rssHash(input) & (INDIRECTION_LEN - 1)];
+}
+
+std::optional<std::size_t> Driver::demuxOf(const std::span<const uint8_t> frame) const {
+  const std::optional<Frame::EtherType> type = Frame::typeOf(frame);
+  if (!type) {
+    return std::nullopt;
+  }
+  const auto wanted = static_cast<uint16_t>(*type);
+  // The key is read once a rule of the frame's EtherType needs it, and
+  // tagged frames have none
+  std::optional<uint8_t> key;
+  bool key_read = false;
+  for (std::size_t i = 0; i < this->demux_len; ++i) {
+    const DemuxEntry &entry = this->demux[i];
+    if (entry.type != wanted) {
+      continue;
+    }
+    if (entry.any_key) {
+      return entry.queue;
+    }
+    if (!key_read) {
+      key_read = true;
+      if (!Frame::priorityOf(frame)) {
+        key = this->demux_key(frame);
+      }
+    }
+    if (key == entry.key) {
+      return entry.queue;
+    }
+  }
+  return std::nullopt;
+}
+
+uint32_t Driver::rssHash(const std::span<const uint8_t> input) {
+  static constexpr std::array<uint8_t, 40> KEY = {
+      0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+      0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
+      0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
+      0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa};
+  if (KEY.size() - sizeof(uint32_t) < input.size()) {
+    throw std::runtime_error("RSS input longer than its key allows");
+  }
+  // Each set input bit adds the 32 key bits starting at the same position
+  uint32_t hash = 0;
+  uint32_t window = (uint32_t{KEY[0]} << 24) | (uint32_t{KEY[1]} << 16) |
+                    (uint32_t{KEY[2]} << 8) | KEY[3];
+  for (std::size_t i = 0; i < input.size(); ++i) {
+    for (int bit = 7; 0 <= bit; --bit) {
+      if ((input[i] >> bit) & 1) {
+        hash ^= window;
+      }
+      window = (window << 1) | ((KEY[i + sizeof(uint32_t)] >> bit) & 1);
+    }
+  }
+  return hash;
+}
+
+void Driver::setFlowControl(const FlowControl &config) {
+  if (!this->txPeer) {
+    throw std::logic_error("Flow control needs a point-to-point link");
+  }
+  if (1 < this->rx_queues) {
+    throw std::logic_error("Flow control needs a single receive queue");
+  }
+  if (this->reliability) {
+    throw std::logic_error("Reliable delivery already bounds what is in flight");
+  }
+  if (config.xoff == 0 || config.xoff <= config.xon || config.quanta == 0) {
+    throw std::runtime_error("Flow control needs xon below xoff and a pause length");
+  }
+  std::lock_guard<std::mutex> lock(this->rx.mutex);
+  if (config.per_class && !this->rx.queue.isSplit()) {
+    throw std::logic_error("Priority flow control needs traffic classes");
+  }
+  this->rx.queue.configureFlow(config);
+}
+
+Driver::FlowStats Driver::getFlowStats() const {
+  FlowStats stats;
+  stats.pauses_sent = this->pauses_sent.load(std::memory_order_relaxed);
+  stats.resumes_sent = this->resumes_sent.load(std::memory_order_relaxed);
+  stats.paused = std::chrono::nanoseconds(this->paused_ns.load(std::memory_order_relaxed));
+  std::lock_guard<std::mutex> lock(this->rx.mutex);
+  stats.pauses_received = this->rx.queue.pauses_received;
+  return stats;
 }
 
 void Driver::setErrorInjection(const bool enable){
   this->error_injection = enable;
 }
 
+void Driver::setBitErrorRate(const double ber){
+  if (ber < 0.0 || 1.0 < ber) {
+    throw std::runtime_error("Bit error rate outside [0, 1]");
+  }
+  this->bit_error_rate = ber;
+}
+
+void Driver::setReliability(const Reliability::Config &config){
+  if (this->medium) {
+    throw std::logic_error("Reliable delivery needs a point-to-point link");
+  }
+  if (this->rx.queue.isSplit() || 1 < this->rx_queues) {
+    throw std::logic_error("Reliable delivery needs frames in order");
+  }
+  if (this->rx.queue.isFlowControlled()) {
+    throw std::logic_error("Reliable delivery already bounds what is in flight");
+  }
+  this->reliability = std::make_unique<Reliability>(*this, config);
+}
+
+void Driver::service(){
+  if (this->reliability) {
+    this->reliability->service(Reliability::Clock::now());
+  }
+}
+
+Reliability::Stats Driver::getReliabilityStats() const {
+  return this->reliability ? this->reliability->getStats() : Reliability::Stats{};
+}
+
 void Driver::link(Driver &a, Driver &b){
   // MAC exchange
   a.mac_peer = b.mac_self;
   b.mac_peer = a.mac_self;
-  // Mutex exchange
-  a.txMutex = &b.rxMutex;
-  b.txMutex = &a.rxMutex;
-  // Queue exchange
-  a.txQueue = &b.rxQueue;
-  b.txQueue = &a.rxQueue;
+  // Peer exchange, each delivers straight into the other's receive queues
+  a.txPeer = &b;
+  b.txPeer = &a;
+}
+
+/* ByteQueue */
+void Driver::ByteQueue::push_back(FrameBuffer &&frame) {
+  if (this->count == this->slots.size()) {
+    this->reserve(this->count + 1);
+  }
+  this->slots[(this->head + this->count) & (this->slots.size() - 1)] =
+      std::move(frame);
+  ++this->count;
+}
+
+void Driver::ByteQueue::pop_front() {
+  this->slots[this->head] = {};
+  this->head = (this->head + 1) & (this->slots.size() - 1);
+  --this->count;
+}
+
+void Driver::ByteQueue::reserve(const std::size_t frames) {
+  if (frames <= this->slots.size()) {
+    return;
+  }
+  // Capacity stays a power of two, so positions wrap with a mask
+  std::vector<FrameBuffer> grown(
+      std::bit_ceil(std::max<std::size_t>(frames, 2 * this->slots.size())));
+  for (std::size_t i = 0; i < this->count; ++i) {
+    grown[i] = std::move(this->slots[(this->head + i) & (this->slots.size() - 1)]);
+  }
+  this->slots = std::move(grown);
+  this->head = 0;
+}
+
+/* RxQueue */
+bool Driver::RxQueue::push(FrameBuffer &&frame) {
+  // MAC Control frames are acted on as they arrive, a damaged one is lost
+  std::optional<Frame::Pause> pause;
+  try {
+    pause = Frame::pauseOf(frame.bytes());
+  } catch (const std::runtime_error &) {
+    return false;
+  }
+  if (pause) {
+    const int64_t now = steadyNanos();
+    bool applied = false;
+    for (std::size_t c = 0; c < CLASSES; ++c) {
+      if (((pause->priorities >> c) & 1) == 0) {
+        continue;
+      }
+      // A pause older than one already acted on was overtaken, and would undo
+      // a resume. The difference is signed, so the numbers may wrap.
+      if (pause->sequence != 0) {
+        if (static_cast<int32_t>(pause->sequence - this->pause_sequences[c]) <= 0) {
+          continue;
+        }
+        this->pause_sequences[c] = pause->sequence;
+      }
+      this->paused_until[c].store(now + pause->quanta[c] * PAUSE_QUANTUM.count(),
+                                  std::memory_order_release);
+      applied = true;
+    }
+    if (applied) {
+      this->pause_seen.store(true, std::memory_order_release);
+      ++this->pauses_received;
+    }
+    return false;
+  }
+
+  std::size_t c = 0;
+  if (this->split) {
+    c = this->classOf(frame.bytes());
+    // Tail drop, so a flooded class cannot take memory from the others
+    const std::size_t limit = this->config.limits[c];
+    if (limit != 0 && limit <= this->classes[c].size()) {
+      ++this->stats.dropped[c];
+      return false;
+    }
+  }
+  this->classes[c].push_back(std::move(frame));
+  ++this->stats.queued[c];
+  ++this->count;
+
+  if (this->flow_on) {
+    const uint8_t bits = this->flow.per_class ? static_cast<uint8_t>(1 << c) : 0xFF;
+    const std::size_t depth = this->flow.per_class ? this->classes[c].size() : this->count;
+    // A frame from a paused peer means its pause ran out, so pause it again
+    if ((this->peer_paused & bits) != 0 || this->flow.xoff <= depth) {
+      this->peer_paused |= bits;
+      this->to_pause |= bits;
+      this->to_resume &= static_cast<uint8_t>(~bits);
+    }
+  }
+  return true;
+}
+
+bool Driver::RxQueue::pop(FrameBuffer &frame) {
+  if (this->count == 0) {
+    return false;
+  }
+  auto take = [&](const std::size_t c) {
+    ByteQueue &queue = this->classes[c];
+    frame = std::move(queue.front());
+    queue.pop_front();
+    --this->count;
+    if (this->peer_paused != 0) {
+      const uint8_t bits = this->flow.per_class ? static_cast<uint8_t>(1 << c) : 0xFF;
+      const std::size_t depth = this->flow.per_class ? queue.size() : this->count;
+      if ((this->peer_paused & bits) != 0 && depth <= this->flow.xon) {
+        this->peer_paused &= static_cast<uint8_t>(~bits);
+        this->to_resume |= bits;
+        this->to_pause &= static_cast<uint8_t>(~bits);
+      }
+    }
+    return true;
+  };
+  if (!this->split) {
+    return take(0);
+  }
+  for (std::size_t c = CLASSES; this->config.strict_from < c--;) {
+    if (!this->classes[c].empty()) {
+      return take(c);
+    }
+  }
+  // Every strict class is empty, so some round-robin class has a frame
+  while (true) {
+    if (0 < this->credit && !this->classes[this->turn].empty()) {
+      --this->credit;
+      return take(this->turn);
+    }
+    this->turn = static_cast<uint8_t>((this->turn + 1) % this->config.strict_from);
+    this->credit = this->config.weights[this->turn];
+  }
+}
+
+void Driver::RxQueue::reserve(const std::size_t frames) {
+  for (std::size_t c = 0; c < (this->split ? CLASSES : 1); ++c) {
+    this->classes[c].reserve(frames);
+  }
+}
+
+void Driver::RxQueue::configure(const QueueConfig &config) {
+  this->config = config;
+  this->split = true;
+  this->turn = 0;
+  this->credit = config.strict_from == 0 ? 0 : config.weights[0];
+}
+
+void Driver::RxQueue::configureFlow(const FlowControl &config) {
+  this->flow = config;
+  this->flow_on = true;
+}
+
+std::size_t Driver::RxQueue::classOf(const std::span<const uint8_t> frame) const {
+  if (const std::optional<uint8_t> pcp = Frame::priorityOf(frame)) {
+    return *pcp;
+  }
+  if (this->config.classify) {
+    return std::min<std::size_t>(this->config.classify(frame), CLASSES - 1);
+  }
+  return 0;
+}
+
+void Medium::connect(Driver &driver, Medium &medium) {
+  if (driver.txPeer || driver.medium) {
+    throw std::logic_error("Driver already linked");
+  }
+  if (driver.reliability) {
+    throw std::logic_error("Reliable delivery needs a point-to-point link");
+  }
+  driver.medium = &medium;
+}
+
+void Medium::deliver(Driver &driver, FrameBuffer &&frame) {
+  driver.deliver(std::move(frame));
 }
 
-void Driver::corrupt(Frame& frame){
-  auto payload = frame.getPayload();
+void Driver::corrupt(std::span<uint8_t> payload){
+  // The CRC32 has already been written, so flipping the bit in place leaves a
+  // frame that fails validation on the receiving side
   const std::size_t byte_index = rand() % payload.size();
   const uint8_t bit_index = 0x01 << (rand() % 7);
   payload[byte_index] ^= bit_index;
-  frame.setPayload(payload, false);
 }
 
 } // namespace Ethernet
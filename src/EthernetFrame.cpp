@@ -114,6 +114,123 @@ std::vector<uint8_t> Frame::serialize() const {
   return output;
 }
 
+void Frame::encodeInPlace(std::span<uint8_t> frame, const MacAddr &dst,
+                          const MacAddr &src, const EtherType type) {
+  // Size checks
+  if (FRAME_LEN_MAX < frame.size()) {
+    throw std::runtime_error("Payload too large");
+  }
+  if (frame.size() < FRAME_LEN_MIN) {
+    throw std::runtime_error("Payload too small");
+  }
+  auto iter = frame.begin();
+
+  // Copy MAC addresses
+  iter = std::copy(dst.begin(), dst.end(), iter);
+  iter = std::copy(src.begin(), src.end(), iter);
+
+  // Copy EtherType
+  *(iter++) = static_cast<uint8_t>(static_cast<uint16_t>(type) >> 8);
+  *(iter++) = static_cast<uint8_t>(static_cast<uint16_t>(type) & 0xff);
+
+  // The payload was written in place by the caller, so the CRC32 is computed
+  // directly over the buffer rather than over a copy
+  const std::span<const uint8_t> covered = frame.first(frame.size() - CRC_LEN);
+  const uint32_t crc = Frame::crc32(std::span(&covered, 1));
+  iter = frame.end() - CRC_LEN;
+  for (std::size_t i = 0; i < CRC_LEN; ++i) {
+    *(iter++) = static_cast<uint8_t>((crc >> (8 * i)) & 0xff);
+  }
+}
+
+std::span<uint8_t> Frame::payloadOf(std::span<uint8_t> frame) {
+  if (frame.size() < HEADER_LEN + CRC_LEN) {
+    throw std::runtime_error("Data too short");
+  }
+  return frame.subspan(HEADER_LEN, frame.size() - HEADER_LEN - CRC_LEN);
+}
+
+std::optional<uint8_t> Frame::priorityOf(std::span<const uint8_t> frame) {
+  // The tag sits where an untagged frame has its EtherType
+  const std::size_t type_at = 2 * MAC_LEN;
+  if (frame.size() < type_at + TAG_LEN ||
+      frame[type_at] != static_cast<uint16_t>(EtherType::VLAN) >> 8 ||
+      frame[type_at + 1] != (static_cast<uint16_t>(EtherType::VLAN) & 0xff)) {
+    return std::nullopt;
+  }
+  return static_cast<uint8_t>(frame[type_at + 2] >> 5);
+}
+
+std::optional<Frame::EtherType> Frame::typeOf(std::span<const uint8_t> frame) {
+  std::size_t type_at = 2 * MAC_LEN;
+  if (Frame::priorityOf(frame)) {
+    type_at += TAG_LEN;
+  }
+  if (frame.size() < type_at + sizeof(uint16_t)) {
+    return std::nullopt;
+  }
+  return static_cast<EtherType>((frame[type_at] << 8) | frame[type_at + 1]);
+}
+
+std::vector<uint8_t> Frame::encodePause(const MacAddr &src, const Pause &pause) {
+  std::vector<uint8_t> frame(HEADER_LEN + PAYLOAD_LEN_MIN + CRC_LEN);
+  const std::span<uint8_t> payload = Frame::payloadOf(frame);
+  auto put = [&payload](const std::size_t at, const uint16_t value) {
+    payload[at] = static_cast<uint8_t>(value >> 8);
+    payload[at + 1] = static_cast<uint8_t>(value & 0xff);
+  };
+  const bool uniform =
+      pause.priorities == 0xFF &&
+      std::all_of(pause.quanta.begin(), pause.quanta.end(),
+                  [&pause](const uint16_t quanta) { return quanta == pause.quanta[0]; });
+  if (uniform) {
+    // Opcode then quanta, the rest is padding
+    put(0, PAUSE_OPCODE);
+    put(2, pause.quanta[0]);
+  } else {
+    // Opcode, the priority enable vector, then quanta for every priority
+    put(0, PFC_OPCODE);
+    put(2, pause.priorities);
+    for (std::size_t p = 0; p < PRIORITIES; ++p) {
+      put(4 + 2 * p, (pause.priorities >> p) & 1 ? pause.quanta[p] : 0);
+    }
+  }
+  // Big-endian like the rest
+  put(PAUSE_SEQUENCE_AT, static_cast<uint16_t>(pause.sequence >> 16));
+  put(PAUSE_SEQUENCE_AT + 2, static_cast<uint16_t>(pause.sequence & 0xffff));
+  Frame::encodeInPlace(frame, PAUSE_MAC, src, EtherType::MAC_CONTROL);
+  return frame;
+}
+
+std::optional<Frame::Pause> Frame::pauseOf(std::span<const uint8_t> frame) {
+  const std::size_t type_at = 2 * MAC_LEN;
+  if (frame.size() < HEADER_LEN ||
+      frame[type_at] != static_cast<uint16_t>(EtherType::MAC_CONTROL) >> 8 ||
+      frame[type_at + 1] != (static_cast<uint16_t>(EtherType::MAC_CONTROL) & 0xff)) {
+    return std::nullopt;
+  }
+  const Frame decoded(frame);
+  const std::vector<uint8_t> &payload = decoded.getPayload();
+  auto get = [&payload](const std::size_t at) {
+    return static_cast<uint16_t>((payload[at] << 8) | payload[at + 1]);
+  };
+  Pause pause;
+  const uint16_t opcode = get(0);
+  if (opcode == PAUSE_OPCODE) {
+    pause.quanta.fill(get(2));
+  } else if (opcode == PFC_OPCODE) {
+    pause.priorities = static_cast<uint8_t>(get(2));
+    for (std::size_t p = 0; p < PRIORITIES; ++p) {
+      pause.quanta[p] = get(4 + 2 * p);
+    }
+  } else {
+    return std::nullopt;
+  }
+  pause.sequence =
+      (static_cast<uint32_t>(get(PAUSE_SEQUENCE_AT)) << 16) | get(PAUSE_SEQUENCE_AT + 2);
+  return pause;
+}
+
 bool Frame::isValid() const {
   return this->crc == Frame::crc32(*this);
 }
@@ -192,9 +309,6 @@ constexpr std::array<uint32_t, 256> Frame::generateCRC32Table() {
 }
 
 uint32_t Frame::crc32(const Frame &frame) {
-  // Generates the table once and reuses it for all CRC32 calculations
-  static constexpr std::array<uint32_t, 256> CRC32_TABLE = generateCRC32Table();
-
   // Arrange data into spans for lightweight, easier, and safer access
   // Most of this will likely be optimized out
   std::array<std::span<const uint8_t>, 4> data;
@@ -207,9 +321,15 @@ uint32_t Frame::crc32(const Frame &frame) {
   data[2] = std::span<const uint8_t>(ethertype_bytes);
   data[3] = std::span<const uint8_t>(frame.payload);
 
+  return Frame::crc32(std::span<const std::span<const uint8_t>>(data));
+}
+
+uint32_t Frame::crc32(std::span<const std::span<const uint8_t>> spans) {
+  // Generates the table once and reuses it for all CRC32 calculations
+  static constexpr std::array<uint32_t, 256> CRC32_TABLE = generateCRC32Table();
+
   // Calculates CRC32 from multiple spans, useful to remove copying, etc
   uint32_t crc = CRC32_INITIAL;
-  std::span<const std::span<const uint8_t>> spans(data);
   for (const std::span<const uint8_t> &span : spans) {
     for (const uint8_t byte : span) {
       uint8_t index = (crc ^ byte) & 0xFF;
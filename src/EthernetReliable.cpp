@@ -0,0 +1,253 @@
+#include "EthernetReliable.hpp"
+#include "EthernetDriver.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Ethernet {
+
+namespace {
+
+/* Writes the link header at the front of a frame payload
+ */
+void writeHeader(std::span<uint8_t> payload, const Reliability::Kind kind,
+                 const uint32_t seq) {
+  payload[0] = static_cast<uint8_t>(kind);
+  for (std::size_t i = 0; i < sizeof(seq); ++i) {
+    payload[1 + i] = static_cast<uint8_t>((seq >> (8 * i)) & 0xff);
+  }
+}
+
+/* Signed distance between two wrapping sequence numbers
+ */
+int32_t seqDiff(const uint32_t a, const uint32_t b) {
+  return static_cast<int32_t>(a - b);
+}
+
+} // namespace
+
+Reliability::Reliability(Driver &driver, const Config &config)
+    : driver(driver), config(config), rto(config.rto),
+      tx_window(config.window), rx_window(config.window) {
+  if (config.window == 0 || WINDOW_MAX < config.window) {
+    throw std::runtime_error("Reliability window outside supported range");
+  }
+}
+
+void Reliability::send(std::vector<uint8_t> &&frame,
+                       const Frame::EtherType type,
+                       const Clock::time_point now) {
+  this->backlog.push_back(Pending{type, std::move(frame)});
+  this->fill(now);
+}
+
+void Reliability::receive(std::span<const uint8_t> payload,
+                          const Clock::time_point now) {
+  if (payload.size() < HEADER_LEN) {
+    throw std::runtime_error("Frame shorter than link header");
+  }
+  const Kind kind = static_cast<Kind>(payload[0]);
+  uint32_t seq = 0;
+  for (std::size_t i = 0; i < sizeof(seq); ++i) {
+    seq |= static_cast<uint32_t>(payload[1 + i]) << (8 * i);
+  }
+  const std::span<const uint8_t> body = payload.subspan(HEADER_LEN);
+  const std::size_t window = this->config.window;
+
+  switch (kind) {
+  case Kind::ACK: {
+    ++this->stats.acks_received;
+    if (body.size() < WINDOW_MAX / 8) {
+      throw std::runtime_error("ACK shorter than selective ACK bitmap");
+    }
+
+    // Cumulative: everything before seq has arrived
+    for (uint32_t s = this->base; seqDiff(s, seq) < 0 &&
+                                  seqDiff(s, this->next_seq) < 0;
+         ++s) {
+      this->acknowledge(this->tx_window[s % window], now);
+    }
+
+    // Selective: bit i covers seq + 1 + i
+    uint32_t highest = seq;
+    for (std::size_t i = 0; i < WINDOW_MAX; ++i) {
+      if (!(body[i / 8] & (1u << (i % 8)))) {
+        continue;
+      }
+      const uint32_t s = seq + 1 + static_cast<uint32_t>(i);
+      if (seqDiff(s, this->base) >= 0 && seqDiff(s, this->next_seq) < 0) {
+        this->acknowledge(this->tx_window[s % window], now);
+        highest = s;
+      }
+    }
+    this->advance();
+
+    // Holes below a selectively acknowledged frame were lost, so they are
+    // resent straight away rather than waiting out the timeout
+    for (uint32_t s = this->base; seqDiff(s, highest) < 0; ++s) {
+      TxSlot &slot = this->tx_window[s % window];
+      if (!slot.acked && !slot.fast_retransmitted) {
+        slot.fast_retransmitted = true;
+        ++this->stats.retransmitted;
+        this->transmit(slot, now);
+      }
+    }
+    this->fill(now);
+    break;
+  }
+  case Kind::DATA: {
+    const int32_t offset = seqDiff(seq, this->expected);
+    if (offset < 0 || static_cast<std::size_t>(offset) >= window) {
+      // Already delivered, or beyond what the window can hold
+      ++this->stats.duplicates;
+      this->sendAck();
+      break;
+    }
+    RxSlot &slot = this->rx_window[seq % window];
+    if (slot.present) {
+      ++this->stats.duplicates;
+    } else {
+      slot.present = true;
+      slot.payload.assign(body.begin(), body.end());
+    }
+
+    // Deliver the in-order run
+    while (this->rx_window[this->expected % window].present) {
+      RxSlot &next = this->rx_window[this->expected % window];
+      this->delivered.push_back(std::move(next.payload));
+      next.present = false;
+      next.payload.clear();
+      ++this->expected;
+      ++this->stats.delivered;
+    }
+    this->sendAck();
+    break;
+  }
+  default:
+    throw std::runtime_error("Unknown link header kind");
+  }
+}
+
+void Reliability::service(const Clock::time_point now) {
+  bool timed_out = false;
+  for (uint32_t s = this->base; seqDiff(s, this->next_seq) < 0; ++s) {
+    TxSlot &slot = this->tx_window[s % this->config.window];
+    if (slot.acked || now < slot.deadline) {
+      continue;
+    }
+
+    // Back off once per expiry rather than once per frame, so a whole window
+    // timing out together does not inflate the timeout
+    if (!timed_out) {
+      timed_out = true;
+      this->rto = std::min(2 * this->rto, this->config.rto_max);
+    }
+    ++slot.retries;
+    ++this->stats.retransmitted;
+    this->transmit(slot, now);
+  }
+}
+
+bool Reliability::deliver(std::vector<uint8_t> &output) {
+  if (this->delivered.empty()) {
+    return false;
+  }
+  output = std::move(this->delivered.front());
+  this->delivered.pop_front();
+  return true;
+}
+
+bool Reliability::hasDeliverable() const {
+  return !this->delivered.empty();
+}
+
+std::size_t Reliability::inFlight() const {
+  return static_cast<std::size_t>(this->next_seq - this->base);
+}
+
+void Reliability::countCorrupted() {
+  ++this->stats.corrupted;
+}
+
+const Reliability::Stats &Reliability::getStats() const {
+  return this->stats;
+}
+
+void Reliability::fill(const Clock::time_point now) {
+  while (!this->backlog.empty() && this->inFlight() < this->config.window) {
+    TxSlot &slot = this->tx_window[this->next_seq % this->config.window];
+    slot.frame = std::move(this->backlog.front().frame);
+    slot.type = this->backlog.front().type;
+    this->backlog.pop_front();
+    writeHeader(Frame::payloadOf(slot.frame), Kind::DATA, this->next_seq);
+    slot.in_use = true;
+    slot.acked = false;
+    slot.fast_retransmitted = false;
+    slot.retries = 0;
+    ++this->next_seq;
+    ++this->stats.sent;
+    this->transmit(slot, now);
+  }
+}
+
+void Reliability::transmit(TxSlot &slot, const Clock::time_point now) {
+  // The retained frame stays clean, only the copy on the wire can be damaged
+  std::vector<uint8_t> copy = slot.frame;
+  this->driver.transmit(std::move(copy), slot.type);
+  slot.sent_at = now;
+  slot.deadline = now + this->rto;
+}
+
+void Reliability::acknowledge(TxSlot &slot, const Clock::time_point now) {
+  if (slot.acked) {
+    return;
+  }
+  slot.acked = true;
+
+  // Round-trip estimate as in RFC 6298. Retransmitted frames are skipped
+  // since their ACK cannot be matched to a particular transmission.
+  if (slot.retries != 0 || slot.fast_retransmitted) {
+    return;
+  }
+  const Clock::duration sample = now - slot.sent_at;
+  if (this->srtt == Clock::duration::zero()) {
+    this->srtt = sample;
+    this->rttvar = sample / 2;
+  } else {
+    const Clock::duration error =
+        this->srtt < sample ? sample - this->srtt : this->srtt - sample;
+    this->rttvar = (3 * this->rttvar + error) / 4;
+    this->srtt = (7 * this->srtt + sample) / 8;
+  }
+  this->rto = std::clamp(this->srtt + 4 * this->rttvar, this->config.rto_min,
+                         this->config.rto_max);
+}
+
+void Reliability::advance() {
+  while (this->base != this->next_seq) {
+    TxSlot &slot = this->tx_window[this->base % this->config.window];
+    if (!slot.acked) {
+      break;
+    }
+    slot.in_use = false;
+    slot.frame.clear();
+    ++this->base;
+  }
+}
+
+void Reliability::sendAck() {
+  std::vector<uint8_t> frame = this->driver.reserve(Frame::PAYLOAD_LEN_MIN);
+  std::span<uint8_t> payload = Frame::payloadOf(frame);
+  writeHeader(payload, Kind::ACK, this->expected);
+  std::span<uint8_t> bitmap = payload.subspan(HEADER_LEN, WINDOW_MAX / 8);
+  std::fill(bitmap.begin(), bitmap.end(), 0x00);
+  for (std::size_t i = 0; i + 1 < this->config.window; ++i) {
+    const uint32_t s = this->expected + 1 + static_cast<uint32_t>(i);
+    if (this->rx_window[s % this->config.window].present) {
+      bitmap[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+    }
+  }
+  ++this->stats.acks_sent;
+  this->driver.transmit(std::move(frame), Frame::EtherType::IPV4);
+}
+
+} // namespace Ethernet
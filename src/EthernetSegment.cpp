@@ -0,0 +1,88 @@
+#include "EthernetSegment.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Ethernet {
+
+void Segment::attach(Driver &driver) {
+  // Attaching the same driver twice fails in connect as already linked
+  const auto port = this->ports.find(driver.getMacAddr());
+  if (port != this->ports.end() && port->second != &driver) {
+    throw std::runtime_error("MAC address already on segment");
+  }
+  Medium::connect(driver, *this);
+  this->ports.emplace(driver.getMacAddr(), &driver);
+  this->stations.push_back(&driver);
+}
+
+void Segment::join(const MacAddr &group, Driver &driver) {
+  if ((group[0] & GROUP_BIT) == 0 || group == BROADCAST_MAC) {
+    throw std::runtime_error("Not a multicast address");
+  }
+  const auto port = this->ports.find(driver.getMacAddr());
+  if (port == this->ports.end() || port->second != &driver) {
+    throw std::logic_error("Driver not attached to segment");
+  }
+  std::vector<Driver *> &members = this->groups[group];
+  if (std::find(members.begin(), members.end(), &driver) == members.end()) {
+    members.push_back(&driver);
+  }
+}
+
+std::size_t Segment::size() const {
+  return this->ports.size();
+}
+
+Segment::Stats Segment::getStats() const {
+  return Stats{this->forwarded.load(), this->flooded.load(),
+               this->multicast.load(), this->dropped.load()};
+}
+
+void Segment::forward(const MacAddr &src, std::vector<uint8_t> &&frame) {
+  MacAddr dst{};
+  std::copy_n(frame.begin(), MAC_LEN, dst.begin());
+
+  if (dst == BROADCAST_MAC) {
+    fanOut(src, std::move(frame), this->stations);
+    this->flooded.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if ((dst[0] & GROUP_BIT) != 0) {
+    const auto group = this->groups.find(dst);
+    if (group == this->groups.end()) {
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    fanOut(src, std::move(frame), group->second);
+    this->multicast.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  const auto port = this->ports.find(dst);
+  if (port == this->ports.end()) {
+    this->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Medium::deliver(*port->second, std::move(frame));
+  this->forwarded.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Segment::fanOut(const MacAddr &src, FrameBuffer &&frame,
+                     const std::span<Driver *const> drivers) {
+  // Every receiver but the last gets a reference, the last the frame itself,
+  // so a single receiver needs no shared block
+  Driver *last = nullptr;
+  for (Driver *driver : drivers) {
+    if (driver->getMacAddr() == src) {
+      continue;
+    }
+    if (last) {
+      Medium::deliver(*last, frame.share());
+    }
+    last = driver;
+  }
+  if (last) {
+    Medium::deliver(*last, std::move(frame));
+  }
+}
+
+} // namespace Ethernet
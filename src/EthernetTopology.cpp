@@ -0,0 +1,493 @@
+#include "EthernetTopology.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <optional>
+#include <stdexcept>
+
+namespace Ethernet {
+
+namespace {
+
+constexpr uint8_t BINARY_MAGIC[4] = {'E', 'T', 'O', 'P'};
+constexpr uint32_t BINARY_VERSION = 1;
+
+[[noreturn]] void fail(const std::size_t line, const std::string &message) {
+  throw std::runtime_error("Topology line " + std::to_string(line) + ": " +
+                           message);
+}
+
+std::vector<std::string_view> split(std::string_view line) {
+  std::vector<std::string_view> words;
+  std::size_t pos = 0;
+  while (true) {
+    pos = line.find_first_not_of(" \t\r", pos);
+    if (pos == std::string_view::npos) {
+      return words;
+    }
+    const std::size_t end = std::min(line.find_first_of(" \t\r", pos), line.size());
+    words.push_back(line.substr(pos, end - pos));
+    pos = end;
+  }
+}
+
+/* Expands a trailing range, so dev[0..2] gives dev0, dev1 and dev2
+ */
+std::vector<std::string> expand(const std::string_view word,
+                                 const std::size_t line) {
+  const std::size_t open = word.find('[');
+  if (open == std::string_view::npos) {
+    return {std::string(word)};
+  }
+  const std::size_t dots = word.find("..", open);
+  if (word.back() != ']' || dots == std::string_view::npos) {
+    fail(line, "bad range " + std::string(word));
+  }
+  uint32_t first = 0;
+  uint32_t last = 0;
+  const char *from = word.data() + open + 1;
+  const char *to = word.data() + dots;
+  if (std::from_chars(from, to, first).ptr != to) {
+    fail(line, "bad range " + std::string(word));
+  }
+  from = word.data() + dots + 2;
+  to = word.data() + word.size() - 1;
+  if (std::from_chars(from, to, last).ptr != to || last < first) {
+    fail(line, "bad range " + std::string(word));
+  }
+  const std::string_view prefix = word.substr(0, open);
+  std::vector<std::string> names;
+  names.reserve(last - first + 1);
+  for (uint64_t i = first; i <= last; ++i) {
+    names.push_back(std::string(prefix) + std::to_string(i));
+  }
+  return names;
+}
+
+std::optional<MacAddr> parseMac(const std::string_view text) {
+  MacAddr mac{};
+  if (text.size() != 17) {
+    return std::nullopt;
+  }
+  for (std::size_t i = 0; i < mac.size(); ++i) {
+    const char *from = text.data() + 3 * i;
+    if (std::from_chars(from, from + 2, mac[i], 16).ptr != from + 2 ||
+        (i + 1 < mac.size() && text[3 * i + 2] != ':')) {
+      return std::nullopt;
+    }
+  }
+  return mac;
+}
+
+/* Checks indices are in range, every node is connected at most once, and
+ * names and MACs are unique
+ */
+void validate(const Topology::Description &description) {
+  const std::size_t node_count = description.nodes.size();
+  std::vector<bool> connected(node_count, false);
+  auto connect = [&](const uint32_t node) {
+    if (node_count <= node) {
+      throw std::runtime_error("Topology node index out of range");
+    }
+    if (connected[node]) {
+      throw std::runtime_error("Topology node " + description.nodes[node].name +
+                               " is connected twice");
+    }
+    connected[node] = true;
+  };
+  for (const Topology::Link &link : description.links) {
+    connect(link.a);
+    connect(link.b);
+  }
+  for (const Topology::Attachment &attachment : description.attachments) {
+    if (description.segments.size() <= attachment.segment) {
+      throw std::runtime_error("Topology switch index out of range");
+    }
+    connect(attachment.node);
+  }
+
+  // Sorted copies find duplicates without a node per entry
+  std::vector<MacAddr> macs;
+  std::vector<std::string_view> node_names;
+  macs.reserve(node_count);
+  node_names.reserve(node_count);
+  for (const Topology::Node &node : description.nodes) {
+    macs.push_back(node.mac);
+    node_names.push_back(node.name);
+  }
+  std::sort(macs.begin(), macs.end());
+  if (std::adjacent_find(macs.begin(), macs.end()) != macs.end()) {
+    throw std::runtime_error("Topology has a duplicate MAC address");
+  }
+  std::sort(node_names.begin(), node_names.end());
+  if (std::adjacent_find(node_names.begin(), node_names.end()) !=
+      node_names.end()) {
+    throw std::runtime_error("Topology has a duplicate node name");
+  }
+  std::vector<std::string_view> segment_names(description.segments.begin(),
+                                              description.segments.end());
+  std::sort(segment_names.begin(), segment_names.end());
+  if (std::adjacent_find(segment_names.begin(), segment_names.end()) !=
+      segment_names.end()) {
+    throw std::runtime_error("Topology has a duplicate switch name");
+  }
+}
+
+/* Binary helpers, little-endian */
+void put32(std::vector<uint8_t> &out, const uint32_t value) {
+  for (int shift = 0; shift < 32; shift += 8) {
+    out.push_back(static_cast<uint8_t>(value >> shift));
+  }
+}
+
+void putString(std::vector<uint8_t> &out, const std::string &text) {
+  if (0xffff < text.size()) {
+    throw std::runtime_error("Topology name too long");
+  }
+  out.push_back(static_cast<uint8_t>(text.size()));
+  out.push_back(static_cast<uint8_t>(text.size() >> 8));
+  out.insert(out.end(), text.begin(), text.end());
+}
+
+class Reader {
+public:
+  explicit Reader(std::span<const uint8_t> bytes) : bytes(bytes) {}
+
+  std::span<const uint8_t> take(const std::size_t len) {
+    if (this->bytes.size() - this->pos < len) {
+      throw std::runtime_error("Truncated topology");
+    }
+    const std::span<const uint8_t> taken = this->bytes.subspan(this->pos, len);
+    this->pos += len;
+    return taken;
+  }
+
+  uint32_t get32() {
+    const std::span<const uint8_t> raw = this->take(4);
+    return static_cast<uint32_t>(raw[0]) | static_cast<uint32_t>(raw[1]) << 8 |
+           static_cast<uint32_t>(raw[2]) << 16 |
+           static_cast<uint32_t>(raw[3]) << 24;
+  }
+
+  std::string getString() {
+    const std::span<const uint8_t> len = this->take(2);
+    const std::span<const uint8_t> text = this->take(
+        static_cast<std::size_t>(len[0]) | static_cast<std::size_t>(len[1]) << 8);
+    return std::string(text.begin(), text.end());
+  }
+
+  // A count of records at least min_len bytes each, checked against what is
+  // left before anything is reserved for them
+  std::size_t getCount(const std::size_t min_len) {
+    const uint32_t count = this->get32();
+    if ((this->bytes.size() - this->pos) / min_len < count) {
+      throw std::runtime_error("Truncated topology");
+    }
+    return count;
+  }
+
+  [[nodiscard]] bool done() const { return this->pos == this->bytes.size(); }
+
+private:
+  std::span<const uint8_t> bytes;
+  std::size_t pos{0};
+};
+
+uint64_t hashText(const std::string_view text) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char c : text) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::optional<std::vector<uint8_t>> readFile(const std::string &path) {
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return std::nullopt;
+  }
+  std::vector<uint8_t> bytes;
+  uint8_t chunk[65536];
+  std::size_t read = 0;
+  while ((read = std::fread(chunk, 1, sizeof(chunk), file)) != 0) {
+    bytes.insert(bytes.end(), chunk, chunk + read);
+  }
+  std::fclose(file);
+  return bytes;
+}
+
+} // namespace
+
+/* Description */
+Topology::Description Topology::Description::parse(const std::string_view text) {
+  Description description{};
+  std::unordered_map<std::string, uint32_t> nodes;
+  std::unordered_map<std::string, uint32_t> segments;
+  auto nodeOf = [&nodes](const std::string &name, const std::size_t line) {
+    const auto found = nodes.find(name);
+    if (found == nodes.end()) {
+      fail(line, "unknown node " + name);
+    }
+    return found->second;
+  };
+
+  std::size_t line = 0;
+  std::size_t pos = 0;
+  while (pos < text.size()) {
+    ++line;
+    const std::size_t end = std::min(text.find('\n', pos), text.size());
+    std::string_view content = text.substr(pos, end - pos);
+    pos = end + 1;
+    content = content.substr(0, content.find('#'));
+    const std::vector<std::string_view> words = split(content);
+    if (words.empty()) {
+      continue;
+    }
+
+    const std::string_view statement = words[0];
+    if (statement == "node") {
+      if (words.size() < 2 || 3 < words.size()) {
+        fail(line, "expected node <name> [mac]");
+      }
+      const std::vector<std::string> names = expand(words[1], line);
+      std::optional<MacAddr> mac{};
+      if (words.size() == 3) {
+        mac = parseMac(words[2]);
+        if (!mac) {
+          fail(line, "bad MAC address " + std::string(words[2]));
+        }
+        if (names.size() != 1) {
+          fail(line, "a MAC address names a single node");
+        }
+      }
+      for (const std::string &name : names) {
+        const auto index = static_cast<uint32_t>(description.nodes.size());
+        if (!nodes.emplace(name, index).second) {
+          fail(line, "duplicate node " + name);
+        }
+        // Locally administered, unicast
+        const MacAddr assigned{0x02,
+                               0x00,
+                               static_cast<uint8_t>(index >> 24),
+                               static_cast<uint8_t>(index >> 16),
+                               static_cast<uint8_t>(index >> 8),
+                               static_cast<uint8_t>(index)};
+        description.nodes.push_back(Node{name, mac.value_or(assigned)});
+      }
+    } else if (statement == "switch") {
+      if (words.size() != 2) {
+        fail(line, "expected switch <name>");
+      }
+      for (const std::string &name : expand(words[1], line)) {
+        const auto index = static_cast<uint32_t>(description.segments.size());
+        if (!segments.emplace(name, index).second) {
+          fail(line, "duplicate switch " + name);
+        }
+        description.segments.push_back(name);
+      }
+    } else if (statement == "link") {
+      if (words.size() != 3) {
+        fail(line, "expected link <node> <node>");
+      }
+      const std::vector<std::string> a = expand(words[1], line);
+      const std::vector<std::string> b = expand(words[2], line);
+      if (a.size() != b.size()) {
+        fail(line, "both ends of a link need the same number of nodes");
+      }
+      for (std::size_t i = 0; i < a.size(); ++i) {
+        description.links.push_back(Link{nodeOf(a[i], line), nodeOf(b[i], line)});
+      }
+    } else if (statement == "attach") {
+      if (words.size() < 3) {
+        fail(line, "expected attach <switch> <node>...");
+      }
+      const auto segment = segments.find(std::string(words[1]));
+      if (segment == segments.end()) {
+        fail(line, "unknown switch " + std::string(words[1]));
+      }
+      for (std::size_t i = 2; i < words.size(); ++i) {
+        for (const std::string &name : expand(words[i], line)) {
+          description.attachments.push_back(
+              Attachment{segment->second, nodeOf(name, line)});
+        }
+      }
+    } else {
+      fail(line, "unknown statement " + std::string(statement));
+    }
+  }
+
+  validate(description);
+  return description;
+}
+
+Topology::Description
+Topology::Description::fromBinary(std::span<const uint8_t> bytes) {
+  Reader reader(bytes);
+  const std::span<const uint8_t> magic = reader.take(sizeof(BINARY_MAGIC));
+  if (!std::equal(magic.begin(), magic.end(), std::begin(BINARY_MAGIC)) ||
+      reader.get32() != BINARY_VERSION) {
+    throw std::runtime_error("Not a topology cache of this version");
+  }
+
+  Description description{};
+  description.nodes.resize(reader.getCount(2 + MAC_LEN));
+  for (Node &node : description.nodes) {
+    node.name = reader.getString();
+    const std::span<const uint8_t> mac = reader.take(MAC_LEN);
+    std::copy(mac.begin(), mac.end(), node.mac.begin());
+  }
+  description.segments.resize(reader.getCount(2));
+  for (std::string &segment : description.segments) {
+    segment = reader.getString();
+  }
+  description.links.resize(reader.getCount(8));
+  for (Link &link : description.links) {
+    link.a = reader.get32();
+    link.b = reader.get32();
+  }
+  description.attachments.resize(reader.getCount(8));
+  for (Attachment &attachment : description.attachments) {
+    attachment.segment = reader.get32();
+    attachment.node = reader.get32();
+  }
+  if (!reader.done()) {
+    throw std::runtime_error("Trailing bytes after topology");
+  }
+
+  validate(description);
+  return description;
+}
+
+std::vector<uint8_t> Topology::Description::toBinary() const {
+  std::vector<uint8_t> out(std::begin(BINARY_MAGIC), std::end(BINARY_MAGIC));
+  put32(out, BINARY_VERSION);
+  put32(out, static_cast<uint32_t>(this->nodes.size()));
+  for (const Node &node : this->nodes) {
+    putString(out, node.name);
+    out.insert(out.end(), node.mac.begin(), node.mac.end());
+  }
+  put32(out, static_cast<uint32_t>(this->segments.size()));
+  for (const std::string &segment : this->segments) {
+    putString(out, segment);
+  }
+  put32(out, static_cast<uint32_t>(this->links.size()));
+  for (const Link &link : this->links) {
+    put32(out, link.a);
+    put32(out, link.b);
+  }
+  put32(out, static_cast<uint32_t>(this->attachments.size()));
+  for (const Attachment &attachment : this->attachments) {
+    put32(out, attachment.segment);
+    put32(out, attachment.node);
+  }
+  return out;
+}
+
+/* Topology */
+Topology::Topology(const Description &description, const Config &config)
+    : segments(description.segments.size()),
+      driver_storage(description.nodes.size()) {
+  validate(description);
+
+  // Names are copied once, and the indices view them, so they never move
+  this->names.reserve(description.nodes.size() + description.segments.size());
+  this->node_index.reserve(description.nodes.size());
+  this->segment_index.reserve(description.segments.size());
+  for (const Node &node : description.nodes) {
+    Driver &driver = this->driver_storage.emplace(node.mac);
+    if (0 < config.queue_depth) {
+      driver.reserveQueue(config.queue_depth);
+    }
+    this->node_index.emplace(this->names.emplace_back(node.name),
+                             static_cast<uint32_t>(this->node_index.size()));
+  }
+  for (const std::string &name : description.segments) {
+    this->segments.emplace();
+    this->segment_index.emplace(this->names.emplace_back(name),
+                                static_cast<uint32_t>(this->segment_index.size()));
+  }
+
+  const std::span<Driver> drivers = this->driver_storage.span();
+  const std::span<Segment> built = this->segments.span();
+  for (const Link &link : description.links) {
+    Driver::link(drivers[link.a], drivers[link.b]);
+  }
+  for (const Attachment &attachment : description.attachments) {
+    built[attachment.segment].attach(drivers[attachment.node]);
+  }
+}
+
+Topology::Topology(const Description &description)
+    : Topology(description, Config{}) {}
+
+Topology::~Topology() = default;
+
+Topology::Description Topology::load(const std::string &path) {
+  const std::optional<std::vector<uint8_t>> text = readFile(path);
+  if (!text) {
+    throw std::runtime_error("Cannot read topology " + path);
+  }
+  return Description::parse(std::string_view(
+      reinterpret_cast<const char *>(text->data()), text->size()));
+}
+
+Topology::Description Topology::loadCached(const std::string &path,
+                                           const std::string &cache_path) {
+  const std::optional<std::vector<uint8_t>> text = readFile(path);
+  if (!text) {
+    throw std::runtime_error("Cannot read topology " + path);
+  }
+  const std::string_view source(reinterpret_cast<const char *>(text->data()),
+                                text->size());
+  const uint64_t hash = hashText(source);
+
+  // The cache is the text's hash followed by the binary form
+  if (const std::optional<std::vector<uint8_t>> cache = readFile(cache_path);
+      cache && 8 <= cache->size()) {
+    uint64_t cached_hash = 0;
+    for (std::size_t i = 0; i < 8; ++i) {
+      cached_hash |= static_cast<uint64_t>((*cache)[i]) << (8 * i);
+    }
+    if (cached_hash == hash) {
+      try {
+        return Description::fromBinary(std::span(*cache).subspan(8));
+      } catch (const std::runtime_error &) {
+        // A damaged cache is rebuilt below
+      }
+    }
+  }
+
+  Description description = Description::parse(source);
+  std::vector<uint8_t> cache;
+  for (std::size_t i = 0; i < 8; ++i) {
+    cache.push_back(static_cast<uint8_t>(hash >> (8 * i)));
+  }
+  const std::vector<uint8_t> binary = description.toBinary();
+  cache.insert(cache.end(), binary.begin(), binary.end());
+  if (std::FILE *file = std::fopen(cache_path.c_str(), "wb")) {
+    std::fwrite(cache.data(), 1, cache.size(), file);
+    std::fclose(file);
+  }
+  return description;
+}
+
+std::span<Driver> Topology::drivers() { return this->driver_storage.span(); }
+
+Driver &Topology::driver(const std::string_view name) {
+  const auto found = this->node_index.find(name);
+  if (found == this->node_index.end()) {
+    throw std::runtime_error("No such node " + std::string(name));
+  }
+  return this->driver_storage.span()[found->second];
+}
+
+Segment &Topology::segment(const std::string_view name) {
+  const auto found = this->segment_index.find(name);
+  if (found == this->segment_index.end()) {
+    throw std::runtime_error("No such switch " + std::string(name));
+  }
+  return this->segments.span()[found->second];
+}
+
+} // namespace Ethernet
@@ -0,0 +1,215 @@
+#include "EthernetTrace.hpp"
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace Ethernet {
+
+namespace {
+
+// Events before this time belong to an earlier trace
+std::atomic<uint64_t> started_at{0};
+std::atomic<std::size_t> ring_len{std::size_t{1} << 14};
+
+} // namespace
+
+/* Ring */
+// Each slot is a seqlock of atomic words, so the exporter can read a ring
+// while its thread keeps writing and skip any slot it catches half written
+struct Trace::Ring {
+  struct Slot {
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<const char *> name{nullptr};
+    std::atomic<Phase> phase{Phase::SPAN};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> duration{0};
+    std::atomic<uint64_t> id{0};
+  };
+
+  Ring(const uint32_t thread, const std::size_t len)
+      : thread(thread), slots(std::bit_ceil(std::max<std::size_t>(len, 1))) {}
+
+  void write(const Event &event) {
+    const uint64_t index = this->head.load(std::memory_order_relaxed);
+    Slot &slot = this->slots[index & (this->slots.size() - 1)];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(event.name, std::memory_order_relaxed);
+    slot.phase.store(event.phase, std::memory_order_relaxed);
+    slot.start.store(event.start, std::memory_order_relaxed);
+    slot.duration.store(event.duration, std::memory_order_relaxed);
+    slot.id.store(event.id, std::memory_order_relaxed);
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+    this->head.store(index + 1, std::memory_order_release);
+  }
+
+  void read(std::vector<Event> &out, const uint64_t since) const {
+    const uint64_t end = this->head.load(std::memory_order_acquire);
+    const uint64_t len = this->slots.size();
+    for (uint64_t index = end < len ? 0 : end - len; index < end; ++index) {
+      const Slot &slot = this->slots[index & (len - 1)];
+      const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+      Event event{};
+      event.name = slot.name.load(std::memory_order_relaxed);
+      event.phase = slot.phase.load(std::memory_order_relaxed);
+      event.thread = this->thread;
+      event.start = slot.start.load(std::memory_order_relaxed);
+      event.duration = slot.duration.load(std::memory_order_relaxed);
+      event.id = slot.id.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+      if (before == after && before == 2 * index + 2 && since <= event.start) {
+        out.push_back(event);
+      }
+    }
+  }
+
+  const uint32_t thread;
+  std::atomic<uint64_t> head{0};
+  std::vector<Slot> slots;
+  // When the thread exited, 0 while it runs
+  std::atomic<uint64_t> exited_at{0};
+
+  // Rings outlive their threads, so a worker's events can be exported after
+  // it has been joined. A ring is dropped once its thread has exited and its
+  // events were exported or belong to an earlier trace.
+  static inline std::mutex registry_mutex{};
+  static inline std::vector<std::shared_ptr<Ring>> registry{};
+  static inline uint32_t threads{0};
+
+  /* Drops the rings of threads that exited before a time
+   */
+  static void prune(const uint64_t before) {
+    std::erase_if(registry, [before](const std::shared_ptr<Ring> &ring) {
+      const uint64_t exited = ring->exited_at.load(std::memory_order_acquire);
+      return exited != 0 && exited <= before;
+    });
+  }
+
+  // Held by the thread writing the ring, marks it exited when the thread ends
+  struct Owner {
+    ~Owner() {
+      if (this->ring) {
+        this->ring->exited_at.store(Trace::now(), std::memory_order_release);
+      }
+    }
+    std::shared_ptr<Ring> ring{};
+  };
+};
+
+/* Trace */
+void Trace::start(const Config &config) {
+  if (config.sample_every == 0) {
+    throw std::runtime_error("Trace sampling must be at least one");
+  }
+  ring_len.store(config.ring_len, std::memory_order_relaxed);
+  sample_every.store(config.sample_every, std::memory_order_relaxed);
+  const uint64_t at = now();
+  {
+    // Events of threads that already exited are never exported again
+    std::lock_guard<std::mutex> lock(Ring::registry_mutex);
+    Ring::prune(at);
+  }
+  started_at.store(at, std::memory_order_relaxed);
+  active.store(true, std::memory_order_release);
+}
+
+void Trace::start() { start(Config{}); }
+
+void Trace::stop() { active.store(false, std::memory_order_release); }
+
+void Trace::span(const char *name, const uint64_t start,
+                 const uint64_t duration) {
+  record(Event{name, Phase::SPAN, 0, start, duration, 0});
+}
+
+void Trace::begin(const char *name, const uint64_t id) {
+  if (enabled() && sampleId(id)) {
+    record(Event{name, Phase::BEGIN, 0, now(), 0, id});
+  }
+}
+
+void Trace::end(const char *name, const uint64_t id) {
+  if (enabled() && sampleId(id)) {
+    record(Event{name, Phase::END, 0, now(), 0, id});
+  }
+}
+
+uint64_t Trace::now() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Clock::now().time_since_epoch())
+          .count());
+}
+
+std::vector<Trace::Event> Trace::snapshot() {
+  std::vector<Event> events;
+  const uint64_t since = started_at.load(std::memory_order_relaxed);
+  const uint64_t exported_at = now();
+  {
+    // A thread that exited before the export began has had all its events
+    // read, so its ring is no longer needed
+    std::lock_guard<std::mutex> lock(Ring::registry_mutex);
+    for (const std::shared_ptr<Ring> &ring : Ring::registry) {
+      ring->read(events, since);
+    }
+    Ring::prune(exported_at);
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const Event &a, const Event &b) { return a.start < b.start; });
+  return events;
+}
+
+std::size_t Trace::rings() {
+  std::lock_guard<std::mutex> lock(Ring::registry_mutex);
+  return Ring::registry.size();
+}
+
+void Trace::writeChrome(std::FILE *out) {
+  const std::vector<Event> events = snapshot();
+  std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    const Event &event = events[i];
+    // Chrome counts in microseconds
+    const double ts = static_cast<double>(event.start) / 1e3;
+    std::fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"frame\",\"pid\":1,"
+                      "\"tid\":%u,\"ts\":%.3f",
+                 i == 0 ? "" : ",", event.name, event.thread, ts);
+    switch (event.phase) {
+    case Phase::SPAN:
+      std::fprintf(out, ",\"ph\":\"X\",\"dur\":%.3f}",
+                   static_cast<double>(event.duration) / 1e3);
+      break;
+    case Phase::BEGIN:
+      std::fprintf(out, ",\"ph\":\"b\",\"id\":\"0x%llx\"}",
+                   static_cast<unsigned long long>(event.id));
+      break;
+    case Phase::END:
+      std::fprintf(out, ",\"ph\":\"e\",\"id\":\"0x%llx\"}",
+                   static_cast<unsigned long long>(event.id));
+      break;
+    }
+  }
+  std::fputs("\n]}\n", out);
+}
+
+bool Trace::sampleId(const uint64_t id) {
+  // Mixed first, since ids such as CRCs need not be uniform in their low bits
+  return (id * 0x9E3779B97F4A7C15ULL >> 32) %
+             sample_every.load(std::memory_order_relaxed) ==
+         0;
+}
+
+void Trace::record(const Event &event) {
+  thread_local Ring::Owner owner{};
+  if (!owner.ring) {
+    std::lock_guard<std::mutex> lock(Ring::registry_mutex);
+    owner.ring = Ring::registry.emplace_back(std::make_shared<Ring>(
+        ++Ring::threads, ring_len.load(std::memory_order_relaxed)));
+  }
+  owner.ring->write(event);
+}
+
+} // namespace Ethernet
@@ -0,0 +1,97 @@
+#include "EthernetSegment.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+using namespace Ethernet;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+/* Floods every frame as a separate copy per receiver, as segments did
+ * before frames were shared, for comparison
+ */
+class CopyingHub : public Medium {
+public:
+  void attach(Driver &driver) {
+    Medium::connect(driver, *this);
+    this->stations.push_back(&driver);
+  }
+
+  void forward(const MacAddr &src, std::vector<uint8_t> &&frame) override {
+    for (Driver *driver : this->stations) {
+      if (driver->getMacAddr() != src) {
+        Medium::deliver(*driver, std::vector<uint8_t>(frame));
+      }
+    }
+  }
+
+private:
+  std::vector<Driver *> stations{};
+};
+
+MacAddr macOf(const std::size_t index) {
+  return MacAddr{0x02, 0x00, 0x00, static_cast<uint8_t>(index >> 16),
+                 static_cast<uint8_t>(index >> 8), static_cast<uint8_t>(index)};
+}
+
+/* Broadcasts frames to a number of receivers and times the sends, which
+ * is where the fan-out happens. Receivers are drained between batches,
+ * outside the timing.
+ * @return Nanoseconds per broadcast
+ */
+template <typename Network>
+double measure(const std::size_t receivers, const std::size_t payload,
+               const std::size_t frames) {
+  constexpr std::size_t BATCH = 32;
+  Network network;
+  std::vector<std::unique_ptr<Driver>> drivers;
+  for (std::size_t i = 0; i <= receivers; ++i) {
+    Driver &driver = *drivers.emplace_back(std::make_unique<Driver>(macOf(i)));
+    network.attach(driver);
+    driver.reserveQueue(BATCH);
+  }
+
+  const std::vector<uint8_t> data(payload, 0x5A);
+  std::vector<uint8_t> received;
+  Clock::duration sending{};
+  for (std::size_t sent = 0; sent < frames; sent += BATCH) {
+    const Clock::time_point start = Clock::now();
+    for (std::size_t i = 0; i < BATCH; ++i) {
+      drivers[0]->sendTo(BROADCAST_MAC, data);
+    }
+    sending += Clock::now() - start;
+    for (std::size_t i = 1; i <= receivers; ++i) {
+      while (drivers[i]->recv(received)) {
+      }
+    }
+  }
+  const std::size_t batches = (frames + BATCH - 1) / BATCH;
+  return static_cast<double>(std::chrono::nanoseconds(sending).count()) /
+         static_cast<double>(batches * BATCH);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  // Usage: fanout_bench [broadcasts per run]
+  const std::size_t frames =
+      1 < argc ? static_cast<std::size_t>(std::atoi(argv[1])) : 2048;
+  const std::size_t receiver_counts[] = {1, 4, 16, 64, 256};
+  const std::size_t payloads[] = {64, 1500};
+
+  std::printf("%8s %10s %14s %14s %14s %8s\n", "payload", "receivers",
+              "copied ns", "shared ns", "shared ns/rx", "speedup");
+  for (const std::size_t payload : payloads) {
+    for (const std::size_t receivers : receiver_counts) {
+      const double copied = measure<CopyingHub>(receivers, payload, frames);
+      const double shared = measure<Segment>(receivers, payload, frames);
+      std::printf("%8zu %10zu %14.0f %14.0f %14.1f %7.2fx\n", payload,
+                  receivers, copied, shared,
+                  shared / static_cast<double>(receivers), copied / shared);
+    }
+  }
+  return 0;
+}
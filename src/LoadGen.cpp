@@ -0,0 +1,558 @@
+#include "EthernetAlloc.hpp"
+#include "EthernetSegment.hpp"
+#include "EthernetTrace.hpp"
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+using Clock = RequestTable::Clock;
+
+/* Round trip latencies in nanoseconds. Each power of two is split into 32
+ * buckets, so a percentile is within about 3% of the exact value without
+ * storing every sample.
+ */
+struct Histogram {
+  static constexpr unsigned SUB_BITS = 5;
+  static constexpr uint64_t SUB_COUNT = uint64_t{1} << SUB_BITS;
+
+  static std::size_t index(const uint64_t ns) {
+    if (ns < SUB_COUNT) {
+      return ns;
+    }
+    const unsigned shift = std::bit_width(ns) - 1 - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + ((ns >> shift) - SUB_COUNT);
+  }
+
+  // Middle of a bucket's range
+  static uint64_t value(const std::size_t index) {
+    if (index < SUB_COUNT) {
+      return index;
+    }
+    const unsigned shift = index / SUB_COUNT - 1;
+    const uint64_t low = (index % SUB_COUNT + SUB_COUNT) << shift;
+    return low + (uint64_t{1} << shift) / 2;
+  }
+
+  void record(const Clock::duration latency) {
+    const uint64_t ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+    ++this->counts[index(ns)];
+    ++this->total;
+    this->sum += ns;
+    this->max = std::max(this->max, ns);
+  }
+
+  void merge(const Histogram &other) {
+    for (std::size_t i = 0; i < this->counts.size(); ++i) {
+      this->counts[i] += other.counts[i];
+    }
+    this->total += other.total;
+    this->sum += other.sum;
+    this->max = std::max(this->max, other.max);
+  }
+
+  uint64_t percentile(const double q) const {
+    const auto rank = static_cast<uint64_t>(q * static_cast<double>(this->total));
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < this->counts.size(); ++i) {
+      seen += this->counts[i];
+      if (rank < seen) {
+        return std::min(value(i), this->max);
+      }
+    }
+    return this->max;
+  }
+
+  std::array<uint64_t, 64 * SUB_COUNT> counts{};
+  uint64_t total{0};
+  uint64_t sum{0};
+  uint64_t max{0};
+};
+
+/* Configuration --------------------------------------------------------- */
+enum class Transport { LINK, RELIABLE, SEGMENT };
+
+struct Payload {
+  std::size_t bytes{0};
+  double weight{1.0};
+};
+
+struct Config {
+  Transport transport{Transport::LINK};
+  std::size_t pairs{4};
+  std::size_t threads{1};
+  Clock::duration duration{1s};
+  std::vector<Payload> payloads{{64, 1.0}};
+  // Share of requests that start or stop the device's telemetry stream
+  double stream_ratio{0.0};
+  // Bit error rate applied to every driver
+  double error_rate{0.0};
+  Clock::duration timeout{100ms};
+  uint64_t seed{1};
+  std::string json{};
+  // Chrome trace of a sample of frames, written after the run
+  std::string trace{};
+};
+
+static const char *transportName(const Transport transport) {
+  switch (transport) {
+  case Transport::LINK:
+    return "link";
+  case Transport::RELIABLE:
+    return "reliable";
+  case Transport::SEGMENT:
+    return "segment";
+  }
+  return "unknown";
+}
+
+/* Parses "64:0.7,512:0.2,1400:0.1", the weight defaulting to 1
+ */
+static std::vector<Payload> parsePayloads(const char *spec) {
+  std::vector<Payload> payloads;
+  const char *cursor = spec;
+  while (*cursor != '\0') {
+    char *end = nullptr;
+    Payload payload{};
+    payload.bytes = std::strtoull(cursor, &end, 10);
+    if (end == cursor) {
+      throw std::runtime_error("Bad payload size in " + std::string(spec));
+    }
+    cursor = end;
+    if (*cursor == ':') {
+      payload.weight = std::strtod(cursor + 1, &end);
+      if (end == cursor + 1 || payload.weight < 0.0) {
+        throw std::runtime_error("Bad payload weight in " + std::string(spec));
+      }
+      cursor = end;
+    }
+    payloads.push_back(payload);
+    if (*cursor == ',') {
+      ++cursor;
+    } else if (*cursor != '\0') {
+      throw std::runtime_error("Bad payload list " + std::string(spec));
+    }
+  }
+  if (payloads.empty()) {
+    throw std::runtime_error("No payload sizes given");
+  }
+  return payloads;
+}
+
+static Config parseArgs(const int argc, char **argv) {
+  Config config{};
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (i + 1 == argc) {
+      throw std::runtime_error(std::string("Missing value for ") + arg);
+    }
+    const char *value = argv[++i];
+    if (std::strcmp(arg, "--transport") == 0) {
+      if (std::strcmp(value, "link") == 0) {
+        config.transport = Transport::LINK;
+      } else if (std::strcmp(value, "reliable") == 0) {
+        config.transport = Transport::RELIABLE;
+      } else if (std::strcmp(value, "segment") == 0) {
+        config.transport = Transport::SEGMENT;
+      } else {
+        throw std::runtime_error(std::string("Unknown transport ") + value);
+      }
+    } else if (std::strcmp(arg, "--pairs") == 0) {
+      config.pairs = std::strtoull(value, nullptr, 10);
+    } else if (std::strcmp(arg, "--threads") == 0) {
+      config.threads = std::strtoull(value, nullptr, 10);
+    } else if (std::strcmp(arg, "--duration") == 0) {
+      config.duration = std::chrono::milliseconds(std::strtoll(value, nullptr, 10));
+    } else if (std::strcmp(arg, "--payload") == 0) {
+      config.payloads = parsePayloads(value);
+    } else if (std::strcmp(arg, "--stream-ratio") == 0) {
+      config.stream_ratio = std::strtod(value, nullptr);
+    } else if (std::strcmp(arg, "--error-rate") == 0) {
+      config.error_rate = std::strtod(value, nullptr);
+    } else if (std::strcmp(arg, "--timeout") == 0) {
+      config.timeout = std::chrono::milliseconds(std::strtoll(value, nullptr, 10));
+    } else if (std::strcmp(arg, "--seed") == 0) {
+      config.seed = std::strtoull(value, nullptr, 10);
+    } else if (std::strcmp(arg, "--json") == 0) {
+      config.json = value;
+    } else if (std::strcmp(arg, "--trace") == 0) {
+      config.trace = value;
+    } else {
+      throw std::runtime_error(std::string("Unknown option ") + arg);
+    }
+  }
+  if (config.pairs == 0 || config.threads == 0) {
+    throw std::runtime_error("Pairs and threads must be positive");
+  }
+  if (config.stream_ratio < 0.0 || 1.0 < config.stream_ratio) {
+    throw std::runtime_error("Stream ratio outside [0, 1]");
+  }
+  if (config.transport == Transport::SEGMENT && 0.0 < config.error_rate) {
+    // Corrupted frames on a segment are never retransmitted, so every one
+    // would just be a timeout; use link for that
+    throw std::runtime_error("Error rate needs the link or reliable transport");
+  }
+  return config;
+}
+
+/* Traffic --------------------------------------------------------------- */
+struct Pair {
+  std::unique_ptr<Driver> host_eth{};
+  std::unique_ptr<Driver> dev_eth{};
+  std::unique_ptr<Host> host{};
+  std::unique_ptr<Device> device{};
+  std::optional<std::future<Msg>> reply{};
+  Clock::time_point sent{};
+  // PING payload of the outstanding request, counted once it is answered
+  std::size_t payload{0};
+  bool streaming{false};
+  uint64_t stream_samples{0};
+};
+
+struct Counters {
+  Histogram latency{};
+  uint64_t exchanges{0};
+  uint64_t payload_bytes{0};
+  uint64_t failed{0};
+  uint64_t timed_out{0};
+  uint64_t corrupted{0};
+};
+
+/* Drives a share of the pairs closed loop, one request outstanding per pair,
+ * polling both ends until the deadline
+ */
+static void drive(const Config &config, std::vector<Pair *> pairs,
+                  const Clock::time_point until, const uint64_t seed,
+                  Counters &counters) {
+  std::mt19937_64 rng(seed);
+  std::bernoulli_distribution stream_op(config.stream_ratio);
+  std::vector<double> weights;
+  std::size_t largest = 0;
+  for (const Payload &payload : config.payloads) {
+    weights.push_back(payload.weight);
+    largest = std::max(largest, payload.bytes);
+  }
+  std::discrete_distribution<std::size_t> pick(weights.begin(), weights.end());
+
+  // Payloads are built once so requests only allocate inside the stack
+  std::vector<std::vector<uint8_t>> buffers;
+  for (const Payload &payload : config.payloads) {
+    std::vector<uint8_t> &buffer = buffers.emplace_back(payload.bytes);
+    for (std::size_t i = 0; i < buffer.size(); ++i) {
+      buffer[i] = static_cast<uint8_t>(i);
+    }
+  }
+  const std::vector<uint8_t> none{};
+
+  while (true) {
+    const Clock::time_point now = Clock::now();
+    if (until <= now) {
+      break;
+    }
+    for (Pair *pair : pairs) {
+      if (!pair->reply) {
+        const MacAddr dst = pair->dev_eth->getMacAddr();
+        // Timed from the send itself, not from the top of the loop, so the
+        // pairs polled before this one do not count towards its latency
+        if (stream_op(rng)) {
+          pair->streaming = !pair->streaming;
+          pair->payload = 0;
+          pair->sent = Clock::now();
+          pair->reply = pair->host->request(
+              dst, pair->streaming ? CmdID::START_STREAM : CmdID::STOP_STREAM,
+              none, config.timeout, pair->sent);
+        } else {
+          const std::size_t choice = pick(rng);
+          pair->payload = buffers[choice].size();
+          pair->sent = Clock::now();
+          pair->reply = pair->host->request(dst, CmdID::PING, buffers[choice],
+                                            config.timeout, pair->sent);
+        }
+      }
+
+      // Damaged frames throw from recv without reliable delivery
+      try {
+        do {
+          pair->device->poll(now);
+        } while (pair->dev_eth->hasPending());
+        pair->dev_eth->service();
+      } catch (const std::runtime_error &) {
+        ++counters.corrupted;
+      }
+      try {
+        while (pair->host->poll(now)) {
+        }
+        pair->host_eth->service();
+      } catch (const std::runtime_error &) {
+        ++counters.corrupted;
+      }
+
+      if (pair->reply->wait_for(0s) != std::future_status::ready) {
+        continue;
+      }
+      try {
+        pair->reply->get();
+        counters.latency.record(Clock::now() - pair->sent);
+        ++counters.exchanges;
+        counters.payload_bytes += pair->payload;
+      } catch (const CommandTimeout &) {
+        ++counters.timed_out;
+      } catch (const CommandError &) {
+        ++counters.failed;
+      }
+      pair->reply.reset();
+    }
+  }
+}
+
+/* Output ---------------------------------------------------------------- */
+struct Results {
+  Counters counters{};
+  uint64_t stream_samples{0};
+  double seconds{0.0};
+  double user_seconds{0.0};
+  double system_seconds{0.0};
+  uint64_t allocations{0};
+  uint64_t allocated_bytes{0};
+};
+
+static double cpuSeconds(const timeval &time) {
+  return static_cast<double>(time.tv_sec) +
+         static_cast<double>(time.tv_usec) / 1e6;
+}
+
+static void writeJson(std::FILE *out, const Config &config,
+                      const Results &results) {
+  const Counters &counters = results.counters;
+  const double exchanges = static_cast<double>(counters.exchanges);
+  std::fprintf(out, "{\n  \"config\": {\n");
+  std::fprintf(out, "    \"transport\": \"%s\",\n",
+               transportName(config.transport));
+  std::fprintf(out, "    \"pairs\": %zu,\n    \"threads\": %zu,\n", config.pairs,
+               config.threads);
+  std::fprintf(out, "    \"duration_ms\": %lld,\n",
+               static_cast<long long>(
+                   std::chrono::duration_cast<std::chrono::milliseconds>(
+                       config.duration)
+                       .count()));
+  std::fprintf(out, "    \"payloads\": [");
+  for (std::size_t i = 0; i < config.payloads.size(); ++i) {
+    std::fprintf(out, "%s{\"bytes\": %zu, \"weight\": %g}", i == 0 ? "" : ", ",
+                 config.payloads[i].bytes, config.payloads[i].weight);
+  }
+  std::fprintf(out, "],\n");
+  std::fprintf(out, "    \"stream_ratio\": %g,\n    \"error_rate\": %g,\n",
+               config.stream_ratio, config.error_rate);
+  std::fprintf(out, "    \"timeout_ms\": %lld,\n    \"seed\": %llu\n  },\n",
+               static_cast<long long>(
+                   std::chrono::duration_cast<std::chrono::milliseconds>(
+                       config.timeout)
+                       .count()),
+               static_cast<unsigned long long>(config.seed));
+  std::fprintf(out, "  \"results\": {\n");
+  std::fprintf(out, "    \"seconds\": %.6f,\n", results.seconds);
+  std::fprintf(out,
+               "    \"exchanges\": %llu,\n    \"failed\": %llu,\n"
+               "    \"timed_out\": %llu,\n    \"corrupted\": %llu,\n"
+               "    \"stream_samples\": %llu,\n",
+               static_cast<unsigned long long>(counters.exchanges),
+               static_cast<unsigned long long>(counters.failed),
+               static_cast<unsigned long long>(counters.timed_out),
+               static_cast<unsigned long long>(counters.corrupted),
+               static_cast<unsigned long long>(results.stream_samples));
+  std::fprintf(out,
+               "    \"exchanges_per_second\": %.1f,\n"
+               "    \"payload_bytes_per_second\": %.1f,\n",
+               exchanges / results.seconds,
+               static_cast<double>(counters.payload_bytes) / results.seconds);
+  std::fprintf(out,
+               "    \"latency_ns\": {\"mean\": %.0f, \"p50\": %llu, "
+               "\"p99\": %llu, \"p999\": %llu, \"max\": %llu},\n",
+               counters.latency.total == 0
+                   ? 0.0
+                   : static_cast<double>(counters.latency.sum) /
+                         static_cast<double>(counters.latency.total),
+               static_cast<unsigned long long>(counters.latency.percentile(0.5)),
+               static_cast<unsigned long long>(counters.latency.percentile(0.99)),
+               static_cast<unsigned long long>(counters.latency.percentile(0.999)),
+               static_cast<unsigned long long>(counters.latency.max));
+  std::fprintf(out,
+               "    \"cpu\": {\"user_seconds\": %.6f, \"system_seconds\": %.6f, "
+               "\"utilization\": %.3f},\n",
+               results.user_seconds, results.system_seconds,
+               (results.user_seconds + results.system_seconds) / results.seconds);
+  std::fprintf(out,
+               "    \"allocations\": {\"count\": %llu, \"bytes\": %llu, "
+               "\"per_exchange\": %.2f}\n",
+               static_cast<unsigned long long>(results.allocations),
+               static_cast<unsigned long long>(results.allocated_bytes),
+               exchanges == 0.0
+                   ? 0.0
+                   : static_cast<double>(results.allocations) / exchanges);
+  std::fprintf(out, "  }\n}\n");
+}
+
+static void printSummary(std::FILE *out, const Config &config,
+                         const Results &results) {
+  const Counters &counters = results.counters;
+  const double exchanges = static_cast<double>(counters.exchanges);
+  std::fprintf(out, "%s transport, %zu pairs on %zu threads, %.2f s\n",
+               transportName(config.transport), config.pairs, config.threads,
+               results.seconds);
+  std::fprintf(out, "%16s %16s %10s %10s %10s\n", "exchanges/s", "payload MB/s",
+               "failed", "timed out", "corrupted");
+  std::fprintf(out, "%16.0f %16.2f %10llu %10llu %10llu\n",
+               exchanges / results.seconds,
+               static_cast<double>(counters.payload_bytes) / results.seconds / 1e6,
+               static_cast<unsigned long long>(counters.failed),
+               static_cast<unsigned long long>(counters.timed_out),
+               static_cast<unsigned long long>(counters.corrupted));
+  std::fprintf(out, "%16s %16s %10s %10s %10s\n", "p50 us", "p99 us", "p99.9 us",
+               "max us", "streamed");
+  std::fprintf(out, "%16.1f %16.1f %10.1f %10.1f %10llu\n",
+               static_cast<double>(counters.latency.percentile(0.5)) / 1e3,
+               static_cast<double>(counters.latency.percentile(0.99)) / 1e3,
+               static_cast<double>(counters.latency.percentile(0.999)) / 1e3,
+               static_cast<double>(counters.latency.max) / 1e3,
+               static_cast<unsigned long long>(results.stream_samples));
+  std::fprintf(out, "%16s %16s %10s\n", "cpu", "allocs", "per exch");
+  std::fprintf(out, "%15.0f%% %16llu %10.2f\n",
+               100.0 * (results.user_seconds + results.system_seconds) /
+                   results.seconds,
+               static_cast<unsigned long long>(results.allocations),
+               exchanges == 0.0
+                   ? 0.0
+                   : static_cast<double>(results.allocations) / exchanges);
+}
+
+int main(int argc, char **argv) {
+  // Usage: ethernet_loadgen [--transport link|reliable|segment] [--pairs N]
+  //   [--threads N] [--duration ms] [--payload bytes[:weight],...]
+  //   [--stream-ratio r] [--error-rate ber] [--timeout ms] [--seed n]
+  //   [--json path|-] [--trace path]
+  Config config{};
+  try {
+    config = parseArgs(argc, argv);
+  } catch (const std::runtime_error &error) {
+    std::fprintf(stderr, "ethernet_loadgen: %s\n", error.what());
+    return 2;
+  }
+
+  // Topology
+  Segment segment;
+  std::vector<Pair> pairs(config.pairs);
+  for (std::size_t i = 0; i < config.pairs; ++i) {
+    Pair &pair = pairs[i];
+    pair.host_eth = std::make_unique<Driver>(
+        MacAddr{0x02, 0x00, 0x00, 0x00, static_cast<uint8_t>(i >> 8),
+                static_cast<uint8_t>(i)});
+    pair.dev_eth = std::make_unique<Driver>(
+        MacAddr{0x02, 0x00, 0x00, 0x01, static_cast<uint8_t>(i >> 8),
+                static_cast<uint8_t>(i)});
+    if (config.transport == Transport::SEGMENT) {
+      segment.attach(*pair.host_eth);
+      segment.attach(*pair.dev_eth);
+    } else {
+      Driver::link(*pair.host_eth, *pair.dev_eth);
+    }
+    if (config.transport == Transport::RELIABLE) {
+      pair.host_eth->setReliability({});
+      pair.dev_eth->setReliability({});
+    }
+    pair.host_eth->setBitErrorRate(config.error_rate);
+    pair.dev_eth->setBitErrorRate(config.error_rate);
+    pair.host = std::make_unique<Host>(*pair.host_eth);
+    pair.device = std::make_unique<Device>(*pair.dev_eth);
+    pair.host->onStream(StreamID::TELEMETRY,
+                        [&pair](Host &, const MsgView &) { ++pair.stream_samples; });
+  }
+
+  // Pairs are dealt to the threads in turn
+  std::vector<std::vector<Pair *>> shares(config.threads);
+  for (std::size_t i = 0; i < config.pairs; ++i) {
+    shares[i % config.threads].push_back(&pairs[i]);
+  }
+  std::vector<Counters> counters(config.threads);
+
+  if (!config.trace.empty()) {
+    Trace::start();
+  }
+  rusage usage_before{};
+  getrusage(RUSAGE_SELF, &usage_before);
+  const Alloc::Counts allocations_before = Alloc::process();
+  const Clock::time_point start = Clock::now();
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t i = 0; i < config.threads; ++i) {
+      threads.emplace_back(drive, std::cref(config), shares[i],
+                           start + config.duration, config.seed + i,
+                           std::ref(counters[i]));
+    }
+  }
+  const std::chrono::duration<double> elapsed = Clock::now() - start;
+  Trace::stop();
+  Results results{};
+  const Alloc::Counts allocations = Alloc::process() - allocations_before;
+  results.allocations = allocations.allocations;
+  results.allocated_bytes = allocations.bytes;
+  rusage usage_after{};
+  getrusage(RUSAGE_SELF, &usage_after);
+
+  results.seconds = elapsed.count();
+  results.user_seconds =
+      cpuSeconds(usage_after.ru_utime) - cpuSeconds(usage_before.ru_utime);
+  results.system_seconds =
+      cpuSeconds(usage_after.ru_stime) - cpuSeconds(usage_before.ru_stime);
+  for (const Counters &share : counters) {
+    results.counters.latency.merge(share.latency);
+    results.counters.exchanges += share.exchanges;
+    results.counters.payload_bytes += share.payload_bytes;
+    results.counters.failed += share.failed;
+    results.counters.timed_out += share.timed_out;
+    results.counters.corrupted += share.corrupted;
+  }
+  for (const Pair &pair : pairs) {
+    results.stream_samples += pair.stream_samples;
+  }
+
+  // JSON on stdout must be all that is there, so the summary goes aside
+  printSummary(config.json == "-" ? stderr : stdout, config, results);
+  if (config.json == "-") {
+    writeJson(stdout, config, results);
+  } else if (!config.json.empty()) {
+    std::FILE *out = std::fopen(config.json.c_str(), "w");
+    if (!out) {
+      std::fprintf(stderr, "ethernet_loadgen: cannot write %s\n",
+                   config.json.c_str());
+      return 1;
+    }
+    writeJson(out, config, results);
+    std::fclose(out);
+  }
+  if (!config.trace.empty()) {
+    std::FILE *out = std::fopen(config.trace.c_str(), "w");
+    if (!out) {
+      std::fprintf(stderr, "ethernet_loadgen: cannot write %s\n",
+                   config.trace.c_str());
+      return 1;
+    }
+    Trace::writeChrome(out);
+    std::fclose(out);
+  }
+  return 0;
+}
@@ -1,30 +1,75 @@
 #include "Protocol.hpp"
 #include "EthernetFrame.hpp"
+#include "EthernetTrace.hpp"
+#include <algorithm>
 #include <cstring>
 #include <limits>
+#include <optional>
 #include <stdexcept>
 
 namespace Protocol {
 
 /* Helper Functions */
+uint8_t packId(const MsgType t, const ID id) {
+  switch (t) {
+  case MsgType::RESPONSE:
+  case MsgType::COMMAND:
+    return static_cast<uint8_t>(id.cmd_id);
+  case MsgType::STREAM:
+    return static_cast<uint8_t>(id.stream_id);
+  case MsgType::ERROR:
+    return static_cast<uint8_t>(id.error_id);
+  default:
+    throw std::runtime_error("Unknown message type");
+  }
+}
+
+ID unpackId(const MsgType t, const uint8_t byte) {
+  ID id;
+  switch (t) {
+  case MsgType::RESPONSE:
+  case MsgType::COMMAND:
+    id.cmd_id = static_cast<CmdID>(byte);
+    break;
+  case MsgType::STREAM:
+    id.stream_id = static_cast<StreamID>(byte);
+    break;
+  case MsgType::ERROR:
+    id.error_id = static_cast<ErrorID>(byte);
+    break;
+  default:
+    throw std::runtime_error("Unknown message type");
+  }
+  return id;
+}
+
 std::vector<uint8_t> packMsg(const MsgType t, const ID id,
-                             const std::vector<uint8_t> &data) {
+                             const std::vector<uint8_t> &data,
+                             const CorrID corr) {
+  std::vector<uint8_t> bytes(packedLen(data.size()));
+  packMsgInto(bytes, t, id, data, corr);
+  return bytes;
+}
+
+std::size_t packedLen(const std::size_t data_len) {
   // Size check
-  if (std::numeric_limits<uint16_t>::max() < data.size()) {
+  if (std::numeric_limits<uint16_t>::max() < data_len) {
     throw std::runtime_error(
         "Attempt to pack message with more data than allowed");
   }
+  return std::max(MSG_LEN_MIN + data_len, Ethernet::Frame::PAYLOAD_LEN_MIN);
+}
 
+std::span<uint8_t> packHeaderInto(std::span<uint8_t> out, const MsgType t,
+                                  const ID id, const std::size_t data_len,
+                                  const CorrID corr) {
   // Buffer size
-  const std::size_t size_total = MSG_LEN_MIN + data.size();
-  const std::size_t size_padding =
-      size_total < Ethernet::Frame::PAYLOAD_LEN_MIN
-          ? Ethernet::Frame::PAYLOAD_LEN_MIN - size_total
-          : 0;
-
-  // Create buffer
-  std::vector<uint8_t> bytes(size_total + size_padding);
-  auto iter = bytes.begin();
+  const std::size_t size_total = packedLen(data_len);
+  const std::size_t size_padding = size_total - MSG_LEN_MIN - data_len;
+  if (out.size() != size_total) {
+    throw std::runtime_error("Pack buffer does not match packed length");
+  }
+  auto iter = out.begin();
 
   // Pack message type
   *(iter++) = static_cast<uint8_t>(t);
@@ -41,24 +86,51 @@ std::vector<uint8_t> packMsg(const MsgType t, const ID id,
   case MsgType::ERROR:
     *(iter++) = static_cast<uint8_t>(id.error_id);
     break;
+  case MsgType::FRAGMENT:
+  case MsgType::BATCH:
+    // The inner message ids are carried in the fragment header or records
+    *(iter++) = 0x00;
+    break;
   default:
     throw std::runtime_error("Unknown message type");
     break;
   }
 
   // Pack message length
-  *(iter++) = static_cast<uint16_t>(data.size()) & 0xff;
-  *(iter++) = (static_cast<uint16_t>(data.size()) >> 8) & 0xff;
+  *(iter++) = static_cast<uint16_t>(data_len) & 0xff;
+  *(iter++) = (static_cast<uint16_t>(data_len) >> 8) & 0xff;
 
-  // Pack message data
+  // Pack correlation id
+  *(iter++) = static_cast<uint16_t>(corr) & 0xff;
+  *(iter++) = (static_cast<uint16_t>(corr) >> 8) & 0xff;
+
+  // Pack padding
   std::fill_n(iter, size_padding, 0x00);
-  iter += size_padding;
-  std::copy(data.begin(), data.end(), iter);
+  return out.last(data_len);
+}
 
-  return bytes;
+void packMsgInto(std::span<uint8_t> out, const MsgType t, const ID id,
+                 std::span<const uint8_t> data, const CorrID corr) {
+  ETHERNET_TRACE_SPAN("msg.pack");
+  const std::span<uint8_t> region =
+      packHeaderInto(out, t, id, data.size(), corr);
+  std::copy(data.begin(), data.end(), region.begin());
+}
+
+void sendMsg(Driver &driver, const MsgType t, const ID id,
+             std::span<const uint8_t> data, const CorrID corr) {
+  sendMsg(driver, driver.getPeerMacAddr(), t, id, data, corr);
+}
+
+void sendMsg(Driver &driver, const MacAddr &dst, const MsgType t, const ID id,
+             std::span<const uint8_t> data, const CorrID corr) {
+  std::vector<uint8_t> frame = driver.reserve(packedLen(data.size()));
+  packMsgInto(driver.payloadOf(frame), t, id, data, corr);
+  driver.sendReservedTo(std::move(frame), dst);
 }
 
 Msg unpackMsg(const std::vector<uint8_t> &bytes) {
+  ETHERNET_TRACE_SPAN("msg.unpack");
   Msg msg;
   auto iter = bytes.begin();
   if (bytes.size() < MSG_LEN_MIN) {
@@ -80,6 +152,11 @@ Msg unpackMsg(const std::vector<uint8_t> &bytes) {
   case MsgType::ERROR:
     msg.header.id.error_id = static_cast<ErrorID>(*(iter++));
     break;
+  case MsgType::FRAGMENT:
+  case MsgType::BATCH:
+    msg.header.id = ID{};
+    ++iter;
+    break;
   default:
     throw std::runtime_error("Unknown message type");
     break;
@@ -90,6 +167,11 @@ Msg unpackMsg(const std::vector<uint8_t> &bytes) {
                    (static_cast<uint16_t>(*(iter + 1) << 8));
   iter += sizeof(msg.header.len);
 
+  // Copy correlation id
+  msg.header.corr = static_cast<CorrID>((static_cast<uint16_t>(*iter)) |
+                                        (static_cast<uint16_t>(*(iter + 1) << 8)));
+  iter += sizeof(msg.header.corr);
+
   // Check message length
   if (bytes.size() - MSG_LEN_MIN < msg.header.len) {
     throw std::runtime_error("Message length longer than remaining data bytes");
@@ -105,4 +187,67 @@ Msg unpackMsg(const std::vector<uint8_t> &bytes) {
   return msg;
 }
 
+namespace {
+
+/* Reads the stream a SET_ENCODING response switches, from a wire-format
+ * frame. The device encodes only what it sends after that response, so the
+ * response must be received in order with the stream.
+ * @return The stream, nothing for any other frame
+ */
+std::optional<StreamID> encodingSwitchOf(std::span<const uint8_t> frame) {
+  constexpr std::size_t TYPE_AT = Ethernet::Frame::HEADER_LEN;
+  if (frame.size() < TYPE_AT + MSG_LEN_MIN + Ethernet::Frame::CRC_LEN ||
+      static_cast<MsgType>(frame[TYPE_AT]) != MsgType::RESPONSE ||
+      static_cast<CmdID>(frame[TYPE_AT + 1]) != CmdID::SET_ENCODING) {
+    return std::nullopt;
+  }
+  // The data sits at the end of the message, just before the CRC32
+  const std::size_t len = frame[TYPE_AT + 2] | (frame[TYPE_AT + 3] << 8);
+  const std::size_t end = frame.size() - Ethernet::Frame::CRC_LEN;
+  if (len == 0 || end < TYPE_AT + MSG_LEN_MIN + len) {
+    return std::nullopt;
+  }
+  return static_cast<StreamID>(frame[end - len]);
+}
+
+} // namespace
+
+uint8_t trafficClass(std::span<const uint8_t> frame) {
+  if (frame.size() <= Ethernet::Frame::HEADER_LEN) {
+    return BULK_CLASS;
+  }
+  // Kept behind the stream samples it must not overtake
+  if (encodingSwitchOf(frame)) {
+    return BULK_CLASS;
+  }
+  switch (static_cast<MsgType>(frame[Ethernet::Frame::HEADER_LEN])) {
+  case MsgType::COMMAND:
+  case MsgType::RESPONSE:
+  case MsgType::ERROR:
+    return CONTROL_CLASS;
+  default:
+    return BULK_CLASS;
+  }
+}
+
+uint32_t flowKey(std::span<const uint8_t> frame) {
+  constexpr std::size_t TYPE_AT = Ethernet::Frame::HEADER_LEN;
+  if (frame.size() <= TYPE_AT + sizeof(ID)) {
+    return 0;
+  }
+  // Joins the flow of the stream it switches, so it stays in order with it
+  if (const std::optional<StreamID> stream_id = encodingSwitchOf(frame)) {
+    return (uint32_t{static_cast<uint8_t>(MsgType::STREAM)} << 8) |
+           static_cast<uint8_t>(*stream_id);
+  }
+  return (uint32_t{frame[TYPE_AT]} << 8) | frame[TYPE_AT + 1];
+}
+
+uint8_t demuxKey(std::span<const uint8_t> frame) {
+  if (frame.size() <= Ethernet::Frame::HEADER_LEN) {
+    return 0;
+  }
+  return frame[Ethernet::Frame::HEADER_LEN];
+}
+
 } // namespace Protocol
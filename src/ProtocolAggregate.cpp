@@ -0,0 +1,293 @@
+#include "ProtocolAggregate.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+namespace Protocol {
+
+namespace {
+
+// Tick of a bucket that has never been used
+constexpr int64_t EMPTY = -1;
+// Tick of a bucket a writer is clearing for reuse
+constexpr int64_t CLEARING = std::numeric_limits<int64_t>::min();
+
+constexpr std::size_t SUB_SHIFT = std::countr_zero(Aggregator::SUB_BINS);
+
+} // namespace
+
+/* Series */
+// One stream's ring of buckets, each field a column indexed by bucket
+struct Aggregator::Series {
+  explicit Series(const std::size_t buckets)
+      : ticks(buckets), counts(buckets), sums(buckets), mins(buckets),
+        maxs(buckets), bins(buckets * BINS) {
+    for (std::atomic<int64_t> &tick : this->ticks) {
+      tick.store(EMPTY, std::memory_order_relaxed);
+    }
+  }
+
+  /* Makes a bucket hold a tick, clearing it if it held an older one
+   * @return False if the bucket already holds a newer tick
+   */
+  bool claim(const std::size_t i, const int64_t tick) {
+    int64_t seen = this->ticks[i].load(std::memory_order_acquire);
+    while (seen != tick) {
+      if (seen == CLEARING) {
+        std::this_thread::yield();
+        seen = this->ticks[i].load(std::memory_order_acquire);
+      } else if (tick < seen) {
+        return false;
+      } else if (this->ticks[i].compare_exchange_weak(seen, CLEARING,
+                                                      std::memory_order_acquire)) {
+        this->counts[i].store(0, std::memory_order_relaxed);
+        this->sums[i].store(0, std::memory_order_relaxed);
+        this->mins[i].store(UINT32_MAX, std::memory_order_relaxed);
+        this->maxs[i].store(0, std::memory_order_relaxed);
+        for (std::size_t bin = 0; bin < BINS; ++bin) {
+          this->bins[i * BINS + bin].store(0, std::memory_order_relaxed);
+        }
+        this->ticks[i].store(tick, std::memory_order_release);
+        return true;
+      }
+    }
+    return true;
+  }
+
+  void lower(const std::size_t i, const uint32_t value) {
+    uint32_t current = this->mins[i].load(std::memory_order_relaxed);
+    while (value < current &&
+           !this->mins[i].compare_exchange_weak(current, value,
+                                                std::memory_order_relaxed)) {
+    }
+  }
+
+  void raise(const std::size_t i, const uint32_t value) {
+    uint32_t current = this->maxs[i].load(std::memory_order_relaxed);
+    while (current < value &&
+           !this->maxs[i].compare_exchange_weak(current, value,
+                                                std::memory_order_relaxed)) {
+    }
+  }
+
+  std::vector<std::atomic<int64_t>> ticks;
+  std::vector<std::atomic<uint64_t>> counts;
+  std::vector<std::atomic<uint64_t>> sums;
+  std::vector<std::atomic<uint32_t>> mins;
+  std::vector<std::atomic<uint32_t>> maxs;
+  std::vector<std::atomic<uint32_t>> bins;
+};
+
+/* Aggregator */
+Aggregator::Aggregator(const Config &config) : config(config) {
+  if (config.bucket_width <= Clock::duration::zero() || config.buckets == 0) {
+    throw std::runtime_error("Aggregator needs a bucket width and buckets");
+  }
+}
+
+Aggregator::Aggregator() : Aggregator(Config{}) {}
+
+Aggregator::~Aggregator() {
+  for (std::atomic<Series *> &stream : this->streams) {
+    delete stream.load();
+  }
+}
+
+void Aggregator::add(const StreamID stream_id, const Clock::time_point time,
+                     const uint32_t value) {
+  Series &series = this->series(stream_id);
+  const int64_t tick = this->tickOf(time);
+  const std::size_t i = static_cast<uint64_t>(tick) % this->config.buckets;
+  if (!series.claim(i, tick)) {
+    this->late.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  series.counts[i].fetch_add(1, std::memory_order_relaxed);
+  series.sums[i].fetch_add(value, std::memory_order_relaxed);
+  series.lower(i, value);
+  series.raise(i, value);
+  series.bins[i * BINS + binOf(value)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Aggregator::add(const StreamID stream_id, const Clock::time_point time,
+                     const std::span<const uint32_t> values) {
+  if (values.empty()) {
+    return;
+  }
+  Series &series = this->series(stream_id);
+  const int64_t tick = this->tickOf(time);
+  const std::size_t i = static_cast<uint64_t>(tick) % this->config.buckets;
+  if (!series.claim(i, tick)) {
+    this->late.fetch_add(values.size(), std::memory_order_relaxed);
+    return;
+  }
+
+  // Plain reductions the compiler can vectorize
+  uint64_t sum = 0;
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  for (const uint32_t value : values) {
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+  }
+  series.counts[i].fetch_add(values.size(), std::memory_order_relaxed);
+  series.sums[i].fetch_add(sum, std::memory_order_relaxed);
+  series.lower(i, min);
+  series.raise(i, max);
+  for (const uint32_t value : values) {
+    series.bins[i * BINS + binOf(value)].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+Aggregator::Summary Aggregator::sliding(const StreamID stream_id,
+                                        const Clock::duration span,
+                                        const Clock::time_point now) const {
+  const int64_t last = this->tickOf(now);
+  const auto width = this->config.bucket_width;
+  const int64_t count = std::clamp<int64_t>((span + width - Clock::duration(1)) / width,
+                                            1, static_cast<int64_t>(this->config.buckets));
+  const int64_t first = last - count + 1;
+  return this->merge(stream_id, first, last,
+                     now.time_since_epoch() - first * width);
+}
+
+Aggregator::Summary Aggregator::tumbling(const StreamID stream_id,
+                                         const Clock::duration width,
+                                         const Clock::time_point now) const {
+  const auto bucket_width = this->config.bucket_width;
+  // The window and the one filling after it must both fit in the ring
+  if (width <= Clock::duration::zero() || width % bucket_width != Clock::duration::zero() ||
+      this->config.buckets < 2 * static_cast<std::size_t>(width / bucket_width)) {
+    throw std::runtime_error(
+        "Tumbling window must be whole buckets within half the history");
+  }
+  const int64_t count = width / bucket_width;
+  const int64_t current = this->tickOf(now);
+  const int64_t start = current - current % count;
+  return this->merge(stream_id, start - count, start - 1, width);
+}
+
+Aggregator::Stats Aggregator::getStats() const {
+  return Stats{this->late.load(std::memory_order_relaxed)};
+}
+
+std::size_t Aggregator::binOf(const uint32_t value) {
+  if (value < 2 * SUB_BINS) {
+    return value;
+  }
+  // The top bits below the leading one pick the sub-bin within its octave
+  const auto exponent = static_cast<std::size_t>(std::bit_width(value)) - 1;
+  const std::size_t sub = (value >> (exponent - SUB_SHIFT)) & (SUB_BINS - 1);
+  return 2 * SUB_BINS + (exponent - SUB_SHIFT - 1) * SUB_BINS + sub;
+}
+
+uint32_t Aggregator::binValue(const std::size_t bin) {
+  if (bin < 2 * SUB_BINS) {
+    return static_cast<uint32_t>(bin);
+  }
+  const std::size_t exponent = (bin - 2 * SUB_BINS) / SUB_BINS + SUB_SHIFT + 1;
+  const std::size_t sub = (bin - 2 * SUB_BINS) % SUB_BINS;
+  const std::size_t shift = exponent - SUB_SHIFT;
+  return static_cast<uint32_t>(((SUB_BINS + sub) << shift) +
+                               (std::size_t{1} << (shift - 1)));
+}
+
+Aggregator::Series &Aggregator::series(const StreamID stream_id) {
+  std::atomic<Series *> &slot = this->streams[static_cast<uint8_t>(stream_id)];
+  Series *series = slot.load(std::memory_order_acquire);
+  if (!series) {
+    // Racing first samples each build one, and all but the first are freed
+    auto fresh = std::make_unique<Series>(this->config.buckets);
+    if (slot.compare_exchange_strong(series, fresh.get(),
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_acquire)) {
+      series = fresh.release();
+    }
+  }
+  return *series;
+}
+
+Aggregator::Summary Aggregator::merge(const StreamID stream_id, int64_t first,
+                                      const int64_t last,
+                                      const Clock::duration elapsed) const {
+  Summary summary{};
+  const Series *series =
+      this->streams[static_cast<uint8_t>(stream_id)].load(std::memory_order_acquire);
+  if (!series) {
+    return summary;
+  }
+  const auto buckets = static_cast<int64_t>(this->config.buckets);
+  first = std::max({first, last - buckets + 1, int64_t{0}});
+
+  uint64_t sum = 0;
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  std::array<uint64_t, BINS> merged{};
+  std::array<uint32_t, BINS> bucket{};
+  for (int64_t tick = first; tick <= last; ++tick) {
+    const std::size_t i = static_cast<uint64_t>(tick) % this->config.buckets;
+    if (series->ticks[i].load(std::memory_order_acquire) != tick) {
+      continue;
+    }
+    const uint64_t count = series->counts[i].load(std::memory_order_relaxed);
+    const uint64_t bucket_sum = series->sums[i].load(std::memory_order_relaxed);
+    const uint32_t bucket_min = series->mins[i].load(std::memory_order_relaxed);
+    const uint32_t bucket_max = series->maxs[i].load(std::memory_order_relaxed);
+    for (std::size_t bin = 0; bin < BINS; ++bin) {
+      bucket[bin] = series->bins[i * BINS + bin].load(std::memory_order_relaxed);
+    }
+    // Skip the bucket if a writer reused it while it was read
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (series->ticks[i].load(std::memory_order_relaxed) != tick || count == 0) {
+      continue;
+    }
+    summary.count += count;
+    sum += bucket_sum;
+    min = std::min(min, bucket_min);
+    max = std::max(max, bucket_max);
+    for (std::size_t bin = 0; bin < BINS; ++bin) {
+      merged[bin] += bucket[bin];
+    }
+  }
+  if (summary.count == 0) {
+    return summary;
+  }
+
+  summary.min = min;
+  summary.max = max;
+  summary.mean = static_cast<double>(sum) / static_cast<double>(summary.count);
+  summary.rate = static_cast<double>(summary.count) /
+                 std::chrono::duration<double>(elapsed).count();
+
+  // Bins are counted as they are read, so use their total for ranks
+  uint64_t total = 0;
+  for (const uint64_t count : merged) {
+    total += count;
+  }
+  auto quantile = [&](const double q) {
+    const auto rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(total))));
+    uint64_t seen = 0;
+    for (std::size_t bin = 0; bin < BINS; ++bin) {
+      seen += merged[bin];
+      if (rank <= seen) {
+        return std::clamp(binValue(bin), min, max);
+      }
+    }
+    return max;
+  };
+  summary.p50 = quantile(0.50);
+  summary.p90 = quantile(0.90);
+  summary.p99 = quantile(0.99);
+  return summary;
+}
+
+int64_t Aggregator::tickOf(const Clock::time_point time) const {
+  return time.time_since_epoch() / this->config.bucket_width;
+}
+
+} // namespace Protocol
@@ -0,0 +1,160 @@
+#include "ProtocolBatch.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Protocol {
+
+/* Coalescer */
+Coalescer::Coalescer(Driver &driver, const Config &config)
+    : driver(driver), config(config) {
+  if (Ethernet::Frame::PAYLOAD_LEN_MAX < config.max_len ||
+      config.max_len < Ethernet::Frame::PAYLOAD_LEN_MIN) {
+    throw std::runtime_error("Batch length outside Ethernet payload bounds");
+  }
+}
+
+bool Coalescer::append(const MsgType t, const ID id,
+                       std::span<const uint8_t> data,
+                       const Clock::time_point now) {
+  const std::size_t record_len = MSG_LEN_MIN + data.size();
+  const std::size_t max_len = std::min(this->config.max_len, this->driver.mtu());
+
+  // Records that could never share a frame keep their original framing
+  if (max_len < MSG_LEN_MIN + record_len) {
+    this->flush();
+    return false;
+  }
+  if (max_len < MSG_LEN_MIN + this->used + record_len) {
+    this->flush();
+  }
+
+  // Records are staged after the BATCH header's position in the frame, so
+  // flush only has to fill in the header
+  if (this->frame.empty()) {
+    this->frame = this->driver.reserve(max_len);
+    this->deadline = now + this->config.max_delay;
+  }
+  auto iter = this->driver.payloadOf(this->frame).begin() + MSG_LEN_MIN +
+              this->used;
+  *(iter++) = static_cast<uint8_t>(t);
+  *(iter++) = packId(t, id);
+  *(iter++) = static_cast<uint16_t>(data.size()) & 0xff;
+  *(iter++) = (static_cast<uint16_t>(data.size()) >> 8) & 0xff;
+  // Batched records are never replies, so they carry no correlation id
+  *(iter++) = static_cast<uint16_t>(CorrID::NONE) & 0xff;
+  *(iter++) = (static_cast<uint16_t>(CorrID::NONE) >> 8) & 0xff;
+  std::copy(data.begin(), data.end(), iter);
+  this->used += record_len;
+  ++this->records;
+  return true;
+}
+
+bool Coalescer::flushIfDue(const Clock::time_point now) {
+  if (this->records == 0 || now < this->deadline) {
+    return false;
+  }
+  this->flush();
+  return true;
+}
+
+void Coalescer::flush() {
+  if (this->records == 0) {
+    return;
+  }
+
+  // Short batches are padded at the front like any other message, so the
+  // staged records are shifted back to make room
+  const std::size_t payload_len = packedLen(this->used);
+  const std::size_t padding = payload_len - MSG_LEN_MIN - this->used;
+  auto records_begin = this->driver.payloadOf(this->frame).begin() + MSG_LEN_MIN;
+  if (padding != 0) {
+    std::copy_backward(records_begin, records_begin + this->used,
+                       records_begin + padding + this->used);
+  }
+
+  // Trim the frame to the batch and fill in the header
+  const std::size_t headroom = Ethernet::Frame::PAYLOAD_LEN_MAX - this->driver.mtu();
+  this->frame.resize(Ethernet::Frame::HEADER_LEN + headroom + payload_len +
+                     Ethernet::Frame::CRC_LEN);
+  packHeaderInto(this->driver.payloadOf(this->frame), MsgType::BATCH, ID{},
+                 this->used);
+  this->driver.sendReserved(std::move(this->frame));
+  this->frame.clear();
+  this->used = 0;
+  this->records = 0;
+}
+
+std::size_t Coalescer::pending() const {
+  return this->records;
+}
+
+std::optional<Coalescer::Clock::time_point> Coalescer::nextDeadline() const {
+  if (this->records == 0) {
+    return std::nullopt;
+  }
+  return this->deadline;
+}
+
+/* BatchView */
+BatchView::BatchView(std::span<const uint8_t> data) : data(data) {}
+
+BatchView::Iterator BatchView::begin() const {
+  return Iterator(this->data);
+}
+
+BatchView::Iterator BatchView::end() const {
+  return Iterator(this->data.last(0));
+}
+
+BatchView::Iterator::Iterator(std::span<const uint8_t> remaining)
+    : remaining(remaining) {
+  this->decode();
+}
+
+BatchView::Iterator::reference BatchView::Iterator::operator*() const {
+  return this->current;
+}
+
+BatchView::Iterator::pointer BatchView::Iterator::operator->() const {
+  return &this->current;
+}
+
+BatchView::Iterator &BatchView::Iterator::operator++() {
+  this->remaining =
+      this->remaining.subspan(MSG_LEN_MIN + this->current.data.size());
+  this->decode();
+  return *this;
+}
+
+BatchView::Iterator BatchView::Iterator::operator++(int) {
+  Iterator prev = *this;
+  ++(*this);
+  return prev;
+}
+
+void BatchView::Iterator::decode() {
+  if (this->remaining.empty()) {
+    return;
+  }
+  if (this->remaining.size() < MSG_LEN_MIN) {
+    throw std::runtime_error("Batch record shorter than message header");
+  }
+
+  // Batches only ever carry plain messages
+  auto iter = this->remaining.begin();
+  this->current.header.type = static_cast<MsgType>(*(iter++));
+  this->current.header.id = unpackId(this->current.header.type, *(iter++));
+  this->current.header.len = (static_cast<uint16_t>(*iter)) |
+                             (static_cast<uint16_t>(*(iter + 1) << 8));
+  iter += sizeof(this->current.header.len);
+  this->current.header.corr =
+      static_cast<CorrID>((static_cast<uint16_t>(*iter)) |
+                          (static_cast<uint16_t>(*(iter + 1) << 8)));
+  if (this->remaining.size() - MSG_LEN_MIN < this->current.header.len) {
+    throw std::runtime_error("Batch record longer than remaining data bytes");
+  }
+  this->current.data =
+      this->remaining.subspan(MSG_LEN_MIN, this->current.header.len);
+}
+
+} // namespace Protocol
@@ -1,94 +1,278 @@
 #include "ProtocolDevice.hpp"
 #include "Protocol.hpp"
+#include "EthernetTrace.hpp"
 #include <stdexcept>
 
 namespace Protocol {
 /* Device */
-Device::Device(Driver &driver) : driver(driver) {}
+Device::Device(Driver &driver) : driver(driver) {
+  // Built-in commands, applications may replace or extend these
+  this->commands.bind<&Device::handlePing>(CmdID::PING);
+  this->commands.bind<&Device::handleStartStream>(CmdID::START_STREAM);
+  this->commands.bind<&Device::handleStopStream>(CmdID::STOP_STREAM);
+  this->commands.bind<&Device::handleSetEncoding>(CmdID::SET_ENCODING);
+  this->commands.bind<&Device::handleDiscover>(CmdID::DISCOVER);
+  this->commands.fallback<&Device::handleUnknown>();
+
+  // Built-in telemetry counter stream
+  StreamScheduler::StreamConfig telemetry;
+  telemetry.id = StreamID::TELEMETRY;
+  telemetry.rate_hz = 1000.0;
+  telemetry.producer = &Device::produceTelemetry;
+  this->streams.add(telemetry);
+}
+
+bool Device::poll(const StreamScheduler::Clock::time_point now) {
+  this->polled_at = now;
 
-bool Device::poll() {
   // Check for any received commands
   std::vector<uint8_t> bytes{};
-  if (this->driver.recv(bytes)) {
+  MacAddr src{};
+  if (this->driver.recv(bytes, src)) {
+    // Answers and streams go to whichever host last sent a command, so a
+    // device on a shared segment learns its host like an ARP cache would
+    this->driver.setPeerMacAddr(src);
     const Msg msg = Protocol::unpackMsg(bytes);
-    // Handler dispatch
-    switch (msg.header.type) {
-    case MsgType::COMMAND:
-      this->handleCommand(msg);
-      break;
-    case MsgType::RESPONSE:
-      throw std::runtime_error("Device received response");
-    case MsgType::STREAM:
-      throw std::runtime_error("Device received stream");
-    case MsgType::ERROR:
-      throw std::runtime_error("Device received error");
-    default:
-      throw std::runtime_error("Unrecognized message type");
+    if (msg.header.type == MsgType::BATCH) {
+      for (const MsgView &record : BatchView(msg.data)) {
+        this->dispatch(record);
+      }
+    } else if (msg.header.type != MsgType::FRAGMENT) {
+      this->dispatch(MsgView{msg.header, msg.data});
+    } else if (Msg whole; this->reassembler.push(msg, whole, now)) {
+      this->dispatch(MsgView{whole.header, whole.data});
     }
   }
 
-  // Send stream data if enabled
-  static uint32_t num_frames_sent = 0;
-  if(this->send_stream){
-    std::vector<uint8_t> payload;
-    payload.resize(sizeof(num_frames_sent));
-    for(std::size_t i = 0; i < sizeof(num_frames_sent); ++i){
-      payload[i] = static_cast<uint8_t>((num_frames_sent >> (i*8)) & 0xff);
-    }
-    this->sendStream(StreamID::TELEMETRY, payload);
-    ++num_frames_sent;
+  // Send stream data that is due
+  this->streams.poll(
+      [this](const StreamID id, const std::vector<uint8_t> &sample) {
+        this->emitSample(id, sample);
+      },
+      now);
+  this->flushBlock();
+  if (this->coalescer) {
+    this->coalescer->flushIfDue(now);
   }
 
   return true;
 }
 
+void Device::addStream(const StreamScheduler::StreamConfig &config,
+                       const StreamScheduler::Clock::time_point now) {
+  this->streams.add(config, now);
+}
+
+bool Device::enableStream(const StreamID stream_id, const bool enable,
+                          const StreamScheduler::Clock::time_point now) {
+  return this->streams.enable(stream_id, enable, now);
+}
+
+bool Device::setStreamEncoding(const StreamID stream_id,
+                               const Encoding encoding) {
+  if (!this->streams.contains(stream_id)) {
+    return false;
+  }
+  this->encodings[static_cast<uint8_t>(stream_id)] = encoding;
+  return true;
+}
+
+std::optional<StreamScheduler::Clock::time_point> Device::nextDeadline() const {
+  std::optional<StreamScheduler::Clock::time_point> next =
+      this->streams.nextDeadline();
+  if (this->coalescer) {
+    if (const auto flush = this->coalescer->nextDeadline();
+        flush && (!next || *flush < *next)) {
+      next = flush;
+    }
+  }
+  return next;
+}
+
+Runtime::Task Device::run(Runtime::Scheduler &scheduler) {
+  while (!scheduler.stopping()) {
+    co_await scheduler.readable(
+        this->driver,
+        this->nextDeadline().value_or(StreamScheduler::Clock::time_point::max()));
+
+    // Drain everything that arrived, sampling streams on the same clock
+    const StreamScheduler::Clock::time_point now = StreamScheduler::Clock::now();
+    do {
+      this->poll(now);
+    } while (this->driver.hasPending());
+  }
+}
+
+Runtime::Simulation::Endpoint Device::simulate() {
+  return Runtime::Simulation::Endpoint{
+      &this->driver, [this](const StreamScheduler::Clock::time_point now) {
+        do {
+          this->poll(now);
+        } while (this->driver.hasPending());
+        return this->nextDeadline();
+      }};
+}
+
+void Device::setStreamCoalescing(const Coalescer::Config &config) {
+  if (this->coalescer) {
+    this->coalescer->flush();
+  }
+  this->coalescer.emplace(this->driver, config);
+}
+
+void Device::dispatch(const MsgView &msg) {
+  ETHERNET_TRACE_SPAN("msg.handle");
+  // Handler dispatch
+  switch (msg.header.type) {
+  case MsgType::COMMAND:
+    // Responses and errors sent by the handler echo the command's correlation
+    // id, so handlers do not need to know about requests
+    this->replying_to = msg.header.corr;
+    try {
+      this->commands(msg.header.id.cmd_id, *this, msg);
+    } catch (...) {
+      this->replying_to = CorrID::NONE;
+      throw;
+    }
+    this->replying_to = CorrID::NONE;
+    break;
+  case MsgType::RESPONSE:
+    throw std::runtime_error("Device received response");
+  case MsgType::STREAM:
+    throw std::runtime_error("Device received stream");
+  case MsgType::ERROR:
+    throw std::runtime_error("Device received error");
+  default:
+    throw std::runtime_error("Unrecognized message type");
+  }
+}
+
+void Device::emitSample(const StreamID stream_id,
+                        const std::vector<uint8_t> &sample) {
+  const Encoding encoding = this->encodings[static_cast<uint8_t>(stream_id)];
+  if (encoding == Encoding::RAW) {
+    this->sendStream(stream_id, sample);
+    return;
+  }
+  if (sample.size() != WIRE_LEN<BlockSample>) {
+    throw std::runtime_error("Encoded streams need 4-byte samples");
+  }
+
+  // The scheduler emits each stream's samples together, so a block only
+  // holds one stream
+  if (stream_id != this->block_id || this->block.size() == BLOCK_SAMPLES_MAX) {
+    this->flushBlock();
+  }
+  this->block_id = stream_id;
+  this->block.push_back(unpack<BlockSample>(sample).value);
+}
+
+void Device::flushBlock() {
+  if (this->block.empty()) {
+    return;
+  }
+  encodeBlock(this->encodings[static_cast<uint8_t>(this->block_id)], this->block,
+              this->encoded);
+  this->block.clear();
+  this->sendStream(this->block_id, this->encoded);
+}
+
 void Device::sendResponse(const CmdID cmd_id,
                           const std::vector<uint8_t> &data) {
+  this->sendResponseData(cmd_id, data);
+}
+
+void Device::sendResponseData(const CmdID cmd_id,
+                              std::span<const uint8_t> data) {
   ID id;
   id.cmd_id = cmd_id;
-  const std::vector<uint8_t> bytes = packMsg(MsgType::RESPONSE, id, data);
-  this->driver.send(bytes);
+  if (this->coalescer) {
+    this->coalescer->flush();
+  }
+  sendMsg(this->driver, MsgType::RESPONSE, id, data, this->frag_id,
+          this->replying_to);
 }
 
 void Device::sendStream(const StreamID stream_id,
                         const std::vector<uint8_t> &data) {
+  this->sendStreamData(stream_id, data);
+}
+
+void Device::sendStreamData(const StreamID stream_id,
+                            std::span<const uint8_t> data) {
   ID id;
   id.stream_id = stream_id;
-  const std::vector<uint8_t> bytes = packMsg(MsgType::STREAM, id, data);
-  this->driver.send(bytes);
+  // Batches start on the poll's clock, which is simulated time in a simulation
+  if (this->coalescer &&
+      this->coalescer->append(MsgType::STREAM, id, data, this->polled_at)) {
+    return;
+  }
+  sendMsg(this->driver, MsgType::STREAM, id, data, this->frag_id);
 }
 
 void Device::sendError(const ErrorID error_id) {
   ID id;
   id.error_id = error_id;
-  const std::vector<uint8_t> bytes = packMsg(MsgType::ERROR, id, {});
-  this->driver.send(bytes);
+  if (this->coalescer) {
+    this->coalescer->flush();
+  }
+  sendMsg(this->driver, MsgType::ERROR, id, {}, this->replying_to);
 }
 
-void Device::handleCommand(const Msg &msg) {
-  const CmdID id = msg.header.id.cmd_id;
-  switch (msg.header.id.cmd_id) {
-    case CmdID::PING: {
-      const std::vector<uint8_t> pong = {'P','O','N','G'};
-      sendResponse(id, pong);
-      break;
-    }
-    case CmdID::START_STREAM: {
-      this->send_stream = true;
-      const std::vector<uint8_t> ok = {'O','K'};
-      sendResponse(id, ok);
-      break;
-    }
-    case CmdID::STOP_STREAM: {
-      this->send_stream = false;
-      const std::vector<uint8_t> ok = {'O','K'};
-      sendResponse(id, ok);
-      break;
-    }
-    default:
-      this->sendError(ErrorID::UNKNOWN_CMD);
-      break;
+void Device::handlePing(Device &dev, const MsgView &msg) {
+  const std::vector<uint8_t> pong = {'P','O','N','G'};
+  dev.sendResponse(msg.header.id.cmd_id, pong);
+}
+
+void Device::handleStartStream(Device &dev, const MsgView &msg) {
+  // An empty payload selects the built-in telemetry stream
+  const StreamID stream_id =
+      msg.data.empty() ? StreamID::TELEMETRY : static_cast<StreamID>(msg.data[0]);
+  if (!dev.enableStream(stream_id, true, dev.polled_at)) {
+    dev.sendError(ErrorID::BAD_PAYLOAD);
+    return;
+  }
+  const std::vector<uint8_t> ok = {'O','K'};
+  dev.sendResponse(msg.header.id.cmd_id, ok);
+}
+
+void Device::handleStopStream(Device &dev, const MsgView &msg) {
+  const StreamID stream_id =
+      msg.data.empty() ? StreamID::TELEMETRY : static_cast<StreamID>(msg.data[0]);
+  if (!dev.enableStream(stream_id, false, dev.polled_at)) {
+    dev.sendError(ErrorID::BAD_PAYLOAD);
+    return;
+  }
+  const std::vector<uint8_t> ok = {'O','K'};
+  dev.sendResponse(msg.header.id.cmd_id, ok);
+}
+
+void Device::handleSetEncoding(Device &dev, const MsgView &msg) {
+  if (msg.data.size() != WIRE_LEN<EncodingSelect>) {
+    dev.sendError(ErrorID::BAD_PAYLOAD);
+    return;
   }
+  const auto select = unpack<EncodingSelect>(msg.data);
+  if (!isEncoding(static_cast<uint8_t>(select.encoding)) ||
+      !dev.setStreamEncoding(select.stream_id, select.encoding)) {
+    dev.sendError(ErrorID::BAD_PAYLOAD);
+    return;
+  }
+  // Samples sent after the response use the new encoding
+  dev.sendResponse(msg.header.id.cmd_id, select);
+}
+
+void Device::handleDiscover(Device &dev, const MsgView &msg) {
+  dev.sendResponse(msg.header.id.cmd_id, Announce{dev.driver.getMacAddr()});
+}
+
+void Device::produceTelemetry(uint32_t index, std::vector<uint8_t> &sample) {
+  const auto data = pack(TelemetrySample{index});
+  sample.assign(data.begin(), data.end());
+}
+
+void Device::handleUnknown(Device &dev, const MsgView &) {
+  dev.sendError(ErrorID::UNKNOWN_CMD);
 }
 
 } // namespace Protocol
@@ -0,0 +1,188 @@
+#include "ProtocolEncoding.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Protocol {
+
+namespace {
+
+uint32_t zigzag(const uint32_t delta) {
+  return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+}
+
+uint32_t unzigzag(const uint32_t value) {
+  return (value >> 1) ^ (0u - (value & 1u));
+}
+
+uint32_t readLe32(const uint8_t *bytes) {
+  return static_cast<uint32_t>(bytes[0]) |
+         static_cast<uint32_t>(bytes[1]) << 8 |
+         static_cast<uint32_t>(bytes[2]) << 16 |
+         static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+/* Turns zig-zag differences into samples in place, continuing from the
+ * previous sample
+ */
+void undelta(uint32_t *values, const std::size_t count, uint32_t previous) {
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i carry = _mm_set1_epi32(static_cast<int>(previous));
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+    v = _mm_xor_si128(_mm_srli_epi32(v, 1),
+                      _mm_sub_epi32(zero, _mm_and_si128(v, one)));
+    // Prefix sum across the four lanes, then add the last sample
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, carry);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(values + i), v);
+    carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  if (i != 0) {
+    previous = values[i - 1];
+  }
+#endif
+  for (; i < count; ++i) {
+    previous += unzigzag(values[i]);
+    values[i] = previous;
+  }
+}
+
+[[noreturn]] void malformed() {
+  throw std::runtime_error("Malformed stream block");
+}
+
+} // namespace
+
+bool isEncoding(const uint8_t byte) {
+  return byte <= static_cast<uint8_t>(Encoding::DELTA_BITPACK);
+}
+
+void encodeBlock(const Encoding encoding, std::span<const uint32_t> samples,
+                 std::vector<uint8_t> &out) {
+  if (encoding == Encoding::RAW || !isEncoding(static_cast<uint8_t>(encoding))) {
+    throw std::logic_error("Blocks need a delta encoding");
+  }
+  if (samples.empty() || BLOCK_SAMPLES_MAX < samples.size()) {
+    throw std::logic_error("Block needs 1 to BLOCK_SAMPLES_MAX samples");
+  }
+
+  out.clear();
+  out.push_back(static_cast<uint8_t>(encoding));
+  out.push_back(static_cast<uint8_t>(samples.size() & 0xff));
+  out.push_back(static_cast<uint8_t>((samples.size() >> 8) & 0xff));
+  for (std::size_t i = 0; i < sizeof(uint32_t); ++i) {
+    out.push_back(static_cast<uint8_t>((samples[0] >> (i * 8)) & 0xff));
+  }
+
+  if (encoding == Encoding::DELTA_VARINT) {
+    for (std::size_t i = 1; i < samples.size(); ++i) {
+      uint32_t value = zigzag(samples[i] - samples[i - 1]);
+      while (0x80 <= value) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+      }
+      out.push_back(static_cast<uint8_t>(value));
+    }
+    return;
+  }
+
+  // Every difference is written at the width of the largest
+  uint32_t widest = 0;
+  for (std::size_t i = 1; i < samples.size(); ++i) {
+    widest |= zigzag(samples[i] - samples[i - 1]);
+  }
+  const unsigned bits = static_cast<unsigned>(std::bit_width(widest));
+  out.push_back(static_cast<uint8_t>(bits));
+  const std::size_t packed_start = out.size();
+  out.resize(packed_start + ((samples.size() - 1) * bits + 7) / 8);
+  uint64_t buffer = 0;
+  unsigned buffered = 0;
+  std::size_t pos = packed_start;
+  for (std::size_t i = 1; i < samples.size(); ++i) {
+    buffer |= static_cast<uint64_t>(zigzag(samples[i] - samples[i - 1]))
+              << buffered;
+    buffered += bits;
+    while (8 <= buffered) {
+      out[pos++] = static_cast<uint8_t>(buffer & 0xff);
+      buffer >>= 8;
+      buffered -= 8;
+    }
+  }
+  if (buffered != 0) {
+    out[pos] = static_cast<uint8_t>(buffer & 0xff);
+  }
+}
+
+void decodeBlock(std::span<const uint8_t> block, std::vector<uint32_t> &samples) {
+  if (block.size() < BLOCK_HEADER_LEN || !isEncoding(block[0]) ||
+      static_cast<Encoding>(block[0]) == Encoding::RAW) {
+    malformed();
+  }
+  const auto encoding = static_cast<Encoding>(block[0]);
+  const std::size_t count = block[1] | (block[2] << 8);
+  if (count == 0) {
+    malformed();
+  }
+  const uint32_t first = readLe32(block.data() + 3);
+  samples.resize(count);
+  samples[0] = first;
+  uint32_t *deltas = samples.data() + 1;
+  const std::size_t delta_count = count - 1;
+  std::size_t pos = BLOCK_HEADER_LEN;
+
+  if (encoding == Encoding::DELTA_VARINT) {
+    for (std::size_t i = 0; i < delta_count; ++i) {
+      uint32_t value = 0;
+      for (unsigned shift = 0;; shift += 7) {
+        if (block.size() <= pos || 35 <= shift) {
+          malformed();
+        }
+        const uint8_t byte = block[pos++];
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+          break;
+        }
+      }
+      deltas[i] = value;
+    }
+  } else {
+    if (block.size() <= pos) {
+      malformed();
+    }
+    const unsigned bits = block[pos++];
+    if (32 < bits || block.size() - pos < (delta_count * bits + 7) / 8) {
+      malformed();
+    }
+    const uint8_t *packed = block.data() + pos;
+    const std::size_t packed_len = (delta_count * bits + 7) / 8;
+    const uint64_t mask = (uint64_t{1} << bits) - 1;
+    for (std::size_t i = 0; i < delta_count; ++i) {
+      const std::size_t bit = i * bits;
+      const std::size_t byte = bit / 8;
+      // A delta spans at most five bytes, so one 8-byte load covers it
+      uint64_t word = 0;
+      std::memcpy(&word, packed + byte, std::min<std::size_t>(8, packed_len - byte));
+      if constexpr (std::endian::native == std::endian::big) {
+        word = __builtin_bswap64(word);
+      }
+      deltas[i] = static_cast<uint32_t>((word >> (bit % 8)) & mask);
+    }
+    pos += packed_len;
+  }
+  if (pos != block.size()) {
+    malformed();
+  }
+  undelta(deltas, delta_count, first);
+}
+
+} // namespace Protocol
@@ -0,0 +1,185 @@
+#include "ProtocolFragment.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Protocol {
+
+/* Helper Functions */
+void sendMsg(Driver &driver, const MsgType t, const ID id,
+             std::span<const uint8_t> data, uint16_t &frag_id,
+             const CorrID corr) {
+  sendMsg(driver, driver.getPeerMacAddr(), t, id, data, frag_id, corr);
+}
+
+void sendMsg(Driver &driver, const MacAddr &dst, const MsgType t, const ID id,
+             std::span<const uint8_t> data, uint16_t &frag_id,
+             const CorrID corr) {
+  // Messages that fit in one frame are sent as-is
+  if (MSG_LEN_MIN + data.size() <= driver.mtu()) {
+    sendMsg(driver, dst, t, id, data, corr);
+    return;
+  }
+  if (std::numeric_limits<uint16_t>::max() < data.size()) {
+    throw std::runtime_error(
+        "Attempt to pack message with more data than allowed");
+  }
+
+  const uint8_t id_byte = packId(t, id);
+  const uint16_t total_len = static_cast<uint16_t>(data.size());
+  const uint16_t this_id = frag_id++;
+  for (std::size_t offset = 0; offset < data.size();
+       offset += FRAGMENT_DATA_MAX) {
+    const std::size_t chunk_len =
+        std::min(FRAGMENT_DATA_MAX, data.size() - offset);
+
+    // Pack the fragment straight into the frame
+    std::vector<uint8_t> frame =
+        driver.reserve(packedLen(FRAGMENT_HEADER_LEN + chunk_len));
+    std::span<uint8_t> region =
+        packHeaderInto(driver.payloadOf(frame), MsgType::FRAGMENT,
+                       ID{}, FRAGMENT_HEADER_LEN + chunk_len, corr);
+    auto iter = region.begin();
+    *(iter++) = this_id & 0xff;
+    *(iter++) = (this_id >> 8) & 0xff;
+    *(iter++) = offset & 0xff;
+    *(iter++) = (offset >> 8) & 0xff;
+    *(iter++) = total_len & 0xff;
+    *(iter++) = (total_len >> 8) & 0xff;
+    *(iter++) = static_cast<uint8_t>(t);
+    *(iter++) = id_byte;
+    std::copy_n(data.begin() + offset, chunk_len, iter);
+    driver.sendReservedTo(std::move(frame), dst);
+  }
+}
+
+FragmentHeader unpackFragmentHeader(std::span<const uint8_t> data) {
+  if (data.size() < FRAGMENT_HEADER_LEN) {
+    throw std::runtime_error("Fragment shorter than fragment header");
+  }
+  FragmentHeader header;
+  auto iter = data.begin();
+  header.frag_id = static_cast<uint16_t>(iter[0] | (iter[1] << 8));
+  header.offset = static_cast<uint16_t>(iter[2] | (iter[3] << 8));
+  header.total_len = static_cast<uint16_t>(iter[4] | (iter[5] << 8));
+  header.type = static_cast<MsgType>(iter[6]);
+  header.id = unpackId(header.type, iter[7]);
+
+  // Bounds checks
+  const std::size_t chunk_len = data.size() - FRAGMENT_HEADER_LEN;
+  if (header.offset % FRAGMENT_DATA_MAX != 0) {
+    throw std::runtime_error("Fragment offset not aligned to fragment size");
+  }
+  if (header.total_len < header.offset + chunk_len) {
+    throw std::runtime_error("Fragment extends past message length");
+  }
+  if (header.offset + chunk_len < header.total_len &&
+      chunk_len != FRAGMENT_DATA_MAX) {
+    throw std::runtime_error("Non-final fragment is not full size");
+  }
+  return header;
+}
+
+/* Reassembler */
+Reassembler::Reassembler(const Config &config)
+    : config(config), slots(config.max_pending) {}
+
+Reassembler::Reassembler() : Reassembler(Config{}) {}
+
+bool Reassembler::push(const Msg &fragment, Msg &output,
+                       const Clock::time_point now) {
+  if (fragment.header.type != MsgType::FRAGMENT) {
+    throw std::runtime_error("Reassembler received non-fragment message");
+  }
+  this->expire(now);
+
+  const FragmentHeader header = unpackFragmentHeader(fragment.data);
+  if (this->config.max_msg_len < header.total_len) {
+    ++this->stats.dropped;
+    return false;
+  }
+  Slot *slot = this->claim(header, fragment.header.corr, now);
+  if (!slot) {
+    ++this->stats.dropped;
+    return false;
+  }
+
+  // Duplicate fragments are ignored so they are not counted twice
+  const std::size_t chunk = header.offset / FRAGMENT_DATA_MAX;
+  const std::size_t chunk_len = fragment.data.size() - FRAGMENT_HEADER_LEN;
+  if (slot->chunks.test(chunk)) {
+    return false;
+  }
+  slot->chunks.set(chunk);
+  std::copy(fragment.data.begin() + FRAGMENT_HEADER_LEN, fragment.data.end(),
+            slot->buffer.begin() + header.offset);
+  slot->received += chunk_len;
+  if (slot->received < slot->header.total_len) {
+    return false;
+  }
+
+  // Complete
+  output.header.type = slot->header.type;
+  output.header.id = slot->header.id;
+  output.header.len = slot->header.total_len;
+  output.header.corr = slot->corr;
+  output.data.assign(slot->buffer.begin(),
+                     slot->buffer.begin() + slot->header.total_len);
+  slot->active = false;
+  ++this->stats.completed;
+  return true;
+}
+
+void Reassembler::expire(const Clock::time_point now) {
+  for (Slot &slot : this->slots) {
+    if (slot.active && slot.deadline <= now) {
+      slot.active = false;
+      ++this->stats.expired;
+    }
+  }
+}
+
+std::size_t Reassembler::pending() const {
+  return std::count_if(this->slots.begin(), this->slots.end(),
+                       [](const Slot &slot) { return slot.active; });
+}
+
+const Reassembler::Stats &Reassembler::getStats() const {
+  return this->stats;
+}
+
+Reassembler::Slot *Reassembler::claim(const FragmentHeader &header,
+                                      const CorrID corr,
+                                      const Clock::time_point now) {
+  Slot *free_slot = nullptr;
+  for (Slot &slot : this->slots) {
+    if (!slot.active) {
+      free_slot = free_slot ? free_slot : &slot;
+      continue;
+    }
+    if (slot.header.frag_id == header.frag_id) {
+      // A fragment id whose shape changed mid-message means a corrupt flow
+      if (slot.header.total_len != header.total_len ||
+          slot.header.type != header.type || slot.corr != corr) {
+        throw std::runtime_error("Fragment does not match pending message");
+      }
+      return &slot;
+    }
+  }
+  if (!free_slot) {
+    return nullptr;
+  }
+
+  // The buffer is only ever grown, so a slot allocates at most once
+  free_slot->active = true;
+  free_slot->header = header;
+  free_slot->corr = corr;
+  free_slot->received = 0;
+  free_slot->deadline = now + this->config.timeout;
+  free_slot->chunks.reset();
+  if (free_slot->buffer.size() < this->config.max_msg_len) {
+    free_slot->buffer.resize(this->config.max_msg_len);
+  }
+  return free_slot;
+}
+
+} // namespace Protocol
@@ -1,72 +1,421 @@
 #include "ProtocolHost.hpp"
 #include "Protocol.hpp"
-#include <cstring>
+#include "EthernetTrace.hpp"
 #include <stdexcept>
 
 namespace Protocol {
 
+thread_local Host::Session *Host::handling = nullptr;
+
 /* Host */
-Host::Host(Driver &driver) : driver(driver) {}
+Host::Host(Driver &driver) : Host(driver, Config{}) {}
+
+Host::Host(Driver &driver, const RequestTable::Config &config)
+    : Host(driver, Config{config, NeighborCache::Config{}}) {}
+
+Host::Host(Driver &driver, const Config &config)
+    : driver(driver), requests(config.requests), neighbors(config.neighbors) {
+  // Default handlers, applications may replace or extend these
+  this->responses.fallback<&Host::handleResponse>();
+  this->responses.bind<&Host::handleEncodingSet>(CmdID::SET_ENCODING);
+  this->responses.bind<&Host::handleAnnounce>(CmdID::DISCOVER);
+  this->streams.bind<&Host::handleTelemetry>(StreamID::TELEMETRY);
+  this->streams.fallback<&Host::handleUnknownStream>();
+  this->errors.fallback<&Host::handleError>();
+
+  // A single shard is handled inline by poll
+  if (1 < config.neighbors.shards) {
+    for (std::size_t i = 0; i < config.neighbors.shards; ++i) {
+      this->shards.push_back(std::make_unique<Shard>());
+    }
+    for (const std::unique_ptr<Shard> &shard : this->shards) {
+      shard->thread = std::thread(&Host::runShard, this, std::ref(*shard));
+    }
+  }
+}
+
+Host::~Host() {
+  for (const std::unique_ptr<Shard> &shard : this->shards) {
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->stopping = true;
+    }
+    shard->ready.notify_all();
+  }
+  for (const std::unique_ptr<Shard> &shard : this->shards) {
+    shard->thread.join();
+  }
+}
+
+bool Host::poll(const RequestTable::Clock::time_point now) {
+  this->rethrowShardError();
+  {
+    std::lock_guard<std::mutex> lock(this->requests_mutex);
+    this->requests.expire(now);
+  }
+
+  // Probe devices that have gone quiet, forget ones that never answered
+  this->stale.clear();
+  this->evicted.clear();
+  this->neighbors.expire(now, this->stale, this->evicted);
+  for (const MacAddr &mac : this->stale) {
+    this->sendCommand(mac, CmdID::DISCOVER, std::vector<uint8_t>{});
+  }
+  if (!this->evicted.empty()) {
+    std::lock_guard<std::mutex> lock(this->sessions_mutex);
+    for (const MacAddr &mac : this->evicted) {
+      this->sessions.erase(mac);
+    }
+  }
 
-bool Host::poll() {
   // Get message
   std::vector<uint8_t> bytes{};
-  if (!this->driver.recv(bytes)) {
+  MacAddr src{};
+  if (!this->driver.recv(bytes, src)) {
     return false;
   }
+  const NeighborCache::Neighbor &neighbor = this->neighbors.learn(src, now);
+  std::shared_ptr<Session> session = this->sessionFor(src);
+  if (this->shards.empty()) {
+    this->handle(*session, bytes, now);
+    return true;
+  }
+
+  // Hand the frame to the device's shard
+  Shard &shard = *this->shards[neighbor.shard];
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.inbox.push_back(Work{std::move(session), std::move(bytes), now});
+  }
+  shard.ready.notify_one();
+  return true;
+}
+
+void Host::sync() {
+  for (const std::unique_ptr<Shard> &shard : this->shards) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    shard->idle.wait(lock,
+                     [&shard] { return shard->inbox.empty() && !shard->busy; });
+  }
+  this->rethrowShardError();
+}
+
+void Host::discover() {
+  this->sendCommand(Ethernet::BROADCAST_MAC, CmdID::DISCOVER,
+                    std::vector<uint8_t>{});
+}
+
+const NeighborCache &Host::getNeighbors() const {
+  return this->neighbors;
+}
+
+MacAddr Host::source() const {
+  return handling ? handling->mac : MacAddr{};
+}
+
+RequestTable::Clock::time_point Host::receivedAt() const {
+  return handling ? handling->received_at : RequestTable::Clock::time_point{};
+}
+
+Runtime::Task Host::run(Runtime::Scheduler &scheduler) {
+  while (!scheduler.stopping()) {
+    // The neighbor cache is aged and probed on the next sweep too
+    RequestTable::Clock::time_point deadline = this->neighbors.nextDeadline().value_or(
+        RequestTable::Clock::time_point::max());
+    {
+      // Published under the lock requests are opened under, so a request
+      // opened from here on sees the wait it has to cut short
+      std::lock_guard<std::mutex> lock(this->requests_mutex);
+      if (const auto timeout = this->requests.nextDeadline();
+          timeout && *timeout < deadline) {
+        deadline = *timeout;
+      }
+      this->waking_at = deadline;
+    }
+    co_await scheduler.readable(this->driver, deadline);
+    while (this->poll()) {
+    }
+  }
+}
+
+Runtime::Simulation::Endpoint Host::simulate() {
+  return Runtime::Simulation::Endpoint{
+      &this->driver, [this](const RequestTable::Clock::time_point now) {
+        while (this->poll(now)) {
+        }
+        this->sync();
+        return this->nextDeadline();
+      }};
+}
+
+std::optional<RequestTable::Clock::time_point> Host::nextDeadline() const {
+  std::lock_guard<std::mutex> lock(this->requests_mutex);
+  return this->requests.nextDeadline();
+}
+
+std::shared_ptr<Host::Session> Host::sessionFor(const MacAddr &mac) {
+  std::lock_guard<std::mutex> lock(this->sessions_mutex);
+  std::shared_ptr<Session> &session = this->sessions[mac];
+  if (!session) {
+    session = std::make_shared<Session>();
+    session->mac = mac;
+  }
+  return session;
+}
+
+void Host::handle(Session &session, const std::vector<uint8_t> &bytes,
+                  const RequestTable::Clock::time_point now) {
+  // Restores the previous session even when a handler throws
+  struct Handling {
+    Session *previous;
+    ~Handling() { Host::handling = this->previous; }
+  } guard{std::exchange(handling, &session)};
+  session.received_at = now;
+
   const Msg msg = Protocol::unpackMsg(bytes);
+  if (msg.header.type == MsgType::BATCH) {
+    for (const MsgView &record : BatchView(msg.data)) {
+      this->dispatch(session, record);
+    }
+  } else if (msg.header.type != MsgType::FRAGMENT) {
+    this->dispatch(session, MsgView{msg.header, msg.data});
+  } else if (Msg whole; session.reassembler.push(msg, whole, now)) {
+    this->dispatch(session, MsgView{whole.header, whole.data});
+  }
+}
+
+void Host::runShard(Shard &shard) {
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  while (true) {
+    shard.ready.wait(lock,
+                     [&shard] { return shard.stopping || !shard.inbox.empty(); });
+    if (shard.stopping) {
+      return;
+    }
+    const Work work = std::move(shard.inbox.front());
+    shard.inbox.pop_front();
+    shard.busy = true;
+    lock.unlock();
+
+    // Only the first failure is kept, poll or sync rethrows it
+    try {
+      this->handle(*work.session, work.bytes, work.received_at);
+    } catch (...) {
+      std::lock_guard<std::mutex> error_lock(this->error_mutex);
+      if (!this->shard_error) {
+        this->shard_error = std::current_exception();
+      }
+    }
+
+    lock.lock();
+    shard.busy = false;
+    if (shard.inbox.empty()) {
+      shard.idle.notify_all();
+    }
+  }
+}
+
+void Host::rethrowShardError() {
+  std::exception_ptr error{};
+  {
+    std::lock_guard<std::mutex> lock(this->error_mutex);
+    error = std::exchange(this->shard_error, nullptr);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void Host::dispatch(Session &session, const MsgView &msg) {
+  ETHERNET_TRACE_SPAN("msg.handle");
+  // Replies to requests never reach the handlers, including late ones. An
+  // accepted encoding still switches the session first, so the blocks that
+  // follow it decode.
+  if (msg.header.corr != CorrID::NONE) {
+    if (msg.header.type == MsgType::RESPONSE &&
+        msg.header.id.cmd_id == CmdID::SET_ENCODING) {
+      Host::handleEncodingSet(*this, msg);
+    }
+    std::lock_guard<std::mutex> lock(this->requests_mutex);
+    this->requests.complete(msg);
+    return;
+  }
 
   // Handler dispatch
   switch (msg.header.type) {
   case MsgType::COMMAND:
     throw std::runtime_error("Host received command");
   case MsgType::RESPONSE:
-    this->handleResponse(msg);
+    this->responses(msg.header.id.cmd_id, *this, msg);
     break;
   case MsgType::STREAM:
-    this->handleStream(msg);
+    if (session.encodings[static_cast<uint8_t>(msg.header.id.stream_id)].load(
+            std::memory_order_relaxed) != Encoding::RAW) {
+      this->dispatchBlock(session, msg);
+    } else {
+      if (this->aggregator && msg.data.size() == WIRE_LEN<BlockSample>) {
+        this->aggregator->add(msg.header.id.stream_id, session.received_at,
+                              unpack<BlockSample>(msg.data).value);
+      }
+      this->streams(msg.header.id.stream_id, *this, msg);
+    }
     break;
   case MsgType::ERROR:
-    this->handleError(msg);
+    this->errors(msg.header.id.error_id, *this, msg);
     break;
   default:
     throw std::runtime_error("Unrecognized message type");
   }
+}
 
-  return true;
+void Host::dispatchBlock(Session &session, const MsgView &msg) {
+  decodeBlock(msg.data, session.decoded);
+  if (this->aggregator) {
+    this->aggregator->add(msg.header.id.stream_id, session.received_at,
+                          session.decoded);
+  }
+  MsgView sample{msg.header, {}};
+  sample.header.len = WIRE_LEN<BlockSample>;
+  for (const uint32_t value : session.decoded) {
+    const auto bytes = pack(BlockSample{value});
+    sample.data = bytes;
+    this->streams(msg.header.id.stream_id, *this, sample);
+  }
 }
 
 void Host::sendCommand(const CmdID cmd_id, const std::vector<uint8_t> &data) {
+  this->sendCommandData(this->driver.getPeerMacAddr(), cmd_id, data);
+}
+
+void Host::sendCommand(const MacAddr &dst, const CmdID cmd_id,
+                       const std::vector<uint8_t> &data) {
+  this->sendCommandData(dst, cmd_id, data);
+}
+
+void Host::sendCommandData(const MacAddr &dst, const CmdID cmd_id,
+                           std::span<const uint8_t> data) {
   ID id;
   id.cmd_id = cmd_id;
-  const std::vector<uint8_t> bytes = packMsg(MsgType::COMMAND, id, data);
-  this->driver.send(bytes);
+  std::lock_guard<std::mutex> lock(this->send_mutex);
+  sendMsg(this->driver, dst, MsgType::COMMAND, id, data, this->frag_id);
+}
+
+std::future<Msg> Host::request(const CmdID cmd_id,
+                               const std::vector<uint8_t> &data,
+                               const RequestTable::Clock::duration timeout) {
+  return this->request(this->driver.getPeerMacAddr(), cmd_id, data, timeout);
+}
+
+std::future<Msg> Host::request(const CmdID cmd_id,
+                               const std::vector<uint8_t> &data) {
+  return this->request(cmd_id, data, this->requests.getConfig().timeout);
 }
 
-void Host::handleResponse(const Msg &msg) {
-  std::printf("[HOST] Response id=%u len=%u: ",
-              static_cast<uint8_t>(msg.header.id.cmd_id), msg.header.len);
-  for (const uint8_t byte : msg.data) {
-    std::printf("%c", std::isprint(byte) ? byte : '.');
+std::future<Msg> Host::request(const MacAddr &dst, const CmdID cmd_id,
+                               const std::vector<uint8_t> &data,
+                               const RequestTable::Clock::duration timeout,
+                               const RequestTable::Clock::time_point now) {
+  std::promise<Msg> promise;
+  std::future<Msg> future = promise.get_future();
+  CorrID corr{};
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lock(this->requests_mutex);
+    corr = this->requests.open(std::move(promise), now, timeout);
+    // A run task sleeping past the new timeout must wake to wait for it
+    if (now + timeout < this->waking_at) {
+      this->waking_at = now + timeout;
+      wake = true;
+    }
   }
-  std::puts("");
+  if (wake) {
+    this->driver.wakeReceiver();
+  }
+  ID id;
+  id.cmd_id = cmd_id;
+  try {
+    std::lock_guard<std::mutex> lock(this->send_mutex);
+    sendMsg(this->driver, dst, MsgType::COMMAND, id, data, this->frag_id, corr);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(this->requests_mutex);
+    this->requests.cancel(corr);
+    throw;
+  }
+  return future;
 }
 
-void Host::handleStream(const Msg &msg) {
-  const StreamID id = msg.header.id.stream_id;
-  switch (id) {
-  case StreamID::TELEMETRY:
-    uint32_t count;
-    std::memcpy(&count, msg.data.data(), sizeof(count));
-    std::printf("[HOST] Stream count: %u\n", count);
-    break;
-  default:
-    throw std::runtime_error("Unknown StreamID code");
+RequestTable::Stats Host::getRequestStats() const {
+  std::lock_guard<std::mutex> lock(this->requests_mutex);
+  return this->requests.getStats();
+}
+
+void Host::setStreamEncoding(const StreamID stream_id,
+                             const Encoding encoding) {
+  this->setStreamEncoding(this->driver.getPeerMacAddr(), stream_id, encoding);
+}
+
+void Host::setStreamEncoding(const MacAddr &dst, const StreamID stream_id,
+                             const Encoding encoding) {
+  this->sendCommand(dst, CmdID::SET_ENCODING,
+                    EncodingSelect{stream_id, encoding});
+}
+
+Encoding Host::getStreamEncoding(const StreamID stream_id) const {
+  return this->getStreamEncoding(this->driver.getPeerMacAddr(), stream_id);
+}
+
+Encoding Host::getStreamEncoding(const MacAddr &dst,
+                                 const StreamID stream_id) const {
+  std::lock_guard<std::mutex> lock(this->sessions_mutex);
+  const auto session = this->sessions.find(dst);
+  if (session == this->sessions.end()) {
+    return Encoding::RAW;
+  }
+  return session->second->encodings[static_cast<uint8_t>(stream_id)].load(
+      std::memory_order_relaxed);
+}
+
+void Host::setSink(Sink &sink) {
+  this->sink = &sink;
+}
+
+void Host::setAggregator(Aggregator &aggregator) {
+  this->aggregator = &aggregator;
+}
+
+void Host::handleResponse(Host &host, const MsgView &msg) {
+  host.sink->response(
+      ResponseRecord{msg.header.id.cmd_id, msg.header.corr, msg.data});
+}
+
+void Host::handleEncodingSet(Host &, const MsgView &msg) {
+  const auto select = unpack<EncodingSelect>(msg.data);
+  if (!isEncoding(static_cast<uint8_t>(select.encoding))) {
+    throw std::runtime_error("Malformed SET_ENCODING response");
+  }
+  handling->encodings[static_cast<uint8_t>(select.stream_id)].store(
+      select.encoding, std::memory_order_relaxed);
+}
+
+void Host::handleAnnounce(Host &host, const MsgView &msg) {
+  // Receiving the frame already refreshed the neighbor entry
+  if (unpack<Announce>(msg.data).mac != host.source()) {
+    throw std::runtime_error("Announce does not match its sender");
   }
 }
 
-void Host::handleError(const Msg &msg) {
-  std::printf("[HOST] ERROR code=%u\n", static_cast<uint8_t>(msg.header.id.error_id));
+void Host::handleTelemetry(Host &host, const MsgView &msg) {
+  host.sink->telemetry(TelemetryRecord{unpack<TelemetrySample>(msg.data).count,
+                                       StreamID::TELEMETRY, host.source(),
+                                       host.receivedAt()});
+}
+
+void Host::handleUnknownStream(Host &, const MsgView &) {
+  throw std::runtime_error("Unknown StreamID code");
+}
+
+void Host::handleError(Host &host, const MsgView &msg) {
+  host.sink->error(ErrorRecord{msg.header.id.error_id, msg.header.corr});
 }
 
 } // namespace Protocol
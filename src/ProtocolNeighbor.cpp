@@ -0,0 +1,92 @@
+#include "ProtocolNeighbor.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Protocol {
+
+NeighborCache::NeighborCache(const Config &config) : config(config) {
+  if (config.shards == 0) {
+    throw std::runtime_error("Neighbor cache needs at least one shard");
+  }
+  if (config.evict_after < config.stale_after) {
+    throw std::runtime_error("Neighbors must go stale before they are evicted");
+  }
+  this->loads.resize(config.shards);
+}
+
+NeighborCache::NeighborCache() : NeighborCache(Config{}) {}
+
+const NeighborCache::Neighbor &
+NeighborCache::learn(const MacAddr &mac, const Clock::time_point now) {
+  auto [entry, added] = this->neighbors.try_emplace(mac);
+  Neighbor &neighbor = entry->second;
+  if (added) {
+    neighbor.mac = mac;
+    neighbor.shard = static_cast<std::size_t>(
+        std::min_element(this->loads.begin(), this->loads.end()) -
+        this->loads.begin());
+    ++this->loads[neighbor.shard];
+  }
+  neighbor.state = State::REACHABLE;
+  neighbor.last_seen = std::max(neighbor.last_seen, now);
+  return neighbor;
+}
+
+const NeighborCache::Neighbor *NeighborCache::find(const MacAddr &mac) const {
+  const auto entry = this->neighbors.find(mac);
+  return entry == this->neighbors.end() ? nullptr : &entry->second;
+}
+
+void NeighborCache::expire(const Clock::time_point now,
+                           std::vector<MacAddr> &stale,
+                           std::vector<MacAddr> &evicted) {
+  if (now < this->next_sweep) {
+    return;
+  }
+  this->next_sweep = now + this->config.stale_after / 10;
+
+  for (auto entry = this->neighbors.begin(); entry != this->neighbors.end();) {
+    Neighbor &neighbor = entry->second;
+    if (neighbor.last_seen + this->config.evict_after <= now) {
+      evicted.push_back(neighbor.mac);
+      --this->loads[neighbor.shard];
+      entry = this->neighbors.erase(entry);
+      continue;
+    }
+    if (neighbor.state == State::REACHABLE &&
+        neighbor.last_seen + this->config.stale_after <= now) {
+      neighbor.state = State::STALE;
+      stale.push_back(neighbor.mac);
+    }
+    ++entry;
+  }
+}
+
+std::optional<NeighborCache::Clock::time_point>
+NeighborCache::nextDeadline() const {
+  if (this->neighbors.empty()) {
+    return std::nullopt;
+  }
+  return this->next_sweep;
+}
+
+std::size_t NeighborCache::size() const {
+  return this->neighbors.size();
+}
+
+std::size_t NeighborCache::load(const std::size_t shard) const {
+  return this->loads.at(shard);
+}
+
+std::vector<NeighborCache::Neighbor> NeighborCache::entries() const {
+  std::vector<Neighbor> entries;
+  entries.reserve(this->neighbors.size());
+  for (const auto &[mac, neighbor] : this->neighbors) {
+    entries.push_back(neighbor);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Neighbor &a, const Neighbor &b) { return a.mac < b.mac; });
+  return entries;
+}
+
+} // namespace Protocol
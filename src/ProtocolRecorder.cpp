@@ -0,0 +1,523 @@
+#include "ProtocolRecorder.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Protocol {
+
+namespace {
+
+constexpr uint8_t SEGMENT_MAGIC[4] = {'E', 'R', 'E', 'C'};
+constexpr uint32_t SEGMENT_VERSION = 1;
+
+struct SegmentHeader {
+  uint8_t magic[4];
+  uint32_t version;
+  uint64_t capacity;
+  uint64_t reserved[6];
+};
+static_assert(sizeof(SegmentHeader) == 64);
+
+// One per segment, in the order they were written
+struct IndexEntry {
+  uint64_t sequence;
+  int64_t min;
+  int64_t max;
+  uint64_t count;
+  // Whether every sample is no earlier than the one before it
+  uint64_t sorted;
+};
+static_assert(sizeof(IndexEntry) == 40);
+
+/* Where each column starts in a segment of the given capacity. Wider
+ * columns come first so every column is naturally aligned.
+ */
+struct Layout {
+  explicit Layout(const uint64_t capacity)
+      : times(sizeof(SegmentHeader)), devices(times + 8 * capacity),
+        values(devices + 8 * capacity), streams(values + 4 * capacity),
+        len(streams + capacity) {}
+  uint64_t times;
+  uint64_t devices;
+  uint64_t values;
+  uint64_t streams;
+  uint64_t len;
+};
+
+std::string indexPath(const std::string &directory) {
+  return (std::filesystem::path(directory) / "index").string();
+}
+
+std::string segmentPath(const std::string &directory, const uint64_t sequence) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "segment-%08llu.rec",
+                static_cast<unsigned long long>(sequence));
+  return (std::filesystem::path(directory) / name).string();
+}
+
+int64_t toNanos(const Recorder::Clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+Recorder::Clock::time_point fromNanos(const int64_t nanos) {
+  return Recorder::Clock::time_point(
+      std::chrono::duration_cast<Recorder::Clock::duration>(
+          std::chrono::nanoseconds(nanos)));
+}
+
+uint64_t packMac(const MacAddr &mac) {
+  uint64_t packed = 0;
+  for (const uint8_t byte : mac) {
+    packed = packed << 8 | byte;
+  }
+  return packed;
+}
+
+MacAddr unpackMac(uint64_t packed) {
+  MacAddr mac{};
+  for (std::size_t i = mac.size(); 0 < i; --i) {
+    mac[i - 1] = static_cast<uint8_t>(packed);
+    packed >>= 8;
+  }
+  return mac;
+}
+
+/* Thrown when a segment listed in the index has since been rotated out
+ */
+class SegmentRemoved : public std::runtime_error {
+public:
+  explicit SegmentRemoved(const std::string &path)
+      : std::runtime_error("Recording segment was removed " + path) {}
+};
+
+/* A file mapped into memory, unmapped and closed on destruction
+ */
+class Mapping {
+public:
+  /* Alternate constructor, maps a segment for writing, sized for its capacity
+   */
+  Mapping(const std::string &path, const uint64_t len)
+      : fd(::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)), len(len) {
+    if (this->fd < 0 || ::ftruncate(this->fd, static_cast<off_t>(len)) != 0) {
+      this->close();
+      throw std::runtime_error("Cannot create recording segment " + path);
+    }
+    this->map(path, PROT_READ | PROT_WRITE);
+  }
+
+  /* Alternate constructor, maps a whole segment read-only. Throws
+   * SegmentRemoved if the file is gone.
+   */
+  explicit Mapping(const std::string &path)
+      : fd(::open(path.c_str(), O_RDONLY)) {
+    if (this->fd < 0 && errno == ENOENT) {
+      throw SegmentRemoved(path);
+    }
+    struct stat status {};
+    if (this->fd < 0 || ::fstat(this->fd, &status) != 0) {
+      this->close();
+      throw std::runtime_error("Cannot open recording segment " + path);
+    }
+    this->len = static_cast<uint64_t>(status.st_size);
+    this->map(path, PROT_READ);
+  }
+
+  ~Mapping() { this->close(); }
+  Mapping(const Mapping &) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+
+  [[nodiscard]] uint8_t *data() const { return this->bytes; }
+  [[nodiscard]] uint64_t size() const { return this->len; }
+
+private:
+  void map(const std::string &path, const int protection) {
+    if (this->len == 0) {
+      return;
+    }
+    void *address = ::mmap(nullptr, this->len, protection, MAP_SHARED, this->fd, 0);
+    if (address == MAP_FAILED) {
+      this->close();
+      throw std::runtime_error("Cannot map recording segment " + path);
+    }
+    this->bytes = static_cast<uint8_t *>(address);
+  }
+
+  void close() {
+    if (this->bytes) {
+      ::munmap(this->bytes, this->len);
+      this->bytes = nullptr;
+    }
+    if (0 <= this->fd) {
+      ::close(this->fd);
+      this->fd = -1;
+    }
+  }
+
+  int fd{-1};
+  uint64_t len{0};
+  uint8_t *bytes{nullptr};
+};
+
+/* Reads every whole entry of the index, a torn last entry is ignored
+ */
+std::vector<IndexEntry> readIndex(const std::string &directory) {
+  std::vector<IndexEntry> entries;
+  std::FILE *file = std::fopen(indexPath(directory).c_str(), "rb");
+  if (!file) {
+    return entries;
+  }
+  IndexEntry entry{};
+  while (std::fread(&entry, sizeof(entry), 1, file) == 1) {
+    entries.push_back(entry);
+  }
+  std::fclose(file);
+  return entries;
+}
+
+} // namespace
+
+/* Writer */
+// Owned by the flusher thread once the Recorder is constructed
+class Recorder::Writer {
+public:
+  explicit Writer(const Config &config)
+      : directory(config.directory), capacity(config.segment_samples),
+        max_segments(config.max_segments), layout(config.segment_samples) {
+    if (this->capacity == 0) {
+      throw std::runtime_error("Recorder segments need room for a sample");
+    }
+    std::filesystem::create_directories(this->directory);
+    this->entries = readIndex(this->directory);
+    this->next_sequence = this->entries.empty() ? 0 : this->entries.back().sequence + 1;
+  }
+
+  ~Writer() {
+    if (0 <= this->index_fd) {
+      ::close(this->index_fd);
+    }
+  }
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+
+  void write(const Sample &sample) {
+    if (!this->segment || this->entries.back().count == this->capacity) {
+      this->rotate();
+    }
+    IndexEntry &entry = this->entries.back();
+    const uint64_t i = entry.count;
+    const int64_t time = toNanos(sample.time);
+    uint8_t *base = this->segment->data();
+    reinterpret_cast<int64_t *>(base + this->layout.times)[i] = time;
+    reinterpret_cast<uint64_t *>(base + this->layout.devices)[i] =
+        packMac(sample.device);
+    reinterpret_cast<uint32_t *>(base + this->layout.values)[i] = sample.value;
+    base[this->layout.streams + i] = static_cast<uint8_t>(sample.stream_id);
+
+    if (i == 0) {
+      entry.min = time;
+      entry.max = time;
+    } else {
+      entry.sorted = entry.sorted && entry.max <= time;
+      entry.min = std::min(entry.min, time);
+      entry.max = std::max(entry.max, time);
+    }
+    entry.count = i + 1;
+  }
+
+  /* Publishes the active segment's entry, so readers see what was written.
+   * Samples are in the mapping before their count is in the index.
+   */
+  void sync() {
+    if (!this->segment) {
+      return;
+    }
+    const off_t offset =
+        static_cast<off_t>((this->entries.size() - 1) * sizeof(IndexEntry));
+    if (::pwrite(this->index_fd, &this->entries.back(), sizeof(IndexEntry),
+                 offset) != static_cast<ssize_t>(sizeof(IndexEntry))) {
+      throw std::runtime_error("Cannot write recording index");
+    }
+  }
+
+  [[nodiscard]] std::size_t segmentCount() const { return this->entries.size(); }
+
+private:
+  void rotate() {
+    this->sync();
+    this->segment.reset();
+
+    const uint64_t sequence = this->next_sequence++;
+    this->segment = std::make_unique<Mapping>(
+        segmentPath(this->directory, sequence), this->layout.len);
+    SegmentHeader header{};
+    std::copy_n(SEGMENT_MAGIC, 4, header.magic);
+    header.version = SEGMENT_VERSION;
+    header.capacity = this->capacity;
+    std::copy_n(reinterpret_cast<const uint8_t *>(&header), sizeof(header),
+                this->segment->data());
+    this->entries.push_back(IndexEntry{sequence, 0, 0, 0, 1});
+
+    while (0 < this->max_segments && this->max_segments < this->entries.size()) {
+      std::error_code ignored;
+      std::filesystem::remove(
+          segmentPath(this->directory, this->entries.front().sequence), ignored);
+      this->entries.erase(this->entries.begin());
+    }
+    this->rewriteIndex();
+  }
+
+  /* Replaces the index with one listing the current segments. It is written
+   * aside and renamed over the old one, so readers never see it half written.
+   */
+  void rewriteIndex() {
+    const std::string path = indexPath(this->directory);
+    const std::string temporary = path + ".tmp";
+    const int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    const auto len =
+        static_cast<ssize_t>(this->entries.size() * sizeof(IndexEntry));
+    if (fd < 0 || ::write(fd, this->entries.data(), static_cast<size_t>(len)) != len ||
+        ::rename(temporary.c_str(), path.c_str()) != 0) {
+      if (0 <= fd) {
+        ::close(fd);
+      }
+      throw std::runtime_error("Cannot write recording index");
+    }
+    if (0 <= this->index_fd) {
+      ::close(this->index_fd);
+    }
+    this->index_fd = fd;
+  }
+
+  std::string directory;
+  uint64_t capacity;
+  std::size_t max_segments;
+  Layout layout;
+  std::vector<IndexEntry> entries{};
+  uint64_t next_sequence{0};
+  std::unique_ptr<Mapping> segment{};
+  int index_fd{-1};
+};
+
+/* Recorder */
+Recorder::Recorder(const Config &config)
+    : config(config),
+      cells(std::bit_ceil(std::max<std::size_t>(config.capacity, 2))),
+      writer(std::make_unique<Writer>(config)) {
+  this->steady_offset = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now().time_since_epoch() -
+      std::chrono::steady_clock::now().time_since_epoch());
+  this->mask = this->cells.size() - 1;
+  for (std::size_t i = 0; i < this->cells.size(); ++i) {
+    this->cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  this->thread = std::thread([this] { this->run(); });
+}
+
+Recorder::~Recorder() {
+  this->running.store(false);
+  this->thread.join();
+}
+
+bool Recorder::append(const Sample &sample) {
+  // Bounded queue after Vyukov, as in AsyncLogSink
+  std::size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+  while (true) {
+    Cell &cell = this->cells[pos & this->mask];
+    const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    const auto diff =
+        static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+    if (diff == 0) {
+      if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed)) {
+        cell.sample = sample;
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = this->enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void Recorder::response(const ResponseRecord &) {}
+
+void Recorder::telemetry(const TelemetryRecord &record) {
+  // Records that did not come through a Host carry no receive time
+  const Clock::time_point time =
+      record.received_at == std::chrono::steady_clock::time_point{}
+          ? Clock::now()
+          : Clock::time_point(std::chrono::duration_cast<Clock::duration>(
+                record.received_at.time_since_epoch() + this->steady_offset));
+  this->append(Sample{time, record.device, record.stream_id, record.count});
+}
+
+void Recorder::error(const ErrorRecord &) {}
+
+void Recorder::flush() {
+  const std::size_t target = this->enqueue_pos.load();
+  while (this->finished.load() < target) {
+    std::this_thread::sleep_for(this->config.idle);
+  }
+  std::lock_guard<std::mutex> lock(this->error_mutex);
+  if (this->flush_error) {
+    std::rethrow_exception(this->flush_error);
+  }
+}
+
+Recorder::Stats Recorder::getStats() const {
+  return Stats{this->written.load(), this->dropped.load(), this->segments.load()};
+}
+
+bool Recorder::pop(Sample &sample) {
+  Cell &cell = this->cells[this->dequeue_pos & this->mask];
+  if (cell.sequence.load(std::memory_order_acquire) != this->dequeue_pos + 1) {
+    return false;
+  }
+  sample = cell.sample;
+  cell.sequence.store(this->dequeue_pos + this->mask + 1,
+                      std::memory_order_release);
+  ++this->dequeue_pos;
+  return true;
+}
+
+void Recorder::run() {
+  Sample sample;
+  while (true) {
+    // Read the flag first, so a sample queued before the destructor ran is
+    // still written
+    const bool stopping = !this->running.load();
+    uint64_t batch = 0;
+    uint64_t failed = 0;
+    while (this->pop(sample)) {
+      // After the first failure samples are counted as dropped, and flush
+      // rethrows it
+      if (this->flush_error) {
+        ++failed;
+        continue;
+      }
+      try {
+        this->writer->write(sample);
+        ++batch;
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(this->error_mutex);
+        this->flush_error = std::current_exception();
+        ++failed;
+      }
+    }
+    if (batch != 0) {
+      try {
+        this->writer->sync();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(this->error_mutex);
+        this->flush_error = std::current_exception();
+      }
+      this->written.fetch_add(batch);
+      this->segments.store(this->writer->segmentCount());
+    }
+    this->dropped.fetch_add(failed);
+    this->finished.fetch_add(batch + failed);
+    if (batch + failed == 0) {
+      if (stopping) {
+        return;
+      }
+      std::this_thread::sleep_for(this->config.idle);
+    }
+  }
+}
+
+/* Recording */
+Recording::Recording(std::string directory) : directory(std::move(directory)) {}
+
+std::size_t Recording::scan(
+    const Recorder::Clock::time_point from, const Recorder::Clock::time_point to,
+    const std::function<void(const Recorder::Sample &)> &visit) const {
+  const int64_t first = toNanos(from);
+  const int64_t last = toNanos(to);
+  std::size_t visited = 0;
+  for (const IndexEntry &entry : readIndex(this->directory)) {
+    if (entry.count == 0 || entry.max < first || last <= entry.min) {
+      continue;
+    }
+    // The writer may rotate a segment out after the index was read, and
+    // its samples are then gone for this scan too
+    const std::string path = segmentPath(this->directory, entry.sequence);
+    std::optional<Mapping> mapped;
+    try {
+      mapped.emplace(path);
+    } catch (const SegmentRemoved &) {
+      continue;
+    }
+    const Mapping &segment = *mapped;
+    SegmentHeader header{};
+    if (segment.size() < sizeof(header)) {
+      throw std::runtime_error("Truncated recording segment " + path);
+    }
+    std::copy_n(segment.data(), sizeof(header),
+                reinterpret_cast<uint8_t *>(&header));
+    const Layout layout(header.capacity);
+    if (!std::equal(SEGMENT_MAGIC, SEGMENT_MAGIC + 4, header.magic) ||
+        header.version != SEGMENT_VERSION || header.capacity < entry.count ||
+        segment.size() < layout.len) {
+      throw std::runtime_error("Not a recording segment of this version " + path);
+    }
+
+    const uint8_t *base = segment.data();
+    const auto *times = reinterpret_cast<const int64_t *>(base + layout.times);
+    const auto *devices = reinterpret_cast<const uint64_t *>(base + layout.devices);
+    const auto *values = reinterpret_cast<const uint32_t *>(base + layout.values);
+    const uint8_t *streams = base + layout.streams;
+    auto emit = [&](const uint64_t i) {
+      visit(Recorder::Sample{fromNanos(times[i]), unpackMac(devices[i]),
+                             static_cast<StreamID>(streams[i]), values[i]});
+      ++visited;
+    };
+
+    if (entry.sorted) {
+      const int64_t *begin = std::lower_bound(times, times + entry.count, first);
+      const int64_t *end = std::lower_bound(begin, times + entry.count, last);
+      for (const int64_t *time = begin; time != end; ++time) {
+        emit(static_cast<uint64_t>(time - times));
+      }
+    } else {
+      for (uint64_t i = 0; i < entry.count; ++i) {
+        if (first <= times[i] && times[i] < last) {
+          emit(i);
+        }
+      }
+    }
+  }
+  return visited;
+}
+
+std::vector<Recorder::Sample>
+Recording::read(const Recorder::Clock::time_point from,
+                const Recorder::Clock::time_point to) const {
+  std::vector<Recorder::Sample> samples;
+  this->scan(from, to,
+             [&samples](const Recorder::Sample &sample) { samples.push_back(sample); });
+  return samples;
+}
+
+std::size_t Recording::size() const {
+  std::size_t count = 0;
+  for (const IndexEntry &entry : readIndex(this->directory)) {
+    count += entry.count;
+  }
+  return count;
+}
+
+} // namespace Protocol
@@ -0,0 +1,189 @@
+#include "ProtocolRequest.hpp"
+#include <algorithm>
+
+namespace Protocol {
+
+/* Exceptions */
+CommandError::CommandError(const ErrorID error_id)
+    : std::runtime_error("Device answered command with an error"),
+      error_id(error_id) {}
+
+CommandTimeout::CommandTimeout()
+    : std::runtime_error("Command timed out waiting for an answer") {}
+
+/* RequestTable */
+RequestTable::RequestTable(const Config &config)
+    : config(config), slots(SLOT_COUNT), wheel(config.wheel_len, NIL) {
+  if (config.tick <= Clock::duration::zero() || config.wheel_len == 0) {
+    throw std::runtime_error("Timer wheel needs a positive tick and length");
+  }
+
+  // Lowest slots are handed out first
+  this->free_slots.reserve(SLOT_COUNT);
+  for (std::size_t i = SLOT_COUNT; i != 0; --i) {
+    this->free_slots.push_back(static_cast<uint16_t>(i - 1));
+  }
+}
+
+RequestTable::RequestTable() : RequestTable(Config{}) {}
+
+CorrID RequestTable::open(std::promise<Msg> &&promise,
+                          const Clock::time_point now,
+                          const Clock::duration timeout) {
+  if (this->free_slots.empty()) {
+    throw std::runtime_error("Too many outstanding requests");
+  }
+  const uint16_t index = this->free_slots.back();
+  this->free_slots.pop_back();
+
+  // A deadline already in the past fires on the next expire
+  Slot &slot = this->slots[index];
+  slot.active = true;
+  slot.promise = std::move(promise);
+  slot.deadline_tick =
+      std::max(this->tickOf(now + timeout), this->current_tick + 1);
+  this->arm(index);
+  return static_cast<CorrID>((slot.generation << 8) | index);
+}
+
+bool RequestTable::complete(const MsgView &msg) {
+  if (msg.header.type != MsgType::RESPONSE &&
+      msg.header.type != MsgType::ERROR) {
+    return false;
+  }
+  const uint16_t index = this->find(msg.header.corr);
+  if (index == NIL) {
+    if (msg.header.corr != CorrID::NONE) {
+      ++this->stats.stale;
+    }
+    return false;
+  }
+
+  // The slot is freed before the future is completed, so a continuation may
+  // immediately open a new request
+  std::promise<Msg> promise = std::move(this->slots[index].promise);
+  this->release(index);
+  if (msg.header.type == MsgType::RESPONSE) {
+    ++this->stats.completed;
+    promise.set_value(
+        Msg{msg.header, std::vector<uint8_t>(msg.data.begin(), msg.data.end())});
+  } else {
+    ++this->stats.failed;
+    promise.set_exception(
+        std::make_exception_ptr(CommandError(msg.header.id.error_id)));
+  }
+  return true;
+}
+
+void RequestTable::cancel(const CorrID corr) {
+  const uint16_t index = this->find(corr);
+  if (index != NIL) {
+    this->release(index);
+  }
+}
+
+void RequestTable::expire(const Clock::time_point now) {
+  const uint64_t now_tick = this->tickOf(now);
+  if (now_tick <= this->current_tick) {
+    return;
+  }
+
+  // Each bucket only needs visiting once however far time has moved
+  const uint64_t steps =
+      std::min<uint64_t>(now_tick - this->current_tick, this->config.wheel_len);
+  for (uint64_t step = 1; step <= steps; ++step) {
+    const std::size_t bucket =
+        (this->current_tick + step) % this->config.wheel_len;
+    uint16_t index = this->wheel[bucket];
+    while (index != NIL) {
+      Slot &slot = this->slots[index];
+      const uint16_t next = slot.next;
+      // Later laps of the wheel share the bucket and are left armed
+      if (slot.deadline_tick <= now_tick) {
+        std::promise<Msg> promise = std::move(slot.promise);
+        this->release(index);
+        ++this->stats.timed_out;
+        promise.set_exception(std::make_exception_ptr(CommandTimeout()));
+      }
+      index = next;
+    }
+  }
+  this->current_tick = now_tick;
+}
+
+std::size_t RequestTable::outstanding() const {
+  return SLOT_COUNT - this->free_slots.size();
+}
+
+std::optional<RequestTable::Clock::time_point>
+RequestTable::nextDeadline() const {
+  std::optional<uint64_t> earliest{};
+  for (const Slot &slot : this->slots) {
+    if (slot.active && (!earliest || slot.deadline_tick < *earliest)) {
+      earliest = slot.deadline_tick;
+    }
+  }
+  if (!earliest) {
+    return std::nullopt;
+  }
+  return this->epoch + static_cast<Clock::rep>(*earliest) * this->config.tick;
+}
+
+const RequestTable::Config &RequestTable::getConfig() const {
+  return this->config;
+}
+
+const RequestTable::Stats &RequestTable::getStats() const {
+  return this->stats;
+}
+
+uint16_t RequestTable::find(const CorrID corr) const {
+  const uint16_t value = static_cast<uint16_t>(corr);
+  const uint16_t index = value & 0xff;
+  const Slot &slot = this->slots[index];
+  if (corr == CorrID::NONE || !slot.active ||
+      slot.generation != static_cast<uint8_t>(value >> 8)) {
+    return NIL;
+  }
+  return index;
+}
+
+void RequestTable::arm(const uint16_t index) {
+  Slot &slot = this->slots[index];
+  uint16_t &head = this->wheel[slot.deadline_tick % this->config.wheel_len];
+  slot.prev = NIL;
+  slot.next = head;
+  if (head != NIL) {
+    this->slots[head].prev = index;
+  }
+  head = index;
+}
+
+void RequestTable::release(const uint16_t index) {
+  Slot &slot = this->slots[index];
+  if (slot.prev == NIL) {
+    this->wheel[slot.deadline_tick % this->config.wheel_len] = slot.next;
+  } else {
+    this->slots[slot.prev].next = slot.next;
+  }
+  if (slot.next != NIL) {
+    this->slots[slot.next].prev = slot.prev;
+  }
+  slot.prev = NIL;
+  slot.next = NIL;
+  slot.active = false;
+  slot.promise = std::promise<Msg>{};
+
+  // Generation zero is skipped so no correlation id is ever NONE
+  slot.generation = slot.generation == 0xff ? 1 : slot.generation + 1;
+  this->free_slots.push_back(index);
+}
+
+uint64_t RequestTable::tickOf(const Clock::time_point time) const {
+  if (time <= this->epoch) {
+    return 0;
+  }
+  return static_cast<uint64_t>((time - this->epoch) / this->config.tick);
+}
+
+} // namespace Protocol
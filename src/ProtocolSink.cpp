@@ -0,0 +1,181 @@
+#include "ProtocolSink.hpp"
+#include <algorithm>
+#include <bit>
+#include <cctype>
+
+namespace Protocol {
+
+namespace {
+
+/* Formats the records the same way for every sink
+ */
+void writeResponse(std::FILE *out, const uint8_t id, const uint16_t len,
+                   std::span<const uint8_t> data) {
+  std::fprintf(out, "[HOST] Response id=%u len=%u: ", id, len);
+  for (const uint8_t byte : data) {
+    std::fputc(std::isprint(byte) ? byte : '.', out);
+  }
+  std::fputc('\n', out);
+}
+
+void writeTelemetry(std::FILE *out, const uint32_t count) {
+  std::fprintf(out, "[HOST] Stream count: %u\n", count);
+}
+
+void writeError(std::FILE *out, const uint8_t id) {
+  std::fprintf(out, "[HOST] ERROR code=%u\n", id);
+}
+
+} // namespace
+
+/* StdioSink */
+StdioSink::StdioSink(std::FILE *out) : out(out) {}
+
+void StdioSink::response(const ResponseRecord &record) {
+  writeResponse(this->out, static_cast<uint8_t>(record.cmd_id),
+                static_cast<uint16_t>(record.data.size()), record.data);
+}
+
+void StdioSink::telemetry(const TelemetryRecord &record) {
+  writeTelemetry(this->out, record.count);
+}
+
+void StdioSink::error(const ErrorRecord &record) {
+  writeError(this->out, static_cast<uint8_t>(record.error_id));
+}
+
+Sink &stdoutSink() {
+  static StdioSink sink(stdout);
+  return sink;
+}
+
+/* AsyncLogSink */
+AsyncLogSink::AsyncLogSink(const Config &config)
+    : config(config), cells(std::bit_ceil(std::max<std::size_t>(config.capacity, 2))) {
+  this->mask = this->cells.size() - 1;
+  for (std::size_t i = 0; i < this->cells.size(); ++i) {
+    this->cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  this->thread = std::thread([this] { this->run(); });
+}
+
+AsyncLogSink::AsyncLogSink() : AsyncLogSink(Config{}) {}
+
+AsyncLogSink::~AsyncLogSink() {
+  this->running.store(false);
+  this->thread.join();
+}
+
+void AsyncLogSink::response(const ResponseRecord &record) {
+  Record copy;
+  copy.kind = Kind::RESPONSE;
+  copy.id = static_cast<uint8_t>(record.cmd_id);
+  copy.corr = record.corr;
+  copy.len = static_cast<uint16_t>(record.data.size());
+  std::copy_n(record.data.begin(), std::min(record.data.size(), DATA_MAX),
+              copy.data.begin());
+  this->push(copy);
+}
+
+void AsyncLogSink::telemetry(const TelemetryRecord &record) {
+  Record copy;
+  copy.kind = Kind::TELEMETRY;
+  copy.count = record.count;
+  this->push(copy);
+}
+
+void AsyncLogSink::error(const ErrorRecord &record) {
+  Record copy;
+  copy.kind = Kind::ERROR;
+  copy.id = static_cast<uint8_t>(record.error_id);
+  copy.corr = record.corr;
+  this->push(copy);
+}
+
+void AsyncLogSink::flush() {
+  const std::size_t target = this->enqueue_pos.load();
+  while (this->written.load() < target) {
+    std::this_thread::sleep_for(this->config.idle);
+  }
+}
+
+AsyncLogSink::Stats AsyncLogSink::getStats() const {
+  return Stats{this->written.load(), this->dropped.load()};
+}
+
+bool AsyncLogSink::push(const Record &record) {
+  // Bounded queue after Vyukov: a cell's sequence says whose turn it is
+  std::size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+  while (true) {
+    Cell &cell = this->cells[pos & this->mask];
+    const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    const auto diff =
+        static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+    if (diff == 0) {
+      if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed)) {
+        cell.record = record;
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      // The consumer has not freed this cell yet, so the queue is full
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = this->enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool AsyncLogSink::pop(Record &record) {
+  Cell &cell = this->cells[this->dequeue_pos & this->mask];
+  if (cell.sequence.load(std::memory_order_acquire) != this->dequeue_pos + 1) {
+    return false;
+  }
+  record = cell.record;
+  cell.sequence.store(this->dequeue_pos + this->mask + 1,
+                      std::memory_order_release);
+  ++this->dequeue_pos;
+  return true;
+}
+
+void AsyncLogSink::write(const Record &record) {
+  switch (record.kind) {
+  case Kind::RESPONSE:
+    writeResponse(this->config.out, record.id, record.len,
+                  std::span<const uint8_t>(record.data).first(
+                      std::min<std::size_t>(record.len, DATA_MAX)));
+    break;
+  case Kind::TELEMETRY:
+    writeTelemetry(this->config.out, record.count);
+    break;
+  case Kind::ERROR:
+    writeError(this->config.out, record.id);
+    break;
+  }
+}
+
+void AsyncLogSink::run() {
+  Record record;
+  while (true) {
+    // Read the flag first, so a record queued before the destructor ran is
+    // still written
+    const bool stopping = !this->running.load();
+    bool any = false;
+    while (this->pop(record)) {
+      this->write(record);
+      this->written.fetch_add(1);
+      any = true;
+    }
+    if (any) {
+      std::fflush(this->config.out);
+    } else if (stopping) {
+      return;
+    } else {
+      std::this_thread::sleep_for(this->config.idle);
+    }
+  }
+}
+
+} // namespace Protocol
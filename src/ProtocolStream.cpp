@@ -0,0 +1,125 @@
+#include "ProtocolStream.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Protocol {
+
+void StreamScheduler::add(const StreamConfig &config,
+                          const Clock::time_point now) {
+  if (!(0.0 < config.rate_hz) || config.batch == 0 ||
+      config.burst < config.batch) {
+    throw std::runtime_error("Stream needs a positive rate and burst >= batch");
+  }
+  if (!config.producer) {
+    throw std::runtime_error("Stream needs a sample producer");
+  }
+  const std::size_t index = static_cast<uint8_t>(config.id);
+  if (this->streams.size() <= index) {
+    this->streams.resize(index + 1);
+  }
+
+  // Replacing a running stream keeps it running with the new settings
+  const bool was_enabled = this->isEnabled(config.id);
+  this->enable(config.id, false, now);
+  this->streams[index] = std::make_unique<Stream>();
+  this->streams[index]->config = config;
+  if (was_enabled) {
+    this->enable(config.id, true, now);
+  }
+}
+
+bool StreamScheduler::enable(const StreamID id, const bool enable,
+                             const Clock::time_point now) {
+  const std::size_t index = static_cast<uint8_t>(id);
+  if (this->streams.size() <= index || !this->streams[index]) {
+    return false;
+  }
+  Stream &stream = *this->streams[index];
+  if (stream.enabled == enable) {
+    return true;
+  }
+  stream.enabled = enable;
+  if (enable) {
+    stream.tokens = stream.config.batch;
+    stream.refilled = now;
+    stream.deadline = now;
+    this->enabled.push_back(&stream);
+  } else {
+    std::erase(this->enabled, &stream);
+  }
+  return true;
+}
+
+bool StreamScheduler::contains(const StreamID id) const {
+  const std::size_t index = static_cast<uint8_t>(id);
+  return index < this->streams.size() && this->streams[index];
+}
+
+bool StreamScheduler::isEnabled(const StreamID id) const {
+  const std::size_t index = static_cast<uint8_t>(id);
+  return index < this->streams.size() && this->streams[index] &&
+         this->streams[index]->enabled;
+}
+
+std::size_t StreamScheduler::poll(const Emitter &emit,
+                                  const Clock::time_point now) {
+  // Collect the due streams, highest priority first
+  this->due.clear();
+  for (Stream *stream : this->enabled) {
+    if (stream->deadline <= now) {
+      this->due.push_back(stream);
+    }
+  }
+  std::stable_sort(this->due.begin(), this->due.end(),
+                   [](const Stream *a, const Stream *b) {
+                     return a->config.priority > b->config.priority;
+                   });
+
+  std::size_t sent = 0;
+  for (Stream *stream : this->due) {
+    refill(*stream, now);
+    const uint32_t batch = stream->config.batch;
+    while (batch <= stream->tokens) {
+      for (uint32_t i = 0; i < batch; ++i) {
+        stream->config.producer(stream->index++, this->scratch);
+        emit(stream->config.id, this->scratch);
+      }
+      stream->tokens -= batch;
+      sent += batch;
+    }
+    schedule(*stream, now);
+  }
+  return sent;
+}
+
+std::optional<StreamScheduler::Clock::time_point>
+StreamScheduler::nextDeadline() const {
+  std::optional<Clock::time_point> next{};
+  for (const Stream *stream : this->enabled) {
+    if (!next || stream->deadline < *next) {
+      next = stream->deadline;
+    }
+  }
+  return next;
+}
+
+void StreamScheduler::refill(Stream &stream, const Clock::time_point now) {
+  if (now <= stream.refilled) {
+    return;
+  }
+  const double elapsed =
+      std::chrono::duration<double>(now - stream.refilled).count();
+  stream.tokens = std::min<double>(stream.tokens + elapsed * stream.config.rate_hz,
+                                   stream.config.burst);
+  stream.refilled = now;
+}
+
+void StreamScheduler::schedule(Stream &stream, const Clock::time_point now) {
+  const double missing = stream.config.batch - stream.tokens;
+  const auto wait = std::chrono::duration<double>(missing / stream.config.rate_hz);
+  stream.deadline =
+      now + std::chrono::ceil<Clock::duration>(std::max(wait, decltype(wait)::zero()));
+}
+
+} // namespace Protocol
@@ -0,0 +1,108 @@
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include "RuntimeScheduler.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <latch>
+#include <memory>
+#include <thread>
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+using Runtime::Scheduler;
+using Runtime::Task;
+
+/* Sends PING requests back to back until a deadline, counting the answers
+ */
+static Task client(Scheduler &scheduler, Host &host, Driver &driver,
+                   const Scheduler::Clock::time_point until,
+                   std::atomic<uint64_t> &exchanges, std::latch &finished) {
+  while (!scheduler.stopping() && Scheduler::Clock::now() < until) {
+    std::future<Msg> reply = host.request(CmdID::PING, {}, 1s);
+    while (reply.wait_for(0s) != std::future_status::ready) {
+      co_await scheduler.readable(driver, Scheduler::Clock::now() + 5ms);
+      while (host.poll()) {
+      }
+    }
+    reply.get();
+    exchanges.fetch_add(1, std::memory_order_relaxed);
+  }
+  finished.count_down();
+}
+
+/* Runs host/device pairs as coroutines on a scheduler for a fixed time
+ * @return Request/response exchanges completed per second
+ */
+static double measure(const Scheduler::Config &config, const std::size_t pairs,
+                      const Scheduler::Clock::duration duration) {
+  std::vector<std::unique_ptr<Driver>> drivers;
+  std::vector<std::unique_ptr<Host>> hosts;
+  std::vector<std::unique_ptr<Device>> devices;
+  Scheduler scheduler(config);
+  for (std::size_t i = 0; i < pairs; ++i) {
+    Driver *host_eth = drivers.emplace_back(std::make_unique<Driver>(
+        MacAddr{0x02, 0x00, 0x00, 0x00, static_cast<uint8_t>(i >> 8),
+                static_cast<uint8_t>(i)})).get();
+    Driver *dev_eth = drivers.emplace_back(std::make_unique<Driver>(
+        MacAddr{0x02, 0x00, 0x00, 0x01, static_cast<uint8_t>(i >> 8),
+                static_cast<uint8_t>(i)})).get();
+    Driver::link(*host_eth, *dev_eth);
+    scheduler.attach(*host_eth);
+    scheduler.attach(*dev_eth);
+    hosts.push_back(std::make_unique<Host>(*host_eth));
+    devices.push_back(std::make_unique<Device>(*dev_eth));
+  }
+
+  std::atomic<uint64_t> exchanges{0};
+  std::latch finished(static_cast<std::ptrdiff_t>(pairs));
+  const auto start = Scheduler::Clock::now();
+  for (std::size_t i = 0; i < pairs; ++i) {
+    scheduler.spawn(devices[i]->run(scheduler));
+    scheduler.spawn(client(scheduler, *hosts[i], *drivers[2 * i],
+                           start + duration, exchanges, finished));
+  }
+  finished.wait();
+  const std::chrono::duration<double> elapsed =
+      Scheduler::Clock::now() - start;
+  scheduler.stop();
+  return static_cast<double>(exchanges.load()) / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  // Usage: runtime_bench [milliseconds per run] [--pin]
+  Scheduler::Clock::duration duration = 250ms;
+  bool pin = false;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--pin") == 0) {
+      pin = true;
+    } else {
+      duration = std::chrono::milliseconds(std::atoi(argv[i]));
+    }
+  }
+
+  const std::size_t cores =
+      std::max<std::size_t>(1, std::thread::hardware_concurrency());
+  std::vector<std::size_t> worker_counts;
+  for (std::size_t workers = 1; workers <= std::max<std::size_t>(cores, 4);
+       workers *= 2) {
+    worker_counts.push_back(workers);
+  }
+  const std::size_t pair_counts[] = {1, 16, 256, 1024};
+
+  std::printf("%zu hardware threads, %s workers\n", cores,
+              pin ? "pinned" : "unpinned");
+  std::printf("%8s %8s %16s %16s\n", "workers", "pairs", "exchanges/s",
+              "per worker");
+  for (const std::size_t workers : worker_counts) {
+    for (const std::size_t pairs : pair_counts) {
+      const double rate = measure(Scheduler::Config{workers, pin}, pairs, duration);
+      std::printf("%8zu %8zu %16.0f %16.0f\n", workers, pairs, rate,
+                  rate / static_cast<double>(workers));
+    }
+  }
+  return 0;
+}
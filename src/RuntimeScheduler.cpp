@@ -0,0 +1,422 @@
+#include "RuntimeScheduler.hpp"
+#include <stdexcept>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Runtime {
+
+namespace {
+
+// Worker the calling thread runs as, so rescheduled coroutines stay local
+thread_local const Scheduler *current_scheduler = nullptr;
+thread_local std::size_t current_worker = 0;
+
+} // namespace
+
+/* Wait */
+void Scheduler::Wait::RxEvent::notify(void *ctx) {
+  RxEvent &event = *static_cast<RxEvent *>(ctx);
+  std::lock_guard<std::mutex> lock(event.mutex);
+  if (event.waiter) {
+    event.waiter->fire();
+    event.waiter = nullptr;
+  } else {
+    event.signaled = true;
+  }
+}
+
+Scheduler::Wait::Wait(Scheduler &scheduler, RxEvent *event,
+                      const Clock::time_point deadline)
+    : scheduler(scheduler), event(event), deadline(deadline) {}
+
+bool Scheduler::Wait::await_ready() const {
+  if (this->scheduler.stopping()) {
+    return true;
+  }
+  if (this->event && this->event->driver->hasPending()) {
+    return true;
+  }
+  return this->deadline != Clock::time_point::max() &&
+         this->deadline <= Clock::now();
+}
+
+bool Scheduler::Wait::await_suspend(std::coroutine_handle<> handle) {
+  this->handle = handle;
+
+  // Either condition may fire while the other is still being armed, which
+  // leaves the state FIRED and the coroutine resumes straight away
+  if (this->event) {
+    std::lock_guard<std::mutex> lock(this->event->mutex);
+    if (this->event->signaled) {
+      this->event->signaled = false;
+      this->state.store(FIRED);
+    } else {
+      this->event->waiter = this;
+    }
+  }
+  if (this->state.load() != FIRED &&
+      this->deadline != Clock::time_point::max()) {
+    bool earliest = false;
+    {
+      std::lock_guard<std::mutex> lock(this->scheduler.timer_mutex);
+      this->scheduler.heapPush(this);
+      earliest = this->heap_index == 0;
+    }
+    // Sleeping workers wait for the old earliest timer
+    if (earliest) {
+      this->scheduler.wake(false);
+    }
+  }
+
+  // stop() sets the flag before it fires every wait, so a wait armed after
+  // that sweep sees the flag here
+  if (this->scheduler.stopping()) {
+    this->state.store(FIRED);
+  }
+  int expected = ARMING;
+  return this->state.compare_exchange_strong(expected, WAITING);
+}
+
+void Scheduler::Wait::await_resume() {
+  this->disarm();
+}
+
+void Scheduler::Wait::fire() {
+  int state = this->state.load();
+  while (state != FIRED) {
+    if (this->state.compare_exchange_weak(state, FIRED)) {
+      if (state == WAITING) {
+        this->scheduler.schedule(this->handle);
+      }
+      return;
+    }
+  }
+}
+
+void Scheduler::Wait::disarm() {
+  if (this->deadline != Clock::time_point::max()) {
+    std::lock_guard<std::mutex> lock(this->scheduler.timer_mutex);
+    if (this->heap_index != NOT_ARMED) {
+      this->scheduler.heapRemove(this);
+    }
+  }
+  if (this->event) {
+    std::lock_guard<std::mutex> lock(this->event->mutex);
+    if (this->event->waiter == this) {
+      this->event->waiter = nullptr;
+    }
+  }
+}
+
+/* Scheduler */
+Scheduler::Scheduler(const std::size_t threads)
+    : Scheduler(Config{threads, false}) {}
+
+Scheduler::Scheduler(const Config &config) {
+  if (config.threads == 0) {
+    throw std::runtime_error("Scheduler needs at least one thread");
+  }
+  this->workers.reserve(config.threads);
+  for (std::size_t i = 0; i < config.threads; ++i) {
+    this->workers.push_back(std::make_unique<Worker>());
+  }
+  for (std::size_t i = 0; i < config.threads; ++i) {
+    this->workers[i]->thread = std::thread([this, i] { this->run(i); });
+  }
+  if (config.pin) {
+    try {
+      this->pin();
+    } catch (...) {
+      this->shutdown();
+      throw;
+    }
+  }
+}
+
+Scheduler::~Scheduler() {
+  this->shutdown();
+}
+
+void Scheduler::attach(Driver &driver) {
+  auto event = std::make_unique<Wait::RxEvent>();
+  event->driver = &driver;
+  driver.setRxNotify(&Wait::RxEvent::notify, event.get());
+  this->events[&driver] = std::move(event);
+}
+
+void Scheduler::spawn(Task &&task) {
+  if (this->stopping()) {
+    throw std::logic_error("Task spawned on a stopped scheduler");
+  }
+  std::coroutine_handle<Task::promise_type> handle =
+      std::exchange(task.handle, nullptr);
+  handle.promise().scheduler = this;
+  ++this->live_tasks;
+  this->schedule(handle);
+}
+
+void Scheduler::stop() {
+  this->shutdown();
+  std::lock_guard<std::mutex> lock(this->exception_mutex);
+  if (this->exception) {
+    std::rethrow_exception(std::exchange(this->exception, nullptr));
+  }
+}
+
+bool Scheduler::stopping() const {
+  return this->stop_requested.load();
+}
+
+std::size_t Scheduler::size() const {
+  return this->workers.size();
+}
+
+Scheduler::Wait Scheduler::sleepUntil(const Clock::time_point deadline) {
+  return Wait(*this, nullptr, deadline);
+}
+
+Scheduler::Wait Scheduler::readable(Driver &driver,
+                                    const Clock::time_point deadline) {
+  const auto found = this->events.find(&driver);
+  if (found == this->events.end()) {
+    throw std::logic_error("Driver not attached to scheduler");
+  }
+  return Wait(*this, found->second.get(), deadline);
+}
+
+void Scheduler::schedule(std::coroutine_handle<> handle) {
+  const std::size_t index =
+      current_scheduler == this
+          ? current_worker
+          : this->next_worker.fetch_add(1) % this->workers.size();
+  {
+    Worker &worker = *this->workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.queue.push_back(handle);
+  }
+  this->wake(false);
+}
+
+std::coroutine_handle<> Scheduler::take(const std::size_t index) {
+  // Own queue from the front, others from the back
+  for (std::size_t i = 0; i < this->workers.size(); ++i) {
+    Worker &worker = *this->workers[(index + i) % this->workers.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.queue.empty()) {
+      continue;
+    }
+    std::coroutine_handle<> handle{};
+    if (i == 0) {
+      handle = worker.queue.front();
+      worker.queue.pop_front();
+    } else {
+      handle = worker.queue.back();
+      worker.queue.pop_back();
+    }
+    return handle;
+  }
+  return nullptr;
+}
+
+Scheduler::Clock::time_point
+Scheduler::fireTimers(const Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(this->timer_mutex);
+  while (!this->timers.empty() && this->timers.front()->deadline <= now) {
+    Wait *wait = this->timers.front();
+    this->heapRemove(wait);
+    wait->fire();
+  }
+  return this->timers.empty() ? Clock::time_point::max()
+                              : this->timers.front()->deadline;
+}
+
+void Scheduler::wake(const bool all) {
+  this->epoch.fetch_add(1);
+  if (!all && this->sleepers.load() == 0) {
+    return;
+  }
+  {
+    // Taking the lock orders this wake after a sleeper's final check
+    std::lock_guard<std::mutex> lock(this->idle_mutex);
+  }
+  if (all) {
+    this->idle.notify_all();
+  } else {
+    this->idle.notify_one();
+  }
+}
+
+void Scheduler::finished(std::exception_ptr exception) {
+  if (exception) {
+    std::lock_guard<std::mutex> lock(this->exception_mutex);
+    if (!this->exception) {
+      this->exception = exception;
+    }
+  }
+  if (--this->live_tasks == 0 && this->stopping()) {
+    this->wake(true);
+  }
+}
+
+void Scheduler::shutdown() {
+  if (this->stop_requested.exchange(true)) {
+    // Already stopped, or stopping on another thread
+    for (auto &worker : this->workers) {
+      if (worker->thread.joinable() &&
+          worker->thread.get_id() != std::this_thread::get_id()) {
+        worker->thread.join();
+      }
+    }
+    return;
+  }
+
+  // Every wait resumes so its task can see stopping() and return
+  {
+    std::lock_guard<std::mutex> lock(this->timer_mutex);
+    while (!this->timers.empty()) {
+      Wait *wait = this->timers.front();
+      this->heapRemove(wait);
+      wait->fire();
+    }
+  }
+  for (auto &[driver, event] : this->events) {
+    std::lock_guard<std::mutex> lock(event->mutex);
+    if (event->waiter) {
+      event->waiter->fire();
+      event->waiter = nullptr;
+    }
+  }
+  this->wake(true);
+  for (auto &worker : this->workers) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
+    }
+  }
+  for (auto &[driver, event] : this->events) {
+    driver->setRxNotify(nullptr, nullptr);
+  }
+}
+
+void Scheduler::pin() {
+#ifdef __linux__
+  // Only CPUs the process is allowed on, so pinning works inside a cpuset
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    throw std::runtime_error("Failed to read CPU affinity");
+  }
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      cpus.push_back(cpu);
+    }
+  }
+  for (std::size_t i = 0; i < this->workers.size(); ++i) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[i % cpus.size()], &set);
+    if (pthread_setaffinity_np(this->workers[i]->thread.native_handle(),
+                               sizeof(set), &set) != 0) {
+      throw std::runtime_error("Failed to pin worker thread");
+    }
+  }
+#else
+  throw std::logic_error("Worker pinning is not supported on this platform");
+#endif
+}
+
+void Scheduler::run(const std::size_t index) {
+  current_scheduler = this;
+  current_worker = index;
+  while (true) {
+    const uint64_t seen = this->epoch.load();
+    if (std::coroutine_handle<> handle = this->take(index)) {
+      handle.resume();
+      continue;
+    }
+    const Clock::time_point next = this->fireTimers(Clock::now());
+    if (this->epoch.load() != seen) {
+      continue;
+    }
+    if (this->stopping() && this->live_tasks.load() == 0) {
+      break;
+    }
+
+    // Sleep until more work is queued or the next timer is due
+    std::unique_lock<std::mutex> lock(this->idle_mutex);
+    ++this->sleepers;
+    auto woken = [this, seen] {
+      return this->epoch.load() != seen ||
+             (this->stopping() && this->live_tasks.load() == 0);
+    };
+    if (next == Clock::time_point::max()) {
+      this->idle.wait(lock, woken);
+    } else {
+      this->idle.wait_until(lock, next, woken);
+    }
+    --this->sleepers;
+  }
+  current_scheduler = nullptr;
+}
+
+void Scheduler::heapPush(Wait *wait) {
+  wait->heap_index = this->timers.size();
+  this->timers.push_back(wait);
+  this->heapUp(wait->heap_index);
+}
+
+void Scheduler::heapRemove(Wait *wait) {
+  const std::size_t index = wait->heap_index;
+  const std::size_t last = this->timers.size() - 1;
+  if (index != last) {
+    this->heapSwap(index, last);
+  }
+  this->timers.pop_back();
+  wait->heap_index = Wait::NOT_ARMED;
+  if (index != last) {
+    this->heapUp(index);
+    this->heapDown(index);
+  }
+}
+
+void Scheduler::heapSwap(const std::size_t a, const std::size_t b) {
+  std::swap(this->timers[a], this->timers[b]);
+  this->timers[a]->heap_index = a;
+  this->timers[b]->heap_index = b;
+}
+
+void Scheduler::heapUp(std::size_t index) {
+  while (index != 0) {
+    const std::size_t parent = (index - 1) / 2;
+    if (this->timers[parent]->deadline <= this->timers[index]->deadline) {
+      break;
+    }
+    this->heapSwap(parent, index);
+    index = parent;
+  }
+}
+
+void Scheduler::heapDown(std::size_t index) {
+  while (true) {
+    const std::size_t left = 2 * index + 1;
+    const std::size_t right = left + 1;
+    std::size_t smallest = index;
+    if (left < this->timers.size() &&
+        this->timers[left]->deadline < this->timers[smallest]->deadline) {
+      smallest = left;
+    }
+    if (right < this->timers.size() &&
+        this->timers[right]->deadline < this->timers[smallest]->deadline) {
+      smallest = right;
+    }
+    if (smallest == index) {
+      return;
+    }
+    this->heapSwap(index, smallest);
+    index = smallest;
+  }
+}
+
+} // namespace Runtime
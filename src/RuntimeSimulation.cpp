@@ -0,0 +1,345 @@
+#include "RuntimeSimulation.hpp"
+#include <algorithm>
+#include <barrier>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+namespace Runtime {
+
+namespace {
+
+// Partition the calling thread is running events for
+thread_local const Simulation *current_simulation = nullptr;
+thread_local std::size_t current_partition = 0;
+
+// Sets the running partition for the lifetime of a run
+struct Running {
+  Running(const Simulation *simulation, const std::size_t partition)
+      : simulation(std::exchange(current_simulation, simulation)),
+        partition(std::exchange(current_partition, partition)) {}
+  ~Running() {
+    current_simulation = this->simulation;
+    current_partition = this->partition;
+  }
+  const Simulation *simulation;
+  std::size_t partition;
+};
+
+} // namespace
+
+/* Wire */
+class Simulation::Wire : public Ethernet::Medium {
+public:
+  Wire(Simulation &simulation, Driver &a, Driver &b,
+       const Clock::duration latency, const double bits_per_second)
+      : simulation(simulation), a(a), b(b), latency(latency),
+        bits_per_second(bits_per_second) {
+    Medium::connect(a, *this);
+    Medium::connect(b, *this);
+  }
+
+  void forward(const Ethernet::MacAddr &src,
+               std::vector<uint8_t> &&frame) override {
+    const bool from_a = src == this->a.getMacAddr();
+    Driver &dst = from_a ? this->b : this->a;
+    Clock::time_point &free_at = from_a ? this->a_free_at : this->b_free_at;
+
+    // Frames queue behind each other for their serialisation time
+    Clock::time_point sent = this->simulation.now();
+    if (0.0 < this->bits_per_second) {
+      const std::chrono::duration<double> serialise(
+          8.0 * static_cast<double>(frame.size()) / this->bits_per_second);
+      sent = std::max(sent, free_at) +
+             std::chrono::duration_cast<Clock::duration>(serialise);
+      free_at = sent;
+    }
+    this->simulation.at(this->simulation.partitionOf(dst), sent + this->latency,
+                        [&dst, frame = std::move(frame)]() mutable {
+                          Medium::deliver(dst, std::move(frame));
+                        });
+  }
+
+private:
+  Simulation &simulation;
+  Driver &a;
+  Driver &b;
+  Clock::duration latency{};
+  double bits_per_second{0.0};
+  // Each direction is only written by its sender's partition
+  Clock::time_point a_free_at{};
+  Clock::time_point b_free_at{};
+};
+
+/* Simulation */
+Simulation::Simulation(const Config &config) : config(config) {
+  if (config.partitions == 0) {
+    throw std::runtime_error("Simulation needs at least one partition");
+  }
+  if (1 < config.partitions && config.lookahead <= Clock::duration::zero()) {
+    throw std::runtime_error("Partitioned simulation needs a positive lookahead");
+  }
+  for (std::size_t i = 0; i < config.partitions; ++i) {
+    this->partitions.push_back(std::make_unique<Partition>());
+  }
+}
+
+Simulation::Simulation() : Simulation(Config{}) {}
+
+Simulation::~Simulation() = default;
+
+Simulation::Clock::time_point Simulation::now() const {
+  if (current_simulation == this) {
+    return this->partitions[current_partition]->now;
+  }
+  return this->clock;
+}
+
+void Simulation::at(const Clock::time_point time, Event event) {
+  this->at(current_simulation == this ? current_partition : 0, time,
+           std::move(event));
+}
+
+void Simulation::at(const std::size_t partition, const Clock::time_point time,
+                    Event event) {
+  if (this->partitions.size() <= partition) {
+    throw std::runtime_error("No such partition");
+  }
+  const std::size_t origin = current_simulation == this ? current_partition : 0;
+  Partition &source = *this->partitions[origin];
+  if (time < source.now) {
+    throw std::logic_error("Event scheduled in the past");
+  }
+  Scheduled scheduled{time, origin, source.next_order++, std::move(event)};
+
+  // Only the partition's own thread touches its event list during a window
+  Partition &target = *this->partitions[partition];
+  if (!this->parallel || partition == origin) {
+    target.events.push_back(std::move(scheduled));
+    std::push_heap(target.events.begin(), target.events.end(),
+                   &Simulation::later);
+    return;
+  }
+  if (time < this->window_end) {
+    throw std::logic_error("Event for another partition inside the lookahead");
+  }
+  std::lock_guard<std::mutex> lock(target.inbox_mutex);
+  target.inbox.push_back(std::move(scheduled));
+}
+
+void Simulation::after(const Clock::duration delay, Event event) {
+  this->at(this->now() + delay, std::move(event));
+}
+
+void Simulation::link(Driver &a, Driver &b, const Clock::duration latency,
+                      const double bits_per_second) {
+  if (latency < Clock::duration::zero() || bits_per_second < 0.0) {
+    throw std::runtime_error("Wire latency and bit rate must not be negative");
+  }
+  if (this->partitionOf(a) != this->partitionOf(b) &&
+      latency < this->config.lookahead) {
+    throw std::runtime_error("Wire between partitions shorter than lookahead");
+  }
+  this->wires.push_back(
+      std::make_unique<Wire>(*this, a, b, latency, bits_per_second));
+  a.setPeerMacAddr(b.getMacAddr());
+  b.setPeerMacAddr(a.getMacAddr());
+}
+
+void Simulation::spawn(Endpoint &&endpoint, const std::size_t partition) {
+  if (!endpoint.driver || !endpoint.step) {
+    throw std::logic_error("Endpoint needs a driver and a step");
+  }
+  if (this->partitions.size() <= partition) {
+    throw std::runtime_error("No such partition");
+  }
+  auto process = std::make_unique<Process>();
+  process->simulation = this;
+  process->endpoint = std::move(endpoint);
+  process->partition = partition;
+  this->driver_partitions[process->endpoint.driver] = partition;
+  process->endpoint.driver->setRxNotify(&Simulation::notify, process.get());
+  Process &spawned = *this->processes.emplace_back(std::move(process));
+  this->wake(spawned);
+}
+
+void Simulation::run(const Clock::time_point until) {
+  // Events at until still run
+  const Clock::time_point end =
+      until == Clock::time_point::max() ? until : until + Clock::duration(1);
+
+  if (this->partitions.size() == 1) {
+    Partition &partition = *this->partitions.front();
+    {
+      const Running running(this, 0);
+      this->drain(partition, end);
+    }
+    this->clock = std::max(
+        this->clock, until == Clock::time_point::max() ? partition.now : until);
+    partition.now = this->clock;
+    return;
+  }
+
+  // Each window runs the events before the earliest one plus the lookahead
+  bool done = false;
+  auto window = [this, end, &done]() noexcept {
+    const Clock::time_point next = this->merge();
+    bool failed = false;
+    {
+      std::lock_guard<std::mutex> lock(this->error_mutex);
+      failed = this->error != nullptr;
+    }
+    if (failed || next == Clock::time_point::max() || end <= next) {
+      done = true;
+      return;
+    }
+    this->window_end =
+        end - next <= this->config.lookahead ? end : next + this->config.lookahead;
+    ++this->windows;
+  };
+  std::barrier sync(static_cast<std::ptrdiff_t>(this->partitions.size()),
+                    window);
+  auto body = [this, &sync, &done](const std::size_t index) {
+    const Running running(this, index);
+    while (true) {
+      sync.arrive_and_wait();
+      if (done) {
+        return;
+      }
+      try {
+        this->drain(*this->partitions[index], this->window_end);
+      } catch (...) {
+        this->fail(std::current_exception());
+      }
+    }
+  };
+
+  this->parallel = true;
+  std::vector<std::thread> threads;
+  for (std::size_t i = 1; i < this->partitions.size(); ++i) {
+    threads.emplace_back(body, i);
+  }
+  body(0);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  this->parallel = false;
+  this->window_end = Clock::time_point::max();
+
+  // Partitions resume from the same time
+  Clock::time_point latest = this->clock;
+  for (const std::unique_ptr<Partition> &partition : this->partitions) {
+    latest = std::max(latest, partition->now);
+  }
+  this->clock = until == Clock::time_point::max() ? latest : std::max(latest, until);
+  for (const std::unique_ptr<Partition> &partition : this->partitions) {
+    partition->now = this->clock;
+  }
+
+  std::exception_ptr error{};
+  {
+    std::lock_guard<std::mutex> lock(this->error_mutex);
+    error = std::exchange(this->error, nullptr);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void Simulation::run() {
+  this->run(Clock::time_point::max());
+}
+
+Simulation::Stats Simulation::getStats() const {
+  Stats stats{};
+  for (const std::unique_ptr<Partition> &partition : this->partitions) {
+    stats.events += partition->processed;
+  }
+  stats.windows = this->windows;
+  return stats;
+}
+
+bool Simulation::later(const Scheduled &a, const Scheduled &b) {
+  return std::tie(a.time, a.origin, a.order) >
+         std::tie(b.time, b.origin, b.order);
+}
+
+void Simulation::notify(void *ctx) {
+  Process &process = *static_cast<Process *>(ctx);
+  process.simulation->wake(process);
+}
+
+void Simulation::wake(Process &process) {
+  // Frames that arrive together are handled by one step
+  if (process.wake_queued) {
+    return;
+  }
+  process.wake_queued = true;
+  this->at(process.partition, this->now(),
+           [this, &process] { this->step(process); });
+}
+
+void Simulation::step(Process &process) {
+  process.wake_queued = false;
+  const Clock::time_point now = this->now();
+  const std::optional<Clock::time_point> next = process.endpoint.step(now);
+  if (next == process.armed) {
+    return;
+  }
+
+  // A superseded deadline is left in the event list and ignored
+  process.armed = next;
+  const uint64_t generation = ++process.generation;
+  if (next) {
+    this->at(process.partition, std::max(*next, now),
+             [this, &process, generation] {
+               if (process.generation == generation) {
+                 process.armed.reset();
+                 this->step(process);
+               }
+             });
+  }
+}
+
+std::size_t Simulation::partitionOf(const Driver &driver) const {
+  const auto found = this->driver_partitions.find(&driver);
+  return found == this->driver_partitions.end() ? 0 : found->second;
+}
+
+void Simulation::drain(Partition &partition, const Clock::time_point end) {
+  while (!partition.events.empty() && partition.events.front().time < end) {
+    std::pop_heap(partition.events.begin(), partition.events.end(),
+                  &Simulation::later);
+    Scheduled next = std::move(partition.events.back());
+    partition.events.pop_back();
+    partition.now = next.time;
+    ++partition.processed;
+    next.event();
+  }
+}
+
+Simulation::Clock::time_point Simulation::merge() {
+  Clock::time_point earliest = Clock::time_point::max();
+  for (const std::unique_ptr<Partition> &partition : this->partitions) {
+    for (Scheduled &scheduled : partition->inbox) {
+      partition->events.push_back(std::move(scheduled));
+      std::push_heap(partition->events.begin(), partition->events.end(),
+                     &Simulation::later);
+    }
+    partition->inbox.clear();
+    if (!partition->events.empty()) {
+      earliest = std::min(earliest, partition->events.front().time);
+    }
+  }
+  return earliest;
+}
+
+void Simulation::fail(std::exception_ptr exception) {
+  std::lock_guard<std::mutex> lock(this->error_mutex);
+  if (!this->error) {
+    this->error = exception;
+  }
+}
+
+} // namespace Runtime
@@ -0,0 +1,76 @@
+#include "RuntimeTask.hpp"
+#include "RuntimeScheduler.hpp"
+#include <array>
+#include <new>
+#include <vector>
+
+namespace Runtime {
+
+namespace {
+
+/* Free frames of one thread, returned to the heap when the thread exits
+ */
+struct FrameCache {
+  ~FrameCache() {
+    for (std::size_t i = 0; i < this->free.size(); ++i) {
+      for (void *frame : this->free[i]) {
+        ::operator delete(frame, (i + 1) * FramePool::CLASS_SIZE);
+      }
+    }
+  }
+
+  std::array<std::vector<void *>, FramePool::CLASS_COUNT> free{};
+  std::size_t cached{0};
+};
+
+thread_local FrameCache cache;
+
+} // namespace
+
+/* FramePool */
+void *FramePool::allocate(const std::size_t size) {
+  const std::size_t size_class = (size + CLASS_SIZE - 1) / CLASS_SIZE;
+  if (size_class == 0 || CLASS_COUNT < size_class) {
+    return ::operator new(size);
+  }
+  std::vector<void *> &free = cache.free[size_class - 1];
+  if (free.empty()) {
+    return ::operator new(size_class * CLASS_SIZE);
+  }
+  void *frame = free.back();
+  free.pop_back();
+  --cache.cached;
+  return frame;
+}
+
+void FramePool::deallocate(void *frame, const std::size_t size) noexcept {
+  const std::size_t size_class = (size + CLASS_SIZE - 1) / CLASS_SIZE;
+  if (size_class == 0 || CLASS_COUNT < size_class) {
+    ::operator delete(frame, size);
+    return;
+  }
+  std::vector<void *> &free = cache.free[size_class - 1];
+  if (CACHE_MAX <= free.size()) {
+    ::operator delete(frame, size_class * CLASS_SIZE);
+    return;
+  }
+  try {
+    free.push_back(frame);
+    ++cache.cached;
+  } catch (const std::bad_alloc &) {
+    ::operator delete(frame, size_class * CLASS_SIZE);
+  }
+}
+
+std::size_t FramePool::cached() {
+  return cache.cached;
+}
+
+/* Task */
+Task::promise_type::~promise_type() {
+  if (this->scheduler) {
+    this->scheduler->finished(this->exception);
+  }
+}
+
+} // namespace Runtime
@@ -0,0 +1,183 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolAggregate.hpp"
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+// A fixed origin keeps bucket boundaries where the tests expect them
+static const Aggregator::Clock::time_point T0{100s};
+
+TEST_CASE("Histogram bins stay within a few percent of their values") {
+  for (uint32_t value = 0; value < 2 * Aggregator::SUB_BINS; ++value) {
+    REQUIRE(Aggregator::binValue(Aggregator::binOf(value)) == value);
+  }
+  REQUIRE(Aggregator::binOf(UINT32_MAX) == Aggregator::BINS - 1);
+
+  bool within = true;
+  bool ordered = true;
+  std::size_t previous = 0;
+  for (uint64_t value = 32; value <= UINT32_MAX; value += value / 97 + 1) {
+    const std::size_t bin = Aggregator::binOf(static_cast<uint32_t>(value));
+    const double error =
+        std::abs(static_cast<double>(Aggregator::binValue(bin)) -
+                 static_cast<double>(value)) /
+        static_cast<double>(value);
+    within = within && error <= 1.0 / 32;
+    ordered = ordered && previous <= bin;
+    previous = bin;
+  }
+  REQUIRE(within);
+  REQUIRE(ordered);
+}
+
+TEST_CASE("Sliding windows aggregate the buckets up to now") {
+  Aggregator aggregator(Aggregator::Config{1s, 10});
+  for (uint32_t value = 1; value <= 100; ++value) {
+    aggregator.add(StreamID::TELEMETRY, T0 + value * 9ms, value);
+  }
+
+  const Aggregator::Summary summary =
+      aggregator.sliding(StreamID::TELEMETRY, 1s, T0 + 999ms);
+  REQUIRE(summary.count == 100);
+  REQUIRE(summary.min == 1);
+  REQUIRE(summary.max == 100);
+  REQUIRE(summary.mean == Approx(50.5));
+  REQUIRE(summary.rate == Approx(100.0 / 0.999));
+  REQUIRE(summary.p50 == Approx(50).epsilon(0.04));
+  REQUIRE(summary.p90 == Approx(90).epsilon(0.04));
+  REQUIRE(summary.p99 == Approx(99).epsilon(0.04));
+
+  // A block lands in one bucket, and later windows leave the first behind
+  const std::vector<uint32_t> block = {1000, 2000, 3000};
+  aggregator.add(StreamID::TELEMETRY, T0 + 5s, block);
+  const Aggregator::Summary later =
+      aggregator.sliding(StreamID::TELEMETRY, 2s, T0 + 5500ms);
+  REQUIRE(later.count == 3);
+  REQUIRE(later.min == 1000);
+  REQUIRE(later.max == 3000);
+  REQUIRE(later.mean == Approx(2000.0));
+  REQUIRE(aggregator.sliding(StreamID::TELEMETRY, 1h, T0 + 5500ms).count == 103);
+
+  REQUIRE(aggregator.sliding(static_cast<StreamID>(0x7F), 1s, T0).count == 0);
+  REQUIRE_THROWS_AS(Aggregator(Aggregator::Config{0s, 10}), std::runtime_error);
+}
+
+TEST_CASE("Tumbling windows report the last completed window") {
+  Aggregator aggregator(Aggregator::Config{1s, 10});
+  for (uint32_t value = 0; value < 40; ++value) {
+    aggregator.add(StreamID::TELEMETRY, T0 + value * 100ms, value);
+  }
+
+  // Samples 0 to 19 fill [100s, 102s), the window still filling is ignored
+  const Aggregator::Summary summary =
+      aggregator.tumbling(StreamID::TELEMETRY, 2s, T0 + 3s);
+  REQUIRE(summary.count == 20);
+  REQUIRE(summary.min == 0);
+  REQUIRE(summary.max == 19);
+  REQUIRE(summary.rate == Approx(10.0));
+  REQUIRE(aggregator.tumbling(StreamID::TELEMETRY, 2s, T0 + 4s).min == 20);
+
+  REQUIRE_THROWS_AS(aggregator.tumbling(StreamID::TELEMETRY, 1500ms, T0),
+                    std::runtime_error);
+  REQUIRE_THROWS_AS(aggregator.tumbling(StreamID::TELEMETRY, 6s, T0),
+                    std::runtime_error);
+}
+
+TEST_CASE("Buckets are reused as time moves on and late samples dropped") {
+  Aggregator aggregator(Aggregator::Config{1s, 4});
+  aggregator.add(StreamID::TELEMETRY, T0, 1);
+  aggregator.add(StreamID::TELEMETRY, T0 + 4s, 2);
+  aggregator.add(StreamID::TELEMETRY, T0 + 500ms, 3);
+
+  const Aggregator::Summary summary =
+      aggregator.sliding(StreamID::TELEMETRY, 1h, T0 + 4s);
+  REQUIRE(summary.count == 1);
+  REQUIRE(summary.max == 2);
+  REQUIRE(aggregator.getStats().late == 1);
+}
+
+TEST_CASE("Several threads feed one aggregator") {
+  Aggregator aggregator;
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&aggregator, t] {
+      for (uint32_t i = 0; i < 10000; ++i) {
+        aggregator.add(StreamID::TELEMETRY, T0, t * 10000 + i);
+      }
+    });
+  }
+  // Queries run while the threads add, and never see the count go back
+  uint64_t seen = 0;
+  bool monotonic = true;
+  while (seen < 40000) {
+    const uint64_t count = aggregator.sliding(StreamID::TELEMETRY, 1s, T0).count;
+    monotonic = monotonic && seen <= count;
+    seen = count;
+  }
+  REQUIRE(monotonic);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  const Aggregator::Summary summary = aggregator.sliding(StreamID::TELEMETRY, 1s, T0);
+  REQUIRE(summary.count == 40000);
+  REQUIRE(summary.min == 0);
+  REQUIRE(summary.max == 39999);
+  REQUIRE(summary.mean == Approx(19999.5));
+}
+
+TEST_CASE("Host feeds its aggregator raw and encoded stream samples") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+  Aggregator aggregator;
+  host.setAggregator(aggregator);
+  host.onStream(StreamID::TELEMETRY, [](Host &, const MsgView &) {});
+
+  for (uint32_t value : {10u, 20u, 30u}) {
+    std::vector<uint8_t> sample(sizeof(value));
+    std::memcpy(sample.data(), &value, sizeof(value));
+    dev.sendStream(StreamID::TELEMETRY, sample);
+  }
+  while (host.poll()) {
+  }
+  Aggregator::Summary summary = aggregator.sliding(StreamID::TELEMETRY, 1min);
+  REQUIRE(summary.count == 3);
+  REQUIRE(summary.max == 30);
+
+  // Send 100 to 131 as one encoded block
+  const auto start = StreamScheduler::Clock::now();
+  StreamScheduler::StreamConfig telemetry;
+  telemetry.id = StreamID::TELEMETRY;
+  telemetry.rate_hz = 1000.0;
+  telemetry.burst = 32;
+  telemetry.batch = 32;
+  telemetry.producer = [](uint32_t index, std::vector<uint8_t> &sample) {
+    const uint32_t value = 100 + index;
+    sample.resize(sizeof(value));
+    std::memcpy(sample.data(), &value, sizeof(value));
+  };
+  dev.addStream(telemetry);
+  host.setStreamEncoding(StreamID::TELEMETRY, Encoding::DELTA_VARINT);
+  host.sendCommand(CmdID::START_STREAM, {});
+  dev.poll(start);
+  dev.poll(start);
+  while (host.poll()) {
+  }
+
+  summary = aggregator.sliding(StreamID::TELEMETRY, 1min);
+  REQUIRE(summary.count == 3 + 32);
+  REQUIRE(summary.max == 131);
+}
@@ -0,0 +1,144 @@
+#include <catch2/catch_all.hpp>
+
+#include "EthernetAlloc.hpp"
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include <cstring>
+#include <thread>
+
+using namespace Ethernet;
+using namespace Protocol;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+// Cycles measured after warming up, so one-off growth is not counted
+static constexpr uint64_t CYCLES = 100;
+
+// Allocations a cycle may make at most, which is what each path makes today.
+// Lower these as allocations are taken out, so they stay out.
+static constexpr uint64_t DRIVER_BUDGET = 2;
+static constexpr uint64_t PING_BUDGET = 8;
+
+// Counts responses without formatting them
+struct CountingSink : Sink {
+  void response(const ResponseRecord &) override { ++this->responses; }
+  void telemetry(const TelemetryRecord &) override {}
+  void error(const ErrorRecord &) override {}
+  uint64_t responses{0};
+};
+
+static Alloc::Counts siteCounts(const char *tag) {
+  for (const Alloc::Site &site : Alloc::sites()) {
+    if (site.tag && std::strcmp(site.tag, tag) == 0) {
+      return site.counts;
+    }
+  }
+  return Alloc::Counts{};
+}
+
+TEST_CASE("Allocations are counted per thread and charged to tags") {
+  REQUIRE(Alloc::tracking());
+  static const char *const OUTER = "test.outer";
+  static const char *const INNER = "test.inner";
+
+  const Alloc::Counts outer_before = siteCounts(OUTER);
+  const Alloc::Counts inner_before = siteCounts(INNER);
+  const Alloc::Counts process_before = Alloc::process();
+  // Calling operator new directly, since new expressions may be elided
+  Alloc::Scope scope;
+  {
+    const Alloc::Tag outer(OUTER);
+    void *first = ::operator new(8);
+    void *second = nullptr;
+    {
+      const Alloc::Tag inner(INNER);
+      second = ::operator new(100);
+    }
+    ::operator delete(first);
+    ::operator delete(second);
+  }
+  const Alloc::Counts counts = scope.counts();
+  REQUIRE(counts.allocations == 2);
+  REQUIRE(counts.deallocations == 2);
+  REQUIRE(counts.bytes == 108);
+
+  // Freeing is charged to the tag in force when it happens
+  const Alloc::Counts outer_counts = siteCounts(OUTER) - outer_before;
+  const Alloc::Counts inner_counts = siteCounts(INNER) - inner_before;
+  REQUIRE(outer_counts.allocations == 1);
+  REQUIRE(outer_counts.deallocations == 2);
+  REQUIRE(inner_counts.allocations == 1);
+  REQUIRE(inner_counts.deallocations == 0);
+  REQUIRE(inner_counts.bytes == 100);
+
+  // Another thread's allocations reach the process totals only
+  Alloc::Counts worker{};
+  std::thread([&worker] {
+    Alloc::Scope inside;
+    ::operator delete(::operator new(8));
+    worker = inside.counts();
+  }).join();
+  REQUIRE(worker.allocations == 1);
+  REQUIRE(worker.deallocations == 1);
+  REQUIRE(Alloc::process().allocations - process_before.allocations >= 4);
+}
+
+TEST_CASE("A driver send and recv cycle stays within its allocation budget") {
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver::link(a, b);
+  b.reserveQueue(8);
+  const std::vector<uint8_t> data(64, 0x5A);
+  std::vector<uint8_t> output;
+  for (int i = 0; i < 8; ++i) {
+    a.send(data);
+    b.recv(output);
+  }
+
+  Alloc::Scope scope;
+  bool received = true;
+  for (uint64_t i = 0; i < CYCLES; ++i) {
+    a.send(data);
+    received = b.recv(output) && received;
+  }
+  const Alloc::Counts counts = scope.counts();
+  REQUIRE(received);
+  REQUIRE(counts.allocations <= CYCLES * DRIVER_BUDGET);
+  REQUIRE(counts.deallocations == counts.allocations);
+}
+
+TEST_CASE("A ping round trip stays within its allocation budget") {
+  Driver host_eth(MAC_A);
+  Driver dev_eth(MAC_B);
+  Driver::link(host_eth, dev_eth);
+  host_eth.reserveQueue(8);
+  dev_eth.reserveQueue(8);
+  Host host(host_eth);
+  Device dev(dev_eth);
+  CountingSink sink;
+  host.setSink(sink);
+  for (int i = 0; i < 8; ++i) {
+    host.sendCommand(CmdID::PING, {});
+    dev.poll();
+    host.poll();
+  }
+
+  const Alloc::Counts pack_before = siteCounts("msg.pack");
+  const Alloc::Counts encode_before = siteCounts("frame.encode");
+  Alloc::Scope scope;
+  for (uint64_t i = 0; i < CYCLES; ++i) {
+    host.sendCommand(CmdID::PING, {});
+    dev.poll();
+    host.poll();
+  }
+  const Alloc::Counts counts = scope.counts();
+  REQUIRE(sink.responses == 8 + CYCLES);
+  REQUIRE(counts.allocations <= CYCLES * PING_BUDGET);
+  REQUIRE(counts.deallocations == counts.allocations);
+
+  // Packing and encoding write into the reserved frame
+  REQUIRE(siteCounts("msg.pack").allocations == pack_before.allocations);
+  REQUIRE(siteCounts("frame.encode").allocations == encode_before.allocations);
+  host.setSink(stdoutSink());
+}
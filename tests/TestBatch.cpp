@@ -0,0 +1,115 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolBatch.hpp"
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+
+using namespace Ethernet;
+using namespace Protocol;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+static const ID TELEMETRY{.stream_id = StreamID::TELEMETRY};
+
+TEST_CASE("Coalescer packs records into one frame") {
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver::link(a, b);
+
+  Coalescer coalescer(a, {});
+  for (uint8_t i = 0; i < 10; ++i) {
+    const std::vector<uint8_t> sample = {i, 0, 0, 0};
+    REQUIRE(coalescer.append(MsgType::STREAM, TELEMETRY, sample));
+  }
+  REQUIRE(coalescer.pending() == 10);
+  REQUIRE_FALSE(b.hasPending());
+  coalescer.flush();
+  REQUIRE(coalescer.pending() == 0);
+
+  std::vector<uint8_t> bytes;
+  REQUIRE(b.recv(bytes));
+  REQUIRE_FALSE(b.hasPending());
+  const Msg msg = unpackMsg(bytes);
+  REQUIRE(msg.header.type == MsgType::BATCH);
+  REQUIRE(msg.header.len == 10 * (MSG_LEN_MIN + 4));
+
+  uint8_t expected = 0;
+  for (const MsgView &record : BatchView(msg.data)) {
+    REQUIRE(record.header.type == MsgType::STREAM);
+    REQUIRE(record.header.id.stream_id == StreamID::TELEMETRY);
+    REQUIRE(record.data.size() == 4);
+    REQUIRE(record.data[0] == expected++);
+  }
+  REQUIRE(expected == 10);
+}
+
+TEST_CASE("Coalescer flushes on size and deadline") {
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver::link(a, b);
+
+  Coalescer::Config config;
+  config.max_len = 100;
+  config.max_delay = std::chrono::milliseconds(5);
+  Coalescer coalescer(a, config);
+
+  // Each record is 4 + 40 bytes, so only two fit behind the batch header
+  const std::vector<uint8_t> sample(40, 0x01);
+  const auto t0 = Coalescer::Clock::now();
+  REQUIRE(coalescer.append(MsgType::STREAM, TELEMETRY, sample, t0));
+  REQUIRE(coalescer.append(MsgType::STREAM, TELEMETRY, sample, t0));
+  REQUIRE_FALSE(b.hasPending());
+  REQUIRE(coalescer.append(MsgType::STREAM, TELEMETRY, sample, t0));
+  REQUIRE(b.hasPending());
+  REQUIRE(coalescer.pending() == 1);
+
+  // Deadline flush
+  REQUIRE_FALSE(coalescer.flushIfDue(t0 + std::chrono::milliseconds(1)));
+  REQUIRE(coalescer.flushIfDue(t0 + std::chrono::milliseconds(5)));
+  REQUIRE(coalescer.pending() == 0);
+
+  // Oversize records are refused
+  const std::vector<uint8_t> large(100, 0x02);
+  REQUIRE_FALSE(coalescer.append(MsgType::STREAM, TELEMETRY, large, t0));
+
+  std::vector<uint8_t> bytes;
+  std::size_t records = 0;
+  while (b.recv(bytes)) {
+    const Msg msg = unpackMsg(bytes);
+    for (const MsgView &record : BatchView(msg.data)) {
+      REQUIRE(record.data.size() == sample.size());
+      ++records;
+    }
+  }
+  REQUIRE(records == 3);
+}
+
+TEST_CASE("BatchView rejects truncated records") {
+  const std::vector<uint8_t> data = {0x03, 0x01, 0x08, 0x00, 0xAA, 0xBB};
+  const BatchView view(data);
+  REQUIRE_THROWS_AS(view.begin(), std::runtime_error);
+}
+
+TEST_CASE("Host consumes coalesced device stream") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+  dev.setStreamCoalescing({});
+
+  host.sendCommand(CmdID::START_STREAM, {});
+  dev.poll();
+  host.poll(); // OK response
+  for (int i = 0; i < 5; ++i) {
+    dev.sendStream(StreamID::TELEMETRY, {0x01, 0x00, 0x00, 0x00});
+  }
+  REQUIRE_FALSE(hostEth.hasPending());
+
+  // Responses flush pending stream records ahead of them
+  dev.sendResponse(CmdID::PING, {'P', 'O', 'N', 'G'});
+  REQUIRE(host.poll());
+  REQUIRE(host.poll());
+  REQUIRE_FALSE(hostEth.hasPending());
+}
@@ -0,0 +1,84 @@
+#include <catch2/catch_all.hpp>
+
+#include "EthernetBuffer.hpp"
+#include <atomic>
+#include <numeric>
+#include <thread>
+
+using namespace Ethernet;
+
+static std::vector<uint8_t> sequence(const std::size_t size) {
+  std::vector<uint8_t> bytes(size);
+  std::iota(bytes.begin(), bytes.end(), uint8_t{0});
+  return bytes;
+}
+
+TEST_CASE("Frame buffers are shared without copying the bytes") {
+  const std::vector<uint8_t> expected = sequence(64);
+  std::vector<uint8_t> bytes = expected;
+  const uint8_t *data = bytes.data();
+  FrameBuffer buffer(std::move(bytes));
+  REQUIRE(buffer.useCount() == 1);
+  REQUIRE(buffer.bytes().data() == data);
+
+  FrameBuffer first = buffer.share();
+  FrameBuffer second = first.share();
+  REQUIRE(buffer.useCount() == 3);
+  REQUIRE(first.bytes().data() == data);
+  REQUIRE(second.bytes().data() == data);
+
+  // Moving a reference does not count a new one
+  FrameBuffer moved = std::move(first);
+  REQUIRE(moved.useCount() == 3);
+  REQUIRE(first.useCount() == 0);
+  REQUIRE(first.bytes().empty());
+  {
+    FrameBuffer dropped = std::move(second);
+  }
+  REQUIRE(buffer.useCount() == 2);
+}
+
+TEST_CASE("Releasing a shared frame buffer copies on write") {
+  const std::vector<uint8_t> expected = sequence(64);
+  std::vector<uint8_t> bytes = expected;
+  const uint8_t *data = bytes.data();
+  FrameBuffer buffer(std::move(bytes));
+  FrameBuffer other = buffer.share();
+
+  // Another reference remains, so the released bytes are a copy
+  std::vector<uint8_t> copy = buffer.release();
+  REQUIRE(copy == expected);
+  REQUIRE(copy.data() != data);
+  copy[0] = 0xFF;
+  REQUIRE(other.bytes()[0] == 0);
+  REQUIRE(buffer.useCount() == 0);
+  REQUIRE(other.useCount() == 1);
+
+  // The last reference takes the bytes themselves
+  const std::vector<uint8_t> last = other.release();
+  REQUIRE(last.data() == data);
+  REQUIRE(FrameBuffer(sequence(8)).release() == sequence(8));
+}
+
+TEST_CASE("Frame buffer references are dropped from many threads") {
+  FrameBuffer buffer(sequence(1500));
+  std::atomic<uint64_t> total{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&total, reference = buffer.share()]() mutable {
+      uint64_t sum = 0;
+      for (const uint8_t byte : reference.bytes()) {
+        sum += byte;
+      }
+      total.fetch_add(sum);
+      FrameBuffer dropped = std::move(reference);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  const std::vector<uint8_t> bytes = sequence(1500);
+  REQUIRE(total == 8 * std::accumulate(bytes.begin(), bytes.end(), uint64_t{0}));
+  REQUIRE(buffer.useCount() == 1);
+  REQUIRE(buffer.bytes().size() == 1500);
+}
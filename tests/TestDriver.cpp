@@ -1,5 +1,6 @@
 #include "EthernetDriver.hpp"
 #include <catch2/catch_all.hpp>
+#include <thread>
 
 /*
  * Ethernet Driver tests
@@ -56,3 +57,491 @@ TEST_CASE("Error injection flips bit") {
   std::vector<uint8_t> rx;
   REQUIRE_THROWS_AS(b.recv(rx), std::runtime_error);
 }
+
+/* ------------------------------------------------------------ */
+TEST_CASE("A damaged frame is dropped rather than left at the front") {
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver::link(a, b);
+  const std::vector<uint8_t> damaged(Frame::PAYLOAD_LEN_MIN, 0xAA);
+  const std::vector<uint8_t> intact(Frame::PAYLOAD_LEN_MIN, 0xBB);
+  a.setErrorInjection(true);
+  a.send(damaged);
+  a.setErrorInjection(false);
+  a.send(intact);
+
+  // Only the damaged frame throws, the one behind it is still received
+  std::vector<uint8_t> rx;
+  REQUIRE_THROWS_AS(b.recv(rx), std::runtime_error);
+  REQUIRE(b.recv(rx));
+  REQUIRE(rx == intact);
+  REQUIRE_FALSE(b.recv(rx));
+}
+
+/* ------------------------------------------------------------ */
+TEST_CASE("Reserved frame round-trip") {
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+
+  std::vector<uint8_t> frame = host.reserve(64);
+  auto payload = Frame::payloadOf(frame);
+  REQUIRE(payload.size() == 64);
+  std::fill(payload.begin(), payload.end(), 0x5A);
+  host.sendReserved(std::move(frame));
+
+  std::vector<uint8_t> rx;
+  REQUIRE(dev.recv(rx));
+  REQUIRE(rx == std::vector<uint8_t>(64, 0x5A));
+  REQUIRE_THROWS_AS(host.reserve(Frame::PAYLOAD_LEN_MAX + 1), std::runtime_error);
+}
+
+/* ------------------------------------------------------------ */
+// Tests classify by the first payload byte
+static uint8_t firstByteClass(std::span<const uint8_t> frame) {
+  return frame[Frame::HEADER_LEN];
+}
+
+TEST_CASE("Traffic classes are served strict first then by weighted round-robin") {
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+  dev.setQueueing(Driver::QueueConfig{6, {2, 1, 1, 1, 1, 1, 1, 1}, {}, &firstByteClass});
+
+  // Bulk classes 0 and 1 are queued before the control frame of class 7
+  const std::vector<std::pair<uint8_t, uint8_t>> sent = {
+      {0, 0}, {0, 1}, {0, 2}, {1, 3}, {1, 4}, {1, 5}, {7, 6}};
+  for (const auto &[traffic_class, index] : sent) {
+    std::vector<uint8_t> tx(Frame::PAYLOAD_LEN_MIN, 0);
+    tx[0] = traffic_class;
+    tx[1] = index;
+    host.send(tx);
+  }
+
+  std::vector<uint8_t> order;
+  std::vector<uint8_t> rx;
+  while (dev.recv(rx)) {
+    order.push_back(rx[1]);
+  }
+  // Class 0 takes two frames per turn to class 1's one
+  REQUIRE(order == std::vector<uint8_t>{6, 0, 1, 3, 2, 4, 5});
+  REQUIRE(dev.getQueueStats().queued[0] == 3);
+  REQUIRE(dev.getQueueStats().queued[7] == 1);
+}
+
+namespace {
+
+// Hands frames straight to one driver, tagged ones included
+class TestWire : public Medium {
+public:
+  TestWire(Driver &from, Driver &to) : to(to) { connect(from, *this); }
+  void forward(const MacAddr &, std::vector<uint8_t> &&frame) override {
+    deliver(this->to, std::move(frame));
+  }
+  void inject(std::vector<uint8_t> &&frame) { deliver(this->to, std::move(frame)); }
+
+private:
+  Driver &to;
+};
+
+} // namespace
+
+TEST_CASE("Tagged frames take their PCP and full classes drop") {
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  TestWire wire(host, dev);
+  Driver::QueueConfig config;
+  config.limits[0] = 2;
+  dev.setQueueing(config);
+
+  const std::vector<uint8_t> data(Frame::PAYLOAD_LEN_MIN, 0x33);
+  for (int i = 0; i < 3; ++i) {
+    host.sendTo(MAC_B, data);
+  }
+  // PCP 5, VLAN 10, then the inner EtherType
+  std::vector<uint8_t> tagged = {0xA0, 0x0A, 0x08, 0x00};
+  tagged.insert(tagged.end(), data.begin(), data.end());
+  wire.inject(Frame(MAC_B, MAC_A, Frame::EtherType::VLAN, tagged).serialize());
+
+  const Driver::QueueStats stats = dev.getQueueStats();
+  REQUIRE(stats.queued[0] == 2);
+  REQUIRE(stats.dropped[0] == 1);
+  REQUIRE(stats.queued[5] == 1);
+
+  // The tagged frame comes first, without its tag
+  std::vector<uint8_t> rx;
+  REQUIRE(dev.recv(rx));
+  REQUIRE(rx == data);
+  REQUIRE(dev.recv(rx));
+  REQUIRE(dev.recv(rx));
+  REQUIRE_FALSE(dev.recv(rx));
+
+  config.weights[3] = 0;
+  REQUIRE_THROWS_AS(dev.setQueueing(config), std::runtime_error);
+  Driver other(MAC_A);
+  Driver peer(MAC_B);
+  Driver::link(other, peer);
+  other.setReliability(Reliability::Config{});
+  REQUIRE_THROWS_AS(other.setQueueing(Driver::QueueConfig{}), std::logic_error);
+  REQUIRE_THROWS_AS(dev.setReliability(Reliability::Config{}), std::logic_error);
+}
+
+TEST_CASE("PAUSE holds the sender until the receiver drains to xon") {
+  using namespace std::chrono_literals;
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+  // About a millisecond per pause
+  dev.setFlowControl(Driver::FlowControl{4, 1, 2000, false});
+
+  const std::vector<uint8_t> data(Frame::PAYLOAD_LEN_MIN, 0x44);
+  for (int i = 0; i < 4; ++i) {
+    host.send(data);
+  }
+  REQUIRE(dev.getFlowStats().pauses_sent == 1);
+  REQUIRE(host.getFlowStats().pauses_received == 1);
+
+  // The next send waits the pause out, and is paused again on arrival
+  host.send(data);
+  REQUIRE(500us <= host.getFlowStats().paused);
+  REQUIRE(dev.getFlowStats().pauses_sent == 2);
+
+  // Draining to xon resumes the sender, whose next send does not wait
+  std::vector<uint8_t> rx;
+  for (int i = 0; i < 4; ++i) {
+    REQUIRE(dev.recv(rx));
+  }
+  REQUIRE(dev.getFlowStats().resumes_sent == 1);
+  REQUIRE(host.getFlowStats().pauses_received == 3);
+  const auto paused = host.getFlowStats().paused;
+  host.send(data);
+  REQUIRE(host.getFlowStats().paused == paused);
+  REQUIRE(dev.getQueueStats().queued[0] == 6);
+}
+
+TEST_CASE("A pause overtaken by a later resume is dropped") {
+  using namespace std::chrono_literals;
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  TestWire wire(host, dev);
+  TestWire back(dev, host);
+  Frame::Pause pause;
+  pause.quanta.fill(0xFFFF);
+  pause.sequence = 1;
+  Frame::Pause resume;
+  resume.sequence = 2;
+
+  // The resume was decided last but arrives first, so the pause is stale
+  back.inject(Frame::encodePause(MAC_B, resume));
+  back.inject(Frame::encodePause(MAC_B, pause));
+  REQUIRE(host.getFlowStats().pauses_received == 1);
+  const std::vector<uint8_t> data(Frame::PAYLOAD_LEN_MIN, 0x55);
+  host.send(data);
+  REQUIRE(host.getFlowStats().paused == 0ns);
+
+  // A later pause still holds, and an unnumbered resume always applies
+  pause.sequence = 3;
+  back.inject(Frame::encodePause(MAC_B, pause));
+  REQUIRE(host.getFlowStats().pauses_received == 2);
+  resume.sequence = 0;
+  back.inject(Frame::encodePause(MAC_B, resume));
+  REQUIRE(host.getFlowStats().pauses_received == 3);
+  host.send(data);
+  REQUIRE(host.getFlowStats().paused == 0ns);
+  REQUIRE(dev.getQueueStats().queued[0] == 2);
+}
+
+TEST_CASE("Flow control holds a fast sender to a slow receiver without loss") {
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+  // Without flow control the queue limit would drop most frames
+  Driver::QueueConfig queueing;
+  queueing.limits[0] = 8;
+  dev.setQueueing(queueing);
+  dev.setFlowControl(Driver::FlowControl{8, 2, 0xFFFF, false});
+
+  constexpr uint16_t FRAMES = 500;
+  std::thread sender([&host] {
+    std::vector<uint8_t> tx(Frame::PAYLOAD_LEN_MIN, 0);
+    for (uint16_t i = 0; i < FRAMES; ++i) {
+      tx[0] = static_cast<uint8_t>(i >> 8);
+      tx[1] = static_cast<uint8_t>(i & 0xff);
+      host.send(tx);
+    }
+  });
+  uint16_t received = 0;
+  bool ordered = true;
+  std::vector<uint8_t> rx;
+  while (received < FRAMES) {
+    if (!dev.recv(rx)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+      continue;
+    }
+    ordered = ordered && ((rx[0] << 8) | rx[1]) == received;
+    ++received;
+  }
+  sender.join();
+
+  REQUIRE(ordered);
+  REQUIRE(dev.getQueueStats().dropped[0] == 0);
+  REQUIRE(0 < dev.getFlowStats().pauses_sent);
+  REQUIRE(0 < host.getFlowStats().paused.count());
+}
+
+TEST_CASE("PFC pauses only the class over its threshold") {
+  using namespace std::chrono_literals;
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+  // Both ends classify alike, the sender to know which pause applies
+  const Driver::QueueConfig queueing{6, {1, 1, 1, 1, 1, 1, 1, 1}, {}, &firstByteClass};
+  host.setQueueing(queueing);
+  dev.setQueueing(queueing);
+  dev.setFlowControl(Driver::FlowControl{2, 0, 2000, true});
+
+  std::vector<uint8_t> bulk(Frame::PAYLOAD_LEN_MIN, 0);
+  host.send(bulk);
+  host.send(bulk);
+  REQUIRE(dev.getFlowStats().pauses_sent == 1);
+
+  // Class 6 is not paused, class 0 is
+  std::vector<uint8_t> control(Frame::PAYLOAD_LEN_MIN, 0);
+  control[0] = 6;
+  host.send(control);
+  REQUIRE(host.getFlowStats().paused == 0ns);
+  host.send(bulk);
+  REQUIRE(500us <= host.getFlowStats().paused);
+
+  // Control is served first, and draining class 0 resumes it
+  std::vector<uint8_t> rx;
+  REQUIRE(dev.recv(rx));
+  REQUIRE(rx[0] == 6);
+  for (int i = 0; i < 3; ++i) {
+    REQUIRE(dev.recv(rx));
+  }
+  REQUIRE(dev.getFlowStats().resumes_sent == 1);
+}
+
+TEST_CASE("Flow control configuration is checked") {
+  Driver lone(MAC_A);
+  REQUIRE_THROWS_AS(lone.setFlowControl(Driver::FlowControl{}), std::logic_error);
+
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+  REQUIRE_THROWS_AS(dev.setFlowControl(Driver::FlowControl{4, 4, 100, false}),
+                    std::runtime_error);
+  REQUIRE_THROWS_AS(dev.setFlowControl(Driver::FlowControl{4, 1, 0, false}),
+                    std::runtime_error);
+  REQUIRE_THROWS_AS(dev.setFlowControl(Driver::FlowControl{4, 1, 100, true}),
+                    std::logic_error);
+  dev.setFlowControl(Driver::FlowControl{});
+  REQUIRE_THROWS_AS(dev.setReliability(Reliability::Config{}), std::logic_error);
+  host.setReliability(Reliability::Config{});
+  REQUIRE_THROWS_AS(host.setFlowControl(Driver::FlowControl{}), std::logic_error);
+}
+
+TEST_CASE("RSS hash matches the Toeplitz reference") {
+  // 66.9.149.187:2794 to 161.142.100.80:1766, from the RSS verification suite
+  const std::vector<uint8_t> ipv4 = {0x42, 0x09, 0x95, 0xbb, 0xa1, 0x8e, 0x64, 0x50};
+  std::vector<uint8_t> tcp = ipv4;
+  tcp.insert(tcp.end(), {0x0a, 0xea, 0x06, 0xe6});
+  REQUIRE(Driver::rssHash(ipv4) == 0x323e8fc2);
+  REQUIRE(Driver::rssHash(tcp) == 0x51ccc178);
+  REQUIRE_THROWS_AS(Driver::rssHash(std::vector<uint8_t>(37, 0)), std::runtime_error);
+}
+
+static uint32_t firstByteKey(std::span<const uint8_t> frame) {
+  return frame[Frame::HEADER_LEN];
+}
+
+TEST_CASE("Receive queues keep each flow in order for their own consumers") {
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+  dev.setReceiveQueues(Driver::RssConfig{4, &firstByteKey, {}});
+  REQUIRE(dev.receiveQueues() == 4);
+
+  // 32 flows of 20 frames, interleaved
+  constexpr uint8_t FLOWS = 32;
+  constexpr uint8_t FRAMES = 20;
+  std::vector<uint8_t> tx(Frame::PAYLOAD_LEN_MIN, 0);
+  for (uint8_t seq = 0; seq < FRAMES; ++seq) {
+    for (uint8_t flow = 0; flow < FLOWS; ++flow) {
+      tx[0] = flow;
+      tx[1] = seq;
+      host.send(tx);
+    }
+  }
+
+  // A consumer thread per queue
+  std::array<std::vector<std::pair<uint8_t, uint8_t>>, 4> seen;
+  std::vector<std::thread> consumers;
+  for (std::size_t queue = 0; queue < seen.size(); ++queue) {
+    consumers.emplace_back([&dev, &seen, queue] {
+      std::vector<uint8_t> rx;
+      MacAddr src;
+      while (dev.recvQueue(queue, rx, src)) {
+        seen[queue].emplace_back(rx[0], rx[1]);
+      }
+    });
+  }
+  for (std::thread &consumer : consumers) {
+    consumer.join();
+  }
+
+  std::array<int, FLOWS> queue_of;
+  queue_of.fill(-1);
+  std::array<uint8_t, FLOWS> next{};
+  bool ordered = true;
+  bool pinned = true;
+  std::size_t used = 0;
+  uint64_t counted = 0;
+  for (std::size_t queue = 0; queue < seen.size(); ++queue) {
+    used += !seen[queue].empty();
+    counted += dev.getQueueStats(queue).queued[0];
+    for (const auto &[flow, seq] : seen[queue]) {
+      pinned = pinned && (queue_of[flow] == -1 || queue_of[flow] == static_cast<int>(queue));
+      queue_of[flow] = static_cast<int>(queue);
+      ordered = ordered && next[flow] == seq;
+      next[flow] = static_cast<uint8_t>(seq + 1);
+    }
+  }
+  REQUIRE(ordered);
+  REQUIRE(pinned);
+  REQUIRE(1 < used);
+  REQUIRE(counted == FLOWS * FRAMES);
+  REQUIRE(dev.getQueueStats().queued[0] == FLOWS * FRAMES);
+
+  // An indirection table can steer every bucket to one queue
+  std::vector<uint8_t> table(Driver::INDIRECTION_LEN, 2);
+  dev.setReceiveQueues(Driver::RssConfig{4, &firstByteKey, table});
+  host.send(tx);
+  REQUIRE(dev.hasPending(2));
+  REQUIRE(dev.hasPending());
+  std::vector<uint8_t> rx;
+  REQUIRE(dev.recv(rx));
+  REQUIRE(rx == tx);
+}
+
+TEST_CASE("Receive queue configuration is checked") {
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+  REQUIRE_THROWS_AS(dev.setReceiveQueues(Driver::RssConfig{0, nullptr, {}}),
+                    std::runtime_error);
+  REQUIRE_THROWS_AS(dev.setReceiveQueues(Driver::RssConfig{2, nullptr, {0, 1}}),
+                    std::runtime_error);
+  REQUIRE_THROWS_AS(
+      dev.setReceiveQueues(Driver::RssConfig{
+          2, nullptr, std::vector<uint8_t>(Driver::INDIRECTION_LEN, 2)}),
+      std::runtime_error);
+
+  dev.setReceiveQueues(Driver::RssConfig{2, nullptr, {}});
+  std::vector<uint8_t> rx;
+  MacAddr src;
+  REQUIRE_THROWS_AS(dev.recvQueue(2, rx, src), std::runtime_error);
+  REQUIRE_THROWS_AS(dev.setFlowControl(Driver::FlowControl{}), std::logic_error);
+  REQUIRE_THROWS_AS(dev.setReliability(Reliability::Config{}), std::logic_error);
+  host.setReliability(Reliability::Config{});
+  REQUIRE_THROWS_AS(host.setReceiveQueues(Driver::RssConfig{2, nullptr, {}}),
+                    std::logic_error);
+}
+
+TEST_CASE("Demux rules give each EtherType its own consumer queue") {
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  TestWire wire(host, dev);
+  // Everything else hashes to queue 0, leaving 1 and 2 to their rules
+  dev.setReceiveQueues(
+      Driver::RssConfig{3, nullptr, std::vector<uint8_t>(Driver::INDIRECTION_LEN, 0)});
+  Driver::DemuxConfig config;
+  config.rules = {{Frame::EtherType::ARP, std::nullopt, 1},
+                  {Frame::EtherType::IPV6, std::nullopt, 2}};
+  dev.setDemux(config);
+
+  constexpr uint8_t FRAMES = 50;
+  std::vector<uint8_t> tx(Frame::PAYLOAD_LEN_MIN, 0);
+  for (uint8_t seq = 0; seq < FRAMES; ++seq) {
+    tx[1] = seq;
+    for (const Frame::EtherType type : {Frame::EtherType::IPV4, Frame::EtherType::ARP,
+                                        Frame::EtherType::IPV6}) {
+      tx[0] = static_cast<uint8_t>(type);
+      host.sendTo(MAC_B, tx, type);
+    }
+  }
+  // A tagged IPv6 frame follows its inner EtherType
+  std::vector<uint8_t> tagged = {0x20, 0x0A, 0x86, 0xDD, 0xDD, FRAMES};
+  tagged.resize(Frame::PAYLOAD_LEN_MIN, 0);
+  wire.inject(Frame(MAC_B, MAC_A, Frame::EtherType::VLAN, tagged).serialize());
+
+  // A consumer thread per queue sees only its own EtherType, in order
+  const std::array<uint8_t, 3> expected = {0x00, 0x06, 0xDD};
+  std::array<uint8_t, 3> counts{};
+  std::array<bool, 3> sorted{true, true, true};
+  std::vector<std::thread> consumers;
+  for (std::size_t queue = 0; queue < 3; ++queue) {
+    consumers.emplace_back([&, queue] {
+      std::vector<uint8_t> rx;
+      MacAddr src;
+      while (dev.recvQueue(queue, rx, src)) {
+        sorted[queue] = sorted[queue] && rx[0] == expected[queue] &&
+                        rx[1] == counts[queue];
+        ++counts[queue];
+      }
+    });
+  }
+  for (std::thread &consumer : consumers) {
+    consumer.join();
+  }
+  REQUIRE(sorted == std::array<bool, 3>{true, true, true});
+  REQUIRE(counts == std::array<uint8_t, 3>{FRAMES, FRAMES, FRAMES + 1});
+
+  // Turning demux off hands every frame back to RSS
+  dev.setDemux(Driver::DemuxConfig{});
+  host.sendTo(MAC_B, tx, Frame::EtherType::ARP);
+  REQUIRE(dev.hasPending(0));
+}
+
+static uint8_t secondByteKey(std::span<const uint8_t> frame) {
+  return frame[Frame::HEADER_LEN + 1];
+}
+
+TEST_CASE("Demux keys refine a rule and configuration is checked") {
+  Driver host(MAC_A);
+  Driver dev(MAC_B);
+  Driver::link(host, dev);
+  dev.setReceiveQueues(
+      Driver::RssConfig{3, nullptr, std::vector<uint8_t>(Driver::INDIRECTION_LEN, 0)});
+  Driver::DemuxConfig config;
+  config.rules = {{Frame::EtherType::IPV4, std::nullopt, 1},
+                  {Frame::EtherType::IPV4, 0x07, 2}};
+  config.key = &secondByteKey;
+  dev.setDemux(config);
+
+  // The rule with a key wins for its key, the other takes the rest
+  std::vector<uint8_t> tx(Frame::PAYLOAD_LEN_MIN, 0);
+  tx[1] = 0x07;
+  REQUIRE(dev.queueOf(Frame(MAC_B, MAC_A, Frame::EtherType::IPV4, tx).serialize()) == 2);
+  host.send(tx);
+  REQUIRE(dev.hasPending(2));
+  tx[1] = 0x08;
+  REQUIRE(dev.queueOf(Frame(MAC_B, MAC_A, Frame::EtherType::IPV4, tx).serialize()) == 1);
+  REQUIRE(dev.queueOf(Frame(MAC_B, MAC_A, Frame::EtherType::ARP, tx).serialize()) == 0);
+
+  Driver::DemuxConfig bad = config;
+  bad.key = nullptr;
+  REQUIRE_THROWS_AS(dev.setDemux(bad), std::runtime_error);
+  bad = config;
+  bad.rules.push_back({Frame::EtherType::IPV4, 0x07, 0});
+  REQUIRE_THROWS_AS(dev.setDemux(bad), std::runtime_error);
+  bad.rules = {{Frame::EtherType::ARP, std::nullopt, 3}};
+  REQUIRE_THROWS_AS(dev.setDemux(bad), std::runtime_error);
+  bad.rules = {{Frame::EtherType::MAC_CONTROL, std::nullopt, 1}};
+  REQUIRE_THROWS_AS(dev.setDemux(bad), std::runtime_error);
+  bad.rules.assign(Driver::DEMUX_RULES + 1, {Frame::EtherType::ARP, std::nullopt, 1});
+  REQUIRE_THROWS_AS(dev.setDemux(bad), std::runtime_error);
+  REQUIRE_THROWS_AS(dev.setReceiveQueues(Driver::RssConfig{2, nullptr, {}}),
+                    std::logic_error);
+}
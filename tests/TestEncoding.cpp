@@ -0,0 +1,262 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolEncoding.hpp"
+#include "ProtocolHost.hpp"
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <numeric>
+#include <random>
+
+using namespace Ethernet;
+using namespace Protocol;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+static std::vector<uint32_t> roundTrip(const Encoding encoding,
+                                       const std::vector<uint32_t> &samples) {
+  std::vector<uint8_t> block;
+  encodeBlock(encoding, samples, block);
+  std::vector<uint32_t> decoded;
+  decodeBlock(block, decoded);
+  return decoded;
+}
+
+TEST_CASE("Delta encodings round trip any samples") {
+  const Encoding encoding =
+      GENERATE(Encoding::DELTA_VARINT, Encoding::DELTA_BITPACK);
+
+  // Every length around the four-lane SIMD stage
+  std::mt19937 rng(7);
+  for (std::size_t count = 1; count <= 21; ++count) {
+    std::vector<uint32_t> samples(count);
+    for (uint32_t &sample : samples) {
+      sample = rng();
+    }
+    REQUIRE(roundTrip(encoding, samples) == samples);
+  }
+
+  // Wrapping and alternating extremes
+  const std::vector<uint32_t> edges = {0xFFFFFFFE, 0xFFFFFFFF, 0, 1,
+                                       0x80000000, 0x7FFFFFFF, 0, 0};
+  REQUIRE(roundTrip(encoding, edges) == edges);
+  const std::vector<uint32_t> flat(100, 42);
+  REQUIRE(roundTrip(encoding, flat) == flat);
+}
+
+TEST_CASE("Delta encodings pack slow-moving samples densely") {
+  std::vector<uint32_t> counter(256);
+  for (uint32_t i = 0; i < counter.size(); ++i) {
+    counter[i] = 1000 + i;
+  }
+  std::vector<uint8_t> block;
+
+  // A step of one zig-zags to 2, one varint byte or two packed bits
+  encodeBlock(Encoding::DELTA_VARINT, counter, block);
+  REQUIRE(block.size() == BLOCK_HEADER_LEN + 255);
+  encodeBlock(Encoding::DELTA_BITPACK, counter, block);
+  REQUIRE(block.size() == BLOCK_HEADER_LEN + 1 + (255 * 2 + 7) / 8);
+  REQUIRE(block.size() * 8 < counter.size() * sizeof(uint32_t));
+
+  REQUIRE_THROWS_AS(encodeBlock(Encoding::RAW, counter, block), std::logic_error);
+  REQUIRE_THROWS_AS(encodeBlock(Encoding::DELTA_VARINT, {}, block),
+                    std::logic_error);
+}
+
+TEST_CASE("Malformed blocks are rejected") {
+  const std::vector<uint32_t> samples = {1, 2, 300, 4};
+  std::vector<uint32_t> decoded;
+  for (const Encoding encoding :
+       {Encoding::DELTA_VARINT, Encoding::DELTA_BITPACK}) {
+    std::vector<uint8_t> block;
+    encodeBlock(encoding, samples, block);
+
+    std::vector<uint8_t> truncated(block.begin(), block.end() - 1);
+    REQUIRE_THROWS_AS(decodeBlock(truncated, decoded), std::runtime_error);
+    std::vector<uint8_t> padded = block;
+    padded.push_back(0);
+    REQUIRE_THROWS_AS(decodeBlock(padded, decoded), std::runtime_error);
+    std::vector<uint8_t> unknown = block;
+    unknown[0] = 0x7F;
+    REQUIRE_THROWS_AS(decodeBlock(unknown, decoded), std::runtime_error);
+  }
+  const std::vector<uint8_t> empty = {0x01, 0x00, 0x00, 0, 0, 0, 0};
+  REQUIRE_THROWS_AS(decodeBlock(empty, decoded), std::runtime_error);
+}
+
+TEST_CASE("Host negotiates a stream encoding with the device") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+  const auto start = StreamScheduler::Clock::now();
+
+  // Send telemetry 32 samples at a time
+  StreamScheduler::StreamConfig telemetry;
+  telemetry.id = StreamID::TELEMETRY;
+  telemetry.rate_hz = 1000.0;
+  telemetry.burst = 32;
+  telemetry.batch = 32;
+  telemetry.producer = [](uint32_t index, std::vector<uint8_t> &sample) {
+    sample.resize(sizeof(index));
+    std::memcpy(sample.data(), &index, sizeof(index));
+  };
+  dev.addStream(telemetry);
+
+  std::vector<uint32_t> received;
+  host.onStream(StreamID::TELEMETRY, [&received](Host &, const MsgView &msg) {
+    REQUIRE(msg.data.size() == sizeof(uint32_t));
+    uint32_t value;
+    std::memcpy(&value, msg.data.data(), sizeof(value));
+    received.push_back(value);
+  });
+  std::vector<ErrorID> errors;
+  host.onError(ErrorID::BAD_PAYLOAD, [&errors](Host &, const MsgView &msg) {
+    errors.push_back(msg.header.id.error_id);
+  });
+
+  // Unknown streams and encodings are refused
+  host.setStreamEncoding(static_cast<StreamID>(0x7F), Encoding::DELTA_VARINT);
+  host.sendCommand(CmdID::SET_ENCODING, {0x01, 0x7F});
+  dev.poll(start);
+  dev.poll(start);
+  while (host.poll()) {
+  }
+  REQUIRE(errors.size() == 2);
+  REQUIRE(host.getStreamEncoding(StreamID::TELEMETRY) == Encoding::RAW);
+
+  host.setStreamEncoding(StreamID::TELEMETRY, Encoding::DELTA_BITPACK);
+  host.sendCommand(CmdID::START_STREAM, {});
+  dev.poll(start);
+  dev.poll(start);
+  std::size_t frames = 0;
+  while (host.poll()) {
+    ++frames;
+  }
+  REQUIRE(host.getStreamEncoding(StreamID::TELEMETRY) == Encoding::DELTA_BITPACK);
+
+  // Each due batch arrives as one block of 32 samples
+  for (int ms = 32; ms <= 128; ms += 32) {
+    dev.poll(start + std::chrono::milliseconds(ms));
+  }
+  frames = 0;
+  while (host.poll()) {
+    ++frames;
+  }
+  REQUIRE(frames == 4);
+  REQUIRE(received.size() == 5 * 32);
+  for (uint32_t i = 0; i < received.size(); ++i) {
+    REQUIRE(received[i] == i);
+  }
+}
+
+/* Starts raw telemetry, switches it to DELTA_BITPACK while raw samples are
+ * still queued at the host, then sends more, returning what the host got
+ */
+static std::vector<uint32_t> switchEncodingMidStream(Driver &hostEth, Driver &devEth) {
+  Host host(hostEth);
+  Device dev(devEth);
+  const auto start = StreamScheduler::Clock::now();
+  StreamScheduler::StreamConfig telemetry;
+  telemetry.id = StreamID::TELEMETRY;
+  telemetry.rate_hz = 1000.0;
+  telemetry.burst = 32;
+  telemetry.batch = 32;
+  telemetry.producer = [](uint32_t index, std::vector<uint8_t> &sample) {
+    sample.resize(sizeof(index));
+    std::memcpy(sample.data(), &index, sizeof(index));
+  };
+  dev.addStream(telemetry);
+
+  std::vector<uint32_t> received;
+  host.onStream(StreamID::TELEMETRY, [&received](Host &, const MsgView &msg) {
+    uint32_t value = 0;
+    std::memcpy(&value, msg.data.data(), std::min(msg.data.size(), sizeof(value)));
+    received.push_back(value);
+  });
+  host.sendCommand(CmdID::START_STREAM, {});
+  dev.poll(start);
+  dev.poll(start + std::chrono::milliseconds(32));
+  host.setStreamEncoding(StreamID::TELEMETRY, Encoding::DELTA_BITPACK);
+  for (int ms = 64; ms <= 128; ms += 32) {
+    dev.poll(start + std::chrono::milliseconds(ms));
+  }
+  while (host.poll()) {
+  }
+  REQUIRE(host.getStreamEncoding(StreamID::TELEMETRY) == Encoding::DELTA_BITPACK);
+  return received;
+}
+
+static std::vector<uint32_t> sequence(const uint32_t count) {
+  std::vector<uint32_t> values(count);
+  std::iota(values.begin(), values.end(), 0);
+  return values;
+}
+
+TEST_CASE("An encoding switch stays in order with its stream across traffic classes") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Driver::QueueConfig config;
+  config.classify = &trafficClass;
+  hostEth.setQueueing(config);
+  REQUIRE(switchEncodingMidStream(hostEth, devEth) == sequence(5 * 32));
+}
+
+TEST_CASE("An encoding switch stays in order with its stream across receive queues") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  hostEth.setReceiveQueues(Driver::RssConfig{4, &flowKey, {}});
+  REQUIRE(switchEncodingMidStream(hostEth, devEth) == sequence(5 * 32));
+}
+
+TEST_CASE("An encoding negotiated through a request switches the session") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+  const auto start = StreamScheduler::Clock::now();
+  StreamScheduler::StreamConfig telemetry;
+  telemetry.id = StreamID::TELEMETRY;
+  telemetry.rate_hz = 1000.0;
+  telemetry.burst = 32;
+  telemetry.batch = 32;
+  telemetry.producer = [](uint32_t index, std::vector<uint8_t> &sample) {
+    sample.resize(sizeof(index));
+    std::memcpy(sample.data(), &index, sizeof(index));
+  };
+  dev.addStream(telemetry);
+  std::vector<uint32_t> received;
+  host.onStream(StreamID::TELEMETRY, [&received](Host &, const MsgView &msg) {
+    REQUIRE(msg.data.size() == sizeof(uint32_t));
+    uint32_t value;
+    std::memcpy(&value, msg.data.data(), sizeof(value));
+    received.push_back(value);
+  });
+
+  // The reply goes to the future, and the session still switches
+  const auto select = pack(EncodingSelect{StreamID::TELEMETRY, Encoding::DELTA_VARINT});
+  std::future<Msg> reply = host.request(
+      CmdID::SET_ENCODING, std::vector<uint8_t>(select.begin(), select.end()),
+      std::chrono::seconds(1));
+  host.sendCommand(CmdID::START_STREAM, {});
+  dev.poll(start);
+  dev.poll(start);
+  while (host.poll()) {
+  }
+  REQUIRE(reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+  REQUIRE(unpack<EncodingSelect>(reply.get().data).encoding == Encoding::DELTA_VARINT);
+  REQUIRE(host.getStreamEncoding(StreamID::TELEMETRY) == Encoding::DELTA_VARINT);
+
+  for (int ms = 32; ms <= 128; ms += 32) {
+    dev.poll(start + std::chrono::milliseconds(ms));
+  }
+  while (host.poll()) {
+  }
+  REQUIRE(received == sequence(5 * 32));
+}
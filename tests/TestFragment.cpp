@@ -0,0 +1,123 @@
+#include <catch2/catch_all.hpp>
+#include <numeric>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolFragment.hpp"
+#include "ProtocolHost.hpp"
+
+using namespace Ethernet;
+using namespace Protocol;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+/* Drains every frame from a driver into a list of unpacked messages */
+static std::vector<Msg> drain(Driver &driver) {
+  std::vector<Msg> msgs;
+  std::vector<uint8_t> bytes;
+  while (driver.recv(bytes)) {
+    msgs.push_back(unpackMsg(bytes));
+  }
+  return msgs;
+}
+
+TEST_CASE("Small messages are not fragmented") {
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver::link(a, b);
+
+  uint16_t frag_id = 0;
+  const std::vector<uint8_t> data(Frame::PAYLOAD_LEN_MAX - MSG_LEN_MIN, 0x11);
+  sendMsg(a, MsgType::RESPONSE, static_cast<ID>(CmdID::PING), data, frag_id);
+  const auto msgs = drain(b);
+  REQUIRE(msgs.size() == 1);
+  REQUIRE(msgs[0].header.type == MsgType::RESPONSE);
+  REQUIRE(frag_id == 0);
+}
+
+TEST_CASE("Fragmented message reassembles out of order") {
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver::link(a, b);
+
+  uint16_t frag_id = 7;
+  std::vector<uint8_t> data(10000);
+  std::iota(data.begin(), data.end(), 0);
+  sendMsg(a, MsgType::COMMAND, static_cast<ID>(CmdID::PING), data, frag_id);
+  REQUIRE(frag_id == 8);
+
+  auto msgs = drain(b);
+  REQUIRE(msgs.size() == (data.size() + FRAGMENT_DATA_MAX - 1) / FRAGMENT_DATA_MAX);
+  std::reverse(msgs.begin(), msgs.end());
+
+  Reassembler reassembler;
+  Msg whole;
+  for (std::size_t i = 0; i + 1 < msgs.size(); ++i) {
+    REQUIRE_FALSE(reassembler.push(msgs[i], whole));
+    // Duplicates are ignored
+    REQUIRE_FALSE(reassembler.push(msgs[i], whole));
+  }
+  REQUIRE(reassembler.pending() == 1);
+  REQUIRE(reassembler.push(msgs.back(), whole));
+  REQUIRE(whole.header.type == MsgType::COMMAND);
+  REQUIRE(whole.header.id.cmd_id == CmdID::PING);
+  REQUIRE(whole.header.len == data.size());
+  REQUIRE(whole.data == data);
+  REQUIRE(reassembler.pending() == 0);
+  REQUIRE(reassembler.getStats().completed == 1);
+}
+
+TEST_CASE("Reassembler enforces pending limit and timeout") {
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver::link(a, b);
+
+  Reassembler::Config config;
+  config.max_pending = 1;
+  config.timeout = std::chrono::milliseconds(10);
+  Reassembler reassembler(config);
+
+  uint16_t frag_id = 0;
+  const std::vector<uint8_t> data(2 * FRAGMENT_DATA_MAX, 0x22);
+  sendMsg(a, MsgType::STREAM, ID{.stream_id = StreamID::TELEMETRY}, data, frag_id);
+  sendMsg(a, MsgType::STREAM, ID{.stream_id = StreamID::TELEMETRY}, data, frag_id);
+  const auto msgs = drain(b);
+  REQUIRE(msgs.size() == 4);
+
+  const auto t0 = Reassembler::Clock::now();
+  Msg whole;
+  REQUIRE_FALSE(reassembler.push(msgs[0], whole, t0));
+  // Second message has no free slot
+  REQUIRE_FALSE(reassembler.push(msgs[2], whole, t0));
+  REQUIRE(reassembler.getStats().dropped == 1);
+
+  // First message times out, freeing its slot for the second
+  const auto t1 = t0 + std::chrono::milliseconds(20);
+  REQUIRE_FALSE(reassembler.push(msgs[2], whole, t1));
+  REQUIRE(reassembler.getStats().expired == 1);
+  REQUIRE(reassembler.push(msgs[3], whole, t1));
+  REQUIRE(whole.data == data);
+}
+
+TEST_CASE("Device reassembles fragmented host command") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+
+  // Send a PING that spans several frames
+  host.sendCommand(CmdID::PING, std::vector<uint8_t>(5000, 0x33));
+  while (devEth.hasPending()) {
+    REQUIRE_FALSE(hostEth.hasPending());
+    dev.poll();
+  }
+
+  // Only the reassembled command is answered
+  std::vector<uint8_t> bytes;
+  REQUIRE(hostEth.recv(bytes));
+  const Msg pong = unpackMsg(bytes);
+  REQUIRE(pong.header.type == MsgType::RESPONSE);
+  REQUIRE(pong.data == std::vector<uint8_t>{'P', 'O', 'N', 'G'});
+  REQUIRE_FALSE(hostEth.hasPending());
+}
@@ -74,3 +74,65 @@ TEST_CASE("Serialize length correctness"){
     auto buf = f.serialize();
     REQUIRE(buf.size() == 2*MAC_LEN + sizeof(Frame::EtherType) + payload.size() + sizeof(uint32_t));
 }
+
+/* ------------------------------------------------------------ */
+TEST_CASE("In-place encode matches serialize"){
+    std::vector<uint8_t> payload(100);
+    std::iota(payload.begin(), payload.end(), 0);
+    Frame f(MAC_A, MAC_B, Frame::EtherType::IPV6, payload);
+
+    std::vector<uint8_t> buf(Frame::HEADER_LEN + payload.size() + Frame::CRC_LEN);
+    auto pl = Frame::payloadOf(buf);
+    std::copy(payload.begin(), payload.end(), pl.begin());
+    Frame::encodeInPlace(buf, MAC_A, MAC_B, Frame::EtherType::IPV6);
+    REQUIRE(buf == f.serialize());
+    REQUIRE(Frame(buf) == f);
+}
+
+/* ------------------------------------------------------------ */
+TEST_CASE("802.1Q priority read from tagged frames"){
+    std::vector<uint8_t> tagged = {0xE0, 0x01, 0x08, 0x00};
+    tagged.resize(Frame::PAYLOAD_LEN_MIN, 0x11);
+    const std::vector<uint8_t> buf = Frame(MAC_A, MAC_B, Frame::EtherType::VLAN, tagged).serialize();
+    REQUIRE(Frame::priorityOf(buf) == std::optional<uint8_t>{7});
+
+    const std::vector<uint8_t> untagged = Frame(MAC_A, MAC_B, Frame::EtherType::IPV4, tagged).serialize();
+    REQUIRE_FALSE(Frame::priorityOf(untagged).has_value());
+    REQUIRE_FALSE(Frame::priorityOf(std::span(buf).first(13)).has_value());
+
+    // The EtherType is read past the tag
+    REQUIRE(Frame::typeOf(buf) == Frame::EtherType::IPV4);
+    REQUIRE(Frame::typeOf(untagged) == Frame::EtherType::IPV4);
+    REQUIRE_FALSE(Frame::typeOf(std::span(buf).first(17)).has_value());
+}
+
+/* ------------------------------------------------------------ */
+TEST_CASE("PAUSE and PFC frames round-trip"){
+    Frame::Pause pause;
+    pause.quanta.fill(0x1234);
+    const std::vector<uint8_t> buf = Frame::encodePause(MAC_A, pause);
+    REQUIRE(buf.size() == Frame::FRAME_LEN_MIN);
+    const Frame frame(buf);
+    REQUIRE(frame.getDst() == PAUSE_MAC);
+    REQUIRE(frame.getType() == Frame::EtherType::MAC_CONTROL);
+    REQUIRE(frame.getPayload()[1] == Frame::PAUSE_OPCODE);
+    REQUIRE(Frame::pauseOf(buf) == pause);
+
+    // Priorities 0 and 6 only, anything else is sent as zero, then the
+    // sequence number past the quanta
+    Frame::Pause pfc;
+    pfc.priorities = 0x41;
+    pfc.quanta[0] = 7;
+    pfc.quanta[6] = 9;
+    pfc.sequence = 0x01020304;
+    const std::vector<uint8_t> pfc_buf = Frame::encodePause(MAC_A, pfc);
+    REQUIRE(Frame(pfc_buf).getPayload()[0] == Frame::PFC_OPCODE >> 8);
+    REQUIRE(Frame(pfc_buf).getPayload()[Frame::PAUSE_SEQUENCE_AT + 3] == 0x04);
+    REQUIRE(Frame::pauseOf(pfc_buf) == pfc);
+
+    const std::vector<uint8_t> data(Frame::PAYLOAD_LEN_MIN, 0);
+    REQUIRE_FALSE(Frame::pauseOf(Frame(MAC_A, MAC_B, Frame::EtherType::IPV4, data).serialize()).has_value());
+    std::vector<uint8_t> damaged = buf;
+    damaged[Frame::HEADER_LEN + 3] ^= 0x01;
+    REQUIRE_THROWS_AS(Frame::pauseOf(damaged), std::runtime_error);
+}
@@ -0,0 +1,124 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolHandlers.hpp"
+#include "ProtocolHost.hpp"
+#include <memory>
+
+using namespace Ethernet;
+using namespace Protocol;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+static constexpr CmdID GET_VERSION = static_cast<CmdID>(0x10);
+static constexpr StreamID VOLTAGE = static_cast<StreamID>(0x02);
+
+static int compile_time_calls = 0;
+static void countCall(int &value) {
+  ++compile_time_calls;
+  value += 1;
+}
+
+static void replyVersion(Device &dev, const MsgView &msg) {
+  dev.sendResponse(msg.header.id.cmd_id, {1, 2, 3});
+}
+
+TEST_CASE("HandlerTable dispatches by id") {
+  HandlerTable<CmdID, int &> table;
+  int value = 0;
+
+  // Unbound ids throw without a fallback
+  REQUIRE_THROWS_AS(table(CmdID::PING, value), std::runtime_error);
+
+  table.bind<&countCall>(CmdID::PING);
+  int offset = 10;
+  table.bind(CmdID::START_STREAM, [offset](int &v) { v += offset; });
+  table.fallback([](int &v) { v = -1; });
+  REQUIRE(table.contains(CmdID::PING));
+  REQUIRE_FALSE(table.contains(CmdID::STOP_STREAM));
+
+  table(CmdID::PING, value);
+  REQUIRE(value == 1);
+  REQUIRE(compile_time_calls == 1);
+  table(CmdID::START_STREAM, value);
+  REQUIRE(value == 11);
+  table(CmdID::STOP_STREAM, value);
+  REQUIRE(value == -1);
+
+  table.unbind(CmdID::PING);
+  table(CmdID::PING, value);
+  REQUIRE(compile_time_calls == 1);
+}
+
+TEST_CASE("HandlerTable frees the callable a rebind replaces") {
+  HandlerTable<CmdID, int &> table;
+  const auto token = std::make_shared<int>(0);
+
+  // Rebinding at run time keeps one callable per id, not one per bind
+  for (int i = 0; i < 100; ++i) {
+    table.bind(CmdID::PING, [token, i](int &v) { v = i; });
+    table.fallback([token](int &v) { v = -1; });
+  }
+  REQUIRE(token.use_count() == 3);
+  int value = 0;
+  table(CmdID::PING, value);
+  REQUIRE(value == 99);
+
+  table.bind<&countCall>(CmdID::PING);
+  REQUIRE(token.use_count() == 2);
+  table.bind(CmdID::STOP_STREAM, [token](int &) {});
+  table.unbind(CmdID::STOP_STREAM);
+  REQUIRE(token.use_count() == 2);
+  table.fallback<&countCall>();
+  REQUIRE(token.use_count() == 1);
+}
+
+TEST_CASE("Device dispatches registered commands") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+  dev.onCommand<&replyVersion>(GET_VERSION);
+
+  std::vector<uint8_t> version;
+  host.onResponse(GET_VERSION, [&version](Host &, const MsgView &msg) {
+    version.assign(msg.data.begin(), msg.data.end());
+  });
+  host.sendCommand(GET_VERSION, {});
+  dev.poll();
+  REQUIRE(host.poll());
+  REQUIRE(version == std::vector<uint8_t>{1, 2, 3});
+}
+
+TEST_CASE("Host dispatches registered streams and errors") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+
+  int samples = 0;
+  host.onStream(VOLTAGE, [&samples](Host &, const MsgView &msg) {
+    REQUIRE(msg.data.size() == 2);
+    ++samples;
+  });
+  ErrorID last_error{};
+  host.onError(ErrorID::UNKNOWN_CMD, [&last_error](Host &, const MsgView &msg) {
+    last_error = msg.header.id.error_id;
+  });
+
+  dev.sendStream(VOLTAGE, {0x34, 0x12});
+  dev.sendStream(VOLTAGE, {0x35, 0x12});
+  host.sendCommand(GET_VERSION, {});
+  dev.poll();
+  while (host.poll()) {
+  }
+  REQUIRE(samples == 2);
+  REQUIRE(last_error == ErrorID::UNKNOWN_CMD);
+
+  // Streams without a handler are rejected
+  dev.sendStream(static_cast<StreamID>(0x7F), {0x00});
+  REQUIRE_THROWS_AS(host.poll(), std::runtime_error);
+}
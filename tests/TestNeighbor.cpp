@@ -0,0 +1,228 @@
+#include <catch2/catch_all.hpp>
+
+#include "EthernetSegment.hpp"
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include <atomic>
+#include <map>
+#include <set>
+#include <thread>
+
+using namespace Ethernet;
+using namespace Protocol;
+
+static const MacAddr MAC_HOST{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+
+static constexpr StreamID VOLTAGE = static_cast<StreamID>(0x02);
+
+namespace {
+
+// A host and a number of devices sharing one segment
+struct Bench {
+  explicit Bench(const std::size_t count, const Host::Config &config)
+      : hostEth(MAC_HOST), host(hostEth, config) {
+    this->segment.attach(this->hostEth);
+    for (std::size_t i = 0; i < count; ++i) {
+      const MacAddr mac{0x02, 0x00, 0x00, 0x00, static_cast<uint8_t>(i >> 8),
+                        static_cast<uint8_t>(i)};
+      this->devEths.push_back(std::make_unique<Driver>(mac));
+      this->segment.attach(*this->devEths.back());
+      this->devs.push_back(std::make_unique<Device>(*this->devEths.back()));
+    }
+  }
+
+  // Drains the host's queue, returning the number of frames received
+  std::size_t drain(const NeighborCache::Clock::time_point now) {
+    std::size_t frames = 0;
+    while (this->host.poll(now)) {
+      ++frames;
+    }
+    this->host.sync();
+    return frames;
+  }
+
+  Segment segment{};
+  Driver hostEth;
+  Host host;
+  std::vector<std::unique_ptr<Driver>> devEths{};
+  std::vector<std::unique_ptr<Device>> devs{};
+};
+
+} // namespace
+
+TEST_CASE("Hosts discover every device on a segment") {
+  Bench bench(8, Host::Config{});
+  const auto start = NeighborCache::Clock::now();
+  REQUIRE(bench.host.getNeighbors().size() == 0);
+
+  // One broadcast reaches every device, each announces itself
+  bench.host.discover();
+  for (const auto &dev : bench.devs) {
+    dev->poll(start);
+  }
+  REQUIRE(bench.drain(start) == 8);
+  REQUIRE(bench.segment.getStats().flooded == 1);
+
+  const std::vector<NeighborCache::Neighbor> entries =
+      bench.host.getNeighbors().entries();
+  REQUIRE(entries.size() == 8);
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    REQUIRE(entries[i].mac == bench.devEths[i]->getMacAddr());
+    REQUIRE(entries[i].state == NeighborCache::State::REACHABLE);
+  }
+
+  // Devices answer the host that asked, so commands can be addressed
+  const MacAddr target = bench.devEths[3]->getMacAddr();
+  std::future<Msg> reply =
+      bench.host.request(target, CmdID::DISCOVER, {}, std::chrono::seconds(1));
+  for (const auto &dev : bench.devs) {
+    dev->poll(start);
+  }
+  REQUIRE(bench.drain(start) == 1);
+  REQUIRE(unpack<Announce>(reply.get().data).mac == target);
+}
+
+TEST_CASE("Quiet devices go stale, are probed, and are evicted") {
+  Host::Config config;
+  config.neighbors.stale_after = std::chrono::seconds(1);
+  config.neighbors.evict_after = std::chrono::seconds(2);
+  Bench bench(8, config);
+  const auto start = NeighborCache::Clock::now();
+  bench.host.discover();
+  for (const auto &dev : bench.devs) {
+    dev->poll(start);
+  }
+  bench.drain(start);
+  REQUIRE(bench.host.getNeighbors().size() == 8);
+  // A host's task wakes for the next sweep, a tenth of stale_after on
+  REQUIRE(bench.host.getNeighbors().nextDeadline() ==
+          start + config.neighbors.stale_after / 10);
+
+  // Past stale_after every device is probed directly
+  const auto probed = start + std::chrono::milliseconds(1500);
+  bench.drain(probed);
+  for (const auto &entry : bench.host.getNeighbors().entries()) {
+    REQUIRE(entry.state == NeighborCache::State::STALE);
+  }
+  REQUIRE(bench.segment.getStats().forwarded == 8 + 8);
+
+  // Half answer the probe and are confirmed
+  for (std::size_t i = 0; i < 4; ++i) {
+    bench.devs[i]->poll(probed);
+  }
+  REQUIRE(bench.drain(probed) == 4);
+
+  // The rest are evicted once evict_after passes
+  bench.drain(start + std::chrono::milliseconds(2100));
+  const std::vector<NeighborCache::Neighbor> entries =
+      bench.host.getNeighbors().entries();
+  REQUIRE(entries.size() == 4);
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    REQUIRE(entries[i].mac == bench.devEths[i]->getMacAddr());
+    REQUIRE(entries[i].state == NeighborCache::State::REACHABLE);
+  }
+  REQUIRE(bench.host.getNeighbors().find(bench.devEths[7]->getMacAddr()) ==
+          nullptr);
+}
+
+TEST_CASE("Sharded hosts handle each device on one thread in order") {
+  constexpr std::size_t DEVICES = 64;
+  constexpr std::size_t SHARDS = 4;
+  constexpr uint32_t SAMPLES = 50;
+  Host::Config config;
+  config.neighbors.shards = SHARDS;
+  Bench bench(DEVICES, config);
+
+  std::mutex mutex;
+  std::map<MacAddr, std::vector<uint32_t>> received;
+  std::map<MacAddr, std::set<std::thread::id>> threads;
+  bench.host.onStream(VOLTAGE, [&](Host &host, const MsgView &msg) {
+    const uint32_t value = unpack<BlockSample>(msg.data).value;
+    std::lock_guard<std::mutex> lock(mutex);
+    received[host.source()].push_back(value);
+    threads[host.source()].insert(std::this_thread::get_id());
+  });
+
+  // Devices are spread evenly over the shards as they are discovered
+  const auto start = NeighborCache::Clock::now();
+  bench.host.discover();
+  for (const auto &dev : bench.devs) {
+    dev->poll(start);
+  }
+  REQUIRE(bench.drain(start) == DEVICES);
+  for (std::size_t shard = 0; shard < SHARDS; ++shard) {
+    REQUIRE(bench.host.getNeighbors().load(shard) == DEVICES / SHARDS);
+  }
+
+  // Interleave the devices' streams on the wire
+  for (uint32_t i = 0; i < SAMPLES; ++i) {
+    for (const auto &dev : bench.devs) {
+      dev->sendStream(VOLTAGE, BlockSample{i});
+    }
+  }
+  REQUIRE(bench.drain(start) == DEVICES * SAMPLES);
+
+  std::vector<uint32_t> expected(SAMPLES);
+  for (uint32_t i = 0; i < SAMPLES; ++i) {
+    expected[i] = i;
+  }
+  std::set<std::thread::id> used;
+  REQUIRE(received.size() == DEVICES);
+  for (const auto &eth : bench.devEths) {
+    const MacAddr mac = eth->getMacAddr();
+    REQUIRE(received[mac] == expected);
+    REQUIRE(threads[mac].size() == 1);
+    used.insert(*threads[mac].begin());
+  }
+  REQUIRE(used.size() == SHARDS);
+  REQUIRE(used.count(std::this_thread::get_id()) == 0);
+
+  // Handler failures surface on the polling thread, from poll or sync
+  bench.devs[0]->sendStream(static_cast<StreamID>(0x7F), BlockSample{0});
+  REQUIRE_THROWS_AS(bench.drain(start), std::runtime_error);
+  REQUIRE(bench.drain(start) == 0);
+}
+
+TEST_CASE("Stream encodings set by shards can be read from any thread") {
+  constexpr std::size_t DEVICES = 8;
+  Host::Config config;
+  config.neighbors.shards = 2;
+  Bench bench(DEVICES, config);
+  const auto start = NeighborCache::Clock::now();
+  bench.host.discover();
+  for (const auto &dev : bench.devs) {
+    dev->poll(start);
+  }
+  REQUIRE(bench.drain(start) == DEVICES);
+
+  // A reader polls the encodings while the shards handle the responses
+  std::atomic<bool> done{false};
+  std::atomic<std::size_t> seen{0};
+  std::thread reader([&] {
+    while (!done.load()) {
+      std::size_t switched = 0;
+      for (const auto &eth : bench.devEths) {
+        switched += bench.host.getStreamEncoding(eth->getMacAddr(), StreamID::TELEMETRY) ==
+                    Encoding::DELTA_VARINT;
+      }
+      seen.store(switched);
+    }
+  });
+  for (const auto &eth : bench.devEths) {
+    bench.host.setStreamEncoding(eth->getMacAddr(), StreamID::TELEMETRY,
+                                 Encoding::DELTA_VARINT);
+  }
+  for (const auto &dev : bench.devs) {
+    dev->poll(start);
+  }
+  REQUIRE(bench.drain(start) == DEVICES);
+  while (seen.load() != DEVICES) {
+    std::this_thread::yield();
+  }
+  done.store(true);
+  reader.join();
+  for (const auto &eth : bench.devEths) {
+    REQUIRE(bench.host.getStreamEncoding(eth->getMacAddr(), StreamID::TELEMETRY) ==
+            Encoding::DELTA_VARINT);
+  }
+}
@@ -38,6 +38,22 @@ TEST_CASE("Protocol rejects truncated buffer") {
   REQUIRE_THROWS_AS(unpackMsg(bytes), std::runtime_error);
 }
 
+TEST_CASE("Protocol in-place pack matches packMsg") {
+  const std::vector<uint8_t> payload = {'P', 'O', 'N', 'G'};
+  const auto bytes =
+      packMsg(MsgType::RESPONSE, static_cast<ID>(CmdID::PING), payload);
+
+  std::vector<uint8_t> out(packedLen(payload.size()));
+  packMsgInto(out, MsgType::RESPONSE, static_cast<ID>(CmdID::PING), payload);
+  REQUIRE(out == bytes);
+  REQUIRE(out.size() == Ethernet::Frame::PAYLOAD_LEN_MIN);
+
+  std::vector<uint8_t> wrong(out.size() + 1);
+  REQUIRE_THROWS_AS(packMsgInto(wrong, MsgType::RESPONSE,
+                                static_cast<ID>(CmdID::PING), payload),
+                    std::runtime_error);
+}
+
 /* HOST/DEVICE */
 static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
 static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
@@ -80,3 +96,104 @@ TEST_CASE("Unknown command triggers ERROR frame") {
   REQUIRE_FALSE(hostEth.hasPending());
   REQUIRE_FALSE(devEth.hasPending());
 }
+
+TEST_CASE("Control frames overtake queued stream frames") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Driver::QueueConfig config;
+  config.classify = &trafficClass;
+  hostEth.setQueueing(config);
+  Host host(hostEth);
+  Device dev(devEth);
+  std::size_t samples = 0;
+  host.onStream(StreamID::TELEMETRY,
+                [&samples](Host &, const MsgView &) { ++samples; });
+
+  const std::vector<uint8_t> sample(sizeof(uint32_t), 0x01);
+  for (int i = 0; i < 100; ++i) {
+    dev.sendStream(StreamID::TELEMETRY, sample);
+  }
+  std::future<Msg> reply = host.request(CmdID::PING, {}, std::chrono::seconds(1));
+  dev.poll();
+
+  // The response is handled first, though it was queued last
+  REQUIRE(host.poll());
+  REQUIRE(reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+  REQUIRE(samples == 0);
+  while (host.poll()) {
+  }
+  REQUIRE(samples == 100);
+  REQUIRE(hostEth.getQueueStats().queued[CONTROL_CLASS] == 1);
+  REQUIRE(hostEth.getQueueStats().queued[BULK_CLASS] == 100);
+}
+
+TEST_CASE("A stream keeps to one receive queue of a multi-queue host") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  hostEth.setReceiveQueues(Driver::RssConfig{4, &flowKey, {}});
+  Host host(hostEth);
+  Device dev(devEth);
+  std::size_t samples = 0;
+  host.onStream(StreamID::TELEMETRY,
+                [&samples](Host &, const MsgView &) { ++samples; });
+
+  const std::vector<uint8_t> sample(sizeof(uint32_t), 0x01);
+  for (int i = 0; i < 100; ++i) {
+    dev.sendStream(StreamID::TELEMETRY, sample);
+  }
+  std::future<Msg> reply = host.request(CmdID::PING, {}, std::chrono::seconds(1));
+  dev.poll();
+  while (host.poll()) {
+  }
+  REQUIRE(samples == 100);
+  REQUIRE(reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+
+  // The whole stream went to one queue, the response to whichever it hashed to
+  uint64_t total = 0;
+  uint64_t busiest = 0;
+  for (std::size_t queue = 0; queue < hostEth.receiveQueues(); ++queue) {
+    const uint64_t queued = hostEth.getQueueStats(queue).queued[0];
+    total += queued;
+    busiest = std::max(busiest, queued);
+  }
+  REQUIRE(total == 101);
+  REQUIRE(100 <= busiest);
+}
+
+TEST_CASE("Demux by message type gives streams a queue of their own") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  hostEth.setReceiveQueues(Driver::RssConfig{
+      2, nullptr, std::vector<uint8_t>(Driver::INDIRECTION_LEN, 0)});
+  Driver::DemuxConfig demux;
+  demux.rules = {{Ethernet::Frame::EtherType::IPV4,
+                  static_cast<uint8_t>(MsgType::STREAM), 1}};
+  demux.key = &demuxKey;
+  hostEth.setDemux(demux);
+  Host host(hostEth);
+  Device dev(devEth);
+
+  const std::vector<uint8_t> sample(sizeof(uint32_t), 0x01);
+  for (int i = 0; i < 10; ++i) {
+    dev.sendStream(StreamID::TELEMETRY, sample);
+  }
+  std::future<Msg> reply = host.request(CmdID::PING, {}, std::chrono::seconds(1));
+  dev.poll();
+  REQUIRE(hostEth.getQueueStats(1).queued[0] == 10);
+  REQUIRE(hostEth.getQueueStats(0).queued[0] == 1);
+
+  // A stream consumer drains its queue while the host handles the rest
+  std::vector<uint8_t> bytes;
+  MacAddr src;
+  std::size_t streamed = 0;
+  while (hostEth.recvQueue(1, bytes, src)) {
+    streamed += unpackMsg(bytes).header.type == MsgType::STREAM;
+  }
+  REQUIRE(streamed == 10);
+  while (host.poll()) {
+  }
+  REQUIRE(reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+}
@@ -0,0 +1,169 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include "ProtocolRecorder.hpp"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+static std::string freshDirectory(const std::string &name) {
+  const std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+  std::filesystem::remove_all(path);
+  return path.string();
+}
+
+static std::size_t countSegments(const std::string &directory) {
+  std::size_t count = 0;
+  for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+    count += entry.path().extension() == ".rec";
+  }
+  return count;
+}
+
+TEST_CASE("Host telemetry is recorded with its device and receive time") {
+  const std::string directory = freshDirectory("ethernet_recorder_host");
+  Driver host_eth(MAC_A);
+  Driver dev_eth(MAC_B);
+  Driver::link(host_eth, dev_eth);
+  Host host(host_eth);
+  Device dev(dev_eth);
+
+  const Recorder::Clock::time_point before = Recorder::Clock::now();
+  {
+    Recorder recorder(Recorder::Config{directory});
+    host.setSink(recorder);
+    for (uint32_t count = 1; count <= 3; ++count) {
+      std::vector<uint8_t> sample(sizeof(count));
+      std::memcpy(sample.data(), &count, sizeof(count));
+      dev.sendStream(StreamID::TELEMETRY, sample);
+    }
+    while (host.poll()) {
+    }
+    recorder.flush();
+    REQUIRE(recorder.getStats().written == 3);
+    REQUIRE(recorder.getStats().segments == 1);
+    host.setSink(stdoutSink());
+  }
+  const Recorder::Clock::time_point after = Recorder::Clock::now();
+
+  const Recording recording(directory);
+  REQUIRE(recording.size() == 3);
+  const std::vector<Recorder::Sample> samples =
+      recording.read(before - 1s, after + 1s);
+  REQUIRE(samples.size() == 3);
+  for (uint32_t i = 0; i < 3; ++i) {
+    REQUIRE(samples[i].device == MAC_B);
+    REQUIRE(samples[i].stream_id == StreamID::TELEMETRY);
+    REQUIRE(samples[i].value == i + 1);
+    REQUIRE(before - 1ms <= samples[i].time);
+    REQUIRE(samples[i].time <= after + 1ms);
+  }
+  std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("Segments rotate, are retained by count and scanned by time") {
+  const std::string directory = freshDirectory("ethernet_recorder_rotate");
+  const Recorder::Clock::time_point start = Recorder::Clock::now();
+  auto sampleAt = [&](const int ms) {
+    return Recorder::Sample{start + std::chrono::milliseconds(ms), MAC_B,
+                            StreamID::TELEMETRY, static_cast<uint32_t>(ms)};
+  };
+
+  Recorder::Config config{directory};
+  config.segment_samples = 4;
+  config.max_segments = 3;
+  {
+    Recorder recorder(config);
+    for (int ms = 0; ms < 20; ++ms) {
+      REQUIRE(recorder.append(sampleAt(ms)));
+    }
+    recorder.flush();
+    REQUIRE(recorder.getStats().written == 20);
+    REQUIRE(recorder.getStats().segments == 3);
+  }
+  REQUIRE(countSegments(directory) == 3);
+
+  // Only the last three segments, samples 8 to 19, are left
+  const Recording recording(directory);
+  REQUIRE(recording.size() == 12);
+  REQUIRE(recording.read(start, start + 1h).front() == sampleAt(8));
+  const std::vector<Recorder::Sample> range =
+      recording.read(start + 10ms, start + 14ms);
+  REQUIRE(range == std::vector<Recorder::Sample>{sampleAt(10), sampleAt(11),
+                                                 sampleAt(12), sampleAt(13)});
+  REQUIRE(recording.read(start + 1h, start + 2h).empty());
+
+  // Reopening appends a new segment after the existing ones
+  {
+    Recorder recorder(config);
+    recorder.append(sampleAt(100));
+  }
+  REQUIRE(recording.size() == 9);
+  REQUIRE(recording.read(start + 50ms, start + 1h) ==
+          std::vector<Recorder::Sample>{sampleAt(100)});
+
+  // A segment rotated out after the index was read is skipped, as the writer
+  // leaves it between removing the file and rewriting the index
+  std::filesystem::remove(std::filesystem::path(directory) / "segment-00000003.rec");
+  REQUIRE(recording.size() == 9);
+  REQUIRE(recording.read(start, start + 1h).front() == sampleAt(16));
+  std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("Out of order samples are still found by a scan") {
+  const std::string directory = freshDirectory("ethernet_recorder_unsorted");
+  const Recorder::Clock::time_point start = Recorder::Clock::now();
+  {
+    Recorder recorder(Recorder::Config{directory});
+    for (const int ms : {5, 1, 4, 2, 3}) {
+      recorder.append(Recorder::Sample{start + std::chrono::milliseconds(ms),
+                                       MAC_A, StreamID::TELEMETRY,
+                                       static_cast<uint32_t>(ms)});
+    }
+  }
+
+  std::vector<uint32_t> values;
+  const std::size_t visited =
+      Recording(directory).scan(start + 2ms, start + 5ms,
+                                [&values](const Recorder::Sample &sample) {
+                                  values.push_back(sample.value);
+                                });
+  REQUIRE(visited == 3);
+  REQUIRE(values == std::vector<uint32_t>{4, 2, 3});
+  std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("Recorder rejects bad configuration and malformed segments") {
+  const std::string directory = freshDirectory("ethernet_recorder_bad");
+  Recorder::Config config{directory};
+  config.segment_samples = 0;
+  REQUIRE_THROWS_AS(Recorder(config), std::runtime_error);
+
+  {
+    Recorder recorder(Recorder::Config{directory});
+    recorder.append(Recorder::Sample{Recorder::Clock::now(), MAC_A,
+                                     StreamID::TELEMETRY, 1});
+  }
+  const std::string segment =
+      (std::filesystem::path(directory) / "segment-00000000.rec").string();
+  std::FILE *file = std::fopen(segment.c_str(), "r+b");
+  REQUIRE(file != nullptr);
+  std::fputs("XXXX", file);
+  std::fclose(file);
+
+  const Recording recording(directory);
+  REQUIRE(recording.size() == 1);
+  REQUIRE_THROWS_AS(recording.read(Recorder::Clock::time_point{},
+                                   Recorder::Clock::time_point::max()),
+                    std::runtime_error);
+  std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,170 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include "ProtocolRequest.hpp"
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+static constexpr CmdID GET_NAME = static_cast<CmdID>(0x10);
+static constexpr CmdID SILENT = static_cast<CmdID>(0x11);
+
+static bool isReady(const std::future<Msg> &future) {
+  return future.wait_for(0s) == std::future_status::ready;
+}
+
+TEST_CASE("Correlation id round-trips through pack and unpack") {
+  ID id;
+  id.cmd_id = CmdID::PING;
+  const CorrID corr = static_cast<CorrID>(0x1234);
+  const Msg msg = unpackMsg(packMsg(MsgType::COMMAND, id, {1, 2, 3}, corr));
+  REQUIRE(msg.header.corr == corr);
+  REQUIRE(msg.data == std::vector<uint8_t>{1, 2, 3});
+
+  const Msg plain = unpackMsg(packMsg(MsgType::COMMAND, id, {}));
+  REQUIRE(plain.header.corr == CorrID::NONE);
+}
+
+TEST_CASE("Pipelined requests complete out of order") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+  dev.onCommand(GET_NAME, [](Device &d, const MsgView &msg) {
+    d.sendResponse(msg.header.id.cmd_id, {'d', 'e', 'v'});
+  });
+
+  // Issue everything before the device handles any of it
+  std::vector<std::future<Msg>> futures;
+  for (std::size_t i = 0; i < 32; ++i) {
+    futures.push_back(host.request(i % 2 ? GET_NAME : CmdID::PING, {}));
+  }
+  host.sendCommand(CmdID::PING, {});
+  bool plain_response = false;
+  host.onResponse(CmdID::PING, [&](Host &, const MsgView &) { plain_response = true; });
+
+  while (dev.poll() && devEth.hasPending()) {
+  }
+  while (host.poll()) {
+  }
+  for (std::size_t i = 0; i < futures.size(); ++i) {
+    REQUIRE(isReady(futures[i]));
+    const Msg msg = futures[i].get();
+    REQUIRE(msg.header.type == MsgType::RESPONSE);
+    if (i % 2) {
+      REQUIRE(msg.data == std::vector<uint8_t>{'d', 'e', 'v'});
+    } else {
+      REQUIRE(msg.data == std::vector<uint8_t>{'P', 'O', 'N', 'G'});
+    }
+  }
+
+  // The uncorrelated command still reaches the response handler
+  REQUIRE(plain_response);
+  REQUIRE(host.getRequestStats().completed == 32);
+}
+
+TEST_CASE("Device errors fail the request future") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+
+  std::future<Msg> future = host.request(static_cast<CmdID>(0x7f), {});
+  dev.poll();
+  host.poll();
+  REQUIRE(isReady(future));
+  try {
+    future.get();
+    FAIL("Expected CommandError");
+  } catch (const CommandError &error) {
+    REQUIRE(error.error_id == ErrorID::UNKNOWN_CMD);
+  }
+  REQUIRE(host.getRequestStats().failed == 1);
+}
+
+TEST_CASE("Unanswered requests time out and late replies are dropped") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+
+  // One command is never answered, the other is answered too late
+  dev.onCommand(SILENT, [](Device &, const MsgView &) {});
+  std::future<Msg> silent = host.request(SILENT, {}, 5ms);
+  std::future<Msg> late = host.request(CmdID::PING, {}, 5ms);
+  dev.poll();
+  dev.poll();
+
+  // The host only looks after the timeout has passed
+  REQUIRE_FALSE(isReady(silent));
+  bool handled = false;
+  host.onResponse(CmdID::PING, [&handled](Host &, const MsgView &) { handled = true; });
+  const auto later = RequestTable::Clock::now() + 10ms;
+  while (host.poll(later)) {
+  }
+  REQUIRE(isReady(silent));
+  REQUIRE(isReady(late));
+  REQUIRE_THROWS_AS(silent.get(), CommandTimeout);
+  REQUIRE_THROWS_AS(late.get(), CommandTimeout);
+  REQUIRE(host.getRequestStats().timed_out == 2);
+
+  // The PONG for the timed out request went to neither the future nor the
+  // response handler
+  REQUIRE_FALSE(handled);
+  REQUIRE(host.getRequestStats().stale == 1);
+}
+
+TEST_CASE("Request table reuses slots with new generations") {
+  RequestTable table;
+  const auto now = RequestTable::Clock::now();
+
+  std::promise<Msg> first;
+  std::future<Msg> first_future = first.get_future();
+  const CorrID old_corr = table.open(std::move(first), now, 10ms);
+  REQUIRE(table.outstanding() == 1);
+  table.cancel(old_corr);
+  REQUIRE(table.outstanding() == 0);
+
+  std::promise<Msg> second;
+  std::future<Msg> second_future = second.get_future();
+  const CorrID new_corr = table.open(std::move(second), now, 10ms);
+  REQUIRE(new_corr != old_corr);
+  REQUIRE((static_cast<uint16_t>(new_corr) & 0xff) ==
+          (static_cast<uint16_t>(old_corr) & 0xff));
+
+  // A reply to the old generation does not complete the new request
+  MsgView reply{};
+  reply.header.type = MsgType::RESPONSE;
+  reply.header.id.cmd_id = CmdID::PING;
+  reply.header.corr = old_corr;
+  REQUIRE_FALSE(table.complete(reply));
+  reply.header.corr = new_corr;
+  REQUIRE(table.complete(reply));
+  REQUIRE(isReady(second_future));
+
+  // Every slot can be outstanding, then the table is full
+  std::vector<std::future<Msg>> futures;
+  for (std::size_t i = 0; i < RequestTable::SLOT_COUNT; ++i) {
+    std::promise<Msg> promise;
+    futures.push_back(promise.get_future());
+    table.open(std::move(promise), now, 1s + i * 1ms);
+  }
+  REQUIRE_THROWS(table.open(std::promise<Msg>{}, now, 1s));
+
+  // Timeouts spanning several laps of the wheel fire on time
+  table.expire(now + 1s - 2ms);
+  REQUIRE(table.outstanding() == RequestTable::SLOT_COUNT);
+  table.expire(now + 1s + 100ms);
+  REQUIRE(table.outstanding() == RequestTable::SLOT_COUNT - 101);
+  table.expire(now + 10s);
+  REQUIRE(table.outstanding() == 0);
+  REQUIRE(table.getStats().timed_out == RequestTable::SLOT_COUNT);
+}
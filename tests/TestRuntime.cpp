@@ -0,0 +1,203 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include "RuntimeScheduler.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+using Runtime::Scheduler;
+using Runtime::Task;
+
+static void waitFor(const std::atomic<std::size_t> &count,
+                    const std::size_t target) {
+  const auto give_up = Scheduler::Clock::now() + 10s;
+  while (count.load() < target && Scheduler::Clock::now() < give_up) {
+    std::this_thread::sleep_for(1ms);
+  }
+}
+
+static Task sleeper(Scheduler &scheduler, const Scheduler::Clock::time_point wake,
+                    const int id, std::mutex &mutex, std::vector<int> &order,
+                    std::atomic<std::size_t> &done) {
+  co_await scheduler.sleepUntil(wake);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(id);
+  }
+  ++done;
+}
+
+static Task idle(Scheduler &scheduler) {
+  co_await scheduler.sleepUntil(Scheduler::Clock::time_point::max());
+}
+
+static Task thrower(Scheduler &scheduler) {
+  co_await scheduler.sleepUntil(Scheduler::Clock::now());
+  throw std::runtime_error("task failed");
+}
+
+static Task client(Scheduler &scheduler, Host &host, Driver &driver,
+                   const std::size_t count, std::atomic<std::size_t> &done) {
+  for (std::size_t i = 0; i < count; ++i) {
+    std::future<Msg> future = host.request(CmdID::PING, {}, 1s);
+    while (future.wait_for(0s) != std::future_status::ready) {
+      co_await scheduler.readable(driver, Scheduler::Clock::now() + 5ms);
+      while (host.poll()) {
+      }
+    }
+    if (future.get().data != std::vector<uint8_t>{'P', 'O', 'N', 'G'}) {
+      throw std::runtime_error("Unexpected response");
+    }
+  }
+  ++done;
+}
+
+TEST_CASE("Sleeping coroutines resume in deadline order") {
+  Scheduler scheduler(1);
+  std::mutex mutex;
+  std::vector<int> order;
+  std::atomic<std::size_t> done{0};
+  const auto t0 = Scheduler::Clock::now();
+  scheduler.spawn(sleeper(scheduler, t0 + 30ms, 3, mutex, order, done));
+  scheduler.spawn(sleeper(scheduler, t0 + 10ms, 1, mutex, order, done));
+  scheduler.spawn(sleeper(scheduler, t0 + 20ms, 2, mutex, order, done));
+  waitFor(done, 3);
+  REQUIRE(Scheduler::Clock::now() - t0 >= 30ms);
+
+  // Waits that never fire are released by stop
+  scheduler.spawn(idle(scheduler));
+  scheduler.stop();
+  REQUIRE(order == std::vector<int>{1, 2, 3});
+}
+
+TEST_CASE("Task exceptions are rethrown from stop") {
+  Scheduler scheduler(2);
+  scheduler.spawn(thrower(scheduler));
+  std::this_thread::sleep_for(5ms);
+  REQUIRE_THROWS_WITH(scheduler.stop(), "task failed");
+  REQUIRE_THROWS(scheduler.spawn(idle(scheduler)));
+}
+
+TEST_CASE("Coroutine endpoints share a small thread pool") {
+  constexpr std::size_t PAIRS = 200;
+  constexpr std::size_t REQUESTS = 5;
+  std::vector<std::unique_ptr<Driver>> drivers;
+  std::vector<std::unique_ptr<Host>> hosts;
+  std::vector<std::unique_ptr<Device>> devices;
+  Scheduler scheduler(2);
+  std::atomic<std::size_t> done{0};
+
+  for (std::size_t i = 0; i < PAIRS; ++i) {
+    Driver *host_eth = drivers.emplace_back(std::make_unique<Driver>(
+        MacAddr{0x02, 0x00, 0x00, 0x00, static_cast<uint8_t>(i >> 8),
+                static_cast<uint8_t>(i)})).get();
+    Driver *dev_eth = drivers.emplace_back(std::make_unique<Driver>(
+        MacAddr{0x02, 0x00, 0x00, 0x01, static_cast<uint8_t>(i >> 8),
+                static_cast<uint8_t>(i)})).get();
+    Driver::link(*host_eth, *dev_eth);
+    scheduler.attach(*host_eth);
+    scheduler.attach(*dev_eth);
+    hosts.push_back(std::make_unique<Host>(*host_eth));
+    devices.push_back(std::make_unique<Device>(*dev_eth));
+  }
+  for (std::size_t i = 0; i < PAIRS; ++i) {
+    scheduler.spawn(devices[i]->run(scheduler));
+    scheduler.spawn(client(scheduler, *hosts[i], *drivers[2 * i], REQUESTS, done));
+  }
+  waitFor(done, PAIRS);
+  scheduler.stop();
+
+  REQUIRE(done.load() == PAIRS);
+  for (const auto &host : hosts) {
+    REQUIRE(host->getRequestStats().completed == REQUESTS);
+  }
+}
+
+TEST_CASE("Device coroutine streams on its own clock") {
+  Driver hostEth(MacAddr{0x00, 0x01, 0x02, 0x03, 0x04, 0x05});
+  Driver devEth(MacAddr{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF});
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+  std::atomic<std::size_t> samples{0};
+  host.onStream(StreamID::TELEMETRY,
+                [&samples](Host &, const MsgView &) { ++samples; });
+
+  StreamScheduler::StreamConfig config;
+  config.id = StreamID::TELEMETRY;
+  config.rate_hz = 200.0;
+  config.producer = [](uint32_t, std::vector<uint8_t> &sample) {
+    sample.assign(4, 0x00);
+  };
+  dev.addStream(config);
+  dev.enableStream(StreamID::TELEMETRY, true);
+
+  Scheduler scheduler(1);
+  scheduler.attach(hostEth);
+  scheduler.attach(devEth);
+  scheduler.spawn(dev.run(scheduler));
+  scheduler.spawn(host.run(scheduler));
+  waitFor(samples, 10);
+  scheduler.stop();
+  REQUIRE(samples.load() >= 10);
+}
+
+TEST_CASE("A request from another thread wakes an idle host task") {
+  Driver hostEth(MacAddr{0x00, 0x01, 0x02, 0x03, 0x04, 0x05});
+  Driver devEth(MacAddr{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF});
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Scheduler scheduler(1);
+  scheduler.attach(hostEth);
+  scheduler.spawn(host.run(scheduler));
+  std::this_thread::sleep_for(20ms);
+
+  // The device never answers, so only the task can time the request out
+  std::future<Msg> reply = host.request(CmdID::PING, {}, 10ms);
+  REQUIRE(reply.wait_for(500ms) == std::future_status::ready);
+  REQUIRE_THROWS_AS(reply.get(), CommandTimeout);
+  scheduler.stop();
+}
+
+TEST_CASE("Coroutine frames are reused from the pool") {
+  using Runtime::FramePool;
+  const std::size_t before = FramePool::cached();
+  void *frame = FramePool::allocate(200);
+  FramePool::deallocate(frame, 200);
+  REQUIRE(FramePool::cached() == before + 1);
+
+  // Any size in the same class gets the cached frame back
+  void *again = FramePool::allocate(250);
+  REQUIRE(again == frame);
+  REQUIRE(FramePool::cached() == before);
+  FramePool::deallocate(again, 250);
+
+  // Frames beyond the largest class bypass the pool
+  const std::size_t big = FramePool::CLASS_SIZE * FramePool::CLASS_COUNT + 1;
+  FramePool::deallocate(FramePool::allocate(big), big);
+  REQUIRE(FramePool::cached() == before + 1);
+}
+
+TEST_CASE("Pinned workers run tasks") {
+  REQUIRE_THROWS_AS(Scheduler(Scheduler::Config{0, false}), std::runtime_error);
+
+  // More workers than CPUs wrap around the allowed set
+  const std::size_t threads = std::thread::hardware_concurrency() + 1;
+  Scheduler scheduler(Scheduler::Config{threads, true});
+  REQUIRE(scheduler.size() == threads);
+  std::mutex mutex;
+  std::vector<int> order;
+  std::atomic<std::size_t> done{0};
+  const auto t0 = Scheduler::Clock::now();
+  for (int i = 0; i < 8; ++i) {
+    scheduler.spawn(sleeper(scheduler, t0 + i * 1ms, i, mutex, order, done));
+  }
+  waitFor(done, 8);
+  scheduler.stop();
+  REQUIRE(done.load() == 8);
+}
@@ -0,0 +1,123 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include "ProtocolSchema.hpp"
+
+using namespace Ethernet;
+using namespace Protocol;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+static constexpr CmdID CALIBRATE = static_cast<CmdID>(0x20);
+static constexpr StreamID VOLTAGE = static_cast<StreamID>(0x02);
+
+namespace {
+
+struct Range {
+  int16_t low;
+  int16_t high;
+  using FIELDS = Fields<&Range::low, &Range::high>;
+};
+
+struct Calibration {
+  StreamID stream_id;
+  bool enabled;
+  float gain;
+  Range range;
+  std::array<uint16_t, 3> taps;
+  uint64_t serial;
+  using FIELDS = Fields<&Calibration::stream_id, &Calibration::enabled,
+                        &Calibration::gain, &Calibration::range,
+                        &Calibration::taps, &Calibration::serial>;
+};
+
+struct Voltage {
+  uint16_t millivolts;
+  using FIELDS = Fields<&Voltage::millivolts>;
+};
+
+struct Oversized {
+  std::array<uint8_t, SCHEMA_LEN_MAX + 1> bytes;
+  using FIELDS = Fields<&Oversized::bytes>;
+};
+
+template <typename T>
+concept Packable = requires(const T &value) { pack(value); };
+
+} // namespace
+
+TEST_CASE("Schemas have fixed little-endian layouts") {
+  STATIC_REQUIRE(WIRE_LEN<Range> == 4);
+  STATIC_REQUIRE(WIRE_LEN<Calibration> == 1 + 1 + 4 + 4 + 6 + 8);
+  STATIC_REQUIRE(WIRE_LEN<TelemetrySample> == 4);
+  STATIC_REQUIRE_FALSE(Schema<std::vector<uint8_t>>);
+
+  // Layouts are computed at compile time
+  constexpr auto range = pack(Range{-2, 0x1234});
+  STATIC_REQUIRE(range == std::array<uint8_t, 4>{0xFE, 0xFF, 0x34, 0x12});
+
+  const Calibration calibration{VOLTAGE, true, 1.5f, {-100, 100},
+                                {1, 2, 0x0304}, 0x0102030405060708};
+  const auto bytes = pack(calibration);
+  const std::array<uint8_t, WIRE_LEN<Calibration>> expected = {
+      0x02, 0x01, 0x00, 0x00, 0xC0, 0x3F, 0x9C, 0xFF, 0x64, 0x00, 0x01, 0x00,
+      0x02, 0x00, 0x04, 0x03, 0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01};
+  REQUIRE(bytes == expected);
+
+  const auto decoded = unpack<Calibration>(bytes);
+  REQUIRE(decoded.stream_id == VOLTAGE);
+  REQUIRE(decoded.enabled);
+  REQUIRE(decoded.gain == 1.5f);
+  REQUIRE(decoded.range.low == -100);
+  REQUIRE(decoded.range.high == 100);
+  REQUIRE(decoded.taps == std::array<uint16_t, 3>{1, 2, 0x0304});
+  REQUIRE(decoded.serial == 0x0102030405060708);
+}
+
+TEST_CASE("Schemas reject data of the wrong size") {
+  const std::vector<uint8_t> short_data = {0x01, 0x02, 0x03};
+  const std::vector<uint8_t> long_data = {0x01, 0x02, 0x03, 0x04, 0x05};
+  REQUIRE_THROWS_AS(unpack<Range>(short_data), std::runtime_error);
+  REQUIRE_THROWS_AS(unpack<Range>(long_data), std::runtime_error);
+
+  // Schemas too large for one frame do not compile
+  STATIC_REQUIRE(Packable<Range>);
+  STATIC_REQUIRE(Schema<Oversized>);
+  STATIC_REQUIRE_FALSE(Packable<Oversized>);
+}
+
+TEST_CASE("Typed handlers exchange schema messages") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+
+  dev.onCommand(CALIBRATE, typed<Calibration>([](Device &d, const Calibration &c) {
+    d.sendResponse(CALIBRATE, c.range);
+    d.sendStream(c.stream_id, Voltage{3300});
+  }));
+  Range echoed{};
+  host.onResponse(CALIBRATE, typed<Range>([&echoed](Host &, const Range &r) {
+    echoed = r;
+  }));
+  uint16_t millivolts = 0;
+  host.onStream(VOLTAGE, typed<Voltage>([&millivolts](Host &, const Voltage &v) {
+    millivolts = v.millivolts;
+  }));
+
+  host.sendCommand(CALIBRATE,
+                   Calibration{VOLTAGE, true, 2.0f, {-5, 5}, {0, 0, 0}, 1});
+  dev.poll();
+  while (host.poll()) {
+  }
+  REQUIRE(echoed.low == -5);
+  REQUIRE(echoed.high == 5);
+  REQUIRE(millivolts == 3300);
+
+  // A payload that does not match the schema throws from the handler
+  host.sendCommand(CALIBRATE, Range{0, 0});
+  REQUIRE_THROWS_AS(dev.poll(), std::runtime_error);
+}
@@ -0,0 +1,115 @@
+#include <catch2/catch_all.hpp>
+
+#include "EthernetSegment.hpp"
+
+using namespace Ethernet;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+static const MacAddr MAC_C{0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const MacAddr MAC_D{0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+
+TEST_CASE("Segments forward unicast and flood broadcast frames") {
+  Segment segment;
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver c(MAC_C);
+  segment.attach(a);
+  segment.attach(b);
+  segment.attach(c);
+  REQUIRE(segment.size() == 3);
+
+  const std::vector<uint8_t> data(64, 0x5A);
+  std::vector<uint8_t> received;
+  MacAddr src{};
+
+  // Unicast only reaches its destination
+  a.sendTo(MAC_B, data);
+  REQUIRE(b.recv(received, src));
+  REQUIRE(received == data);
+  REQUIRE(src == MAC_A);
+  REQUIRE_FALSE(c.hasPending());
+  REQUIRE_FALSE(a.hasPending());
+
+  // Broadcast reaches everyone but the sender
+  c.sendTo(BROADCAST_MAC, data);
+  REQUIRE(a.recv(received, src));
+  REQUIRE(src == MAC_C);
+  REQUIRE(b.recv(received, src));
+  REQUIRE(src == MAC_C);
+  REQUIRE_FALSE(c.hasPending());
+
+  // Frames for stations not on the segment are dropped
+  b.sendTo(MAC_D, data);
+  REQUIRE_FALSE(a.hasPending());
+  REQUIRE_FALSE(c.hasPending());
+
+  const Segment::Stats stats = segment.getStats();
+  REQUIRE(stats.forwarded == 1);
+  REQUIRE(stats.flooded == 1);
+  REQUIRE(stats.dropped == 1);
+}
+
+TEST_CASE("Segments reject drivers they cannot carry") {
+  Segment segment;
+  Driver a(MAC_A);
+  segment.attach(a);
+
+  // Duplicate MAC addresses
+  Driver duplicate(MAC_A);
+  REQUIRE_THROWS_AS(segment.attach(duplicate), std::runtime_error);
+
+  // Drivers already on a link or segment
+  REQUIRE_THROWS_AS(segment.attach(a), std::logic_error);
+  Driver b(MAC_B);
+  Driver c(MAC_C);
+  Driver::link(b, c);
+  REQUIRE_THROWS_AS(segment.attach(b), std::logic_error);
+
+  // Reliable delivery only works point-to-point
+  Driver d(MAC_D);
+  d.setReliability(Reliability::Config{});
+  REQUIRE_THROWS_AS(segment.attach(d), std::logic_error);
+  REQUIRE_THROWS_AS(a.setReliability(Reliability::Config{}), std::logic_error);
+
+  // Unattached drivers cannot send
+  Driver e(MAC_B);
+  REQUIRE_THROWS_AS(e.sendTo(MAC_A, std::vector<uint8_t>(64)), std::logic_error);
+}
+
+TEST_CASE("Multicast frames reach the members of their group") {
+  Segment segment;
+  Driver a(MAC_A);
+  Driver b(MAC_B);
+  Driver c(MAC_C);
+  Driver d(MAC_D);
+  for (Driver *driver : {&a, &b, &c, &d}) {
+    segment.attach(*driver);
+  }
+  const MacAddr GROUP{0x01, 0x00, 0x5E, 0x00, 0x00, 0x01};
+  segment.join(GROUP, a);
+  segment.join(GROUP, b);
+  segment.join(GROUP, c);
+
+  // Every member but the sender gets it, each from the same shared bytes
+  const std::vector<uint8_t> data(64, 0x5A);
+  a.sendTo(GROUP, data);
+  std::vector<uint8_t> received;
+  MacAddr src{};
+  REQUIRE(b.recv(received, src));
+  REQUIRE(received == data);
+  REQUIRE(c.recv(received, src));
+  REQUIRE(src == MAC_A);
+  REQUIRE_FALSE(a.hasPending());
+  REQUIRE_FALSE(d.hasPending());
+
+  // Groups nobody joined are dropped
+  a.sendTo(MacAddr{0x01, 0x00, 0x5E, 0x00, 0x00, 0x02}, data);
+  REQUIRE(segment.getStats().multicast == 1);
+  REQUIRE(segment.getStats().dropped == 1);
+
+  REQUIRE_THROWS_AS(segment.join(MAC_B, a), std::runtime_error);
+  REQUIRE_THROWS_AS(segment.join(BROADCAST_MAC, a), std::runtime_error);
+  Driver outside(MAC_A);
+  REQUIRE_THROWS_AS(segment.join(GROUP, outside), std::logic_error);
+}
@@ -0,0 +1,194 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include "RuntimeSimulation.hpp"
+#include <memory>
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+using Runtime::Simulation;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+namespace {
+
+// Host/device pairs streaming telemetry over simulated wires
+struct Topology {
+  Topology(Simulation &simulation, const std::size_t pairs,
+           const std::size_t partitions) {
+    for (std::size_t i = 0; i < pairs; ++i) {
+      Driver &host_eth = *this->drivers.emplace_back(std::make_unique<Driver>(
+          MacAddr{0x02, 0x00, 0x00, 0x00, 0x00, static_cast<uint8_t>(i)}));
+      Driver &dev_eth = *this->drivers.emplace_back(std::make_unique<Driver>(
+          MacAddr{0x02, 0x00, 0x00, 0x01, 0x00, static_cast<uint8_t>(i)}));
+      Host &host = *this->hosts.emplace_back(std::make_unique<Host>(host_eth));
+      Device &dev = *this->devices.emplace_back(std::make_unique<Device>(dev_eth));
+
+      StreamScheduler::StreamConfig config;
+      config.id = StreamID::TELEMETRY;
+      config.rate_hz = 1000.0 * static_cast<double>(i + 1);
+      config.producer = [](uint32_t index, std::vector<uint8_t> &sample) {
+        const auto data = pack(TelemetrySample{index});
+        sample.assign(data.begin(), data.end());
+      };
+      dev.addStream(config);
+      dev.enableStream(StreamID::TELEMETRY, true, simulation.now());
+      uint64_t &count = this->samples.emplace_back(0);
+      host.onStream(StreamID::TELEMETRY,
+                    [&count](Host &, const MsgView &) { ++count; });
+
+      // Each host and its device sit on neighbouring partitions
+      simulation.spawn(host.simulate(), i % partitions);
+      simulation.spawn(dev.simulate(), (i + 1) % partitions);
+      simulation.link(host_eth, dev_eth, 1ms);
+    }
+  }
+
+  std::vector<std::unique_ptr<Driver>> drivers{};
+  std::vector<std::unique_ptr<Host>> hosts{};
+  std::vector<std::unique_ptr<Device>> devices{};
+  std::deque<uint64_t> samples{};
+};
+
+} // namespace
+
+TEST_CASE("Simulated time jumps straight to each event") {
+  Simulation simulation;
+  const Simulation::Clock::time_point t0 = simulation.now();
+  std::vector<int> order;
+  simulation.at(t0 + 10s, [&order] { order.push_back(3); });
+  simulation.at(t0 + 5s, [&order] { order.push_back(1); });
+  simulation.at(t0 + 5s, [&order, &simulation] {
+    order.push_back(2);
+    simulation.after(1s, [&order] { order.push_back(4); });
+  });
+
+  // Ties run in the order they were scheduled
+  simulation.run(t0 + 7s);
+  REQUIRE(order == std::vector<int>{1, 2, 4});
+  REQUIRE(simulation.now() == t0 + 7s);
+  simulation.run();
+  REQUIRE(order == std::vector<int>{1, 2, 4, 3});
+  REQUIRE(simulation.now() == t0 + 10s);
+  REQUIRE(simulation.getStats().events == 4);
+  REQUIRE_THROWS_AS(simulation.at(t0, [] {}), std::logic_error);
+}
+
+TEST_CASE("Simulated wires delay frames by latency and bit rate") {
+  const double bits_per_second = GENERATE(0.0, 1e6);
+  Simulation simulation;
+  const Simulation::Clock::time_point t0 = simulation.now();
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Host host(hostEth);
+  Device dev(devEth);
+  simulation.spawn(host.simulate());
+  simulation.spawn(dev.simulate());
+  simulation.link(hostEth, devEth, 2ms, bits_per_second);
+
+  Simulation::Clock::time_point answered{};
+  host.onResponse(CmdID::PING, [&answered, &simulation](Host &, const MsgView &) {
+    answered = simulation.now();
+  });
+  host.sendCommand(CmdID::PING, {});
+  simulation.run();
+
+  // A minimum-size frame is 64 bytes, 512 us at 1 Mbit/s
+  const Simulation::Clock::duration serialise =
+      bits_per_second == 0.0 ? 0us : 512us;
+  REQUIRE(answered - t0 == 2 * (2ms + serialise));
+}
+
+TEST_CASE("Request timeouts fire in virtual time") {
+  Simulation simulation;
+  const Simulation::Clock::time_point t0 = simulation.now();
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Host host(hostEth);
+  simulation.spawn(host.simulate());
+  simulation.link(hostEth, devEth, 1ms);
+
+  // Nothing answers, and the host sleeps until the deadline
+  std::future<Msg> reply =
+      host.request(MAC_B, CmdID::PING, {}, 250ms, simulation.now());
+  simulation.run();
+  REQUIRE_THROWS_AS(reply.get(), CommandTimeout);
+  REQUIRE(simulation.now() - t0 >= 250ms);
+  REQUIRE(simulation.now() - t0 <= 252ms);
+  REQUIRE(simulation.getStats().events < 10);
+}
+
+TEST_CASE("Simulations are deterministic and partitioned runs agree") {
+  constexpr std::size_t PAIRS = 8;
+  std::vector<std::deque<uint64_t>> results;
+  for (const std::size_t partitions : {1, 1, 4}) {
+    Simulation simulation(Simulation::Config{partitions, 1ms});
+    Topology topology(simulation, PAIRS, partitions);
+    simulation.run(simulation.now() + 500ms);
+    results.push_back(topology.samples);
+    if (1 < partitions) {
+      REQUIRE(simulation.getStats().windows > 0);
+    }
+  }
+
+  // Each device streams for half a simulated second, less the wire's latency
+  for (std::size_t i = 0; i < PAIRS; ++i) {
+    REQUIRE(results[0][i] >= 500 * (i + 1) - 2 * (i + 1));
+    REQUIRE(results[0][i] <= 500 * (i + 1) + 1);
+  }
+  REQUIRE(results[0] == results[1]);
+  REQUIRE(results[0] == results[2]);
+}
+
+TEST_CASE("Partitions need wires at least the lookahead long") {
+  REQUIRE_THROWS_AS(Simulation(Simulation::Config{0, 1ms}), std::runtime_error);
+  REQUIRE_THROWS_AS(Simulation(Simulation::Config{2, 0ms}), std::runtime_error);
+
+  Simulation simulation(Simulation::Config{2, 1ms});
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Host host(hostEth);
+  Device dev(devEth);
+  simulation.spawn(host.simulate(), 0);
+  simulation.spawn(dev.simulate(), 1);
+  REQUIRE_THROWS_AS(simulation.link(hostEth, devEth, 500us), std::runtime_error);
+  simulation.link(hostEth, devEth, 1ms);
+
+  // Drivers on a wire cannot be linked again
+  Driver other(MAC_A);
+  REQUIRE_THROWS_AS(simulation.link(hostEth, other, 1ms), std::logic_error);
+}
+
+TEST_CASE("Coalesced streams flush and restart in virtual time") {
+  Simulation simulation;
+  const Simulation::Clock::time_point t0 = simulation.now();
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Host host(hostEth);
+  Device dev(devEth);
+  dev.setStreamCoalescing({});
+  uint64_t samples = 0;
+  host.onStream(StreamID::TELEMETRY,
+                [&samples](Host &, const MsgView &) { ++samples; });
+  StreamScheduler::StreamConfig config;
+  config.id = StreamID::TELEMETRY;
+  config.rate_hz = 1000.0;
+  config.producer = [](uint32_t index, std::vector<uint8_t> &sample) {
+    const auto data = pack(TelemetrySample{index});
+    sample.assign(data.begin(), data.end());
+  };
+  dev.addStream(config, t0);
+  dev.enableStream(StreamID::TELEMETRY, true, t0);
+  simulation.spawn(host.simulate());
+  simulation.spawn(dev.simulate());
+  simulation.link(hostEth, devEth, 1ms);
+
+  // Halfway through the stream is replaced, and keeps running on the same clock
+  simulation.at(t0 + 25ms, [&] { dev.addStream(config, simulation.now()); });
+  simulation.run(t0 + 50ms);
+  REQUIRE(samples >= 47);
+  REQUIRE(samples <= 51);
+}
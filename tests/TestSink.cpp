@@ -0,0 +1,163 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include "ProtocolSink.hpp"
+#include <cstring>
+#include <string>
+#include <thread>
+
+using namespace Ethernet;
+using namespace Protocol;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+namespace {
+
+struct CaptureSink : Sink {
+  void response(const ResponseRecord &record) override {
+    responses.emplace_back(record.data.begin(), record.data.end());
+  }
+  void telemetry(const TelemetryRecord &record) override {
+    counts.push_back(record.count);
+  }
+  void error(const ErrorRecord &record) override {
+    errors.push_back(record.error_id);
+  }
+
+  std::vector<std::vector<uint8_t>> responses{};
+  std::vector<uint32_t> counts{};
+  std::vector<ErrorID> errors{};
+};
+
+std::string readAll(std::FILE *file) {
+  std::string text;
+  std::rewind(file);
+  char buffer[256];
+  while (std::size_t n = std::fread(buffer, 1, sizeof(buffer), file)) {
+    text.append(buffer, n);
+  }
+  return text;
+}
+
+} // namespace
+
+TEST_CASE("Host default handlers deliver typed records to its sink") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+  CaptureSink sink;
+  host.setSink(sink);
+
+  host.sendCommand(CmdID::PING, {});
+  host.sendCommand(static_cast<CmdID>(0x7E), {});
+  dev.poll();
+  dev.poll();
+  uint32_t count = 7;
+  std::vector<uint8_t> sample(sizeof(count));
+  std::memcpy(sample.data(), &count, sizeof(count));
+  dev.sendStream(StreamID::TELEMETRY, sample);
+  while (host.poll()) {
+  }
+
+  REQUIRE(sink.responses == std::vector<std::vector<uint8_t>>{{'P', 'O', 'N', 'G'}});
+  REQUIRE(sink.counts == std::vector<uint32_t>{7});
+  REQUIRE(sink.errors == std::vector<ErrorID>{ErrorID::UNKNOWN_CMD});
+}
+
+TEST_CASE("StdioSink and AsyncLogSink write the same lines") {
+  const std::vector<uint8_t> data = {'O', 'K', 0x00};
+  std::FILE *direct = std::tmpfile();
+  std::FILE *queued = std::tmpfile();
+  REQUIRE(direct);
+  REQUIRE(queued);
+
+  {
+    StdioSink stdio(direct);
+    AsyncLogSink async(AsyncLogSink::Config{64, queued});
+    for (Sink *sink : {static_cast<Sink *>(&stdio), static_cast<Sink *>(&async)}) {
+      sink->response(ResponseRecord{CmdID::PING, CorrID::NONE, data});
+      sink->telemetry(TelemetryRecord{42});
+      sink->error(ErrorRecord{ErrorID::BAD_PAYLOAD, CorrID::NONE});
+    }
+    std::fflush(direct);
+    async.flush();
+    REQUIRE(async.getStats().written == 3);
+    REQUIRE(async.getStats().dropped == 0);
+  }
+
+  const std::string expected = "[HOST] Response id=1 len=3: OK.\n"
+                               "[HOST] Stream count: 42\n"
+                               "[HOST] ERROR code=2\n";
+  REQUIRE(readAll(direct) == expected);
+  REQUIRE(readAll(queued) == expected);
+  std::fclose(direct);
+  std::fclose(queued);
+}
+
+TEST_CASE("AsyncLogSink keeps every record from concurrent producers") {
+  constexpr uint32_t PRODUCERS = 4;
+  constexpr uint32_t RECORDS = 500;
+  std::FILE *out = std::tmpfile();
+  REQUIRE(out);
+  {
+    AsyncLogSink sink(AsyncLogSink::Config{PRODUCERS * RECORDS, out});
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < PRODUCERS; ++p) {
+      producers.emplace_back([&sink] {
+        for (uint32_t i = 0; i < RECORDS; ++i) {
+          sink.telemetry(TelemetryRecord{i});
+        }
+      });
+    }
+    for (std::thread &producer : producers) {
+      producer.join();
+    }
+    sink.flush();
+    REQUIRE(sink.getStats().written == PRODUCERS * RECORDS);
+    REQUIRE(sink.getStats().dropped == 0);
+  }
+  const std::string text = readAll(out);
+  std::size_t lines = 0;
+  for (const char c : text) {
+    lines += c == '\n';
+  }
+  REQUIRE(lines == PRODUCERS * RECORDS);
+  std::fclose(out);
+}
+
+TEST_CASE("AsyncLogSink drops records instead of blocking when full") {
+  std::FILE *out = std::tmpfile();
+  REQUIRE(out);
+  // A long idle period keeps the writer from draining the queue mid-burst
+  {
+    AsyncLogSink sink(AsyncLogSink::Config{4, out, std::chrono::milliseconds(200)});
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    for (uint32_t i = 0; i < 100; ++i) {
+      sink.telemetry(TelemetryRecord{i});
+    }
+    sink.flush();
+    const AsyncLogSink::Stats stats = sink.getStats();
+    REQUIRE(stats.written == 4);
+    REQUIRE(stats.dropped == 96);
+  }
+  std::fclose(out);
+}
+
+TEST_CASE("AsyncLogSink truncates long responses but keeps their length") {
+  std::FILE *out = std::tmpfile();
+  REQUIRE(out);
+  const std::vector<uint8_t> data(AsyncLogSink::DATA_MAX + 10, 'x');
+  {
+    AsyncLogSink sink(AsyncLogSink::Config{8, out});
+    sink.response(ResponseRecord{CmdID::PING, CorrID::NONE, data});
+  }
+  const std::string expected = "[HOST] Response id=1 len=" +
+                               std::to_string(data.size()) + ": " +
+                               std::string(AsyncLogSink::DATA_MAX, 'x') + "\n";
+  REQUIRE(readAll(out) == expected);
+  std::fclose(out);
+}
@@ -0,0 +1,136 @@
+#include <catch2/catch_all.hpp>
+
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include "ProtocolStream.hpp"
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+static constexpr StreamID VOLTAGE = static_cast<StreamID>(0x02);
+
+static StreamScheduler::StreamConfig makeStream(const StreamID id, const double rate_hz) {
+  StreamScheduler::StreamConfig config;
+  config.id = id;
+  config.rate_hz = rate_hz;
+  config.producer = [](uint32_t index, std::vector<uint8_t> &sample) {
+    sample.assign(1, static_cast<uint8_t>(index));
+  };
+  return config;
+}
+
+TEST_CASE("Stream rate is independent of poll rate") {
+  StreamScheduler scheduler;
+  scheduler.add(makeStream(StreamID::TELEMETRY, 100.0));
+  const auto t0 = StreamScheduler::Clock::now();
+  REQUIRE(scheduler.enable(StreamID::TELEMETRY, true, t0));
+
+  std::size_t sent = 0;
+  auto count = [&sent](StreamID, const std::vector<uint8_t> &) { ++sent; };
+
+  // Polling every 100 us or every 5 ms for one second sends the same amount
+  for (auto t = t0; t < t0 + 1s; t += 100us) {
+    scheduler.poll(count, t);
+  }
+  REQUIRE(sent >= 99);
+  REQUIRE(sent <= 101);
+
+  sent = 0;
+  const auto t1 = t0 + 2s;
+  scheduler.enable(StreamID::TELEMETRY, false, t1);
+  scheduler.enable(StreamID::TELEMETRY, true, t1);
+  for (auto t = t1; t < t1 + 1s; t += 5ms) {
+    scheduler.poll(count, t);
+  }
+  REQUIRE(sent >= 99);
+  REQUIRE(sent <= 101);
+}
+
+TEST_CASE("Stream burst caps catch-up after a stall") {
+  StreamScheduler scheduler;
+  auto config = makeStream(StreamID::TELEMETRY, 1000.0);
+  config.burst = 8;
+  config.batch = 4;
+  scheduler.add(config);
+  const auto t0 = StreamScheduler::Clock::now();
+  scheduler.enable(StreamID::TELEMETRY, true, t0);
+
+  std::vector<uint8_t> seen;
+  auto record = [&seen](StreamID, const std::vector<uint8_t> &sample) {
+    seen.push_back(sample[0]);
+  };
+  REQUIRE(scheduler.poll(record, t0) == 4);
+  REQUIRE(scheduler.nextDeadline() == t0 + 4ms);
+  REQUIRE(scheduler.poll(record, t0 + 1ms) == 0);
+
+  // A one second stall only releases a full bucket
+  REQUIRE(scheduler.poll(record, t0 + 1s) == 8);
+  REQUIRE(seen.size() == 12);
+  REQUIRE(seen[11] == 11);
+}
+
+TEST_CASE("Due streams are served by priority") {
+  StreamScheduler scheduler;
+  auto low = makeStream(StreamID::TELEMETRY, 10.0);
+  auto high = makeStream(VOLTAGE, 10.0);
+  high.priority = 5;
+  scheduler.add(low);
+  scheduler.add(high);
+  const auto t0 = StreamScheduler::Clock::now();
+  scheduler.enable(StreamID::TELEMETRY, true, t0);
+  scheduler.enable(VOLTAGE, true, t0);
+
+  std::vector<StreamID> order;
+  scheduler.poll([&order](StreamID id, const std::vector<uint8_t> &) { order.push_back(id); }, t0);
+  REQUIRE(order == std::vector<StreamID>{VOLTAGE, StreamID::TELEMETRY});
+  REQUIRE_FALSE(scheduler.enable(static_cast<StreamID>(0x55), true));
+}
+
+TEST_CASE("Devices keep their own stream state") {
+  Driver hostEth(MAC_A);
+  Driver devEth(MAC_B);
+  Driver::link(hostEth, devEth);
+  Host host(hostEth);
+  Device dev(devEth);
+
+  Driver otherHostEth(MAC_A);
+  Driver otherDevEth(MAC_B);
+  Driver::link(otherHostEth, otherDevEth);
+  Device other(otherDevEth);
+
+  std::vector<uint32_t> counts;
+  host.onStream(StreamID::TELEMETRY, [&counts](Host &, const MsgView &msg) {
+    counts.push_back(msg.data[0] | (msg.data[1] << 8));
+  });
+  host.onResponse(CmdID::START_STREAM, [](Host &, const MsgView &) {});
+
+  // Another device streaming does not advance this device's counter
+  other.enableStream(StreamID::TELEMETRY, true);
+  const auto t0 = StreamScheduler::Clock::now();
+  other.poll(t0);
+  other.poll(t0 + 10ms);
+
+  host.sendCommand(CmdID::START_STREAM, {static_cast<uint8_t>(StreamID::TELEMETRY)});
+  dev.poll(t0);
+  dev.poll(t0 + 1ms);
+  dev.poll(t0 + 2ms);
+  while (host.poll()) {
+  }
+  REQUIRE(counts == std::vector<uint32_t>{0, 1, 2});
+
+  // Unknown streams are rejected with an error
+  ErrorID error{};
+  host.onError(ErrorID::BAD_PAYLOAD, [&error](Host &, const MsgView &msg) {
+    error = msg.header.id.error_id;
+  });
+  host.sendCommand(CmdID::START_STREAM, {0x55});
+  dev.enableStream(StreamID::TELEMETRY, false);
+  dev.poll(t0 + 3ms);
+  while (host.poll()) {
+  }
+  REQUIRE(error == ErrorID::BAD_PAYLOAD);
+}
@@ -0,0 +1,127 @@
+#include <catch2/catch_all.hpp>
+
+#include "EthernetTopology.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+using namespace Ethernet;
+
+static const std::string SMALL = R"(
+# Two hosts on a switch, and a point-to-point pair
+node host0 00:11:22:33:44:55
+node host1
+node dev[0..1]
+switch sw0
+attach sw0 host0 host1   # both hosts
+link dev0 dev1
+)";
+
+static void writeText(const std::string &path, const std::string &text) {
+  std::FILE *file = std::fopen(path.c_str(), "w");
+  REQUIRE(file != nullptr);
+  std::fputs(text.c_str(), file);
+  std::fclose(file);
+}
+
+TEST_CASE("Topologies are parsed and built from text") {
+  const Topology::Description description = Topology::Description::parse(SMALL);
+  REQUIRE(description.nodes.size() == 4);
+  REQUIRE(description.nodes[0].mac == MacAddr{0x00, 0x11, 0x22, 0x33, 0x44, 0x55});
+  REQUIRE(description.nodes[1].mac == MacAddr{0x02, 0x00, 0x00, 0x00, 0x00, 0x01});
+  REQUIRE(description.nodes[3].name == "dev1");
+  REQUIRE(description.segments == std::vector<std::string>{"sw0"});
+  REQUIRE(description.links == std::vector<Topology::Link>{{2, 3}});
+  REQUIRE(description.attachments.size() == 2);
+
+  Topology topology(description, Topology::Config{16});
+  REQUIRE(topology.drivers().size() == 4);
+  REQUIRE(&topology.driver("dev1") == &topology.drivers()[3]);
+  REQUIRE(topology.segment("sw0").size() == 2);
+  REQUIRE_THROWS_AS(topology.driver("nobody"), std::runtime_error);
+
+  // Frames cross both the switch and the link
+  const std::vector<uint8_t> data(64, 0x5A);
+  std::vector<uint8_t> received;
+  topology.driver("host0").sendTo(description.nodes[1].mac, data);
+  REQUIRE(topology.driver("host1").recv(received));
+  REQUIRE(received == data);
+  topology.driver("dev1").send(data);
+  REQUIRE(topology.driver("dev0").recv(received));
+  REQUIRE(received == data);
+}
+
+TEST_CASE("Topology errors name their line") {
+  auto message = [](const std::string &text) {
+    try {
+      static_cast<void>(Topology::Description::parse(text));
+    } catch (const std::runtime_error &error) {
+      return std::string(error.what());
+    }
+    return std::string();
+  };
+  REQUIRE(message("node a\nlink a b\n") == "Topology line 2: unknown node b");
+  REQUIRE(message("node a\nnode a\n") == "Topology line 2: duplicate node a");
+  REQUIRE(message("node a[3..1]\n") == "Topology line 1: bad range a[3..1]");
+  REQUIRE(message("node a[0..2]\nnode b[0..1]\nlink a[0..2] b[0..1]\n") ==
+          "Topology line 3: both ends of a link need the same number of nodes");
+  REQUIRE(message("node a 00:11:22:33:44\n") ==
+          "Topology line 1: bad MAC address 00:11:22:33:44");
+  REQUIRE(message("route a b\n") == "Topology line 1: unknown statement route");
+  REQUIRE(message("node a[0..2]\nlink a0 a1\nlink a1 a2\n") ==
+          "Topology node a1 is connected twice");
+  REQUIRE(message("node a 02:00:00:00:00:01\nnode b\n") ==
+          "Topology has a duplicate MAC address");
+}
+
+TEST_CASE("Topologies round trip through the binary cache") {
+  const Topology::Description description = Topology::Description::parse(SMALL);
+  const std::vector<uint8_t> binary = description.toBinary();
+  REQUIRE(Topology::Description::fromBinary(binary) == description);
+
+  std::vector<uint8_t> truncated(binary.begin(), binary.end() - 1);
+  REQUIRE_THROWS_AS(Topology::Description::fromBinary(truncated),
+                    std::runtime_error);
+  std::vector<uint8_t> bad_index = binary;
+  bad_index[bad_index.size() - 1] = 0x7F; // last attachment's node
+  REQUIRE_THROWS_AS(Topology::Description::fromBinary(bad_index),
+                    std::runtime_error);
+
+  // The cache is written on first load and rebuilt when the text changes
+  const std::filesystem::path dir = std::filesystem::temp_directory_path();
+  const std::string text_path = (dir / "ethernet_topology_test.txt").string();
+  const std::string cache_path = (dir / "ethernet_topology_test.bin").string();
+  std::filesystem::remove(cache_path);
+  writeText(text_path, SMALL);
+  REQUIRE(Topology::loadCached(text_path, cache_path) == description);
+  REQUIRE(std::filesystem::exists(cache_path));
+  REQUIRE(Topology::loadCached(text_path, cache_path) == description);
+
+  writeText(text_path, SMALL + "node extra\n");
+  REQUIRE(Topology::loadCached(text_path, cache_path).nodes.size() == 5);
+  REQUIRE(Topology::load(text_path).nodes.size() == 5);
+  std::filesystem::remove(text_path);
+  std::filesystem::remove(cache_path);
+  REQUIRE_THROWS_AS(Topology::load(text_path), std::runtime_error);
+}
+
+TEST_CASE("Ten thousand node topologies build in bulk") {
+  const Topology::Description description = Topology::Description::parse(
+      "node host[0..4999]\n"
+      "node dev[0..4999]\n"
+      "link host[0..4999] dev[0..4999]\n");
+  REQUIRE(description.nodes.size() == 10000);
+  REQUIRE(description.links.size() == 5000);
+
+  Topology topology(description);
+  const std::span<Driver> drivers = topology.drivers();
+  REQUIRE(drivers.size() == 10000);
+  REQUIRE(&topology.driver("dev4999") == &drivers[9999]);
+
+  const std::vector<uint8_t> data(64, 0x11);
+  std::vector<uint8_t> received;
+  topology.driver("host4999").send(data);
+  REQUIRE(topology.driver("dev4999").recv(received));
+  REQUIRE(received == data);
+  REQUIRE_FALSE(topology.driver("dev4998").hasPending());
+}
@@ -0,0 +1,171 @@
+#include <catch2/catch_all.hpp>
+
+#include "EthernetTrace.hpp"
+#include "ProtocolDevice.hpp"
+#include "ProtocolHost.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+using namespace Ethernet;
+using namespace Protocol;
+using namespace std::chrono_literals;
+
+static const MacAddr MAC_A{0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const MacAddr MAC_B{0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+
+static std::size_t countNamed(const std::vector<Trace::Event> &events,
+                              const std::string &name,
+                              const Trace::Phase phase = Trace::Phase::SPAN) {
+  return static_cast<std::size_t>(
+      std::count_if(events.begin(), events.end(), [&](const Trace::Event &e) {
+        return e.name == name && e.phase == phase;
+      }));
+}
+
+TEST_CASE("Spans are only recorded while tracing") {
+  Trace::start(Trace::Config{1024, 1});
+  REQUIRE(Trace::enabled());
+  {
+    const Trace::Span span("test.during");
+    std::this_thread::sleep_for(1ms);
+  }
+  Trace::stop();
+  {
+    const Trace::Span span("test.after");
+  }
+
+  const std::vector<Trace::Event> events = Trace::snapshot();
+  REQUIRE(countNamed(events, "test.during") == 1);
+  REQUIRE(countNamed(events, "test.after") == 0);
+  const auto during = std::find_if(events.begin(), events.end(),
+                                   [](const Trace::Event &e) {
+                                     return std::string(e.name) == "test.during";
+                                   });
+  REQUIRE(1'000'000 <= during->duration);
+  REQUIRE(0 < during->thread);
+
+  // Restarting drops what the last trace recorded
+  Trace::start(Trace::Config{1024, 1});
+  Trace::stop();
+  REQUIRE(countNamed(Trace::snapshot(), "test.during") == 0);
+}
+
+TEST_CASE("Spans are sampled per thread and rings keep the newest events") {
+  // Fresh threads start their sampling countdown and ring from scratch
+  Trace::start(Trace::Config{1024, 4});
+  std::thread([] {
+    for (int i = 0; i < 100; ++i) {
+      const Trace::Span span("test.sampled");
+    }
+  }).join();
+  Trace::stop();
+  REQUIRE(countNamed(Trace::snapshot(), "test.sampled") == 25);
+
+  Trace::start(Trace::Config{8, 1});
+  std::thread([] {
+    for (int i = 0; i < 20; ++i) {
+      const Trace::Span span("test.wrapped");
+    }
+  }).join();
+  Trace::stop();
+  const std::vector<Trace::Event> events = Trace::snapshot();
+  REQUIRE(countNamed(events, "test.wrapped") == 8);
+  REQUIRE(std::is_sorted(events.begin(), events.end(),
+                         [](const Trace::Event &a, const Trace::Event &b) {
+                           return a.start < b.start;
+                         }));
+  REQUIRE_THROWS_AS(Trace::start(Trace::Config{8, 0}), std::runtime_error);
+}
+
+TEST_CASE("Rings of exited threads are freed once exported") {
+  Trace::start(Trace::Config{1024, 1});
+  const std::size_t running = Trace::rings();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([] { const Trace::Span span("test.exited"); });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(Trace::rings() == running + 8);
+
+  // Exporting reads them one last time, then frees them
+  REQUIRE(countNamed(Trace::snapshot(), "test.exited") == 8);
+  REQUIRE(Trace::rings() == running);
+
+  // A new trace frees the rings of threads that were never exported
+  std::thread([] { const Trace::Span span("test.exited"); }).join();
+  REQUIRE(Trace::rings() == running + 1);
+  Trace::start(Trace::Config{1024, 1});
+  Trace::stop();
+  REQUIRE(Trace::rings() == running);
+}
+
+#if ETHERNET_TRACING
+TEST_CASE("Frames are traced along the send and receive path") {
+  Driver host_eth(MAC_A);
+  Driver dev_eth(MAC_B);
+  Driver::link(host_eth, dev_eth);
+  Host host(host_eth);
+  Device dev(dev_eth);
+
+  Trace::start(Trace::Config{1024, 1});
+  std::future<Msg> reply = host.request(CmdID::PING, {}, 1s);
+  dev.poll();
+  while (host.poll()) {
+  }
+  Trace::stop();
+  REQUIRE(reply.wait_for(0s) == std::future_status::ready);
+
+  // One PING out and one response back
+  const std::vector<Trace::Event> events = Trace::snapshot();
+  REQUIRE(countNamed(events, "msg.pack") == 2);
+  REQUIRE(countNamed(events, "frame.encode") == 2);
+  REQUIRE(countNamed(events, "frame.decode") == 2);
+  REQUIRE(countNamed(events, "msg.unpack") == 2);
+  REQUIRE(countNamed(events, "msg.handle") == 2);
+  REQUIRE(countNamed(events, "frame.queue", Trace::Phase::BEGIN) == 2);
+  REQUIRE(countNamed(events, "frame.queue", Trace::Phase::END) == 2);
+
+  // Each queue wait ends with the id it began with
+  for (const Trace::Event &begin : events) {
+    if (begin.phase == Trace::Phase::BEGIN) {
+      REQUIRE(std::any_of(events.begin(), events.end(),
+                          [&](const Trace::Event &end) {
+                            return end.phase == Trace::Phase::END &&
+                                   end.id == begin.id && begin.start <= end.start;
+                          }));
+    }
+  }
+}
+#endif
+
+TEST_CASE("Traces export as Chrome trace JSON") {
+  Trace::start(Trace::Config{1024, 1});
+  {
+    const Trace::Span span("test.exported");
+  }
+  Trace::begin("test.interval", 42);
+  Trace::end("test.interval", 42);
+  Trace::stop();
+
+  std::FILE *file = std::tmpfile();
+  REQUIRE(file != nullptr);
+  Trace::writeChrome(file);
+  std::rewind(file);
+  std::string json;
+  for (int c = std::fgetc(file); c != EOF; c = std::fgetc(file)) {
+    json.push_back(static_cast<char>(c));
+  }
+  std::fclose(file);
+
+  REQUIRE(json.starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+  REQUIRE(json.find("\"name\":\"test.exported\"") != std::string::npos);
+  REQUIRE(json.find("\"ph\":\"X\"") != std::string::npos);
+  REQUIRE(json.find("\"ph\":\"b\",\"id\":\"0x2a\"") != std::string::npos);
+  REQUIRE(json.find("\"ph\":\"e\",\"id\":\"0x2a\"") != std::string::npos);
+  REQUIRE(json.ends_with("]}\n"));
+}